@@ -2,6 +2,7 @@
 #include <fstream>
 #include "../GL/glew.h"
 #include "../GL/3dglBitmap.h"
+#include "../GL/3dglCallStats.h"
 
 // DevIL include file
 #undef _UNICODE
@@ -65,7 +66,7 @@ void C3dglBitmap::texture(GLuint &textureId)
 	}
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, ilGetInteger(IL_IMAGE_WIDTH), ilGetInteger(IL_IMAGE_HEIGHT), 0, GL_RGBA, GL_UNSIGNED_BYTE, ilGetData()); 
+	C3dglCallStats::texImage2D(GL_TEXTURE_2D, 0, GL_RGBA, ilGetInteger(IL_IMAGE_WIDTH), ilGetInteger(IL_IMAGE_HEIGHT), 0, GL_RGBA, GL_UNSIGNED_BYTE, ilGetData()); 
 }
 
 long C3dglBitmap::getWidth()
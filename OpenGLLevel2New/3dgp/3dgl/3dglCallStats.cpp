@@ -0,0 +1,355 @@
+#include "../GL/glew.h"
+#include "../GL/3dglCallStats.h"
+#include "../GL/3dglResourceLedger.h"
+
+using std::vector;
+using std::string;
+using namespace _3dgl;
+
+C3dglCallStats *C3dglCallStats::c_pCurrent = NULL;
+
+C3dglCallStats::COUNTERS &C3dglCallStats::COUNTERS::operator+=(const COUNTERS &c)
+{
+	nDraws += c.nDraws; nTriangles += c.nTriangles;
+	nPrograms += c.nPrograms; nBinds += c.nBinds; nUniforms += c.nUniforms;
+	nUploads += c.nUploads; uploadBytes += c.uploadBytes;
+	nFramebuffers += c.nFramebuffers;
+	return *this;
+}
+
+C3dglCallStats::COUNTERS &C3dglCallStats::COUNTERS::operator-=(const COUNTERS &c)
+{
+	nDraws -= c.nDraws; nTriangles -= c.nTriangles;
+	nPrograms -= c.nPrograms; nBinds -= c.nBinds; nUniforms -= c.nUniforms;
+	nUploads -= c.nUploads; uploadBytes -= c.uploadBytes;
+	nFramebuffers -= c.nFramebuffers;
+	return *this;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// The counting versions of the GL functions: they count and call the original function
+
+struct C3dglCallStats::HOOKS
+{
+	// counts a call in FIELD; ID tells apart the functions of the same signature
+	template <int ID, unsigned long long COUNTERS::*FIELD, class... A> struct COUNT
+	{
+		typedef void (GLAPIENTRY *FN)(A...);
+		static FN &original()				{ static FN fn = NULL; return fn; }
+		static void GLAPIENTRY call(A... a)
+		{
+			if (c_pCurrent) c_pCurrent->m_counters.*FIELD += 1;
+			original()(a...);
+		}
+	};
+
+	template <class FN> static void replace(C3dglCallStats *pStats, FN &fn, FN hook, FN &original)
+	{
+		if (!fn) return;
+		original = fn;
+		HOOK h = { (void**)&fn, (void*)fn, (void*)hook };
+		pStats->m_hooks.push_back(h);
+		fn = hook;
+	}
+
+	template <int ID, unsigned long long COUNTERS::*FIELD, class... A> static void count(C3dglCallStats *pStats, void (GLAPIENTRY *&fn)(A...))
+	{
+		replace(pStats, fn, &COUNT<ID, FIELD, A...>::call, COUNT<ID, FIELD, A...>::original());
+	}
+
+	// draws and uploads - their arguments are counted, too
+	static PFNGLDRAWARRAYSINSTANCEDPROC drawArraysInstanced;
+	static PFNGLDRAWELEMENTSINSTANCEDPROC drawElementsInstanced;
+	static PFNGLDRAWELEMENTSBASEVERTEXPROC drawElementsBaseVertex;
+	static PFNGLMULTIDRAWARRAYSPROC multiDrawArrays;
+	static PFNGLMULTIDRAWELEMENTSPROC multiDrawElements;
+	static PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC multiDrawElementsBaseVertex;
+	static PFNGLBUFFERDATAPROC bufferData;
+	static PFNGLBUFFERSUBDATAPROC bufferSubData;
+
+	static void GLAPIENTRY DrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei primcount)
+	{
+		if (c_pCurrent) c_pCurrent->countDraw(mode, count, primcount);
+		drawArraysInstanced(mode, first, count, primcount);
+	}
+	static void GLAPIENTRY DrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei primcount)
+	{
+		if (c_pCurrent) c_pCurrent->countDraw(mode, count, primcount);
+		drawElementsInstanced(mode, count, type, indices, primcount);
+	}
+	static void GLAPIENTRY DrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const void *indices, GLint basevertex)
+	{
+		if (c_pCurrent) c_pCurrent->countDraw(mode, count);
+		drawElementsBaseVertex(mode, count, type, indices, basevertex);
+	}
+	// a multi-draw counts as one draw call
+	static long long sum(const GLsizei *count, GLsizei drawcount)
+	{
+		long long n = 0;
+		for (GLsizei i = 0; i < drawcount; i++)
+			n += count[i];
+		return n;
+	}
+	static void GLAPIENTRY MultiDrawArrays(GLenum mode, const GLint *first, const GLsizei *count, GLsizei drawcount)
+	{
+		if (c_pCurrent) c_pCurrent->countDraw(mode, sum(count, drawcount));
+		multiDrawArrays(mode, first, count, drawcount);
+	}
+	static void GLAPIENTRY MultiDrawElements(GLenum mode, const GLsizei *count, GLenum type, const void *const *indices, GLsizei drawcount)
+	{
+		if (c_pCurrent) c_pCurrent->countDraw(mode, sum(count, drawcount));
+		multiDrawElements(mode, count, type, indices, drawcount);
+	}
+	static void GLAPIENTRY MultiDrawElementsBaseVertex(GLenum mode, const GLsizei *count, GLenum type, const void *const *indices, GLsizei drawcount, const GLint *basevertex)
+	{
+		if (c_pCurrent) c_pCurrent->countDraw(mode, sum(count, drawcount));
+		multiDrawElementsBaseVertex(mode, count, type, indices, drawcount, basevertex);
+	}
+	static void GLAPIENTRY BufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage)
+	{
+		if (c_pCurrent) { c_pCurrent->m_counters.nUploads++; c_pCurrent->m_counters.uploadBytes += size; }
+		bufferData(target, size, data, usage);
+	}
+	static void GLAPIENTRY BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data)
+	{
+		if (c_pCurrent) { c_pCurrent->m_counters.nUploads++; c_pCurrent->m_counters.uploadBytes += size; }
+		bufferSubData(target, offset, size, data);
+	}
+};
+
+PFNGLDRAWARRAYSINSTANCEDPROC C3dglCallStats::HOOKS::drawArraysInstanced = NULL;
+PFNGLDRAWELEMENTSINSTANCEDPROC C3dglCallStats::HOOKS::drawElementsInstanced = NULL;
+PFNGLDRAWELEMENTSBASEVERTEXPROC C3dglCallStats::HOOKS::drawElementsBaseVertex = NULL;
+PFNGLMULTIDRAWARRAYSPROC C3dglCallStats::HOOKS::multiDrawArrays = NULL;
+PFNGLMULTIDRAWELEMENTSPROC C3dglCallStats::HOOKS::multiDrawElements = NULL;
+PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC C3dglCallStats::HOOKS::multiDrawElementsBaseVertex = NULL;
+PFNGLBUFFERDATAPROC C3dglCallStats::HOOKS::bufferData = NULL;
+PFNGLBUFFERSUBDATAPROC C3dglCallStats::HOOKS::bufferSubData = NULL;
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// C3dglCallStats
+
+C3dglCallStats::C3dglCallStats()
+{
+	m_pass = -1;
+}
+
+void C3dglCallStats::countDraw(unsigned mode, long long count, long long instances)
+{
+	long long n = 0;
+	switch (mode)
+	{
+	case GL_TRIANGLES: n = count / 3; break;
+	case GL_TRIANGLE_STRIP:
+	case GL_TRIANGLE_FAN: n = count > 2 ? count - 2 : 0; break;
+	case GL_QUADS: n = count / 4 * 2; break;
+	}
+	m_counters.nDraws++;
+	m_counters.nTriangles += n * instances;
+}
+
+#define COUNT_CALLS(fn, field) HOOKS::count<__LINE__, &COUNTERS::field>(this, __glew##fn)
+
+bool C3dglCallStats::install()
+{
+	if (c_pCurrent == this)
+		return true;
+	if (c_pCurrent)
+		return logError("another instance is installed");
+	if (!__glewUseProgram)
+		return logError("install called before glewInit");
+
+	COUNT_CALLS(UseProgram, nPrograms);
+	COUNT_CALLS(BindFramebuffer, nFramebuffers);
+
+	COUNT_CALLS(Uniform1f, nUniforms);
+	COUNT_CALLS(Uniform2f, nUniforms);
+	COUNT_CALLS(Uniform3f, nUniforms);
+	COUNT_CALLS(Uniform4f, nUniforms);
+	COUNT_CALLS(Uniform1i, nUniforms);
+	COUNT_CALLS(Uniform2i, nUniforms);
+	COUNT_CALLS(Uniform3i, nUniforms);
+	COUNT_CALLS(Uniform4i, nUniforms);
+	COUNT_CALLS(Uniform1ui, nUniforms);
+	COUNT_CALLS(Uniform2ui, nUniforms);
+	COUNT_CALLS(Uniform3ui, nUniforms);
+	COUNT_CALLS(Uniform4ui, nUniforms);
+	COUNT_CALLS(Uniform1fv, nUniforms);
+	COUNT_CALLS(Uniform2fv, nUniforms);
+	COUNT_CALLS(Uniform3fv, nUniforms);
+	COUNT_CALLS(Uniform4fv, nUniforms);
+	COUNT_CALLS(Uniform1iv, nUniforms);
+	COUNT_CALLS(Uniform2iv, nUniforms);
+	COUNT_CALLS(Uniform3iv, nUniforms);
+	COUNT_CALLS(Uniform4iv, nUniforms);
+	COUNT_CALLS(Uniform1uiv, nUniforms);
+	COUNT_CALLS(Uniform2uiv, nUniforms);
+	COUNT_CALLS(Uniform3uiv, nUniforms);
+	COUNT_CALLS(Uniform4uiv, nUniforms);
+	COUNT_CALLS(UniformMatrix2fv, nUniforms);
+	COUNT_CALLS(UniformMatrix3fv, nUniforms);
+	COUNT_CALLS(UniformMatrix4fv, nUniforms);
+	COUNT_CALLS(UniformMatrix2x3fv, nUniforms);
+	COUNT_CALLS(UniformMatrix3x2fv, nUniforms);
+	COUNT_CALLS(UniformMatrix2x4fv, nUniforms);
+	COUNT_CALLS(UniformMatrix4x2fv, nUniforms);
+	COUNT_CALLS(UniformMatrix3x4fv, nUniforms);
+	COUNT_CALLS(UniformMatrix4x3fv, nUniforms);
+
+	HOOKS::replace(this, __glewDrawArraysInstanced, &HOOKS::DrawArraysInstanced, HOOKS::drawArraysInstanced);
+	HOOKS::replace(this, __glewDrawElementsInstanced, &HOOKS::DrawElementsInstanced, HOOKS::drawElementsInstanced);
+	HOOKS::replace(this, __glewDrawElementsBaseVertex, &HOOKS::DrawElementsBaseVertex, HOOKS::drawElementsBaseVertex);
+	HOOKS::replace(this, __glewMultiDrawArrays, &HOOKS::MultiDrawArrays, HOOKS::multiDrawArrays);
+	HOOKS::replace(this, __glewMultiDrawElements, &HOOKS::MultiDrawElements, HOOKS::multiDrawElements);
+	HOOKS::replace(this, __glewMultiDrawElementsBaseVertex, &HOOKS::MultiDrawElementsBaseVertex, HOOKS::multiDrawElementsBaseVertex);
+	HOOKS::replace(this, __glewBufferData, &HOOKS::BufferData, HOOKS::bufferData);
+	HOOKS::replace(this, __glewBufferSubData, &HOOKS::BufferSubData, HOOKS::bufferSubData);
+
+	c_pCurrent = this;
+	return true;
+}
+
+void C3dglCallStats::uninstall()
+{
+	if (c_pCurrent != this)
+		return;
+	// only the pointers still hooked: anything installed later keeps its own hooks
+	for (auto &hook : m_hooks)
+		if (*hook.pFn == hook.hook)
+			*hook.pFn = hook.original;
+	m_hooks.clear();
+	c_pCurrent = NULL;
+}
+
+void C3dglCallStats::beginFrame()
+{
+	if (m_pass >= 0)
+		endPass();
+	m_frame = m_counters;
+	m_lastPasses.swap(m_passes);
+	m_passes.clear();
+	m_counters = COUNTERS();
+}
+
+void C3dglCallStats::beginPass(const string &name)
+{
+	if (m_pass >= 0)
+		endPass();
+	m_pass = -1;
+	for (unsigned i = 0; i < m_passes.size(); i++)
+		if (m_passes[i].name == name)
+			m_pass = i;
+	if (m_pass < 0)
+	{
+		PASS pass;
+		pass.name = name;
+		m_passes.push_back(pass);
+		m_pass = m_passes.size() - 1;
+	}
+	m_passStart = m_counters;
+}
+
+void C3dglCallStats::endPass()
+{
+	if (m_pass < 0)
+		return;
+	COUNTERS counters = m_counters;
+	counters -= m_passStart;
+	m_passes[m_pass].counters += counters;
+	m_pass = -1;
+}
+
+C3dglCallStats::COUNTERS C3dglCallStats::getPass(const string &name)
+{
+	for (PASS &pass : m_lastPasses)
+		if (pass.name == name)
+			return pass.counters;
+	return COUNTERS();
+}
+
+bool C3dglCallStats::withinBudget(const string &pass, const COUNTERS &budget)
+{
+	COUNTERS c = pass.empty() ? m_frame : getPass(pass);
+	auto within = [](unsigned long long count, unsigned long long limit) { return limit == 0 || count <= limit; };
+	return within(c.nDraws, budget.nDraws) && within(c.nTriangles, budget.nTriangles)
+		&& within(c.nPrograms, budget.nPrograms) && within(c.nBinds, budget.nBinds) && within(c.nUniforms, budget.nUniforms)
+		&& within(c.nUploads, budget.nUploads) && within(c.uploadBytes, budget.uploadBytes)
+		&& within(c.nFramebuffers, budget.nFramebuffers);
+}
+
+static void dumpCounters(std::ostream &out, const C3dglCallStats::COUNTERS &c)
+{
+	out << "{\"draws\":" << c.nDraws << ",\"triangles\":" << c.nTriangles << ",\"programs\":" << c.nPrograms
+		<< ",\"binds\":" << c.nBinds << ",\"uniforms\":" << c.nUniforms << ",\"uploads\":" << c.nUploads
+		<< ",\"uploadBytes\":" << c.uploadBytes << ",\"framebuffers\":" << c.nFramebuffers;
+}
+
+void C3dglCallStats::dump(std::ostream &out)
+{
+	dumpCounters(out, m_frame);
+	out << ",\"passes\":{";
+	for (unsigned i = 0; i < m_lastPasses.size(); i++)
+	{
+		out << (i ? "," : "") << "\"" << m_lastPasses[i].name << "\":";
+		dumpCounters(out, m_lastPasses[i].counters);
+		out << "}";
+	}
+	out << "}}";
+}
+
+void C3dglCallStats::drawArrays(unsigned mode, int first, int count)
+{
+	if (c_pCurrent) c_pCurrent->countDraw(mode, count);
+	glDrawArrays(mode, first, count);
+}
+
+void C3dglCallStats::drawElements(unsigned mode, int count, unsigned type, const void *indices)
+{
+	if (c_pCurrent) c_pCurrent->countDraw(mode, count);
+	glDrawElements(mode, count, type, indices);
+}
+
+void C3dglCallStats::bindTexture(unsigned target, unsigned texture)
+{
+	if (c_pCurrent) c_pCurrent->m_counters.nBinds++;
+	glBindTexture(target, texture);
+}
+
+// size of the client pixel data, for the common formats
+static unsigned long long pixelBytes(int width, int height, unsigned format, unsigned type)
+{
+	unsigned long long components = 4, size = 1;
+	switch (format)
+	{
+	case GL_RED: case GL_DEPTH_COMPONENT: components = 1; break;
+	case GL_RG: components = 2; break;
+	case GL_RGB: case GL_BGR: components = 3; break;
+	}
+	switch (type)
+	{
+	case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT: size = 2; break;
+	case GL_UNSIGNED_INT: case GL_INT: case GL_FLOAT: size = 4; break;
+	}
+	return (unsigned long long)width * height * components * size;
+}
+
+void C3dglCallStats::texImage2D(unsigned target, int level, int internalFormat, int width, int height, int border, unsigned format, unsigned type, const void *pixels)
+{
+	if (c_pCurrent && pixels)
+	{
+		c_pCurrent->m_counters.nUploads++;
+		c_pCurrent->m_counters.uploadBytes += pixelBytes(width, height, format, type);
+	}
+	glTexImage2D(target, level, internalFormat, width, height, border, format, type, pixels);
+	C3dglResourceLedger::texImage(target, level, internalFormat, width, height);
+}
+
+void C3dglCallStats::texSubImage2D(unsigned target, int level, int x, int y, int width, int height, unsigned format, unsigned type, const void *pixels)
+{
+	if (c_pCurrent && pixels)
+	{
+		c_pCurrent->m_counters.nUploads++;
+		c_pCurrent->m_counters.uploadBytes += pixelBytes(width, height, format, type);
+	}
+	glTexSubImage2D(target, level, x, y, width, height, format, type, pixels);
+}
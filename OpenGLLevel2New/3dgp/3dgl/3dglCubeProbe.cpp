@@ -0,0 +1,104 @@
+#include "../GL/3dglCubeProbe.h"
+#include "../glm/gtc/matrix_transform.hpp"
+
+using namespace _3dgl;
+
+C3dglCubeProbe::C3dglCubeProbe()
+{
+	m_pos = glm::vec3(0);
+	m_fRadius = FLT_MAX;
+	m_policy = EVERY_FRAME;
+	m_n = 1;
+	m_stale = 0x3f;
+	m_rendered = 0;
+	m_faces = 0;
+	m_nNext = 0;
+	m_nFrame = 0;
+	m_nFacesUpdated = m_nTotalFaces = 0;
+}
+
+void C3dglCubeProbe::setPosition(glm::vec3 pos)
+{
+	if (pos != m_pos)
+		invalidate();
+	m_pos = pos;
+}
+
+void C3dglCubeProbe::setPolicy(POLICY policy, int n)
+{
+	m_policy = policy;
+	m_n = n < 1 ? 1 : n;
+}
+
+std::string C3dglCubeProbe::getPolicyName(POLICY policy)
+{
+	switch (policy)
+	{
+	case EVERY_FRAME: return "every frame";
+	case ROUND_ROBIN: return "round robin";
+	case INTERVAL: return "interval";
+	case ON_CHANGE: return "on change";
+	default: return "";
+	}
+}
+
+void C3dglCubeProbe::notifyChange(glm::vec3 center, float radius)
+{
+	if (m_policy != ON_CHANGE || glm::length(center - m_pos) <= m_fRadius + radius)
+		invalidate();
+}
+
+unsigned C3dglCubeProbe::update()
+{
+	m_faces = 0;
+	switch (m_policy)
+	{
+	case EVERY_FRAME:
+	case ON_CHANGE:
+		m_faces = m_stale;
+		break;
+	case ROUND_ROBIN:
+		// the next m_n stale faces, starting where the last frame stopped
+		for (int i = 0, n = 0, first = m_nNext; i < 6 && n < m_n; i++)
+		{
+			int face = (first + i) % 6;
+			if (m_stale & (1 << face))
+			{
+				m_faces |= 1 << face;
+				m_nNext = (face + 1) % 6;
+				n++;
+			}
+		}
+		break;
+	case INTERVAL:
+		if (m_nFrame % m_n == 0)
+			m_faces = m_stale;
+		break;
+	}
+	m_faces |= ~m_rendered & 0x3f;
+	m_stale &= ~m_faces;
+	m_rendered |= m_faces;
+
+	m_nFacesUpdated = 0;
+	for (int i = 0; i < 6; i++)
+		if (m_faces & (1 << i))
+			m_nFacesUpdated++;
+	m_nTotalFaces += m_nFacesUpdated;
+	m_nFrame++;
+	return m_faces;
+}
+
+glm::mat4 C3dglCubeProbe::getFaceView(int face)
+{
+	static const float ROTATION[6][6] =
+	{	// at              up
+		{ 1.0, 0.0, 0.0,   0.0, -1.0, 0.0 },  // pos x
+		{ -1.0, 0.0, 0.0,  0.0, -1.0, 0.0 },  // neg x
+		{ 0.0, 1.0, 0.0,   0.0, 0.0, 1.0 },   // pos y
+		{ 0.0, -1.0, 0.0,  0.0, 0.0, -1.0 },  // neg y
+		{ 0.0, 0.0, 1.0,   0.0, -1.0, 0.0 },  // poz z
+		{ 0.0, 0.0, -1.0,  0.0, -1.0, 0.0 }   // neg z
+	};
+	const float *r = ROTATION[face];
+	return glm::lookAt(m_pos, m_pos + glm::vec3(r[0], r[1], r[2]), glm::vec3(r[3], r[4], r[5]));
+}
@@ -0,0 +1,609 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+
+#include "../GL/glew.h"
+#include "../GL/3dglFrameGraph.h"
+#include "../GL/3dglCallStats.h"
+#include "../GL/3dglResourceLedger.h"
+
+using std::vector;
+using std::string;
+using namespace _3dgl;
+
+static bool isDepth(unsigned format)
+{
+	return format == GL_DEPTH_COMPONENT || format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24
+		|| format == GL_DEPTH_COMPONENT32 || format == GL_DEPTH_COMPONENT32F;
+}
+
+static size_t bytesPerTexel(unsigned format)
+{
+	switch (format)
+	{
+	case GL_R8: return 1;
+	case GL_R16: case GL_RG8: case GL_DEPTH_COMPONENT16: return 2;
+	case GL_RGBA16F: case GL_RG32F: return 8;
+	case GL_RGBA32F: return 16;
+	default: return 4;
+	}
+}
+
+C3dglFrameGraph::C3dglFrameGraph()
+{
+	m_bDirty = true;
+	m_nScreenWidth = m_nScreenHeight = 0;
+	m_nFrame = 0;
+	m_bTimer = false;
+	m_pCurrent = NULL;
+	m_fboCopy = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Declarations
+
+int C3dglFrameGraph::findResource(const string &name)
+{
+	auto i = m_names.find(name);
+	if (i != m_names.end())
+		return i->second;
+	logError("Frame graph target not declared: " + name);
+	return -1;
+}
+
+void C3dglFrameGraph::addTarget(const string &name, TARGET desc, LIFETIME lifetime)
+{
+	RESOURCE res;
+	res.name = name;
+	res.desc = desc;
+	res.bImported = false;
+	res.lifetime = lifetime;
+	res.physical = -1;
+	res.width = res.height = 0;
+	res.version = 0;
+	res.first = res.last = -1;
+	res.bKept = false;
+	m_names[name] = m_resources.size();
+	m_resources.push_back(res);
+	m_bDirty = true;
+}
+
+void C3dglFrameGraph::importTexture(const string &name, unsigned target, unsigned id, int width, int height)
+{
+	TEXTURE texture = { id, target, 0, width, height, target == GL_TEXTURE_CUBE_MAP ? 6 : 1, true };
+	addTarget(name, target == GL_TEXTURE_CUBE_MAP ? cube(0, width) : texture2D(0, width, height), PERSISTENT);
+	m_resources.back().bImported = true;
+	m_resources.back().physical = m_textures.size();
+	m_textures.push_back(texture);
+}
+
+void C3dglFrameGraph::setTarget(const string &name, TARGET desc)
+{
+	int r = findResource(name);
+	if (r < 0 || m_resources[r].bImported)
+		return;
+	TARGET &old = m_resources[r].desc;
+	if (desc.type != old.type || desc.format != old.format || desc.width != old.width || desc.height != old.height
+		|| desc.scale != old.scale || desc.layers != old.layers)
+	{
+		old = desc;
+		m_bDirty = true;
+	}
+}
+
+int C3dglFrameGraph::addPass(const string &name, EXECUTE execute, KEY key)
+{
+	PASS pass;
+	pass.execute = execute;
+	pass.key = key;
+	pass.fbo = 0;
+	pass.depth = -1;
+	pass.bValid = false;
+	pass.lastKey = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		pass.queries[i] = 0;
+		pass.pending[i] = false;
+	}
+	pass.stats.name = name;
+	pass.stats.executed = pass.stats.skipped = pass.stats.culled = false;
+	pass.stats.cpuTime = pass.stats.gpuTime = 0;
+	pass.stats.nExecuted = pass.stats.nSkipped = 0;
+	m_passes.push_back(pass);
+	m_bDirty = true;
+	return m_passes.size() - 1;
+}
+
+void C3dglFrameGraph::read(int pass, const string &name, int unit)
+{
+	int res = findResource(name);
+	if (res < 0) return;
+	INPUT input = { res, unit, 0 };
+	m_passes[pass].inputs.push_back(input);
+	m_bDirty = true;
+}
+
+void C3dglFrameGraph::write(int pass, const string &name)
+{
+	int res = findResource(name);
+	if (res < 0) return;
+	m_passes[pass].outputs.push_back(res);
+	m_bDirty = true;
+}
+
+void C3dglFrameGraph::invalidate()
+{
+	for (PASS &pass : m_passes)
+		pass.bValid = false;
+}
+
+void C3dglFrameGraph::setScreenSize(int width, int height)
+{
+	if (width == m_nScreenWidth && height == m_nScreenHeight)
+		return;
+	m_nScreenWidth = width;
+	m_nScreenHeight = height;
+	m_bDirty = true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Compiling: culling, lifetimes, aliasing and allocation
+
+void C3dglFrameGraph::compile()
+{
+	m_bTimer = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+
+	// the FBOs are always recreated; persistent targets keep their textures (and contents)
+	// if the format and size do not change
+	for (PASS &pass : m_passes)
+	{
+		if (pass.fbo) glDeleteFramebuffers(1, &pass.fbo);
+		pass.fbo = 0;
+	}
+	vector<TEXTURE> previous = m_textures;
+	vector<int> kept(m_resources.size(), -1);
+	m_textures.clear();
+	for (size_t r = 0; r < m_resources.size(); r++)
+	{
+		RESOURCE &res = m_resources[r];
+		if (res.bImported)
+		{
+			m_textures.push_back(previous[res.physical]);
+			res.physical = m_textures.size() - 1;
+		}
+		else
+		{
+			if (res.physical >= 0 && res.bKept)
+				kept[r] = res.physical;
+			res.physical = -1;
+		}
+	}
+	vector<bool> reused(previous.size(), false);
+
+	// culling: walk the passes backwards from the back buffer, collecting the targets needed
+	vector<bool> needed(m_resources.size(), false), live(m_passes.size(), false);
+	for (size_t r = 0; r < m_resources.size(); r++)
+		needed[r] = m_resources[r].desc.type == BACKBUFFER;
+	for (int p = (int)m_passes.size() - 1; p >= 0; p--)
+	{
+		for (int r : m_passes[p].outputs)
+			if (needed[r])
+				live[p] = true;
+		if (live[p])
+			for (INPUT &input : m_passes[p].inputs)
+				needed[input.resource] = true;
+	}
+
+	// lifetimes; targets written by a pass that may be skipped must survive between frames
+	for (RESOURCE &res : m_resources)
+	{
+		res.first = res.last = -1;
+		if (res.desc.width == 0 && res.desc.type != BACKBUFFER)
+		{
+			res.width = std::max(1, (int)(m_nScreenWidth * res.desc.scale));
+			res.height = std::max(1, (int)(m_nScreenHeight * res.desc.scale));
+		}
+		else
+		{
+			res.width = res.desc.width;
+			res.height = res.desc.height;
+		}
+	}
+	vector<bool> persistent(m_resources.size());
+	for (size_t r = 0; r < m_resources.size(); r++)
+		persistent[r] = m_resources[r].lifetime == PERSISTENT;
+	for (size_t p = 0; p < m_passes.size(); p++)
+	{
+		PASS &pass = m_passes[p];
+		pass.stats.culled = !live[p];
+		if (!live[p]) continue;
+		vector<int> touched = pass.outputs;
+		for (INPUT &input : pass.inputs)
+			touched.push_back(input.resource);
+		for (int r : touched)
+		{
+			RESOURCE &res = m_resources[r];
+			if (res.first < 0) res.first = p;
+			res.last = p;
+		}
+		if (pass.key)
+			for (int r : pass.outputs)
+				if (m_resources[r].lifetime != TRANSIENT)
+					persistent[r] = true;
+	}
+
+	// allocation - transient targets share textures when their lifetimes do not overlap
+	vector<bool> fresh(m_resources.size(), false);
+	vector<int> busyUntil(m_textures.size(), INT_MAX);
+	vector<int> order;
+	for (size_t r = 0; r < m_resources.size(); r++)
+		if (!m_resources[r].bImported && m_resources[r].desc.type != BACKBUFFER && m_resources[r].first >= 0)
+			order.push_back(r);
+	std::sort(order.begin(), order.end(), [this](int a, int b) { return m_resources[a].first < m_resources[b].first; });
+	for (int r : order)
+	{
+		RESOURCE &res = m_resources[r];
+		unsigned target = res.desc.type == TEXTURE_CUBE ? GL_TEXTURE_CUBE_MAP : res.desc.type == TEXTURE_ARRAY ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+		res.physical = -1;
+		if (persistent[r] && kept[r] >= 0)
+		{
+			TEXTURE &tex = previous[kept[r]];
+			if (tex.target == target && tex.format == res.desc.format && tex.width == res.width && tex.height == res.height
+				&& tex.layers == res.desc.layers)
+			{
+				reused[kept[r]] = true;
+				res.physical = m_textures.size();
+				m_textures.push_back(tex);
+				busyUntil.push_back(INT_MAX);
+				continue;
+			}
+		}
+		fresh[r] = true;
+		if (!persistent[r])
+			for (size_t t = 0; t < m_textures.size(); t++)
+			{
+				TEXTURE &tex = m_textures[t];
+				if (!tex.bImported && busyUntil[t] < res.first && tex.target == target && tex.format == res.desc.format
+					&& tex.width == res.width && tex.height == res.height && tex.layers == res.desc.layers)
+				{
+					res.physical = t;
+					break;
+				}
+			}
+		if (res.physical < 0)
+		{
+			TEXTURE tex = { 0, target, res.desc.format, res.width, res.height, res.desc.layers, false };
+			allocate(tex);
+			res.physical = m_textures.size();
+			m_textures.push_back(tex);
+			busyUntil.push_back(0);
+		}
+		busyUntil[res.physical] = persistent[r] ? INT_MAX : res.last;
+	}
+	for (size_t t = 0; t < previous.size(); t++)
+		if (!previous[t].bImported && !reused[t])
+			C3dglResourceLedger::deleteTextures(1, &previous[t].id);
+	for (size_t r = 0; r < m_resources.size(); r++)
+		m_resources[r].bKept = persistent[r] && !m_resources[r].bImported;
+
+	// passes with any new output must run again (scratch targets do not count)
+	for (size_t p = 0; p < m_passes.size(); p++)
+	{
+		if (!live[p]) continue;
+		createFBO(m_passes[p]);
+		for (int r : m_passes[p].outputs)
+			if (fresh[r] && m_resources[r].lifetime != TRANSIENT)
+				m_passes[p].bValid = false;
+	}
+	m_bDirty = false;
+
+	int nTargets = 0;
+	for (RESOURCE &res : m_resources)
+		if (!res.bImported && res.physical >= 0)
+			nTargets++;
+	logInfo("Frame graph: " + std::to_string(m_passes.size()) + " passes, " + std::to_string(nTargets) + " targets in "
+		+ std::to_string(getTextureCount()) + " textures (" + std::to_string(getTargetMemory() / 1024) + " kB)");
+}
+
+void C3dglFrameGraph::allocate(TEXTURE &texture)
+{
+	bool bDepth = isDepth(texture.format);
+	GLenum format = bDepth ? GL_DEPTH_COMPONENT : GL_RGBA;
+	GLenum type = bDepth ? GL_FLOAT : GL_UNSIGNED_BYTE;
+
+	C3dglResourceLedger::OWNER owner(getName());
+	C3dglResourceLedger::genTextures(1, &texture.id);
+	C3dglCallStats::bindTexture(texture.target, texture.id);
+	glTexParameteri(texture.target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(texture.target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(texture.target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(texture.target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	if (texture.target == GL_TEXTURE_CUBE_MAP)
+	{
+		glTexParameteri(texture.target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		for (int i = 0; i < 6; i++)
+			C3dglCallStats::texImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, texture.format, texture.width, texture.height, 0, format, type, 0);
+	}
+	else
+	{
+		// depth targets are sampled as shadow maps
+		if (bDepth)
+		{
+			glTexParameteri(texture.target, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+			glTexParameteri(texture.target, GL_TEXTURE_COMPARE_FUNC, GL_LESS);
+		}
+		if (texture.target == GL_TEXTURE_2D_ARRAY)
+			glTexImage3D(texture.target, 0, texture.format, texture.width, texture.height, texture.layers, 0, format, type, 0);
+		else
+			C3dglCallStats::texImage2D(texture.target, 0, texture.format, texture.width, texture.height, 0, format, type, 0);
+	}
+	C3dglCallStats::bindTexture(texture.target, 0);
+}
+
+void C3dglFrameGraph::createFBO(PASS &pass)
+{
+	// cube maps and arrays are attached with the first face or layer, see setLayer
+	vector<int> &colours = pass.colours;
+	colours.clear();
+	int &depth = pass.depth;
+	depth = -1;
+	for (int r : pass.outputs)
+	{
+		RESOURCE &res = m_resources[r];
+		if (res.desc.type == BACKBUFFER) continue;
+		if (isDepth(m_textures[res.physical].format))
+			depth = r;
+		else
+			colours.push_back(r);
+	}
+	if (colours.empty() && depth < 0)
+		return;
+
+	C3dglResourceLedger::OWNER owner(getName());
+	glGenFramebuffers(1, &pass.fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, pass.fbo);
+	vector<GLenum> buffers;
+	for (size_t i = 0; i < colours.size(); i++)
+	{
+		attach(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, m_textures[m_resources[colours[i]].physical], 0);
+		buffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+	}
+	if (depth >= 0)
+		attach(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_textures[m_resources[depth].physical], 0);
+	if (buffers.empty())
+	{
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+	}
+	else
+		glDrawBuffers(buffers.size(), &buffers[0]);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		logError("Frame graph: incomplete framebuffer in pass " + pass.stats.name);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void C3dglFrameGraph::release()
+{
+	for (PASS &pass : m_passes)
+	{
+		if (pass.fbo) glDeleteFramebuffers(1, &pass.fbo);
+		pass.fbo = 0;
+	}
+	vector<TEXTURE> imported;
+	for (RESOURCE &res : m_resources)
+		if (res.bImported)
+		{
+			imported.push_back(m_textures[res.physical]);
+			res.physical = imported.size() - 1;
+		}
+		else
+			res.physical = -1;
+	for (TEXTURE &texture : m_textures)
+		if (!texture.bImported)
+			C3dglResourceLedger::deleteTextures(1, &texture.id);
+	m_textures = imported;
+}
+
+void C3dglFrameGraph::destroy()
+{
+	release();
+	if (m_fboCopy) glDeleteFramebuffers(1, &m_fboCopy);
+	m_fboCopy = 0;
+	for (PASS &pass : m_passes)
+		for (int i = 0; i < 3; i++)
+			if (pass.queries[i])
+			{
+				glDeleteQueries(1, &pass.queries[i]);
+				pass.queries[i] = 0;
+				pass.pending[i] = false;
+			}
+	m_bDirty = true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Execution
+
+void C3dglFrameGraph::execute()
+{
+	if (m_bDirty)
+		compile();
+
+	int slot = m_nFrame % 3;
+	for (PASS &pass : m_passes)
+	{
+		pass.stats.executed = pass.stats.skipped = false;
+		if (pass.stats.culled)
+			continue;
+
+		// collect the GPU time measured three frames ago
+		if (pass.pending[slot])
+		{
+			GLint available = 0;
+			glGetQueryObjectiv(pass.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available)
+			{
+				GLuint64 ns = 0;
+				glGetQueryObjectui64v(pass.queries[slot], GL_QUERY_RESULT, &ns);
+				pass.stats.gpuTime = ns / 1000000.0;
+			}
+			pass.pending[slot] = !available;
+		}
+
+		// skip if nothing has changed since the last run
+		size_t key = pass.key ? pass.key() : 0;
+		bool bSame = pass.key && pass.bValid && key == pass.lastKey;
+		for (INPUT &input : pass.inputs)
+			if (input.version != m_resources[input.resource].version)
+				bSame = false;
+		if (bSame)
+		{
+			pass.stats.skipped = true;
+			pass.stats.nSkipped++;
+			continue;
+		}
+
+		// render target and viewport: the first output decides
+		int width = m_nScreenWidth, height = m_nScreenHeight;
+		if (!pass.outputs.empty() && m_resources[pass.outputs[0]].desc.type != BACKBUFFER)
+		{
+			width = m_resources[pass.outputs[0]].width;
+			height = m_resources[pass.outputs[0]].height;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, pass.fbo);
+		glViewport(0, 0, width, height);
+
+		for (INPUT &input : pass.inputs)
+			if (input.unit >= 0 && m_resources[input.resource].physical >= 0)
+			{
+				TEXTURE &texture = m_textures[m_resources[input.resource].physical];
+				glActiveTexture(GL_TEXTURE0 + input.unit);
+				C3dglCallStats::bindTexture(texture.target, texture.id);
+			}
+		glActiveTexture(GL_TEXTURE0);
+
+		if (m_hookBegin) m_hookBegin(pass.stats.name);
+		bool bQuery = m_bTimer && !pass.pending[slot];
+		if (bQuery)
+		{
+			if (!pass.queries[slot]) glGenQueries(1, &pass.queries[slot]);
+			glBeginQuery(GL_TIME_ELAPSED, pass.queries[slot]);
+		}
+		auto t0 = std::chrono::high_resolution_clock::now();
+
+		m_pCurrent = &pass;
+		pass.execute(width, height);
+		m_pCurrent = NULL;
+
+		pass.stats.cpuTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+		if (bQuery)
+		{
+			glEndQuery(GL_TIME_ELAPSED);
+			pass.pending[slot] = true;
+		}
+		if (m_hookEnd) m_hookEnd(pass.stats.name);
+
+		for (INPUT &input : pass.inputs)
+			input.version = m_resources[input.resource].version;
+		for (int r : pass.outputs)
+			m_resources[r].version++;
+		pass.lastKey = key;
+		pass.bValid = true;
+		pass.stats.executed = true;
+		pass.stats.nExecuted++;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, m_nScreenWidth, m_nScreenHeight);
+	m_nFrame++;
+}
+
+void C3dglFrameGraph::attach(unsigned fbo, unsigned attachment, TEXTURE &texture, int layer)
+{
+	if (texture.target == GL_TEXTURE_2D_ARRAY)
+		glFramebufferTextureLayer(fbo, attachment, texture.id, 0, layer);
+	else if (texture.target == GL_TEXTURE_CUBE_MAP)
+		glFramebufferTexture2D(fbo, attachment, GL_TEXTURE_CUBE_MAP_POSITIVE_X + layer, texture.id, 0);
+	else
+		glFramebufferTexture2D(fbo, attachment, GL_TEXTURE_2D, texture.id, 0);
+}
+
+void C3dglFrameGraph::setLayer(int layer)
+{
+	if (!m_pCurrent || !m_pCurrent->fbo)
+		return;
+	for (size_t i = 0; i < m_pCurrent->colours.size(); i++)
+	{
+		TEXTURE &texture = m_textures[m_resources[m_pCurrent->colours[i]].physical];
+		if (texture.target != GL_TEXTURE_2D)
+			attach(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, texture, layer);
+	}
+	if (m_pCurrent->depth >= 0)
+	{
+		TEXTURE &texture = m_textures[m_resources[m_pCurrent->depth].physical];
+		if (texture.target != GL_TEXTURE_2D)
+			attach(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, layer);
+	}
+}
+
+void C3dglFrameGraph::copy(const string &name)
+{
+	int r = findResource(name);
+	if (!m_pCurrent || !m_pCurrent->fbo || r < 0 || m_resources[r].physical < 0)
+		return;
+	TEXTURE &texture = m_textures[m_resources[r].physical];
+	if (texture.target == GL_TEXTURE_CUBE_MAP)
+	{
+		logError("Frame graph: cannot copy " + name + ", cube maps are not supported");
+		return;
+	}
+	RESOURCE &dest = m_resources[m_pCurrent->outputs[0]];
+	bool bDepth = isDepth(texture.format);
+	GLenum attachment = bDepth ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0;
+
+	// layer by layer, each into the same layer of the outputs
+	if (!m_fboCopy)
+	{
+		C3dglResourceLedger::OWNER owner(getName());
+		glGenFramebuffers(1, &m_fboCopy);
+	}
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fboCopy);
+	glReadBuffer(bDepth ? GL_NONE : GL_COLOR_ATTACHMENT0);
+	for (int layer = 0; layer < texture.layers; layer++)
+	{
+		attach(GL_READ_FRAMEBUFFER, attachment, texture, layer);
+		if (texture.layers > 1) setLayer(layer);
+		glBlitFramebuffer(0, 0, texture.width, texture.height, 0, 0, dest.width, dest.height,
+			bDepth ? GL_DEPTH_BUFFER_BIT : GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	}
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, attachment, GL_TEXTURE_2D, 0, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_pCurrent->fbo);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Queries
+
+unsigned C3dglFrameGraph::getTexture(const string &name)
+{
+	int r = findResource(name);
+	if (r < 0 || m_resources[r].physical < 0)
+		return 0;
+	return m_textures[m_resources[r].physical].id;
+}
+
+unsigned C3dglFrameGraph::getTextureCount()
+{
+	unsigned n = 0;
+	for (TEXTURE &texture : m_textures)
+		if (!texture.bImported)
+			n++;
+	return n;
+}
+
+size_t C3dglFrameGraph::getTargetMemory()
+{
+	size_t n = 0;
+	for (TEXTURE &texture : m_textures)
+		if (!texture.bImported)
+			n += (size_t)texture.width * texture.height * texture.layers * bytesPerTexel(texture.format);
+	return n;
+}
@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define HEIGHTFIELD_SSE
+#include <emmintrin.h>
+#endif
+
+#include "../GL/3dglHeightField.h"
+
+using namespace _3dgl;
+
+void C3dglHeightField::create(const float *pHeights, int sizeX, int sizeZ)
+{
+	m_pHeights = pHeights;
+	m_nSizeX = sizeX;
+	m_nSizeZ = sizeZ;
+
+	// pyramid levels, down to a single cell
+	m_pyramid.clear();
+	int nx = std::max(1, sizeX - 1), nz = std::max(1, sizeZ - 1);
+	for (;;)
+	{
+		LEVEL level;
+		level.sizeX = nx;
+		level.sizeZ = nz;
+		level.minmax.resize(nx * nz * 2);
+		m_pyramid.push_back(level);
+		if (nx == 1 && nz == 1)
+			break;
+		nx = (nx + 1) / 2;
+		nz = (nz + 1) / 2;
+	}
+	update(0, 0, sizeX - 1, sizeZ - 1);
+}
+
+void C3dglHeightField::update(int x0, int z0, int x1, int z1)
+{
+	if (!m_pHeights || m_nSizeX < 2 || m_nSizeZ < 2)
+		return;
+
+	// quads touching the modified samples
+	LEVEL &level0 = m_pyramid[0];
+	int cx0 = std::max(0, x0 - 1), cx1 = std::min(level0.sizeX - 1, x1);
+	int cz0 = std::max(0, z0 - 1), cz1 = std::min(level0.sizeZ - 1, z1);
+	for (int x = cx0; x <= cx1; x++)
+		for (int z = cz0; z <= cz1; z++)
+		{
+			float h[4] = { height(x, z), height(x + 1, z), height(x, z + 1), height(x + 1, z + 1) };
+			float *p = &level0.minmax[(x * level0.sizeZ + z) * 2];
+			p[0] = std::min(std::min(h[0], h[1]), std::min(h[2], h[3]));
+			p[1] = std::max(std::max(h[0], h[1]), std::max(h[2], h[3]));
+		}
+
+	// propagate up the pyramid
+	for (size_t l = 1; l < m_pyramid.size(); l++)
+	{
+		const LEVEL &child = m_pyramid[l - 1];
+		LEVEL &level = m_pyramid[l];
+		cx0 /= 2; cx1 /= 2; cz0 /= 2; cz1 /= 2;
+		for (int x = cx0; x <= cx1; x++)
+			for (int z = cz0; z <= cz1; z++)
+			{
+				float *p = &level.minmax[(x * level.sizeZ + z) * 2];
+				p[0] = FLT_MAX; p[1] = -FLT_MAX;
+				for (int i = x * 2; i <= std::min(x * 2 + 1, child.sizeX - 1); i++)
+					for (int j = z * 2; j <= std::min(z * 2 + 1, child.sizeZ - 1); j++)
+					{
+						const float *q = &child.minmax[(i * child.sizeZ + j) * 2];
+						p[0] = std::min(p[0], q[0]);
+						p[1] = std::max(p[1], q[1]);
+					}
+			}
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Heights
+
+float C3dglHeightField::getHeight(int x, int z) const
+{
+	x += m_nSizeX / 2;
+	z += m_nSizeZ / 2;
+	if (x < 0 || x >= m_nSizeX) return 0;
+	if (z < 0 || z >= m_nSizeZ) return 0;
+	return height(x, z);
+}
+
+// planar interpolation within the triangle (the quad is split along the x + z = 1 diagonal, as in the mesh)
+float C3dglHeightField::getInterpolatedHeight(float fx, float fz) const
+{
+	int x = (int)floor(fx);
+	int z = (int)floor(fz);
+	fx -= x;
+	fz -= z;
+	if (fx + fz < 1)
+	{
+		float h = getHeight(x, z);
+		return h + fx * (getHeight(x + 1, z) - h) + fz * (getHeight(x, z + 1) - h);
+	}
+	else
+	{
+		float h = getHeight(x + 1, z + 1);
+		return h + (1 - fx) * (getHeight(x, z + 1) - h) + (1 - fz) * (getHeight(x + 1, z) - h);
+	}
+}
+
+void C3dglHeightField::getInterpolatedHeights(const glm::vec2 *pPoints, float *pHeights, int n) const
+{
+	int i = 0;
+#ifdef HEIGHTFIELD_SSE
+	// four points at a time; the same arithmetic as getInterpolatedHeight, so the results are identical
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128i offX = _mm_set1_epi32(m_nSizeX / 2), offZ = _mm_set1_epi32(m_nSizeZ / 2);
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 a = _mm_loadu_ps(&pPoints[i].x);
+		__m128 b = _mm_loadu_ps(&pPoints[i + 2].x);
+		__m128 x = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 z = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+		// floor: truncate, then step down where the truncation rounded up
+		__m128i ix = _mm_cvttps_epi32(x), iz = _mm_cvttps_epi32(z);
+		__m128 flx = _mm_cvtepi32_ps(ix), flz = _mm_cvtepi32_ps(iz);
+		__m128 mx = _mm_cmpgt_ps(flx, x), mz = _mm_cmpgt_ps(flz, z);
+		ix = _mm_add_epi32(ix, _mm_castps_si128(mx));
+		iz = _mm_add_epi32(iz, _mm_castps_si128(mz));
+		__m128 fx = _mm_sub_ps(x, _mm_sub_ps(flx, _mm_and_ps(mx, one)));
+		__m128 fz = _mm_sub_ps(z, _mm_sub_ps(flz, _mm_and_ps(mz, one)));
+
+		// height map coordinates; points near or beyond the edge go the scalar way
+		alignas(16) int px[4], pz[4];
+		_mm_store_si128((__m128i*)px, _mm_add_epi32(ix, offX));
+		_mm_store_si128((__m128i*)pz, _mm_add_epi32(iz, offZ));
+		bool bInside = true;
+		for (int k = 0; k < 4; k++)
+			bInside &= px[k] >= 0 && px[k] < m_nSizeX - 1 && pz[k] >= 0 && pz[k] < m_nSizeZ - 1;
+		if (!bInside)
+		{
+			for (int k = 0; k < 4; k++)
+				pHeights[i + k] = getInterpolatedHeight(pPoints[i + k].x, pPoints[i + k].y);
+			continue;
+		}
+
+		// gather the quad corners
+		alignas(16) float h00[4], h10[4], h01[4], h11[4];
+		for (int k = 0; k < 4; k++)
+		{
+			const float *p = m_pHeights + px[k] * m_nSizeZ + pz[k];
+			h00[k] = p[0];
+			h01[k] = p[1];
+			h10[k] = p[m_nSizeZ];
+			h11[k] = p[m_nSizeZ + 1];
+		}
+		__m128 v00 = _mm_load_ps(h00), v10 = _mm_load_ps(h10), v01 = _mm_load_ps(h01), v11 = _mm_load_ps(h11);
+
+		__m128 lower = _mm_add_ps(_mm_add_ps(v00, _mm_mul_ps(fx, _mm_sub_ps(v10, v00))), _mm_mul_ps(fz, _mm_sub_ps(v01, v00)));
+		__m128 upper = _mm_add_ps(_mm_add_ps(v11, _mm_mul_ps(_mm_sub_ps(one, fx), _mm_sub_ps(v01, v11))), _mm_mul_ps(_mm_sub_ps(one, fz), _mm_sub_ps(v10, v11)));
+		__m128 mask = _mm_cmplt_ps(_mm_add_ps(fx, fz), one);
+		_mm_storeu_ps(pHeights + i, _mm_or_ps(_mm_and_ps(mask, lower), _mm_andnot_ps(mask, upper)));
+	}
+#endif
+	for (; i < n; i++)
+		pHeights[i] = getInterpolatedHeight(pPoints[i].x, pPoints[i].y);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Ray Intersection
+
+// ray vs axis-aligned box: narrows [t0, t1]; false if the ray misses the box
+static bool clipRay(const glm::vec3 &origin, const glm::vec3 &dir, const float bbMin[3], const float bbMax[3], float &t0, float &t1)
+{
+	for (int k = 0; k < 3; k++)
+	{
+		if (dir[k] == 0)
+		{
+			if (origin[k] < bbMin[k] || origin[k] > bbMax[k])
+				return false;
+			continue;
+		}
+		float tNear = (bbMin[k] - origin[k]) / dir[k];
+		float tFar = (bbMax[k] - origin[k]) / dir[k];
+		if (tNear > tFar) std::swap(tNear, tFar);
+		t0 = std::max(t0, tNear);
+		t1 = std::min(t1, tFar);
+		if (t0 > t1)
+			return false;
+	}
+	return true;
+}
+
+// ray vs triangle (Moller-Trumbore)
+static bool intersectTriangle(const glm::vec3 &origin, const glm::vec3 &dir, const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, float &t)
+{
+	const float EPS = 1e-6f;
+	glm::vec3 e1 = v1 - v0, e2 = v2 - v0;
+	glm::vec3 p(dir.y * e2.z - dir.z * e2.y, dir.z * e2.x - dir.x * e2.z, dir.x * e2.y - dir.y * e2.x);
+	float det = e1.x * p.x + e1.y * p.y + e1.z * p.z;
+	if (std::abs(det) < 1e-12f)
+		return false;
+	float inv = 1 / det;
+	glm::vec3 s = origin - v0;
+	float u = (s.x * p.x + s.y * p.y + s.z * p.z) * inv;
+	if (u < -EPS || u > 1 + EPS)
+		return false;
+	glm::vec3 q(s.y * e1.z - s.z * e1.y, s.z * e1.x - s.x * e1.z, s.x * e1.y - s.y * e1.x);
+	float v = (dir.x * q.x + dir.y * q.y + dir.z * q.z) * inv;
+	if (v < -EPS || u + v > 1 + EPS)
+		return false;
+	t = (e2.x * q.x + e2.y * q.y + e2.z * q.z) * inv;
+	return true;
+}
+
+// descends the pyramid, visiting the child cells in the order the ray enters them; origin in height map coordinates
+bool C3dglHeightField::intersectCell(int level, int cx, int cz, const glm::vec3 &origin, const glm::vec3 &dir, float tMax, float &t) const
+{
+	const LEVEL &L = m_pyramid[level];
+	const float *minmax = &L.minmax[(cx * L.sizeZ + cz) * 2];
+	float bbMin[3] = { (float)(cx << level), minmax[0], (float)(cz << level) };
+	float bbMax[3] = { (float)std::min((cx + 1) << level, m_nSizeX - 1), minmax[1], (float)std::min((cz + 1) << level, m_nSizeZ - 1) };
+	float t0 = 0, t1 = tMax;
+	if (!clipRay(origin, dir, bbMin, bbMax, t0, t1))
+		return false;
+
+	if (level == 0)
+	{
+		// the two triangles of the quad
+		glm::vec3 v00(cx, height(cx, cz), cz), v10(cx + 1, height(cx + 1, cz), cz);
+		glm::vec3 v01(cx, height(cx, cz + 1), cz + 1), v11(cx + 1, height(cx + 1, cz + 1), cz + 1);
+		float ta, tb;
+		bool a = intersectTriangle(origin, dir, v00, v10, v01, ta) && ta >= 0 && ta <= tMax;
+		bool b = intersectTriangle(origin, dir, v11, v01, v10, tb) && tb >= 0 && tb <= tMax;
+		if (!a && !b)
+			return false;
+		t = (a && b) ? std::min(ta, tb) : (a ? ta : tb);
+		return true;
+	}
+
+	// children, sorted by the entry point
+	const LEVEL &C = m_pyramid[level - 1];
+	int children[4][2];
+	float entry[4];
+	int n = 0;
+	for (int i = cx * 2; i <= std::min(cx * 2 + 1, C.sizeX - 1); i++)
+		for (int j = cz * 2; j <= std::min(cz * 2 + 1, C.sizeZ - 1); j++)
+		{
+			float cMin[3] = { (float)(i << (level - 1)), -FLT_MAX, (float)(j << (level - 1)) };
+			float cMax[3] = { (float)((i + 1) << (level - 1)), FLT_MAX, (float)((j + 1) << (level - 1)) };
+			float c0 = t0, c1 = t1;
+			if (!clipRay(origin, dir, cMin, cMax, c0, c1))
+				continue;
+			int k = n++;
+			for (; k > 0 && entry[k - 1] > c0; k--)
+			{
+				entry[k] = entry[k - 1];
+				children[k][0] = children[k - 1][0];
+				children[k][1] = children[k - 1][1];
+			}
+			entry[k] = c0;
+			children[k][0] = i;
+			children[k][1] = j;
+		}
+
+	for (int k = 0; k < n; k++)
+		if (intersectCell(level - 1, children[k][0], children[k][1], origin, dir, tMax, t))
+			return true;
+	return false;
+}
+
+bool C3dglHeightField::intersectRay(const glm::vec3 &origin, const glm::vec3 &dir, float &t, float tMax) const
+{
+	if (!m_pHeights || m_nSizeX < 2 || m_nSizeZ < 2)
+		return false;
+	glm::vec3 o(origin.x + m_nSizeX / 2, origin.y, origin.z + m_nSizeZ / 2);
+	return intersectCell(m_pyramid.size() - 1, 0, 0, o, dir, tMax, t);
+}
+
+bool C3dglHeightField::lineOfSight(const glm::vec3 &a, const glm::vec3 &b) const
+{
+	float t;
+	return !intersectRay(a, b - a, t, 1);
+}
@@ -0,0 +1,88 @@
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "../GL/3dglMappedFile.h"
+
+using namespace _3dgl;
+
+C3dglMappedFile::C3dglMappedFile()
+{
+	m_pData = NULL;
+	m_size = 0;
+	m_hFile = m_hMapping = NULL;
+	m_fd = -1;
+}
+
+bool C3dglMappedFile::open(const std::string filename)
+{
+	close();
+	m_name = filename;
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return logError("cannot be opened");
+	m_hFile = hFile;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size) || size.QuadPart == 0 || (unsigned long long)size.QuadPart > (size_t)-1)
+	{
+		close();
+		return logError("is empty or too large for the address space");
+	}
+	m_size = (size_t)size.QuadPart;
+
+	m_hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_hMapping)
+		m_pData = MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	m_fd = ::open(filename.c_str(), O_RDONLY);
+	if (m_fd < 0)
+		return logError("cannot be opened");
+
+	struct stat st;
+	if (fstat(m_fd, &st) != 0 || st.st_size == 0)
+	{
+		close();
+		return logError("is empty");
+	}
+	m_size = (size_t)st.st_size;
+
+	void *p = mmap(NULL, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+	if (p != MAP_FAILED)
+	{
+		madvise(p, m_size, MADV_RANDOM);
+		m_pData = p;
+	}
+#endif
+
+	if (!m_pData)
+	{
+		close();
+		return logError("cannot be mapped into memory");
+	}
+	return logSuccess("mapped: " + std::to_string(m_size) + " bytes");
+}
+
+void C3dglMappedFile::close()
+{
+#ifdef _WIN32
+	if (m_pData) UnmapViewOfFile(m_pData);
+	if (m_hMapping) CloseHandle(m_hMapping);
+	if (m_hFile) CloseHandle(m_hFile);
+#else
+	if (m_pData) munmap((void*)m_pData, m_size);
+	if (m_fd >= 0) ::close(m_fd);
+#endif
+	m_pData = NULL;
+	m_size = 0;
+	m_hFile = m_hMapping = NULL;
+	m_fd = -1;
+}
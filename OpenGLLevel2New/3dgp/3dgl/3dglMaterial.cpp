@@ -4,6 +4,8 @@
 #include "../GL/3dglMaterial.h"
 #include "../GL/3dglShader.h"
 #include "../GL/3dglBitmap.h"
+#include "../GL/3dglCallStats.h"
+#include "../GL/3dglResourceLedger.h"
 
 // assimp include file
 #include "../GL/assimp/cimport.h"
@@ -84,9 +86,13 @@ void CMaterial::create(const aiMaterial *pMat, const char* pDefTexPath)
 
 void CMaterial::destroy()
 {
+	// the blank texture is shared by all the materials
 	for (unsigned& idTexture : m_idTexture)
-		if (idTexture != 0xffffffff)
-			glDeleteTextures(1, &idTexture);
+	{
+		if (idTexture != 0xffffffff && idTexture != c_idTexBlank)
+			C3dglResourceLedger::deleteTextures(1, &idTexture);
+		idTexture = 0xffffffff;
+	}
 }
 
 void CMaterial::bind()
@@ -97,7 +103,7 @@ void CMaterial::bind()
 		if (idTexture != 0xffffffff)
 		{
 			glActiveTexture(texUnit);
-			glBindTexture(GL_TEXTURE_2D, idTexture);
+			C3dglCallStats::bindTexture(GL_TEXTURE_2D, idTexture);
 		}
 		texUnit++;
 	}
@@ -144,14 +150,14 @@ void CMaterial::loadTexture(GLenum texUnit, string strPath)
 	if (bm.load(strPath, GL_RGBA))
 	{
 		// generate texture id
-		glGenTextures(1, &m_idTexture[texUnit - GL_TEXTURE0]);
+		C3dglResourceLedger::genTextures(1, &m_idTexture[texUnit - GL_TEXTURE0]);
 
 		// load texture
 		glActiveTexture(texUnit);
-		glBindTexture(GL_TEXTURE_2D, m_idTexture[texUnit - GL_TEXTURE0]);
+		C3dglCallStats::bindTexture(GL_TEXTURE_2D, m_idTexture[texUnit - GL_TEXTURE0]);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.getWidth(), bm.getHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.getBits());
+		C3dglCallStats::texImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.getWidth(), bm.getHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.getBits());
 	}
 }
 
@@ -159,13 +165,21 @@ void CMaterial::loadBlankTexture(GLenum texUnit)
 {
 	if (c_idTexBlank == 0xffffffff)
 	{
-		glGenTextures(1, &c_idTexBlank);
+		C3dglResourceLedger::OWNER owner("Materials", true);
+		C3dglResourceLedger::genTextures(1, &c_idTexBlank);
 		glActiveTexture(texUnit);
-		glBindTexture(GL_TEXTURE_2D, c_idTexBlank);
+		C3dglCallStats::bindTexture(GL_TEXTURE_2D, c_idTexBlank);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		unsigned char bytes[] = { 255, 255, 255 };
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_BGR, GL_UNSIGNED_BYTE, &bytes);
+		C3dglCallStats::texImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_BGR, GL_UNSIGNED_BYTE, &bytes);
 	}
 	m_idTexture[texUnit - GL_TEXTURE0] = c_idTexBlank;
 }
 
+void CMaterial::destroyBlankTexture()
+{
+	if (c_idTexBlank != 0xffffffff)
+		C3dglResourceLedger::deleteTextures(1, &c_idTexBlank);
+	c_idTexBlank = 0xffffffff;
+}
+
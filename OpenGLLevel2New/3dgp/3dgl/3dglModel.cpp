@@ -4,6 +4,10 @@
 #include "../GL/3dglModel.h"
 #include "../GL/3dglShader.h"
 #include "../GL/3dglBitmap.h"
+#include "../GL/3dglFrustum.h"
+#include "../GL/3dglProfiler.h"
+#include "../GL/3dglCallStats.h"
+#include "../GL/3dglResourceLedger.h"
 
 // assimp include file
 #include "../GL/assimp/cimport.h"
@@ -50,9 +54,9 @@ void C3dglModel::MESH::create(const aiMesh* pMesh, unsigned maskEnabledBufData)
 		if (vec.x < bb[0].x) bb[0].x = vec.x;
 		if (vec.y < bb[0].y) bb[0].y = vec.y;
 		if (vec.z < bb[0].z) bb[0].z = vec.z;
-		if (vec.x > bb[0].x) bb[1].x = vec.x;
-		if (vec.y > bb[0].y) bb[1].y = vec.y;
-		if (vec.z > bb[0].z) bb[1].z = vec.z;
+		if (vec.x > bb[1].x) bb[1].x = vec.x;
+		if (vec.y > bb[1].y) bb[1].y = vec.y;
+		if (vec.z > bb[1].z) bb[1].z = vec.z;
 	}
 	centre.x = 0.5f * (bb[0].x + bb[1].x);
 	centre.y = 0.5f * (bb[0].y + bb[1].y);
@@ -325,12 +329,14 @@ void C3dglModel::MESH::destroy()
 	m_buf[BUF_COLOR].release();
 	m_buf[BUF_BONE].release();
 	m_buf[BUF_INDEX].release();
+	if (m_idVAO) glDeleteVertexArrays(1, &m_idVAO);
+	m_idVAO = 0;
 }
 
 void C3dglModel::MESH::render()
 {
 	glBindVertexArray(m_idVAO);
-	glDrawElements(GL_TRIANGLES, m_indexSize, GL_UNSIGNED_INT, 0);
+	C3dglCallStats::drawElements(GL_TRIANGLES, m_indexSize, GL_UNSIGNED_INT, 0);
 	glBindVertexArray(0);
 }
 
@@ -352,6 +358,7 @@ void __createMap(const aiNode* pNode, std::map<std::string, const aiNode*>& map)
 void C3dglModel::create(const aiScene* pScene)
 {
 	// create meshes
+	C3dglResourceLedger::OWNER owner(getName());
 	m_pScene = pScene;
 	m_meshes.resize(m_pScene->mNumMeshes, MESH(this));
 	aiMesh** ppMesh = m_pScene->mMeshes;
@@ -360,12 +367,15 @@ void C3dglModel::create(const aiScene* pScene)
 
 	m_globInvT = m_pScene->mRootNode->mTransformation;
 	m_globInvT.Inverse();
+
+	getBB(m_bb);
 }
 
 void C3dglModel::loadMaterials(const char* pTexRootPath)
 {
 	if (!m_pScene) return;
 
+	C3dglResourceLedger::OWNER owner(getName() + "/materials");
 	m_materials.resize(m_pScene->mNumMaterials, CMaterial());
 	aiMaterial** ppMaterial = m_pScene->mMaterials;
 	for (CMaterial& material : m_materials)
@@ -442,12 +452,15 @@ void C3dglModel::destroy()
 {
 	if (m_pScene)
 	{
-		for (MESH mesh : m_meshes)
+		for (MESH &mesh : m_meshes)
 			mesh.destroy();
-		for (CMaterial mat : m_materials)
+		for (CMaterial &mat : m_materials)
 			mat.destroy();
 		for (C3dglModel *p : m_auxModels)
 			delete p;
+		m_meshes.clear();
+		m_materials.clear();
+		m_auxModels.clear();
 		aiReleaseImport(m_pScene);
 		m_pScene = NULL;
 	}
@@ -495,12 +508,14 @@ void C3dglModel::renderNode(aiNode* pNode, glm::mat4 m)
 
 void C3dglModel::render(glm::mat4 matrix)
 {
+	C3dglProfiler::ZONE zone("C3dglModel::render");
 	if (m_pScene->mRootNode)
 		renderNode(m_pScene->mRootNode, matrix);
 }
 
 void C3dglModel::render(unsigned iNode, glm::mat4 matrix)
 {
+	C3dglProfiler::ZONE zone("C3dglModel::render");
 	// update transform
 	aiMatrix4x4 m = m_pScene->mRootNode->mTransformation;
 	aiTransposeMatrix4(&m);
@@ -567,16 +582,19 @@ bool C3dglModel::getBBNode(aiNode* pNode, aiVector3D BB[2], aiMatrix4x4* trafo)
 
 	for (unsigned iMesh : vector<unsigned>(pNode->mMeshes, pNode->mMeshes + pNode->mNumMeshes))
 	{
-		aiVector3D bb[2];
-		memcpy(bb, m_meshes[iMesh].getBB(), sizeof(bb));
-		aiTransformVecByMatrix4(&bb[0], trafo);
-		aiTransformVecByMatrix4(&bb[1], trafo);
-		if (bb[0].x < BB[0].x) BB[0].x = bb[0].x;
-		if (bb[0].y < BB[0].y) BB[0].y = bb[0].y;
-		if (bb[0].z < BB[0].z) BB[0].z = bb[0].z;
-		if (bb[1].x > BB[0].x) BB[1].x = bb[1].x;
-		if (bb[1].y > BB[0].y) BB[1].y = bb[1].y;
-		if (bb[1].z > BB[0].z) BB[1].z = bb[1].z;
+		// all 8 corners - the transform may rotate the box
+		aiVector3D *bb = m_meshes[iMesh].getBB();
+		for (int i = 0; i < 8; i++)
+		{
+			aiVector3D vec(bb[i & 1].x, bb[(i >> 1) & 1].y, bb[i >> 2].z);
+			aiTransformVecByMatrix4(&vec, trafo);
+			if (vec.x < BB[0].x) BB[0].x = vec.x;
+			if (vec.y < BB[0].y) BB[0].y = vec.y;
+			if (vec.z < BB[0].z) BB[0].z = vec.z;
+			if (vec.x > BB[1].x) BB[1].x = vec.x;
+			if (vec.y > BB[1].y) BB[1].y = vec.y;
+			if (vec.z > BB[1].z) BB[1].z = vec.z;
+		}
 	}
 
 	for (aiNode* pNode : vector<aiNode*>(pNode->mChildren, pNode->mChildren + pNode->mNumChildren))
@@ -596,6 +614,31 @@ void C3dglModel::getBB(aiVector3D BB[2])
 	getBBNode(m_pScene->mRootNode, BB, &trafo);
 }
 
+unsigned C3dglModel::getTriangleCount()
+{
+	unsigned n = 0;
+	for (MESH &mesh : m_meshes)
+		n += mesh.getTriangleCount();
+	return n;
+}
+
+bool C3dglModel::isVisible(glm::mat4 matrixProjection, glm::mat4 matrix)
+{
+	if (!m_pScene || m_bb[0].x > m_bb[1].x)
+		return true;
+
+	// animated poses may reach beyond the bind pose box
+	aiVector3D bb[2] = { m_bb[0], m_bb[1] };
+	if (getBoneCount() > 0)
+	{
+		aiVector3D margin = 0.5f * (bb[1] - bb[0]);
+		bb[0] -= margin;
+		bb[1] += margin;
+	}
+	float pMin[3] = { bb[0].x, bb[0].y, bb[0].z }, pMax[3] = { bb[1].x, bb[1].y, bb[1].z };	// aiVector3D may be packed
+	return C3dglFrustum(matrixProjection * matrix).testAABB(pMin, pMax) != C3dglFrustum::OUTSIDE;
+}
+
 std::string C3dglModel::getName()
 {
 	if (m_name.empty())
@@ -0,0 +1,330 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+
+#include "../GL/glew.h"
+#include "../GL/3dglProfiler.h"
+
+using std::vector;
+using std::string;
+using std::endl;
+using namespace _3dgl;
+
+C3dglProfiler *C3dglProfiler::c_pCurrent = NULL;
+
+C3dglProfiler::C3dglProfiler(unsigned capacity) : m_ring(capacity ? capacity : 1), m_head(0), m_started(0)
+{
+	m_start = std::chrono::high_resolution_clock::now();
+	m_bEnabled = true;
+	m_bTimer = false;
+	m_bInFrame = false;
+	m_nFrame = 0;
+	m_nDropped = 0;
+	for (FRAME &frame : m_frames)
+	{
+		frame.frame = 0;
+		frame.nQueries = 0;
+		frame.cpuBase = 0;
+		frame.gpuBase = 0;
+		frame.bPending = false;
+	}
+}
+
+double C3dglProfiler::now()
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_start).count();
+}
+
+unsigned C3dglProfiler::query(FRAME &frame)
+{
+	if (frame.nQueries == frame.queries.size())
+	{
+		GLuint id = 0;
+		glGenQueries(1, &id);
+		frame.queries.push_back(id);
+	}
+	return frame.nQueries++;
+}
+
+void C3dglProfiler::push(const EVENT &event)
+{
+	// announce the slot before overwriting it - see getEvents
+	unsigned long long head = m_head.load(std::memory_order_relaxed);
+	m_started.store(head + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	m_ring[head % m_ring.size()] = event;
+	m_head.store(head + 1, std::memory_order_release);
+}
+
+// moves the events of a closed frame to the ring buffer, with the GPU times if available;
+// returns false (and leaves the frame pending) if the results are not ready and !bForce
+bool C3dglProfiler::resolve(FRAME &frame, bool bForce)
+{
+	if (m_bTimer && frame.nQueries)
+	{
+		// queries complete in order: if the last one is available, they all are
+		GLint available = 0;
+		glGetQueryObjectiv(frame.queries[frame.nQueries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available && !bForce)
+			return false;
+		if (available)
+			for (unsigned i = 0; i < frame.events.size(); i++)
+			{
+				GLuint64 t0 = 0, t1 = 0;
+				glGetQueryObjectui64v(frame.queries[frame.slots[2 * i]], GL_QUERY_RESULT, &t0);
+				glGetQueryObjectui64v(frame.queries[frame.slots[2 * i + 1]], GL_QUERY_RESULT, &t1);
+				frame.events[i].gpuBegin = frame.cpuBase + ((long long)t0 - frame.gpuBase) / 1000000.0;
+				frame.events[i].gpuEnd = frame.cpuBase + ((long long)t1 - frame.gpuBase) / 1000000.0;
+			}
+		else
+			m_nDropped++;
+	}
+
+	for (EVENT &event : frame.events)
+		push(event);
+	frame.bPending = false;
+	return true;
+}
+
+void C3dglProfiler::beginFrame()
+{
+	if (m_bInFrame)
+		endFrame();
+	if (!m_bEnabled)
+		return;
+	if (m_nFrame == 0)
+		m_bTimer = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+
+	// collect the closed frames, oldest first; the one in the slot about to be reused cannot wait any longer
+	for (int i = 0; i < LATENCY; i++)
+	{
+		FRAME &frame = m_frames[(m_nFrame + i) % LATENCY];
+		if (frame.bPending && !resolve(frame, i == 0))
+			break;
+	}
+
+	FRAME &frame = m_frames[m_nFrame % LATENCY];
+	frame.frame = m_nFrame;
+	frame.events.clear();
+	frame.slots.clear();
+	frame.nQueries = 0;
+	frame.cpuBase = now();
+	frame.gpuBase = 0;
+	if (m_bTimer)
+	{
+		GLint64 t = 0;
+		glGetInteger64v(GL_TIMESTAMP, &t);
+		frame.gpuBase = t;
+	}
+	m_stack.clear();
+	m_bInFrame = true;
+}
+
+void C3dglProfiler::endFrame()
+{
+	if (!m_bInFrame)
+		return;
+	while (!m_stack.empty())
+		end();
+	m_frames[m_nFrame % LATENCY].bPending = true;
+	m_bInFrame = false;
+	m_nFrame++;
+}
+
+bool C3dglProfiler::begin(const char *name)
+{
+	if (!m_bInFrame)
+		return false;
+	FRAME &frame = m_frames[m_nFrame % LATENCY];
+	EVENT event = { name, m_nFrame, (unsigned)m_stack.size(), now(), 0, -1, -1 };
+	m_stack.push_back(frame.events.size());
+	frame.events.push_back(event);
+	if (m_bTimer)
+	{
+		unsigned slot = query(frame);
+		glQueryCounter(frame.queries[slot], GL_TIMESTAMP);
+		frame.slots.push_back(slot);
+		frame.slots.push_back(0);			// set by end
+	}
+	return true;
+}
+
+bool C3dglProfiler::begin(const string &name)
+{
+	return begin(m_names.insert(name).first->c_str());
+}
+
+void C3dglProfiler::end()
+{
+	if (!m_bInFrame || m_stack.empty())
+		return;
+	FRAME &frame = m_frames[m_nFrame % LATENCY];
+	unsigned i = m_stack.back();
+	m_stack.pop_back();
+	if (m_bTimer)
+	{
+		unsigned slot = query(frame);
+		glQueryCounter(frame.queries[slot], GL_TIMESTAMP);
+		frame.slots[2 * i + 1] = slot;
+	}
+	frame.events[i].cpuEnd = now();
+}
+
+void C3dglProfiler::getEvents(vector<EVENT> &events)
+{
+	unsigned long long head = m_head.load(std::memory_order_acquire);
+	unsigned long long n = std::min<unsigned long long>(head, m_ring.size());
+	events.clear();
+	events.reserve((size_t)n);
+	for (unsigned long long i = head - n; i < head; i++)
+		events.push_back(m_ring[i % m_ring.size()]);
+
+	// the writer may have wrapped around meanwhile: drop the events whose slots were reused
+	// since, and everything if the profiler was cleared
+	std::atomic_thread_fence(std::memory_order_acquire);
+	unsigned long long started = m_started.load(std::memory_order_relaxed);
+	unsigned long long first = started < m_ring.size() ? 0 : started - m_ring.size();	// the oldest event intact
+	if (started < head)
+		events.clear();
+	else if (first > head - n)
+		events.erase(events.begin(), events.begin() + (size_t)std::min(first - (head - n), n));
+}
+
+void C3dglProfiler::getSummary(vector<SUMMARY> &summary)
+{
+	vector<EVENT> events;
+	getEvents(events);
+	summary.clear();
+	if (events.empty())
+		return;
+
+	// in the order the zones first appear
+	std::map<string, size_t> index;
+	vector<unsigned> nMeasured;			// GPU times, not all the events have them
+	for (EVENT &event : events)
+	{
+		auto it = index.find(event.name);
+		if (it == index.end())
+		{
+			it = index.insert(std::make_pair(string(event.name), summary.size())).first;
+			SUMMARY s = { event.name, 0, 0, 0 };
+			summary.push_back(s);
+			nMeasured.push_back(0);
+		}
+		SUMMARY &s = summary[it->second];
+		s.nCalls++;
+		s.cpuTime += event.cpuEnd - event.cpuBegin;
+		if (event.gpuBegin >= 0)
+		{
+			s.gpuTime += event.gpuEnd - event.gpuBegin;
+			nMeasured[it->second]++;
+		}
+	}
+
+	double nFrames = events.back().frame - events.front().frame + 1;
+	for (size_t i = 0; i < summary.size(); i++)
+	{
+		SUMMARY &s = summary[i];
+		if (nMeasured[i])
+			s.gpuTime *= s.nCalls / nMeasured[i];
+		s.nCalls /= nFrames;
+		s.cpuTime /= nFrames;
+		s.gpuTime /= nFrames;
+	}
+}
+
+// CSV field: quoted, with the quotes doubled
+static string csvString(const char *str)
+{
+	string s = "\"";
+	for (const char *p = str; *p; p++)
+		s += (*p == '"') ? string("\"\"") : string(1, *p);
+	return s + "\"";
+}
+
+// JSON string: quoted, with the quotes, backslashes and control characters escaped
+static string jsonString(const char *str)
+{
+	string s = "\"";
+	for (const char *p = str; *p; p++)
+		if (*p == '"' || *p == '\\')
+			s += string("\\") + *p;
+		else if ((unsigned char)*p < 0x20)
+			s += ' ';
+		else
+			s += *p;
+	return s + "\"";
+}
+
+bool C3dglProfiler::exportCSV(const string &filename)
+{
+	std::ofstream file(filename.c_str());
+	if (!file)
+		return logError("cannot write " + filename);
+
+	vector<EVENT> events;
+	getEvents(events);
+	file << "frame,zone,depth,cpu start (ms),cpu time (ms),gpu start (ms),gpu time (ms)" << endl;
+	file << std::fixed << std::setprecision(4);
+	for (EVENT &event : events)
+	{
+		file << event.frame << "," << csvString(event.name) << "," << event.depth << "," << event.cpuBegin << "," << event.cpuEnd - event.cpuBegin << ",";
+		if (event.gpuBegin >= 0)
+			file << event.gpuBegin << "," << event.gpuEnd - event.gpuBegin;
+		else
+			file << ",";
+		file << endl;
+	}
+	return true;
+}
+
+// Chrome trace event format: complete ("X") events, time stamps in microseconds
+bool C3dglProfiler::exportTrace(const string &filename)
+{
+	std::ofstream file(filename.c_str());
+	if (!file)
+		return logError("cannot write " + filename);
+
+	vector<EVENT> events;
+	getEvents(events);
+	file << "{\"traceEvents\":[" << endl;
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}}," << endl;
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+	file << std::fixed << std::setprecision(3);
+	for (EVENT &event : events)
+	{
+		file << "," << endl << "{\"name\":" << jsonString(event.name) << ",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << event.cpuBegin * 1000
+			<< ",\"dur\":" << (event.cpuEnd - event.cpuBegin) * 1000 << ",\"args\":{\"frame\":" << event.frame << "}}";
+		if (event.gpuBegin >= 0)
+			file << "," << endl << "{\"name\":" << jsonString(event.name) << ",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":" << event.gpuBegin * 1000
+				<< ",\"dur\":" << (event.gpuEnd - event.gpuBegin) * 1000 << ",\"args\":{\"frame\":" << event.frame << "}}";
+	}
+	file << endl << "],\"displayTimeUnit\":\"ms\"}" << endl;
+	return true;
+}
+
+void C3dglProfiler::clear()
+{
+	m_head.store(0, std::memory_order_release);
+	m_started.store(0, std::memory_order_release);
+	m_nDropped = 0;
+}
+
+void C3dglProfiler::destroy()
+{
+	for (FRAME &frame : m_frames)
+	{
+		if (!frame.queries.empty())
+			glDeleteQueries(frame.queries.size(), &frame.queries[0]);
+		frame.queries.clear();
+		frame.slots.clear();
+		frame.events.clear();
+		frame.nQueries = 0;
+		frame.bPending = false;
+	}
+	m_stack.clear();
+	m_bInFrame = false;
+	if (c_pCurrent == this)
+		c_pCurrent = NULL;
+}
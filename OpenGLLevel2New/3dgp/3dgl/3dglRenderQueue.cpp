@@ -0,0 +1,216 @@
+#include <cstring>
+
+#include "../GL/glew.h"
+#include "../GL/3dglRenderQueue.h"
+#include "../GL/3dglShader.h"
+#include "../GL/3dglProfiler.h"
+#include "../GL/3dglCallStats.h"
+
+using namespace _3dgl;
+
+C3dglRenderQueue::C3dglRenderQueue()
+{
+	m_backToFront = 0;
+	m_bSorting = true;
+	resetStats();
+}
+
+int C3dglRenderQueue::addMaterial(APPLY apply)
+{
+	if (m_materials.size() >= (1u << MATERIAL_BITS))
+	{
+		logError("Render queue: too many materials");
+		return -1;
+	}
+	m_materials.push_back(apply);
+	return (int)m_materials.size() - 1;
+}
+
+int C3dglRenderQueue::addTextureSet(std::initializer_list<BINDING> bindings)
+{
+	if (m_textureSets.size() >= (1u << TEXTURE_BITS))
+	{
+		logError("Render queue: too many texture sets");
+		return -1;
+	}
+	m_textureSets.push_back(bindings);
+	return (int)m_textureSets.size() - 1;
+}
+
+void C3dglRenderQueue::setTextureSet(int textures, std::initializer_list<BINDING> bindings)
+{
+	if (textures >= 0 && textures < (int)m_textureSets.size())
+		m_textureSets[textures] = bindings;
+}
+
+void C3dglRenderQueue::setBackToFront(int layer, bool bBackToFront)
+{
+	if (bBackToFront)
+		m_backToFront |= 1 << layer;
+	else
+		m_backToFront &= ~(1 << layer);
+}
+
+int C3dglRenderQueue::getProgramId(C3dglProgram *pProgram)
+{
+	for (unsigned i = 0; i < m_programs.size(); i++)
+		if (m_programs[i] == pProgram)
+			return i;
+	m_programs.push_back(pProgram);
+	return (int)m_programs.size() - 1;
+}
+
+void C3dglRenderQueue::submit(int layer, C3dglProgram *pProgram, int material, int textures, float depth, DRAW draw, bool bOwnState)
+{
+	// non-negative floats keep their order when compared as integers; drop the low mantissa bits
+	unsigned bits = 0;
+	if (depth > 0) memcpy(&bits, &depth, sizeof(bits));
+	unsigned long long d = bits >> (32 - DEPTH_BITS);
+	if (m_backToFront & (1 << layer))
+		d = ((1ull << DEPTH_BITS) - 1) - d;
+
+	// ids + 1, so that none (-1) sorts first
+	unsigned long long key = (unsigned long long)(layer & ((1 << LAYER_BITS) - 1));
+	key = (key << PROGRAM_BITS) | (getProgramId(pProgram) & ((1 << PROGRAM_BITS) - 1));
+	key = (key << MATERIAL_BITS) | ((material + 1) & ((1 << MATERIAL_BITS) - 1));
+	key = (key << TEXTURE_BITS) | ((textures + 1) & ((1 << TEXTURE_BITS) - 1));
+	key = (key << DEPTH_BITS) | d;
+
+	PACKET packet = { key, pProgram, material, textures, bOwnState, draw };
+	m_packets.push_back(packet);
+}
+
+// LSD radix sort of the keys, a byte at a time; stable, so equal keys keep the submission order
+void C3dglRenderQueue::sort()
+{
+	size_t n = m_packets.size();
+	m_keys.resize(n);
+	m_keysTemp.resize(n);
+	m_orderTemp.resize(n);
+	for (size_t i = 0; i < n; i++)
+		m_keys[i] = m_packets[i].key;
+
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		size_t count[256] = { 0 };
+		for (size_t i = 0; i < n; i++)
+			count[(m_keys[i] >> shift) & 0xff]++;
+
+		// all keys share this byte
+		if (count[(m_keys[0] >> shift) & 0xff] == n)
+			continue;
+
+		size_t offset = 0;
+		for (size_t &c : count)
+		{
+			size_t t = c;
+			c = offset;
+			offset += t;
+		}
+		for (size_t i = 0; i < n; i++)
+		{
+			size_t j = count[(m_keys[i] >> shift) & 0xff]++;
+			m_keysTemp[j] = m_keys[i];
+			m_orderTemp[j] = m_order[i];
+		}
+		m_keys.swap(m_keysTemp);
+		m_order.swap(m_orderTemp);
+	}
+}
+
+// goes through the packets in m_order, issuing the state changes (and the draws) if bExecute
+void C3dglRenderQueue::run(bool bExecute, COUNTS &counts)
+{
+	C3dglProgram *pProgram = NULL;
+	int material = -1;
+	bool bMaterial = false;				// material known
+	BINDING bound[MAX_UNITS];
+	bool bBound[MAX_UNITS] = { false };	// texture units known
+
+	counts.nPrograms = counts.nMaterials = counts.nBinds = 0;
+	for (unsigned i : m_order)
+	{
+		PACKET &packet = m_packets[i];
+
+		if (packet.pProgram != pProgram || !pProgram)
+		{
+			pProgram = packet.pProgram;
+			bMaterial = false;			// uniforms belong to the program
+			counts.nPrograms++;
+			if (bExecute && pProgram) pProgram->Use();
+		}
+
+		if (packet.material >= 0 && (!bMaterial || packet.material != material))
+		{
+			material = packet.material;
+			bMaterial = true;
+			counts.nMaterials++;
+			if (bExecute) m_materials[material]();
+		}
+
+		unsigned nBinds = counts.nBinds;
+		if (packet.textures >= 0)
+			for (BINDING &binding : m_textureSets[packet.textures])
+			{
+				unsigned unit = binding.unit - GL_TEXTURE0;
+				if (unit >= MAX_UNITS) continue;
+				if (bBound[unit] && bound[unit].target == binding.target && bound[unit].id == binding.id)
+					continue;
+				bound[unit] = binding;
+				bBound[unit] = true;
+				counts.nBinds++;
+				if (bExecute)
+				{
+					glActiveTexture(binding.unit);
+					C3dglCallStats::bindTexture(binding.target, binding.id);
+				}
+			}
+
+		if (bExecute)
+		{
+			if (counts.nBinds != nBinds)
+				glActiveTexture(GL_TEXTURE0);
+			packet.draw();
+		}
+
+		if (packet.bOwnState)
+		{
+			bMaterial = false;
+			memset(bBound, 0, sizeof(bBound));
+		}
+	}
+}
+
+void C3dglRenderQueue::flush()
+{
+	if (m_packets.empty())
+		return;
+	C3dglProfiler::ZONE zone("C3dglRenderQueue::flush");
+
+	m_order.resize(m_packets.size());
+	for (unsigned i = 0; i < m_order.size(); i++)
+		m_order[i] = i;
+
+	// what the submission order would cost
+	COUNTS counts;
+	run(false, counts);
+	m_stats.nProgramsUnsorted += counts.nPrograms;
+	m_stats.nMaterialsUnsorted += counts.nMaterials;
+	m_stats.nBindsUnsorted += counts.nBinds;
+
+	if (m_bSorting)
+		sort();
+	run(true, counts);
+	m_stats.nPrograms += counts.nPrograms;
+	m_stats.nMaterials += counts.nMaterials;
+	m_stats.nBinds += counts.nBinds;
+
+	m_stats.nPackets += m_packets.size();
+	m_stats.nFlushes++;
+	m_packets.clear();
+}
+
+void C3dglRenderQueue::resetStats()
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
@@ -0,0 +1,420 @@
+#include <algorithm>
+#include <iomanip>
+#include <climits>
+
+#include "../GL/glew.h"
+#include "../GL/3dglResourceLedger.h"
+
+using std::vector;
+using std::string;
+using std::endl;
+using namespace _3dgl;
+
+C3dglResourceLedger *C3dglResourceLedger::c_pCurrent = NULL;
+vector<string> C3dglResourceLedger::c_owners;
+
+// estimated size of a texel (or renderbuffer sample) in the given internal format
+static unsigned long long bytesPerTexel(unsigned format)
+{
+	switch (format)
+	{
+	case GL_R8: case GL_RED: case GL_ALPHA: case GL_LUMINANCE: case GL_STENCIL_INDEX8: return 1;
+	case GL_R16: case GL_R16F: case GL_RG8: case GL_RG: case GL_LUMINANCE_ALPHA: case GL_DEPTH_COMPONENT16: return 2;
+	case GL_RGBA16: case GL_RGBA16F: case GL_RGB16F: case GL_RG32F: case GL_DEPTH32F_STENCIL8: return 8;
+	case GL_RGB32F: return 12;
+	case GL_RGBA32F: return 16;
+	default: return 4;					// 8-bit RGB(A), stored as RGBA; 24 and 32-bit depth
+	}
+}
+
+// the glGetIntegerv parameter that returns the object bound to the target
+static GLenum bindingOf(C3dglResourceLedger::KIND kind, unsigned target)
+{
+	switch (kind)
+	{
+	case C3dglResourceLedger::BUFFER:
+		switch (target)
+		{
+		case GL_ARRAY_BUFFER: return GL_ARRAY_BUFFER_BINDING;
+		case GL_ELEMENT_ARRAY_BUFFER: return GL_ELEMENT_ARRAY_BUFFER_BINDING;
+		case GL_UNIFORM_BUFFER: return GL_UNIFORM_BUFFER_BINDING;
+		case GL_COPY_READ_BUFFER: return GL_COPY_READ_BUFFER_BINDING;
+		case GL_COPY_WRITE_BUFFER: return GL_COPY_WRITE_BUFFER_BINDING;
+		case GL_PIXEL_PACK_BUFFER: return GL_PIXEL_PACK_BUFFER_BINDING;
+		case GL_PIXEL_UNPACK_BUFFER: return GL_PIXEL_UNPACK_BUFFER_BINDING;
+		case GL_TRANSFORM_FEEDBACK_BUFFER: return GL_TRANSFORM_FEEDBACK_BUFFER_BINDING;
+		case GL_DRAW_INDIRECT_BUFFER: return GL_DRAW_INDIRECT_BUFFER_BINDING;
+		case GL_SHADER_STORAGE_BUFFER: return GL_SHADER_STORAGE_BUFFER_BINDING;
+		}
+		break;
+	case C3dglResourceLedger::TEXTURE:
+		if (target >= GL_TEXTURE_CUBE_MAP_POSITIVE_X && target <= GL_TEXTURE_CUBE_MAP_NEGATIVE_Z)
+			return GL_TEXTURE_BINDING_CUBE_MAP;
+		switch (target)
+		{
+		case GL_TEXTURE_1D: return GL_TEXTURE_BINDING_1D;
+		case GL_TEXTURE_2D: return GL_TEXTURE_BINDING_2D;
+		case GL_TEXTURE_3D: return GL_TEXTURE_BINDING_3D;
+		case GL_TEXTURE_2D_ARRAY: return GL_TEXTURE_BINDING_2D_ARRAY;
+		case GL_TEXTURE_RECTANGLE: return GL_TEXTURE_BINDING_RECTANGLE;
+		case GL_TEXTURE_CUBE_MAP: return GL_TEXTURE_BINDING_CUBE_MAP;
+		case GL_TEXTURE_CUBE_MAP_ARRAY: return GL_TEXTURE_BINDING_CUBE_MAP_ARRAY;
+		}
+		break;
+	case C3dglResourceLedger::RENDERBUFFER:
+		return GL_RENDERBUFFER_BINDING;
+	default:
+		break;
+	}
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// The recording versions of the GL functions: they call the original function and record
+
+struct C3dglResourceLedger::HOOKS
+{
+	typedef void (GLAPIENTRY *GEN_FN)(GLsizei, GLuint*);
+	typedef void (GLAPIENTRY *DEL_FN)(GLsizei, const GLuint*);
+
+	template <KIND K> struct GEN
+	{
+		static GEN_FN &original()			{ static GEN_FN fn = NULL; return fn; }
+		static void GLAPIENTRY call(GLsizei n, GLuint *ids)
+		{
+			original()(n, ids);
+			if (c_pCurrent) c_pCurrent->created(K, n, ids);
+		}
+	};
+	template <KIND K> struct DEL
+	{
+		static DEL_FN &original()			{ static DEL_FN fn = NULL; return fn; }
+		static void GLAPIENTRY call(GLsizei n, const GLuint *ids)
+		{
+			if (c_pCurrent) c_pCurrent->deleted(K, n, ids);
+			original()(n, ids);
+		}
+	};
+
+	template <class FN> static void replace(C3dglResourceLedger *pLedger, FN &fn, FN hook, FN &original)
+	{
+		if (!fn) return;
+		original = fn;
+		HOOK h = { (void**)&fn, (void*)fn, (void*)hook };
+		pLedger->m_hooks.push_back(h);
+		fn = hook;
+	}
+
+	template <KIND K> static void record(C3dglResourceLedger *pLedger, GEN_FN &gen, DEL_FN &del)
+	{
+		replace(pLedger, gen, &GEN<K>::call, GEN<K>::original());
+		replace(pLedger, del, &DEL<K>::call, DEL<K>::original());
+	}
+
+	// the size of a texture: all its images
+	static void total(C3dglResourceLedger *pLedger, RESOURCE &res)
+	{
+		res.size = 0;
+		auto end = pLedger->m_images.upper_bound(std::make_pair(res.id, INT_MAX));
+		for (auto it = pLedger->m_images.lower_bound(std::make_pair(res.id, INT_MIN)); it != end; ++it)
+			res.size += it->second;
+	}
+
+	// allocations - their sizes are recorded
+	static PFNGLBUFFERDATAPROC bufferData;
+	static PFNGLTEXIMAGE3DPROC texImage3D;
+	static PFNGLTEXSTORAGE2DPROC texStorage2D;
+	static PFNGLTEXSTORAGE3DPROC texStorage3D;
+	static PFNGLGENERATEMIPMAPPROC generateMipmap;
+	static PFNGLRENDERBUFFERSTORAGEPROC renderbufferStorage;
+	static PFNGLRENDERBUFFERSTORAGEMULTISAMPLEPROC renderbufferStorageMultisample;
+
+	static void GLAPIENTRY BufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage)
+	{
+		bufferData(target, size, data, usage);
+		RESOURCE *p = c_pCurrent ? c_pCurrent->bound(BUFFER, target) : NULL;
+		if (p) p->size = size;
+	}
+	static void GLAPIENTRY TexImage3D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type, const void *pixels)
+	{
+		texImage3D(target, level, internalFormat, width, height, depth, border, format, type, pixels);
+		if (c_pCurrent) c_pCurrent->image(target, level, internalFormat, width, height, depth);
+	}
+	static void GLAPIENTRY TexStorage2D(GLenum target, GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height)
+	{
+		texStorage2D(target, levels, internalFormat, width, height);
+		if (!c_pCurrent) return;
+		for (int face = 0; face < (target == GL_TEXTURE_CUBE_MAP ? 6 : 1); face++)
+			for (int l = 0; l < levels; l++)
+				c_pCurrent->image(target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : target, l, internalFormat,
+					std::max(1, width >> l), std::max(1, height >> l), 1);
+	}
+	static void GLAPIENTRY TexStorage3D(GLenum target, GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height, GLsizei depth)
+	{
+		texStorage3D(target, levels, internalFormat, width, height, depth);
+		if (!c_pCurrent) return;
+		for (int l = 0; l < levels; l++)
+			c_pCurrent->image(target, l, internalFormat, std::max(1, width >> l), std::max(1, height >> l), target == GL_TEXTURE_3D ? std::max(1, depth >> l) : depth);
+	}
+	static void GLAPIENTRY GenerateMipmap(GLenum target)
+	{
+		generateMipmap(target);
+		RESOURCE *p = c_pCurrent ? c_pCurrent->bound(TEXTURE, target) : NULL;
+		if (!p) return;
+
+		// the levels below the level 0 of each face
+		int faces = (target == GL_TEXTURE_CUBE_MAP) ? 6 : 1;
+		int layers = (target == GL_TEXTURE_CUBE_MAP) ? 1 : p->depth;
+		for (int face = 0; face < faces; face++)
+		{
+			int w = p->width, h = p->height, d = layers;
+			for (int l = 1; w > 1 || h > 1 || (target == GL_TEXTURE_3D && d > 1); l++)
+			{
+				w = std::max(1, w / 2); h = std::max(1, h / 2);
+				if (target == GL_TEXTURE_3D) d = std::max(1, d / 2);
+				c_pCurrent->m_images[std::make_pair(p->id, face * 32 + l)] = (unsigned long long)w * h * d * bytesPerTexel(p->format);
+			}
+		}
+		total(c_pCurrent, *p);
+	}
+	static void GLAPIENTRY RenderbufferStorage(GLenum target, GLenum internalFormat, GLsizei width, GLsizei height)
+	{
+		renderbufferStorage(target, internalFormat, width, height);
+		storage(target, 1, internalFormat, width, height);
+	}
+	static void GLAPIENTRY RenderbufferStorageMultisample(GLenum target, GLsizei samples, GLenum internalFormat, GLsizei width, GLsizei height)
+	{
+		renderbufferStorageMultisample(target, samples, internalFormat, width, height);
+		storage(target, samples, internalFormat, width, height);
+	}
+	static void storage(GLenum target, GLsizei samples, GLenum internalFormat, GLsizei width, GLsizei height)
+	{
+		RESOURCE *p = c_pCurrent ? c_pCurrent->bound(RENDERBUFFER, target) : NULL;
+		if (!p) return;
+		p->format = internalFormat;
+		p->width = width; p->height = height; p->depth = 1;
+		p->size = (unsigned long long)width * height * std::max(1, (int)samples) * bytesPerTexel(internalFormat);
+	}
+};
+
+PFNGLBUFFERDATAPROC C3dglResourceLedger::HOOKS::bufferData = NULL;
+PFNGLTEXIMAGE3DPROC C3dglResourceLedger::HOOKS::texImage3D = NULL;
+PFNGLTEXSTORAGE2DPROC C3dglResourceLedger::HOOKS::texStorage2D = NULL;
+PFNGLTEXSTORAGE3DPROC C3dglResourceLedger::HOOKS::texStorage3D = NULL;
+PFNGLGENERATEMIPMAPPROC C3dglResourceLedger::HOOKS::generateMipmap = NULL;
+PFNGLRENDERBUFFERSTORAGEPROC C3dglResourceLedger::HOOKS::renderbufferStorage = NULL;
+PFNGLRENDERBUFFERSTORAGEMULTISAMPLEPROC C3dglResourceLedger::HOOKS::renderbufferStorageMultisample = NULL;
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// C3dglResourceLedger
+
+C3dglResourceLedger::C3dglResourceLedger()
+{
+	m_serial = 0;
+	m_nUnknown = 0;
+}
+
+bool C3dglResourceLedger::install()
+{
+	if (c_pCurrent == this)
+		return true;
+	if (c_pCurrent)
+		return logError("another instance is installed");
+	if (!__glewGenBuffers)
+		return logError("install called before glewInit");
+
+	m_resources.clear();
+	m_images.clear();
+	m_nUnknown = 0;
+
+	HOOKS::record<BUFFER>(this, __glewGenBuffers, __glewDeleteBuffers);
+	HOOKS::record<RENDERBUFFER>(this, __glewGenRenderbuffers, __glewDeleteRenderbuffers);
+	HOOKS::record<FRAMEBUFFER>(this, __glewGenFramebuffers, __glewDeleteFramebuffers);
+	HOOKS::record<VERTEX_ARRAY>(this, __glewGenVertexArrays, __glewDeleteVertexArrays);
+
+	HOOKS::replace(this, __glewBufferData, &HOOKS::BufferData, HOOKS::bufferData);
+	HOOKS::replace(this, __glewTexImage3D, &HOOKS::TexImage3D, HOOKS::texImage3D);
+	HOOKS::replace(this, __glewTexStorage2D, &HOOKS::TexStorage2D, HOOKS::texStorage2D);
+	HOOKS::replace(this, __glewTexStorage3D, &HOOKS::TexStorage3D, HOOKS::texStorage3D);
+	HOOKS::replace(this, __glewGenerateMipmap, &HOOKS::GenerateMipmap, HOOKS::generateMipmap);
+	HOOKS::replace(this, __glewRenderbufferStorage, &HOOKS::RenderbufferStorage, HOOKS::renderbufferStorage);
+	HOOKS::replace(this, __glewRenderbufferStorageMultisample, &HOOKS::RenderbufferStorageMultisample, HOOKS::renderbufferStorageMultisample);
+
+	c_pCurrent = this;
+	return true;
+}
+
+void C3dglResourceLedger::uninstall()
+{
+	if (c_pCurrent != this)
+		return;
+	// only the pointers still hooked: anything installed later keeps its own hooks
+	for (auto &hook : m_hooks)
+		if (*hook.pFn == hook.hook)
+			*hook.pFn = hook.original;
+	m_hooks.clear();
+	c_pCurrent = NULL;
+}
+
+void C3dglResourceLedger::pushOwner(const string &name, bool bRoot)
+{
+	c_owners.push_back(bRoot || c_owners.empty() ? name : c_owners.back() + "/" + name);
+}
+
+void C3dglResourceLedger::popOwner()
+{
+	if (!c_owners.empty())
+		c_owners.pop_back();
+}
+
+void C3dglResourceLedger::created(KIND kind, int n, const unsigned *ids)
+{
+	string owner = getOwner();
+	for (int i = 0; i < n; i++)
+	{
+		// a name in use means the previous object was deleted behind the ledger's back
+		RESOURCE res = { kind, ids[i], owner, 0, 0, 0, 0, 0, ++m_serial };
+		m_resources[std::make_pair((int)kind, ids[i])] = res;
+		if (kind == TEXTURE)
+			m_images.erase(m_images.lower_bound(std::make_pair(ids[i], INT_MIN)), m_images.upper_bound(std::make_pair(ids[i], INT_MAX)));
+	}
+}
+
+void C3dglResourceLedger::deleted(KIND kind, int n, const unsigned *ids)
+{
+	for (int i = 0; i < n; i++)
+	{
+		if (ids[i] == 0)
+			continue;						// silently ignored by GL
+		if (m_resources.erase(std::make_pair((int)kind, ids[i])) == 0)
+			m_nUnknown++;					// deleted twice, or created before the ledger was installed
+		else if (kind == TEXTURE)
+			m_images.erase(m_images.lower_bound(std::make_pair(ids[i], INT_MIN)), m_images.upper_bound(std::make_pair(ids[i], INT_MAX)));
+	}
+}
+
+// the resource bound to the target, NULL if none or not in the ledger
+C3dglResourceLedger::RESOURCE *C3dglResourceLedger::bound(KIND kind, unsigned target)
+{
+	GLenum binding = bindingOf(kind, target);
+	if (!binding)
+		return NULL;
+	GLint id = 0;
+	glGetIntegerv(binding, &id);
+	auto it = m_resources.find(std::make_pair((int)kind, (unsigned)id));
+	return (id && it != m_resources.end()) ? &it->second : NULL;
+}
+
+void C3dglResourceLedger::image(unsigned target, int level, unsigned internalFormat, int width, int height, int depth)
+{
+	RESOURCE *p = bound(TEXTURE, target);
+	if (!p)
+		return;
+	bool bFace = target >= GL_TEXTURE_CUBE_MAP_POSITIVE_X && target <= GL_TEXTURE_CUBE_MAP_NEGATIVE_Z;
+	int face = bFace ? target - GL_TEXTURE_CUBE_MAP_POSITIVE_X : 0;
+	m_images[std::make_pair(p->id, face * 32 + level)] = (unsigned long long)width * height * depth * bytesPerTexel(internalFormat);
+	if (level == 0)
+	{
+		p->format = internalFormat;
+		p->width = width;
+		p->height = height;
+		p->depth = bFace ? 6 : depth;
+	}
+	HOOKS::total(this, *p);
+}
+
+void C3dglResourceLedger::genTextures(int n, unsigned *textures)
+{
+	glGenTextures(n, textures);
+	if (c_pCurrent) c_pCurrent->created(TEXTURE, n, textures);
+}
+
+void C3dglResourceLedger::deleteTextures(int n, const unsigned *textures)
+{
+	if (c_pCurrent) c_pCurrent->deleted(TEXTURE, n, textures);
+	glDeleteTextures(n, textures);
+}
+
+void C3dglResourceLedger::texImage(unsigned target, int level, int internalFormat, int width, int height, int depth)
+{
+	if (c_pCurrent) c_pCurrent->image(target, level, internalFormat, width, height, depth);
+}
+
+void C3dglResourceLedger::getResources(vector<RESOURCE> &resources, unsigned long long since)
+{
+	resources.clear();
+	for (auto &i : m_resources)
+		if (i.second.serial > since)
+			resources.push_back(i.second);
+	std::sort(resources.begin(), resources.end(), [](const RESOURCE &a, const RESOURCE &b) { return a.serial < b.serial; });
+}
+
+void C3dglResourceLedger::getUsage(vector<USAGE> &usage)
+{
+	std::map<string, USAGE> owners;
+	for (auto &i : m_resources)
+	{
+		RESOURCE &res = i.second;
+		auto it = owners.find(res.owner);
+		if (it == owners.end())
+		{
+			USAGE u = { res.owner, { 0 }, 0 };
+			it = owners.insert(std::make_pair(res.owner, u)).first;
+		}
+		it->second.count[res.kind]++;
+		it->second.size += res.size;
+	}
+	usage.clear();
+	for (auto &i : owners)
+		usage.push_back(i.second);
+	std::stable_sort(usage.begin(), usage.end(), [](const USAGE &a, const USAGE &b) { return a.size > b.size; });
+}
+
+unsigned long long C3dglResourceLedger::getMemory()
+{
+	unsigned long long size = 0;
+	for (auto &i : m_resources)
+		size += i.second.size;
+	return size;
+}
+
+const char *C3dglResourceLedger::getKindName(KIND kind)
+{
+	const char *NAMES[] = { "buffer", "texture", "renderbuffer", "framebuffer", "vertex array" };
+	return kind < KIND_COUNT ? NAMES[kind] : "";
+}
+
+unsigned C3dglResourceLedger::reportLeaks(std::ostream &out, unsigned long long since)
+{
+	vector<RESOURCE> resources;
+	getResources(resources, since);
+	unsigned long long size = 0;
+	for (RESOURCE &res : resources)
+		size += res.size;
+	out << "GPU resources alive" << (since ? " created since the checkpoint" : "") << ": " << resources.size() << " (" << size / 1024 << " kB)" << endl;
+	for (RESOURCE &res : resources)
+	{
+		out << "  " << getKindName(res.kind) << " " << res.id << ", " << res.owner;
+		if (res.width)
+			out << ": " << res.width << " x " << res.height << " x " << res.depth << ", format 0x" << std::hex << res.format << std::dec;
+		if (res.size)
+			out << ", " << res.size / 1024 << " kB";
+		out << endl;
+	}
+	return resources.size();
+}
+
+void C3dglResourceLedger::print(std::ostream &out)
+{
+	vector<USAGE> usage;
+	getUsage(usage);
+	out << "GPU resources: " << m_resources.size() << " alive, " << getMemory() / 1024 << " kB";
+	if (m_nUnknown)
+		out << ", " << m_nUnknown << " deletions of handles not in the ledger";
+	out << endl;
+	out << std::setw(10) << "kB" << std::setw(9) << "buffers" << std::setw(10) << "textures" << std::setw(8) << "rbos"
+		<< std::setw(8) << "fbos" << std::setw(8) << "vaos" << "  owner" << endl;
+	for (USAGE &u : usage)
+		out << std::setw(10) << u.size / 1024 << std::setw(9) << u.count[BUFFER] << std::setw(10) << u.count[TEXTURE] << std::setw(8) << u.count[RENDERBUFFER]
+			<< std::setw(8) << u.count[FRAMEBUFFER] << std::setw(8) << u.count[VERTEX_ARRAY] << "  " << u.owner << endl;
+}
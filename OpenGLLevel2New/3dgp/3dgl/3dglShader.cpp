@@ -1,8 +1,11 @@
 #include "../GL/glew.h"
 #include "../GL/3dglShader.h"
+#include "../GL/3dglResourceLedger.h"
 
 #include <fstream>
 #include <vector>
+#include <algorithm>
+#include <cstring>
 
 using namespace std;
 using namespace _3dgl;
@@ -156,6 +159,11 @@ std::string C3dglShader::getName()
 // C3dglProgram
 
 C3dglProgram *C3dglProgram::c_pCurrentProgram = NULL;
+std::map<std::string, GLuint> C3dglProgram::c_blockBindings;
+bool C3dglProgram::c_bUniformCache = true;
+bool C3dglProgram::c_bUniformVerify = false;
+unsigned C3dglProgram::c_nUniformsSent = 0;
+unsigned C3dglProgram::c_nUniformsElided = 0;
 
 C3dglProgram::C3dglProgram() : C3dglObject()
 {
@@ -211,6 +219,7 @@ bool C3dglProgram::Link(std::string std_attrib_names, std::string std_uni_names)
 	glGetProgramiv(GetId(), GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLen);
 	glGetProgramiv(GetId(), GL_ACTIVE_UNIFORMS, &nUniforms);
 	GLchar *buf = new GLchar[maxLen];
+	GLint maxLocation = -1;
 	for (int i = 0; i < nUniforms; ++i) 
 	{
 		GLsizei written;
@@ -220,6 +229,7 @@ bool C3dglProgram::Link(std::string std_attrib_names, std::string std_uni_names)
 		location = glGetUniformLocation(GetId(), buf);
 		string name = buf;
 		m_uniforms[name] = UNIFORM(location, m_types[type]);
+		maxLocation = std::max(maxLocation, location);
 
 		// special entry for arrays...
 		size_t nPos = name.find('[');
@@ -228,10 +238,41 @@ bool C3dglProgram::Link(std::string std_attrib_names, std::string std_uni_names)
 			string nameArray = name.substr(0, nPos);
 			location = glGetUniformLocation(GetId(), nameArray.c_str());
 			m_uniforms[nameArray] = UNIFORM(location, m_types[type]);
+
+			// ... and the locations of its elements
+			for (GLint j = 1; j < size; j++)
+				maxLocation = std::max(maxLocation, glGetUniformLocation(GetId(), (nameArray + "[" + to_string(j) + "]").c_str()));
 		}
 	}
 	delete[] buf;
 
+	// names by their hashes
+	m_hashed.clear();
+	for (auto &pair : m_uniforms)
+		if (!m_hashed.insert(make_pair(UniformHash(pair.first.c_str()), pair.second)).second)
+			logError("uniform name hash collision: " + pair.first);
+
+	// uniform cache: a slot for each location (uniforms in blocks have none); no values known yet
+	m_cache.assign(maxLocation + 1, UNIFORM_CACHE());
+	InvalidateUniformCache();
+
+	// bind the uniform blocks with registered binding points
+	GLint nBlocks = 0;
+	glGetProgramiv(GetId(), GL_ACTIVE_UNIFORM_BLOCKS, &nBlocks);
+	for (int i = 0; i < nBlocks; ++i)
+	{
+		GLchar name[256];
+		glGetActiveUniformBlockName(GetId(), i, sizeof(name), NULL, name);
+		auto it = c_blockBindings.find(name);
+		if (it == c_blockBindings.end())
+			logWarning("uniform block not bound: " + string(name));
+		else
+		{
+			glUniformBlockBinding(GetId(), i, it->second);
+			logSuccess("uniform block bound: " + string(name) + " = " + to_string(it->second));
+		}
+	}
+
 	//for (auto pair : m_uniforms)
 	//{
 	//	string name = pair.first;
@@ -330,6 +371,25 @@ bool C3dglProgram::Link(std::string std_attrib_names, std::string std_uni_names)
 	return logSuccess("linked successfully.");
 }
 
+bool C3dglProgram::BindUniformBlock(std::string name, GLuint binding)
+{
+	if (m_id == 0) return logError("not created.");
+	GLuint index = glGetUniformBlockIndex(m_id, name.c_str());
+	if (index == GL_INVALID_INDEX)
+	{
+		logWarning("uniform block not found: " + name);
+		return false;
+	}
+	glUniformBlockBinding(m_id, index, binding);
+	return logSuccess("uniform block bound: " + name + " = " + to_string(binding));
+}
+
+void C3dglProgram::InvalidateUniformCache()
+{
+	for (UNIFORM_CACHE &cache : m_cache)
+		cache.size = 0;
+}
+
 bool C3dglProgram::Use(bool bValidate)
 {
 	if (m_id == 0) return logError("not created.");
@@ -364,7 +424,23 @@ void C3dglProgram::GetAttribLocation(std::string idAttrib, GLuint &location)
 		location = i->second;
 }
 
-void C3dglProgram::GetUniformLocation(std::string idUniform, GLuint &location, GLenum &type, GLenum &targetType)
+void C3dglProgram::GetUniformLocation(UniformName idUniform, GLuint &location, GLenum &type, GLenum &targetType)
+{
+	// look up the hash of the name; names used for the first time are searched for and registered
+	auto i = m_hashed.find(idUniform.hash);
+	if (i == m_hashed.end())
+	{
+		UNIFORM uni;
+		_findUniform(idUniform.name, uni);
+		i = m_hashed.insert(make_pair(idUniform.hash, uni)).first;
+	}
+	UNIFORM &uni = i->second;
+	location = uni.location;
+	type = c_uniTypes[uni.type].glType;
+	targetType = c_uniTypes[uni.type].targetType;
+}
+
+void C3dglProgram::_findUniform(std::string idUniform, UNIFORM &uni)
 {
 	auto i = m_uniforms.find(idUniform);
 	
@@ -372,10 +448,7 @@ void C3dglProgram::GetUniformLocation(std::string idUniform, GLuint &location, G
 	if (i != m_uniforms.end())
 	{
 		// Uniform found
-		UNIFORM uni = (i->second);
-		location = uni.location;
-		type = c_uniTypes[uni.type].glType;
-		targetType = c_uniTypes[uni.type].targetType;
+		uni = i->second;
 		//printf(" %-20s | %s\n", idUniform.c_str(), c_uniTypes[uni.type].name.c_str());
 		return;
 	}
@@ -389,20 +462,18 @@ void C3dglProgram::GetUniformLocation(std::string idUniform, GLuint &location, G
 		if (i != m_uniforms.end())
 		{
 			// array located...
-			UNIFORM uni = (i->second);
+			uni = i->second;
 			uni.location = glGetUniformLocation(m_id, idUniform.c_str());
 			m_uniforms[idUniform] = uni;
-			type = c_uniTypes[uni.type].glType;
-			targetType = c_uniTypes[uni.type].targetType;
 			//printf(" %-20s | %s\n", idUniform.c_str(), c_uniTypes[uni.type].name.c_str());
 			return;
 		}
 	}
 
 	// if all else fails, process as unregistred variable
-	location = glGetUniformLocation(m_id, idUniform.c_str());
-	type = targetType = 0;
-	m_uniforms[idUniform] = UNIFORM(location, m_types[type]);
+	GLuint location = glGetUniformLocation(m_id, idUniform.c_str());
+	uni = UNIFORM(location, m_types[0]);
+	m_uniforms[idUniform] = uni;
 	if (location == (GLuint)-1) logWarning("uniform location not found: " + idUniform);
 	else logWarning("unregistered uniform used: " + idUniform);
 }
@@ -426,6 +497,64 @@ void C3dglProgram::GetUniformLocation(UNI_STD uniId, GLuint &location, GLenum &t
 	targetType = T.targetType;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Uniform cache
+
+bool C3dglProgram::_send(GLuint location, char kind, const void *p, GLsizei size, GLsizei count)
+{
+	if (!IsUsed()) Use();
+
+	if (!c_bUniformCache || location >= m_cache.size())
+	{
+		c_nUniformsSent++;
+		return true;
+	}
+
+	// arrays are not cached - the elements sent take the consecutive locations
+	if (count != 1)
+	{
+		for (GLuint i = location; i < location + count && i < m_cache.size(); i++)
+			m_cache[i].size = 0;
+		c_nUniformsSent++;
+		return true;
+	}
+
+	UNIFORM_CACHE &cache = m_cache[location];
+	if (cache.size == size && cache.kind == kind && memcmp(cache.data, p, size) == 0)
+	{
+		c_nUniformsElided++;
+		if (c_bUniformVerify) _verify(location, cache);
+		return false;
+	}
+
+	cache.kind = kind;
+	cache.size = size;
+	memcpy(cache.data, p, size);
+	c_nUniformsSent++;
+	return true;
+}
+
+void C3dglProgram::_verify(GLuint location, const UNIFORM_CACHE &cache)
+{
+	GLuint actual[16];
+	if (cache.kind == 'f' || cache.kind == 'm') glGetUniformfv(m_id, location, (GLfloat*)actual);
+	else if (cache.kind == 'u') glGetUniformuiv(m_id, location, actual);
+	else glGetUniformiv(m_id, location, (GLint*)actual);
+	if (memcmp(actual, cache.data, cache.size) == 0)
+		return;
+
+	string name = to_string(location);
+	for (auto &pair : m_uniforms)
+		if (pair.second.location == location)
+			name = pair.first;
+	string msg = "uniform cache out of sync: " + name;
+	if (m_errlookup.find(msg) == m_errlookup.end())
+	{
+		m_errlookup.insert(msg);
+		logError(msg);
+	}
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////
 // SendUniform and its overloads
 
@@ -454,275 +583,275 @@ bool C3dglProgram::_error(string name, GLenum actual, GLenum expected)
 	}
 }
 
-bool C3dglProgram::SendUniform(std::string name, GLint v0)
+bool C3dglProgram::SendUniform(UniformName name, GLint v0)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_INT || t == 0) SendUniform(location, (GLint)v0);
 	else if (t == GL_UNSIGNED_INT) SendUniform(location, (GLuint)v0);
 	else if (t == GL_BOOL) SendUniform(location, v0 != 0);
 	else if (t == GL_FLOAT) SendUniform(location, (GLfloat)v0);
-	else return _error(name, GL_INT, t);
+	else return _error(name.name, GL_INT, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform(std::string name, GLint v0, GLint v1)
+bool C3dglProgram::SendUniform(UniformName name, GLint v0, GLint v1)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_INT_VEC2 || t == 0) SendUniform(location, (GLint)v0, (GLint)v1);
 	else if (t == GL_UNSIGNED_INT_VEC2) SendUniform(location, (GLuint)v0, (GLuint)v1);
 	else if (t == GL_BOOL_VEC2) SendUniform(location, v0 != 0, v1 != 0);
 	else if (t == GL_FLOAT_VEC2) SendUniform(location, (GLfloat)v0, (GLfloat)v1);
-	else return _error(name, GL_INT_VEC2, t);
+	else return _error(name.name, GL_INT_VEC2, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform(std::string name, GLint v0, GLint v1, GLint v2)
+bool C3dglProgram::SendUniform(UniformName name, GLint v0, GLint v1, GLint v2)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_INT_VEC3 || t == 0) SendUniform(location, (GLint)v0, (GLint)v1, (GLint)v2);
 	else if (t == GL_UNSIGNED_INT_VEC3) SendUniform(location, (GLuint)v0, (GLuint)v1, (GLuint)v2);
 	else if (t == GL_BOOL_VEC3) SendUniform(location, v0 != 0, v1 != 0, v2 != 0);
 	else if (t == GL_FLOAT_VEC3) SendUniform(location, (GLfloat)v0, (GLfloat)v1, (GLfloat)v2);
-	else return _error(name, GL_INT_VEC3, t);
+	else return _error(name.name, GL_INT_VEC3, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform(std::string name, GLint v0, GLint v1, GLint v2, GLint v3)
+bool C3dglProgram::SendUniform(UniformName name, GLint v0, GLint v1, GLint v2, GLint v3)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_INT_VEC4 || t == 0) SendUniform(location, (GLint)v0, (GLint)v1, (GLint)v2, (GLint)v3);
 	else if (t == GL_UNSIGNED_INT_VEC4) SendUniform(location, (GLuint)v0, (GLuint)v1, (GLuint)v2, (GLuint)v3);
 	else if (t == GL_BOOL_VEC4) SendUniform(location, v0 != 0, v1 != 0, v2 != 0, v3 != 0);
 	else if (t == GL_FLOAT_VEC4) SendUniform(location, (GLfloat)v0, (GLfloat)v1, (GLfloat)v2, (GLfloat)v3);
-	else return _error(name, GL_INT_VEC4, t);
+	else return _error(name.name, GL_INT_VEC4, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform(std::string name, GLuint v0)
+bool C3dglProgram::SendUniform(UniformName name, GLuint v0)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_INT) SendUniform(location, (GLint)v0);
 	else if (t == GL_UNSIGNED_INT || t == 0) SendUniform(location, (GLuint)v0);
 	else if (t == GL_BOOL) SendUniform(location, v0 != 0);
 	else if (t == GL_FLOAT) SendUniform(location, (GLfloat)v0);
-	else return _error(name, GL_UNSIGNED_INT, t);
+	else return _error(name.name, GL_UNSIGNED_INT, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform(std::string name, GLuint v0, GLuint v1)
+bool C3dglProgram::SendUniform(UniformName name, GLuint v0, GLuint v1)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_INT_VEC2) SendUniform(location, (GLint)v0, (GLint)v1);
 	else if (t == GL_UNSIGNED_INT_VEC2 || t == 0) SendUniform(location, (GLuint)v0, (GLuint)v1);
 	else if (t == GL_BOOL_VEC2) SendUniform(location, v0 != 0, v1 != 0);
 	else if (t == GL_FLOAT_VEC2) SendUniform(location, (GLfloat)v0, (GLfloat)v1);
-	else return _error(name, GL_UNSIGNED_INT_VEC2, t);
+	else return _error(name.name, GL_UNSIGNED_INT_VEC2, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform(std::string name, GLuint v0, GLuint v1, GLuint v2)
+bool C3dglProgram::SendUniform(UniformName name, GLuint v0, GLuint v1, GLuint v2)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_INT_VEC3) SendUniform(location, (GLint)v0, (GLint)v1, (GLint)v2);
 	else if (t == GL_UNSIGNED_INT_VEC3 || t == 0) SendUniform(location, (GLuint)v0, (GLuint)v1, (GLuint)v2);
 	else if (t == GL_BOOL_VEC3) SendUniform(location, v0 != 0, v1 != 0, v2 != 0);
 	else if (t == GL_FLOAT_VEC3) SendUniform(location, (GLfloat)v0, (GLfloat)v1, (GLfloat)v2);
-	else return _error(name, GL_UNSIGNED_INT_VEC3, t);
+	else return _error(name.name, GL_UNSIGNED_INT_VEC3, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform(std::string name, GLuint v0, GLuint v1, GLuint v2, GLuint v3)
+bool C3dglProgram::SendUniform(UniformName name, GLuint v0, GLuint v1, GLuint v2, GLuint v3)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_INT_VEC4) SendUniform(location, (GLint)v0, (GLint)v1, (GLint)v2, (GLint)v3);
 	else if (t == GL_UNSIGNED_INT_VEC4 || t == 0) SendUniform(location, (GLuint)v0, (GLuint)v1, (GLuint)v2, (GLuint)v3);
 	else if (t == GL_BOOL_VEC4) SendUniform(location, v0 != 0, v1 != 0, v2 != 0, v3 != 0);
 	else if (t == GL_FLOAT_VEC4) SendUniform(location, (GLfloat)v0, (GLfloat)v1, (GLfloat)v2, (GLfloat)v3);
-	else return _error(name, GL_UNSIGNED_INT_VEC4, t);
+	else return _error(name.name, GL_UNSIGNED_INT_VEC4, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform(std::string name, GLfloat v0)
+bool C3dglProgram::SendUniform(UniformName name, GLfloat v0)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_FLOAT || t == 0) SendUniform(location, v0);
-	else return _error(name, GL_FLOAT, t);
+	else return _error(name.name, GL_FLOAT, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform(std::string name, GLfloat v0, GLfloat v1)
+bool C3dglProgram::SendUniform(UniformName name, GLfloat v0, GLfloat v1)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_FLOAT_VEC2 || t == 0) SendUniform(location, v0, v1);
-	else return _error(name, GL_FLOAT_VEC2, t);
+	else return _error(name.name, GL_FLOAT_VEC2, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform(std::string name, GLfloat v0, GLfloat v1, GLfloat v2)
+bool C3dglProgram::SendUniform(UniformName name, GLfloat v0, GLfloat v1, GLfloat v2)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_FLOAT_VEC3 || t == 0) SendUniform(location, v0, v1, v2);
-	else return _error(name, GL_FLOAT_VEC3, t);
+	else return _error(name.name, GL_FLOAT_VEC3, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform(std::string name, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3)
+bool C3dglProgram::SendUniform(UniformName name, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_FLOAT_VEC4 || t == 0) SendUniform(location, v0, v1, v2, v3);
-	else return _error(name, GL_FLOAT_VEC4, t);
+	else return _error(name.name, GL_FLOAT_VEC4, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform(std::string name, double v0)
+bool C3dglProgram::SendUniform(UniformName name, double v0)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_FLOAT || t == 0) SendUniform(location, v0);
-	else return _error(name, GL_FLOAT, t);
+	else return _error(name.name, GL_FLOAT, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform(std::string name, double v0, double v1)
+bool C3dglProgram::SendUniform(UniformName name, double v0, double v1)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_FLOAT_VEC2 || t == 0) SendUniform(location, v0, v1);
-	else return _error(name, GL_FLOAT_VEC2, t);
+	else return _error(name.name, GL_FLOAT_VEC2, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform(std::string name, double v0, double v1, double v2)
+bool C3dglProgram::SendUniform(UniformName name, double v0, double v1, double v2)
 { 
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);  
 	if (t == GL_FLOAT_VEC3 || t == 0) SendUniform(location, v0, v1, v2);
-	else return _error(name, GL_FLOAT_VEC3, t);
+	else return _error(name.name, GL_FLOAT_VEC3, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform(std::string name, double v0, double v1, double v2, double v3)
+bool C3dglProgram::SendUniform(UniformName name, double v0, double v1, double v2, double v3)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_FLOAT_VEC4 || t == 0) SendUniform(location, v0, v1, v2, v3);
-	else return _error(name, GL_FLOAT_VEC4, t);
+	else return _error(name.name, GL_FLOAT_VEC4, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform(std::string name, GLfloat pMatrix[16])
+bool C3dglProgram::SendUniform(UniformName name, GLfloat pMatrix[16])
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_FLOAT_MAT4 || t == 0) SendUniform(location, pMatrix);
-	else return _error(name, GL_FLOAT_MAT4, t);
+	else return _error(name.name, GL_FLOAT_MAT4, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform(std::string name, glm::mat4 matrix)
+bool C3dglProgram::SendUniform(UniformName name, glm::mat4 matrix)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_FLOAT_MAT4 || t == 0) SendUniform(location, matrix);
-	else return _error(name, GL_FLOAT_MAT4, t);
+	else return _error(name.name, GL_FLOAT_MAT4, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform1v(std::string name, GLint *p, GLuint count) 
+bool C3dglProgram::SendUniform1v(UniformName name, GLint *p, GLuint count) 
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_INT || t == 0) SendUniform1v(location, p, count);
-	else return _error(name, GL_INT, t);
+	else return _error(name.name, GL_INT, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform2v(std::string name, GLint *p, GLuint count)
+bool C3dglProgram::SendUniform2v(UniformName name, GLint *p, GLuint count)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_INT_VEC2 || t == 0) SendUniform2v(location, p, count);
-	else return _error(name, GL_INT_VEC2, t);
+	else return _error(name.name, GL_INT_VEC2, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform3v(std::string name, GLint *p, GLuint count)
+bool C3dglProgram::SendUniform3v(UniformName name, GLint *p, GLuint count)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_INT_VEC3 || t == 0) SendUniform3v(location, p, count);
-	else return _error(name, GL_INT_VEC3, t);
+	else return _error(name.name, GL_INT_VEC3, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform4v(std::string name, GLint *p, GLuint count)
+bool C3dglProgram::SendUniform4v(UniformName name, GLint *p, GLuint count)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_INT_VEC4 || t == 0) SendUniform4v(location, p, count);
-	else return _error(name, GL_INT_VEC4, t);
+	else return _error(name.name, GL_INT_VEC4, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform1v(std::string name, GLuint *p, GLuint count)
+bool C3dglProgram::SendUniform1v(UniformName name, GLuint *p, GLuint count)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_UNSIGNED_INT || t == 0) SendUniform1v(location, p, count);
-	else return _error(name, GL_UNSIGNED_INT, t);
+	else return _error(name.name, GL_UNSIGNED_INT, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform2v(std::string name, GLuint *p, GLuint count)
+bool C3dglProgram::SendUniform2v(UniformName name, GLuint *p, GLuint count)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_UNSIGNED_INT_VEC2 || t == 0) SendUniform2v(location, p, count);
-	else return _error(name, GL_UNSIGNED_INT_VEC2, t);
+	else return _error(name.name, GL_UNSIGNED_INT_VEC2, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform3v(std::string name, GLuint *p, GLuint count)
+bool C3dglProgram::SendUniform3v(UniformName name, GLuint *p, GLuint count)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_UNSIGNED_INT_VEC3 || t == 0) SendUniform3v(location, p, count);
-	else return _error(name, GL_UNSIGNED_INT_VEC3, t);
+	else return _error(name.name, GL_UNSIGNED_INT_VEC3, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform4v(std::string name, GLuint *p, GLuint count)
+bool C3dglProgram::SendUniform4v(UniformName name, GLuint *p, GLuint count)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_UNSIGNED_INT_VEC4 || t == 0) SendUniform4v(location, p, count);
-	else return _error(name, GL_UNSIGNED_INT_VEC4, t);
+	else return _error(name.name, GL_UNSIGNED_INT_VEC4, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform1v(std::string name, GLfloat *p, GLuint count)
+bool C3dglProgram::SendUniform1v(UniformName name, GLfloat *p, GLuint count)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_FLOAT || t == 0) SendUniform1v(location, p, count);
-	else return _error(name, GL_FLOAT, t);
+	else return _error(name.name, GL_FLOAT, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform2v(std::string name, GLfloat *p, GLuint count)
+bool C3dglProgram::SendUniform2v(UniformName name, GLfloat *p, GLuint count)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_FLOAT_VEC2 || t == 0) SendUniform2v(location, p, count);
-	else return _error(name, GL_FLOAT_VEC2, t);
+	else return _error(name.name, GL_FLOAT_VEC2, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform3v(std::string name, GLfloat *p, GLuint count)
+bool C3dglProgram::SendUniform3v(UniformName name, GLfloat *p, GLuint count)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_FLOAT_VEC3 || t == 0) SendUniform3v(location, p, count);
-	else return _error(name, GL_FLOAT_VEC3, t);
+	else return _error(name.name, GL_FLOAT_VEC3, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniform4v(std::string name, GLfloat *p, GLuint count)
+bool C3dglProgram::SendUniform4v(UniformName name, GLfloat *p, GLuint count)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_FLOAT_VEC4 || t == 0) SendUniform4v(location, p, count);
-	else return _error(name, GL_FLOAT_VEC4, t);
+	else return _error(name.name, GL_FLOAT_VEC4, t);
 	return true;
 }
 
-bool C3dglProgram::SendUniformMatrixv(std::string name, GLfloat *pMatrix, GLuint count)
+bool C3dglProgram::SendUniformMatrixv(UniformName name, GLfloat *pMatrix, GLuint count)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
 	if (t == GL_FLOAT_MAT4 || t == 0) SendUniformMatrixv(location, pMatrix, count);
-	else return _error(name, GL_FLOAT_MAT4, t);
+	else return _error(name.name, GL_FLOAT_MAT4, t);
 	return true;
 }
 
@@ -761,3 +890,38 @@ bool C3dglProgram::SendStandardUniform(enum UNI_STD loc, glm::mat4 matrix)
 	return true;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// C3dglUniformBuffer
+
+bool C3dglUniformBuffer::Create(std::string blockName, GLuint binding, GLsizeiptr size)
+{
+	Destroy();
+	C3dglResourceLedger::OWNER owner(getName() + " (" + blockName + ")");
+	glGenBuffers(1, &m_id);
+	if (m_id == 0) return logError("creation error.");
+	m_binding = binding;
+	m_size = size;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, m_id);
+	glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, binding, m_id);
+
+	// programs linked from now on bind the block to this buffer
+	C3dglProgram::SetUniformBlockBinding(blockName, binding);
+	return logSuccess("created for " + blockName + " at binding point " + to_string(binding));
+}
+
+void C3dglUniformBuffer::Update(const void *pData, GLsizeiptr size, GLintptr offset)
+{
+	if (m_id == 0) return;
+	glBindBuffer(GL_UNIFORM_BUFFER, m_id);
+	glBufferSubData(GL_UNIFORM_BUFFER, offset, size, pData);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void C3dglUniformBuffer::Destroy()
+{
+	if (m_id) glDeleteBuffers(1, &m_id);
+	m_id = 0;
+}
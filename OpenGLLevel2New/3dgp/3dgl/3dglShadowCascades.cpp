@@ -0,0 +1,80 @@
+#include <cmath>
+
+#include "../GL/3dglShadowCascades.h"
+#include "../glm/gtc/matrix_transform.hpp"
+
+using namespace _3dgl;
+
+C3dglShadowCascades::C3dglShadowCascades()
+{
+	m_nCascades = 3;
+	m_nResolution = 1024;
+	m_fShadowDistance = 200;
+	m_fLambda = 0.75f;
+	m_fCasterDistance = 100;
+	setLightDirection(glm::vec3(0, -1, 0));
+	for (int i = 0; i < MAX_CASCADES; i++)
+	{
+		m_projection[i] = glm::mat4(1);
+		m_splits[i] = 0;
+	}
+}
+
+void C3dglShadowCascades::setLightDirection(glm::vec3 dir)
+{
+	m_lightDir = glm::normalize(dir);
+	glm::vec3 up = fabs(m_lightDir.y) > 0.99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+	m_view = glm::lookAt(glm::vec3(0), m_lightDir, up);
+}
+
+void C3dglShadowCascades::update(const glm::mat4 &matrixView, float fov, float aspect, float zNear, float zFar)
+{
+	float range = zFar < m_fShadowDistance ? zFar : m_fShadowDistance;
+	float tanY = tan(fov / 2), tanX = tanY * aspect;
+	glm::mat4 toLight = m_view * glm::inverse(matrixView);
+
+	float from = zNear;
+	for (int i = 0; i < m_nCascades; i++)
+	{
+		// split distance: a blend of the logarithmic and the uniform scheme
+		float f = (float)(i + 1) / m_nCascades;
+		float to = m_fLambda * zNear * pow(range / zNear, f) + (1 - m_fLambda) * (zNear + (range - zNear) * f);
+		m_splits[i] = to;
+
+		// bounding sphere of the slice of the frustum - its size does not change when the camera turns
+		glm::vec3 corners[8];
+		glm::vec3 centre(0);
+		for (int j = 0; j < 8; j++)
+		{
+			float d = (j & 4) ? to : from;
+			corners[j] = glm::vec3((j & 1 ? 1 : -1) * tanX * d, (j & 2 ? 1 : -1) * tanY * d, -d);
+			centre += corners[j] / 8.0f;
+		}
+		float radius = 0;
+		for (int j = 0; j < 8; j++)
+			radius = glm::max(radius, glm::length(corners[j] - centre));
+		radius = ceil(radius);
+
+		// centre in the light space, moved in whole texels
+		glm::vec3 c = glm::vec3(toLight * glm::vec4(centre, 1));
+		float texel = 2 * radius / m_nResolution;
+		c.x = floor(c.x / texel) * texel;
+		c.y = floor(c.y / texel) * texel;
+
+		m_projection[i] = glm::ortho(c.x - radius, c.x + radius, c.y - radius, c.y + radius,
+			-c.z - radius - m_fCasterDistance, -c.z + radius);
+		from = to;
+	}
+}
+
+glm::mat4 C3dglShadowCascades::getShadowMatrix(int i)
+{
+	// from [-1, 1] to [0, 1]
+	const glm::mat4 bias = {
+		{ 0.5, 0.0, 0.0, 0.0 },
+		{ 0.0, 0.5, 0.0, 0.0 },
+		{ 0.0, 0.0, 0.5, 0.0 },
+		{ 0.5, 0.5, 0.5, 1.0 }
+	};
+	return bias * m_projection[i] * m_view;
+}
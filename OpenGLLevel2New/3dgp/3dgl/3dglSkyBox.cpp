@@ -2,17 +2,23 @@
 #include "../GL/3dglShader.h"
 #include "../GL/3dglBitmap.h"
 #include "../GL/3dglSkyBox.h"
+#include "../GL/3dglCallStats.h"
+#include "../GL/3dglResourceLedger.h"
 
 using namespace _3dgl;
 using namespace std;
 
 C3dglSkyBox::C3dglSkyBox()
 {
+	for (unsigned &idTex : m_idTex)
+		idTex = 0;
+	m_vertexBuffer = m_normalBuffer = m_texCoordBuffer = 0;
 }
 
 bool C3dglSkyBox::load(const char* pFd, const char* pRt, const char* pBk, const char* pLt, const char* pUp, const char* pDn) 
 {
-	glGenTextures(6, m_idTex);
+	destroy();
+	C3dglResourceLedger::OWNER owner("Sky Box");
 
 	// load six textures
 	glActiveTexture(GL_TEXTURE0);
@@ -20,13 +26,13 @@ bool C3dglSkyBox::load(const char* pFd, const char* pRt, const char* pBk, const
 	for (int i = 0; i < 6; ++i)
 	{
 		C3dglBitmap bm(pFilenames[i], GL_RGBA);
-		glGenTextures(1, &m_idTex[i]);
+		C3dglResourceLedger::genTextures(1, &m_idTex[i]);
 		glBindTexture(GL_TEXTURE_2D, m_idTex[i]);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), abs(bm.GetHeight()), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
+		C3dglCallStats::texImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), abs(bm.GetHeight()), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
 	}
 
 	float vertices[] = 
@@ -111,8 +117,8 @@ void C3dglSkyBox::render(glm::mat4 matrix)
 	glActiveTexture(GL_TEXTURE0);
 	for (int i = 0; i < 6; ++i)
 	{
-		glBindTexture(GL_TEXTURE_2D, m_idTex[i]);
-		glDrawArrays(GL_TRIANGLE_FAN, i * 4, 4);
+		C3dglCallStats::bindTexture(GL_TEXTURE_2D, m_idTex[i]);
+		C3dglCallStats::drawArrays(GL_TRIANGLE_FAN, i * 4, 4);
 	}
 
 	glDisableVertexAttribArray(attribVertex);
@@ -129,3 +135,17 @@ void C3dglSkyBox::render()
 	glGetFloatv(GL_MODELVIEW_MATRIX, (GLfloat*)&m);
 	render(m);
 }
+
+void C3dglSkyBox::destroy()
+{
+	for (unsigned &idTex : m_idTex)
+	{
+		if (idTex) C3dglResourceLedger::deleteTextures(1, &idTex);
+		idTex = 0;
+	}
+	for (unsigned *pBuffer : { &m_vertexBuffer, &m_normalBuffer, &m_texCoordBuffer })
+	{
+		if (*pBuffer) glDeleteBuffers(1, pBuffer);
+		*pBuffer = 0;
+	}
+}
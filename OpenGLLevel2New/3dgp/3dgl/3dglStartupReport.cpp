@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#include <psapi.h>
+#pragma comment (lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+#include "../GL/3dglStartupReport.h"
+
+using std::vector;
+using std::string;
+using std::endl;
+using namespace _3dgl;
+
+C3dglStartupReport::C3dglStartupReport()
+{
+	m_bStarted = m_bStep = false;
+	m_readStart = m_uploadStart = 0;
+	m_totalTime = 0;
+}
+
+unsigned long long C3dglStartupReport::getBytesRead()
+{
+#ifdef _WIN32
+	IO_COUNTERS io;
+	if (GetProcessIoCounters(GetCurrentProcess(), &io))
+		return io.ReadTransferCount;
+	return 0;
+#else
+	// characters read by the process, cached or not
+	std::ifstream file("/proc/self/io");
+	string key;
+	unsigned long long value;
+	while (file >> key >> value)
+		if (key == "rchar:")
+			return value;
+	return 0;
+#endif
+}
+
+unsigned long long C3dglStartupReport::getPeakMemory()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize;
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		return (unsigned long long)usage.ru_maxrss * 1024;
+	return 0;
+#endif
+}
+
+unsigned long long C3dglStartupReport::getUploaded()
+{
+	C3dglCallStats *pStats = C3dglCallStats::getCurrent();
+	return pStats ? pStats->getCounters().uploadBytes : 0;
+}
+
+void C3dglStartupReport::start()
+{
+	m_steps.clear();
+	m_bStarted = true;
+	m_bStep = false;
+	m_totalTime = 0;
+	if (!C3dglCallStats::getCurrent())
+		m_callStats.install();
+	m_start = CLOCK::now();
+}
+
+void C3dglStartupReport::endStep()
+{
+	if (!m_bStep)
+		return;
+	STEP &step = m_steps.back();
+	step.time = std::chrono::duration<double, std::milli>(CLOCK::now() - m_stepStart).count();
+	step.bytesRead = getBytesRead() - m_readStart;
+	step.bytesUploaded = getUploaded() - m_uploadStart;
+	step.peakMemory = getPeakMemory();
+	m_bStep = false;
+}
+
+void C3dglStartupReport::step(const string &name, const string &category)
+{
+	if (!m_bStarted)
+		start();
+	endStep();
+	STEP step = { name, category, 0, 0, 0, 0 };
+	m_steps.push_back(step);
+	m_readStart = getBytesRead();
+	m_uploadStart = getUploaded();
+	m_bStep = true;
+	m_stepStart = CLOCK::now();
+}
+
+void C3dglStartupReport::finish()
+{
+	if (!m_bStarted)
+		return;
+	endStep();
+	m_totalTime = std::chrono::duration<double, std::milli>(CLOCK::now() - m_start).count();
+	m_callStats.uninstall();
+	m_bStarted = false;
+}
+
+void C3dglStartupReport::print(std::ostream &out)
+{
+	unsigned long long read = 0, uploaded = 0, peak = 0;
+	for (STEP &step : m_steps)
+	{
+		read += step.bytesRead;
+		uploaded += step.bytesUploaded;
+		peak = std::max(peak, step.peakMemory);
+	}
+
+	vector<STEP> steps = m_steps;
+	std::stable_sort(steps.begin(), steps.end(), [](const STEP &a, const STEP &b) { return a.time > b.time; });
+
+	std::ios::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+	out << std::fixed << std::setprecision(1);
+	out << "Startup: " << m_totalTime << " ms, " << read / 1024 << " kB read, " << uploaded / 1024 << " kB uploaded, peak memory " << peak / (1024 * 1024) << " MB" << endl;
+	out << std::setw(10) << "ms" << std::setw(6) << "%" << std::setw(12) << "kB read" << std::setw(12) << "kB uploaded" << std::setw(10) << "peak MB" << "  " << std::left << std::setw(10) << "category" << "step" << std::right << endl;
+	for (STEP &step : steps)
+		out << std::setw(10) << step.time << std::setw(6) << (m_totalTime > 0 ? 100 * step.time / m_totalTime : 0)
+			<< std::setw(12) << step.bytesRead / 1024 << std::setw(12) << step.bytesUploaded / 1024 << std::setw(10) << step.peakMemory / (1024 * 1024)
+			<< "  " << std::left << std::setw(10) << step.category << step.name << std::right << endl;
+	out.flags(flags);
+	out.precision(precision);
+}
+
+// JSON string: quoted, with the quotes, backslashes and control characters escaped
+static string jsonString(const string &str)
+{
+	string s = "\"";
+	for (char c : str)
+		if (c == '"' || c == '\\')
+			s += string("\\") + c;
+		else if ((unsigned char)c < 0x20)
+			s += ' ';
+		else
+			s += c;
+	return s + "\"";
+}
+
+bool C3dglStartupReport::exportJSON(const string &filename)
+{
+	std::ofstream file(filename.c_str());
+	if (!file)
+		return logError("cannot write " + filename);
+
+	file << std::fixed << std::setprecision(3);
+	file << "{" << endl;
+	file << "  \"total_ms\": " << m_totalTime << "," << endl;
+	file << "  \"steps\": [" << endl;
+	for (size_t i = 0; i < m_steps.size(); i++)
+	{
+		STEP &step = m_steps[i];
+		file << "    { \"name\": " << jsonString(step.name) << ", \"category\": " << jsonString(step.category) << ", \"ms\": " << step.time
+			<< ", \"bytes_read\": " << step.bytesRead << ", \"bytes_uploaded\": " << step.bytesUploaded << ", \"peak_memory\": " << step.peakMemory
+			<< " }" << (i + 1 < m_steps.size() ? "," : "") << endl;
+	}
+	file << "  ]" << endl;
+	file << "}" << endl;
+	return true;
+}
@@ -0,0 +1,550 @@
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+
+#define NOMINMAX
+#include <Windows.h>
+#include "../GL/glew.h"
+#include "../GL/3dglShader.h"
+#include "../GL/3dglStreamingTerrain.h"
+#include "../GL/3dglTerrain.h"
+#include "../GL/3dglCallStats.h"
+#include "../GL/3dglResourceLedger.h"
+
+using std::vector;
+using namespace _3dgl;
+
+// vertex layout: position (3), normal (3), tex coord (2)
+static const int VERTEX_FLOATS = 8;
+
+C3dglStreamingTerrain::C3dglStreamingTerrain()
+{
+	memset(&m_header, 0, sizeof(m_header));
+	m_pSamples = NULL;
+	m_nTilesX = m_nTilesZ = 0;
+	m_nTileBytes = 0;
+	m_bQuit = m_bBusy = false;
+	m_fRadius = 1024;
+	m_nBudget = 256 * 1024 * 1024;
+	m_nMaxUploads = 4;
+	m_indexBuffer = m_nIndices = 0;
+	m_nLoaded = m_nEvicted = m_nUploaded = m_nTilesDrawn = 0;
+	m_nPeakBytes = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Tiled Height Field Files
+
+static int tileCount(unsigned size, unsigned tileSize)
+{
+	return std::max(1, (int)((size - 1 + tileSize - 1) / tileSize));
+}
+
+// writes the header and the tiles; sample(x, z) returns 16-bit heights for x < sizeX, z < sizeZ
+template <class F>
+static bool writeTiles(const std::string filename, unsigned sizeX, unsigned sizeZ, unsigned tileSize, float scaleHeight, F sample)
+{
+	std::ofstream file(filename, std::ios::out | std::ios::binary);
+	if (!file)
+		return false;
+
+	C3dglStreamingTerrain::HEADER header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "3DTH", 4);
+	header.version = 1;
+	header.sizeX = sizeX;
+	header.sizeZ = sizeZ;
+	header.tileSize = tileSize;
+	header.scaleHeight = scaleHeight;
+	file.write((const char*)&header, sizeof(header));
+
+	// tiles overlap by one sample; samples past the edge of the map are clamped
+	int nTilesX = tileCount(sizeX, tileSize), nTilesZ = tileCount(sizeZ, tileSize);
+	vector<unsigned short> tile((tileSize + 1) * (tileSize + 1));
+	for (int tx = 0; tx < nTilesX; tx++)
+		for (int tz = 0; tz < nTilesZ; tz++)
+		{
+			unsigned short *p = &tile[0];
+			for (unsigned lx = 0; lx <= tileSize; lx++)
+			{
+				unsigned x = std::min(tx * tileSize + lx, sizeX - 1);
+				for (unsigned lz = 0; lz <= tileSize; lz++)
+					*p++ = sample(x, std::min(tz * tileSize + lz, sizeZ - 1));
+			}
+			file.write((const char*)&tile[0], tile.size() * sizeof(unsigned short));
+		}
+	return file.good();
+}
+
+bool C3dglStreamingTerrain::createSynthetic(const std::string filename, unsigned sizeX, unsigned sizeZ, unsigned tileSize, float scaleHeight)
+{
+	if (sizeX < 2 || sizeZ < 2 || tileSize < 1)
+		return false;
+
+	// a few overlapping waves, from lookup tables along each axis
+	const float freq[3][2] = { { 0.0031f, 0.0027f }, { 0.017f, 0.013f }, { 0.071f, 0.053f } };
+	const float amp[3] = { 0.3f, 0.12f, 0.03f };
+	vector<float> wx[3], wz[3];
+	for (int k = 0; k < 3; k++)
+	{
+		wx[k].resize(sizeX);
+		wz[k].resize(sizeZ);
+		for (unsigned x = 0; x < sizeX; x++) wx[k][x] = amp[k] * std::sin(x * freq[k][0]);
+		for (unsigned z = 0; z < sizeZ; z++) wz[k][z] = std::cos(z * freq[k][1]);
+	}
+
+	return writeTiles(filename, sizeX, sizeZ, tileSize, scaleHeight, [&](unsigned x, unsigned z) -> unsigned short
+	{
+		float f = 0.5f + wx[0][x] * wz[0][z] + wx[1][x] * wz[1][z] + wx[2][x] * wz[2][z];
+		return (unsigned short)(std::min(std::max(f, 0.f), 1.f) * 65535);
+	});
+}
+
+bool C3dglStreamingTerrain::createFromRAW(const std::string rawFilename, unsigned sizeX, unsigned sizeZ, float scaleHeight, const std::string filename, unsigned tileSize)
+{
+	// 8-bit samples, x-major, as written by C3dglTerrain::storeAsRAW
+	C3dglMappedFile raw;
+	if (!raw.open(rawFilename))
+		return false;
+	if (sizeX < 2 || sizeZ < 2 || tileSize < 1 || raw.getSize() < (size_t)sizeX * sizeZ)
+		return false;
+	const unsigned char *pRaw = (const unsigned char*)raw.getData();
+
+	// the 8-bit value v is stored as v * 256, so that heights are preserved exactly
+	return writeTiles(filename, sizeX, sizeZ, tileSize, scaleHeight * 65535 / 65536, [&](unsigned x, unsigned z) -> unsigned short
+	{
+		return (unsigned short)(pRaw[(size_t)x * sizeZ + z] << 8);
+	});
+}
+
+bool C3dglStreamingTerrain::open(const std::string filename)
+{
+	close();
+	if (!m_file.open(filename))
+		return false;
+
+	if (m_file.getSize() < sizeof(HEADER))
+		return logError(filename + " is not a tiled height field");
+	memcpy(&m_header, m_file.getData(), sizeof(HEADER));
+	if (memcmp(m_header.magic, "3DTH", 4) != 0 || m_header.version != 1 || m_header.sizeX < 2 || m_header.sizeZ < 2 || m_header.tileSize < 1)
+	{
+		m_file.close();
+		return logError(filename + " is not a tiled height field");
+	}
+
+	m_nTilesX = tileCount(m_header.sizeX, m_header.tileSize);
+	m_nTilesZ = tileCount(m_header.sizeZ, m_header.tileSize);
+	size_t nTileSamples = (size_t)(m_header.tileSize + 1) * (m_header.tileSize + 1);
+	if (m_file.getSize() < sizeof(HEADER) + (size_t)m_nTilesX * m_nTilesZ * nTileSamples * sizeof(unsigned short))
+	{
+		m_file.close();
+		return logError(filename + " is truncated");
+	}
+	m_pSamples = (const unsigned short*)((const char*)m_file.getData() + sizeof(HEADER));
+	m_nTileBytes = nTileSamples * VERTEX_FLOATS * sizeof(float);
+
+	m_nLoaded = m_nEvicted = m_nUploaded = m_nTilesDrawn = 0;
+	m_nPeakBytes = 0;
+	m_bQuit = false;
+	m_thread = std::thread(&C3dglStreamingTerrain::loaderThread, this);
+
+	return logSuccess("opened " + filename + ": " + std::to_string(m_header.sizeX) + " x " + std::to_string(m_header.sizeZ)
+		+ ", " + std::to_string(m_nTilesX * m_nTilesZ) + " tiles");
+}
+
+void C3dglStreamingTerrain::close()
+{
+	if (m_thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_bQuit = true;
+		}
+		m_cv.notify_all();
+		m_thread.join();
+	}
+	m_queue.clear();
+	m_results.clear();
+
+	while (!m_tiles.empty())
+		evict(m_tiles.begin());
+	if (m_indexBuffer)
+		glDeleteBuffers(1, &m_indexBuffer);
+	m_indexBuffer = m_nIndices = 0;
+
+	m_file.close();
+	m_pSamples = NULL;
+	m_nTilesX = m_nTilesZ = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Height Map
+
+float C3dglStreamingTerrain::sample(int x, int z)
+{
+	x = std::min(std::max(x, 0), (int)m_header.sizeX - 1);
+	z = std::min(std::max(z, 0), (int)m_header.sizeZ - 1);
+	int T = m_header.tileSize;
+	int tx = std::min(x / T, m_nTilesX - 1), tz = std::min(z / T, m_nTilesZ - 1);
+	size_t iTile = (size_t)tx * m_nTilesZ + tz;
+	size_t iSample = iTile * (T + 1) * (T + 1) + (x - tx * T) * (T + 1) + (z - tz * T);
+	return m_pSamples[iSample] * m_header.scaleHeight / 65535;
+}
+
+float C3dglStreamingTerrain::getHeight(int x, int z)
+{
+	if (!m_pSamples) return 0;
+	x += m_header.sizeX / 2;
+	z += m_header.sizeZ / 2;
+	if (x < 0 || x >= (int)m_header.sizeX) return 0;
+	if (z < 0 || z >= (int)m_header.sizeZ) return 0;
+	return sample(x, z);
+}
+
+float C3dglStreamingTerrain::getInterpolatedHeight(float fx, float fz)
+{
+	int x = (int)floor(fx);
+	int z = (int)floor(fz);
+	fx -= x;
+	fz -= z;
+	if (fx + fz < 1)
+	{
+		float h = getHeight(x, z);
+		return h + fx * (getHeight(x + 1, z) - h) + fz * (getHeight(x, z + 1) - h);
+	}
+	else
+	{
+		float h = getHeight(x + 1, z + 1);
+		return h + (1 - fx) * (getHeight(x, z + 1) - h) + (1 - fz) * (getHeight(x + 1, z) - h);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Background Loader
+
+void C3dglStreamingTerrain::loaderThread()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;)
+	{
+		m_cv.wait(lock, [this] { return m_bQuit || !m_queue.empty(); });
+		if (m_bQuit)
+			return;
+
+		// the nearest tile first
+		RESULT result;
+		result.key = m_queue.front();
+		m_queue.pop_front();
+		m_bBusy = true;
+
+		lock.unlock();
+		loadTile(result.key, result);
+		lock.lock();
+
+		m_results.push_back(std::move(result));
+		m_bBusy = false;
+		m_cv.notify_all();
+	}
+}
+
+// reads the tile samples (paged in from the mapped file) and builds its vertices
+void C3dglStreamingTerrain::loadTile(int key, RESULT &result)
+{
+	int T = m_header.tileSize;
+	int tx = key / m_nTilesZ, tz = key % m_nTilesZ;
+	int minx = -(int)m_header.sizeX / 2, minz = -(int)m_header.sizeZ / 2;
+	int maxx = m_header.sizeX - 1, maxz = m_header.sizeZ - 1;
+
+	result.vertices.resize((T + 1) * (T + 1) * VERTEX_FLOATS);
+	float *p = &result.vertices[0];
+	float miny = FLT_MAX, maxy = -FLT_MAX;
+	for (int lx = 0; lx <= T; lx++)
+		for (int lz = 0; lz <= T; lz++)
+		{
+			// the last tiles are clamped to the edge of the map
+			int x = std::min(tx * T + lx, maxx), z = std::min(tz * T + lz, maxz);
+			float h = sample(x, z);
+			miny = std::min(miny, h);
+			maxy = std::max(maxy, h);
+
+			*p++ = (float)(minx + x);
+			*p++ = h;
+			*p++ = (float)(minz + z);
+
+			// normal vector - central differences across the tile borders, one-sided at the
+			// edges of the map (sample clamps), as C3dglTerrain
+			C3dglTerrain::computeNormal(sample(x + 1, z) - sample(x - 1, z), sample(x, z + 1) - sample(x, z - 1), p);
+			p += 3;
+			*p++ = (float)(minx + x) / 2.f;
+			*p++ = (float)(minz + z) / 2.f;
+		}
+
+	result.bb[0][0] = (float)(minx + tx * T);
+	result.bb[0][1] = miny;
+	result.bb[0][2] = (float)(minz + tz * T);
+	result.bb[1][0] = (float)(minx + std::min(tx * T + T, maxx));
+	result.bb[1][1] = maxy;
+	result.bb[1][2] = (float)(minz + std::min(tz * T + T, maxz));
+}
+
+// moves the tiles decoded by the loader into the tile map
+void C3dglStreamingTerrain::collect()
+{
+	vector<RESULT> results;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		results.swap(m_results);
+	}
+	for (RESULT &result : results)
+	{
+		// tiles evicted in the meantime are discarded
+		auto i = m_tiles.find(result.key);
+		if (i == m_tiles.end() || i->second.state != QUEUED)
+			continue;
+		TILE &tile = i->second;
+		memcpy(tile.bb, result.bb, sizeof(tile.bb));
+		tile.vertices.swap(result.vertices);
+		tile.state = READY;
+		m_nLoaded++;
+	}
+}
+
+void C3dglStreamingTerrain::flush()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cv.wait(lock, [this] { return m_queue.empty() && !m_bBusy; });
+	}
+	collect();
+}
+
+unsigned C3dglStreamingTerrain::getQueuedTiles()
+{
+	unsigned n = 0;
+	for (auto &i : m_tiles)
+		if (i.second.state == QUEUED)
+			n++;
+	return n;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Residency
+
+void C3dglStreamingTerrain::evict(std::map<int, TILE>::iterator i)
+{
+	if (i->second.vertexBuffer)
+		glDeleteBuffers(1, &i->second.vertexBuffer);
+	m_tiles.erase(i);
+	m_nEvicted++;
+}
+
+void C3dglStreamingTerrain::update(glm::vec3 eye)
+{
+	if (!m_pSamples)
+		return;
+	collect();
+
+	int T = m_header.tileSize;
+	float minx = (float)(-(int)m_header.sizeX / 2), minz = (float)(-(int)m_header.sizeZ / 2);
+
+	// horizontal distance from the eye to the tile
+	auto distance = [&](int tx, int tz) -> float
+	{
+		float x0 = minx + tx * T, z0 = minz + tz * T;
+		float dx = std::max(std::max(x0 - eye.x, eye.x - x0 - T), 0.f);
+		float dz = std::max(std::max(z0 - eye.z, eye.z - z0 - T), 0.f);
+		return std::sqrt(dx * dx + dz * dz);
+	};
+
+	// evict the tiles well beyond the resident radius (with some hysteresis)
+	for (auto i = m_tiles.begin(); i != m_tiles.end(); )
+	{
+		i->second.distance = distance(i->first / m_nTilesZ, i->first % m_nTilesZ);
+		if (i->second.distance > m_fRadius * 1.25f)
+			evict(i++);
+		else
+			++i;
+	}
+
+	// tiles within the resident radius, nearest first
+	vector<std::pair<float, int> > wanted;
+	int tx0 = std::max(0, (int)floor((eye.x - m_fRadius - minx) / T)), tx1 = std::min(m_nTilesX - 1, (int)floor((eye.x + m_fRadius - minx) / T));
+	int tz0 = std::max(0, (int)floor((eye.z - m_fRadius - minz) / T)), tz1 = std::min(m_nTilesZ - 1, (int)floor((eye.z + m_fRadius - minz) / T));
+	for (int tx = tx0; tx <= tx1; tx++)
+		for (int tz = tz0; tz <= tz1; tz++)
+		{
+			float d = distance(tx, tz);
+			if (d <= m_fRadius)
+				wanted.push_back(std::make_pair(d, tx * m_nTilesZ + tz));
+		}
+	std::sort(wanted.begin(), wanted.end());
+
+	// request the missing tiles; within the budget, a tile may only displace a farther one
+	for (auto &w : wanted)
+	{
+		if (m_tiles.count(w.second))
+			continue;
+		if ((m_tiles.size() + 1) * m_nTileBytes > m_nBudget)
+		{
+			auto farthest = m_tiles.end();
+			for (auto i = m_tiles.begin(); i != m_tiles.end(); ++i)
+				if (i->second.distance > w.first && (farthest == m_tiles.end() || i->second.distance > farthest->second.distance))
+					farthest = i;
+			if (farthest == m_tiles.end())
+				break;
+			evict(farthest);
+		}
+		TILE &tile = m_tiles[w.second];
+		tile.state = QUEUED;
+		memset(tile.bb, 0, sizeof(tile.bb));
+		tile.vertexBuffer = 0;
+		tile.distance = w.first;
+	}
+	m_nPeakBytes = std::max(m_nPeakBytes, getResidentBytes());
+
+	// hand the queued tiles over to the loader, nearest first
+	vector<std::pair<float, int> > queued;
+	for (auto &i : m_tiles)
+		if (i.second.state == QUEUED)
+			queued.push_back(std::make_pair(i.second.distance, i.first));
+	std::sort(queued.begin(), queued.end());
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queue.clear();
+		for (auto &q : queued)
+			m_queue.push_back(q.second);
+	}
+	m_cv.notify_all();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Rendering
+
+void C3dglStreamingTerrain::render(glm::mat4 matrix, glm::mat4 matrixProjection)
+{
+	m_nTilesDrawn = 0;
+	if (!m_pSamples)
+		return;
+	int T = m_header.tileSize;
+	C3dglResourceLedger::OWNER owner(getName());
+
+	// index buffer, shared by all the tiles
+	bool bShort = (T + 1) * (T + 1) <= 65536;
+	if (!m_indexBuffer)
+	{
+		vector<unsigned> indices;
+		for (int x = 0; x < T; x++)
+			for (int z = 0; z < T; z++)
+			{
+				unsigned i = x * (T + 1) + z;
+				unsigned quad[6] = { i, i + 1, i + T + 1, i + 1, i + T + 2, i + T + 1 };
+				indices.insert(indices.end(), quad, quad + 6);
+			}
+		m_nIndices = indices.size();
+		glGenBuffers(1, &m_indexBuffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+		if (bShort)
+		{
+			vector<GLushort> shorts(indices.begin(), indices.end());
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * shorts.size(), &shorts[0], GL_STATIC_DRAW);
+		}
+		else
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), &indices[0], GL_STATIC_DRAW);
+	}
+
+	// upload a few decoded tiles per frame, nearest first, to avoid stalls
+	vector<std::pair<float, TILE*> > ready;
+	for (auto &i : m_tiles)
+		if (i.second.state == READY)
+			ready.push_back(std::make_pair(i.second.distance, &i.second));
+	std::sort(ready.begin(), ready.end(), [](const std::pair<float, TILE*> &a, const std::pair<float, TILE*> &b) { return a.first < b.first; });
+	for (size_t i = 0; i < ready.size() && (int)i < m_nMaxUploads; i++)
+	{
+		TILE &tile = *ready[i].second;
+		glGenBuffers(1, &tile.vertexBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, tile.vertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * tile.vertices.size(), &tile.vertices[0], GL_STATIC_DRAW);
+		vector<float>().swap(tile.vertices);
+		tile.state = RESIDENT;
+		m_nUploaded++;
+	}
+
+	C3dglFrustum frustum(matrixProjection * matrix);
+	GLenum indexType = bShort ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	GLsizei stride = VERTEX_FLOATS * sizeof(GLfloat);
+
+	// check if a shading program is active
+	C3dglProgram *pProgram = C3dglProgram::GetCurrentProgram();
+
+	if (pProgram)
+	{
+		pProgram->SendStandardUniform(C3dglProgram::UNI_MODELVIEW, matrix);
+
+		// the terrain shader: plain vertices, no LOD morphing, heights from the vertices not the height field texture
+		if (pProgram->GetAttribLocation("aMorph") != (GLuint)-1)
+		{
+			GLfloat morph[10] = { 0 };
+			pProgram->SendUniform2v("lodMorph", morph, 5);
+			pProgram->SendUniform("compact", 0);
+			pProgram->SendUniform("heightField", 0);
+		}
+
+		GLuint attribVertex = pProgram->GetAttribLocation(C3dglProgram::ATTR_VERTEX);
+		GLuint attribNormal = pProgram->GetAttribLocation(C3dglProgram::ATTR_NORMAL);
+		GLuint attribTexCoord = pProgram->GetAttribLocation(C3dglProgram::ATTR_TEXCOORD);
+		glEnableVertexAttribArray(attribVertex);
+		glEnableVertexAttribArray(attribNormal);
+		glEnableVertexAttribArray(attribTexCoord);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+
+		for (auto &i : m_tiles)
+		{
+			TILE &tile = i.second;
+			if (tile.state != RESIDENT || frustum.testAABB(tile.bb[0], tile.bb[1]) == C3dglFrustum::OUTSIDE)
+				continue;
+			glBindBuffer(GL_ARRAY_BUFFER, tile.vertexBuffer);
+			glVertexAttribPointer(attribVertex, 3, GL_FLOAT, GL_FALSE, stride, 0);
+			glVertexAttribPointer(attribNormal, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(GLfloat)));
+			glVertexAttribPointer(attribTexCoord, 2, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(GLfloat)));
+			C3dglCallStats::drawElements(GL_TRIANGLES, m_nIndices, indexType, 0);
+			m_nTilesDrawn++;
+		}
+
+		glDisableVertexAttribArray(attribVertex);
+		glDisableVertexAttribArray(attribNormal);
+		glDisableVertexAttribArray(attribTexCoord);
+	}
+	else
+	{
+		glMatrixMode(GL_MODELVIEW);
+		glLoadIdentity();
+		glMultMatrixf((GLfloat*)&matrix);
+
+		// fixed pipeline rendering
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_NORMAL_ARRAY);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+
+		for (auto &i : m_tiles)
+		{
+			TILE &tile = i.second;
+			if (tile.state != RESIDENT || frustum.testAABB(tile.bb[0], tile.bb[1]) == C3dglFrustum::OUTSIDE)
+				continue;
+			glBindBuffer(GL_ARRAY_BUFFER, tile.vertexBuffer);
+			glVertexPointer(3, GL_FLOAT, stride, 0);
+			glNormalPointer(GL_FLOAT, stride, (void*)(3 * sizeof(GLfloat)));
+			glTexCoordPointer(2, GL_FLOAT, stride, (void*)(6 * sizeof(GLfloat)));
+			C3dglCallStats::drawElements(GL_TRIANGLES, m_nIndices, indexType, 0);
+			m_nTilesDrawn++;
+		}
+
+		glDisableClientState(GL_VERTEX_ARRAY);
+		glDisableClientState(GL_NORMAL_ARRAY);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
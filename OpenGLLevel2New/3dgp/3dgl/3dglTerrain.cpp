@@ -1,19 +1,58 @@
 #include <fstream>
 #include <iostream>
-
+#include <algorithm>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <chrono>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define TERRAIN_SSE
+#include <emmintrin.h>
+#endif
+
+#define NOMINMAX
 #include <Windows.h>
 #include "../GL/glew.h"
 #include "../GL/3dglShader.h"
 #include "../GL/3dglTerrain.h"
 #include "../GL/3dglBitmap.h"
+#include "../GL/3dglMappedFile.h"
+#include "../GL/3dglProfiler.h"
+#include "../GL/3dglCallStats.h"
+#include "../GL/3dglResourceLedger.h"
 
 using std::vector;
 using namespace _3dgl;
 
 C3dglTerrain::C3dglTerrain()
 {
-    m_nSizeX = m_nSizeZ = m_vertexBuffer = m_normalBuffer = m_texCoordBuffer = m_indexBuffer = 0;
+    m_nSizeX = m_nSizeZ = m_vertexBuffer = m_normalBuffer = m_texCoordBuffer = m_indexBuffer = m_linesBuffer = m_morphBuffer = 0;
 	m_fScaleHeight = 1;
+	m_nChunkSize = 64;
+	m_nLevels = MAX_LOD;
+	m_fChunkDiag = m_fSkirtDepth = 0;
+	m_bLod = false;
+	m_bCompact = m_bWarned = m_bBakedCache = false;
+	m_fHeightQuantum = 1;
+	m_nVertices = m_nBytesPerVertex = 0;
+	m_nVideoMemory = 0;
+	for (int i = 0; i < MAX_LOD; i++)
+		m_lodError[i] = m_lodRange[i] = 0;
+	m_nChunksDrawn = m_nChunksCulled = m_nTrianglesDrawn = 0;
+	m_indexMode = INDEX_LIST;
+	m_nIndexSize = 4;
+	m_bHeightTexture = false;
+	m_nHeightTextureUnit = 6;
+	m_heightTexture = m_patchBuffer = m_patchIndexBuffer = m_instanceBuffer = 0;
+	m_fHeightBase = 0;
+	m_nPatchVertices = 0;
+	m_nPatchIndexSize = 2;
+	for (int i = 0; i < MAX_LOD; i++)
+		m_patchFirst[i] = m_patchCount[i] = 0;
 }
 
 float C3dglTerrain::getHeight(int x, int z)
@@ -25,80 +64,150 @@ float C3dglTerrain::getHeight(int x, int z)
 	return m_heights[x * m_nSizeZ + z];
 }
 
-glm::vec3 barycentric(glm::vec2 p, glm::vec2 a, glm::vec2 b, glm::vec2 c)
+// runs body(first, last) on up to nThreads threads (0 = all hardware threads), splitting the range [0, n)
+static void parallelFor(int n, int nThreads, const std::function<void(int, int)> &body)
 {
-	auto v0 = b - a;
-	auto v1 = c - a;
-	auto v2 = p - a;
+	if (nThreads <= 0)
+		nThreads = std::max(1u, std::thread::hardware_concurrency());
+	nThreads = std::max(1, std::min(nThreads, n));
+	if (nThreads == 1)
+	{
+		body(0, n);
+		return;
+	}
+	vector<std::thread> threads;
+	for (int i = 1; i < nThreads; i++)
+		threads.push_back(std::thread(body, (int)((long long)n * i / nThreads), (int)((long long)n * (i + 1) / nThreads)));
+	body(0, n / nThreads);
+	for (std::thread &thread : threads)
+		thread.join();
+}
 
-	float d00 = glm::dot(v0, v0);
-	float d01 = glm::dot(v0, v1);
-	float d11 = glm::dot(v1, v1);
-	float d20 = glm::dot(v2, v0);
-	float d21 = glm::dot(v2, v1);
-	float denom = d00 * d11 - d01 * d01;
+void C3dglTerrain::computeHeights(const unsigned char *pBits, int sizeX, int sizeZ, float scaleHeight, float *pHeights, int nThreads)
+{
+	// heights[x * sizeZ + z] = red channel of the RGBA pixel (x, sizeZ - 1 - z)
+	// the image is transposed in 4x4 blocks - contiguous reads and writes; threads take blocks of output rows (x)
+	float scale = scaleHeight / 256.0f;
+	parallelFor((sizeX + 3) / 4, nThreads, [=](int iFirst, int iLast)
+	{
+		for (int x = iFirst * 4; x < std::min(iLast * 4, sizeX); x += 4)
+		{
+			int z = 0;
+#ifdef TERRAIN_SSE
+			if (x + 4 <= sizeX)
+			{
+				__m128i mask = _mm_set1_epi32(0xff);
+				__m128 vScale = _mm_set1_ps(scale);
+				for (; z + 4 <= sizeZ; z += 4)
+				{
+					// four image rows (z .. z + 3), four pixels each (x .. x + 3)
+					__m128 row[4];
+					for (int k = 0; k < 4; k++)
+					{
+						__m128i pixels = _mm_loadu_si128((const __m128i*)(pBits + ((size_t)(sizeZ - 1 - z - k) * sizeX + x) * 4));
+						row[k] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(pixels, mask)), vScale);
+					}
+					_MM_TRANSPOSE4_PS(row[0], row[1], row[2], row[3]);
+					for (int k = 0; k < 4; k++)
+						_mm_storeu_ps(pHeights + (size_t)(x + k) * sizeZ + z, row[k]);
+				}
+			}
+#endif
+			// remaining samples
+			for (int xx = x; xx < std::min(x + 4, sizeX); xx++)
+				for (int zz = z; zz < sizeZ; zz++)
+					pHeights[(size_t)xx * sizeZ + zz] = pBits[((size_t)(sizeZ - 1 - zz) * sizeX + xx) * 4] * scale;
+		}
+	});
+}
 
-	float v = (d11 * d20 - d01 * d21) / denom;
-	float w = (d00 * d21 - d01 * d20) / denom;
-	float u = 1.0f - v - w;
+void C3dglTerrain::computeNormal(float dy_x, float dy_z, float *pNormal)
+{
+	float m = std::sqrt(dy_x * dy_x + 4 + dy_z * dy_z);
+	pNormal[0] = -dy_x / m;
+	pNormal[1] = 2 / m;
+	pNormal[2] = -dy_z / m;
+}
 
-	return glm::vec3(u, v, w);
+void C3dglTerrain::computeNormals(const float *pHeights, int sizeX, int sizeZ, float *pNormals, int nThreads)
+{
+	// central differences (one-sided at the edges): n = normalize(-dy_x, 2, -dy_z) - see computeNormal
+	parallelFor(sizeX, nThreads, [=](int iFirst, int iLast)
+	{
+		for (int x = iFirst; x < iLast; x++)
+		{
+			const float *pRow = pHeights + (size_t)x * sizeZ;
+			const float *pRowPrev = pHeights + (size_t)std::max(x - 1, 0) * sizeZ;
+			const float *pRowNext = pHeights + (size_t)std::min(x + 1, sizeX - 1) * sizeZ;
+			float *pOut = pNormals + (size_t)x * sizeZ * 3;
+
+			auto normal = [&](int z)
+			{
+				computeNormal(pRowNext[z] - pRowPrev[z], pRow[std::min(z + 1, sizeZ - 1)] - pRow[std::max(z - 1, 0)], pOut + z * 3);
+			};
+
+			int z = 0;
+			if (sizeZ > 0) normal(z++);
+#ifdef TERRAIN_SSE
+			__m128 vFour = _mm_set1_ps(4), vTwo = _mm_set1_ps(2), vZero = _mm_setzero_ps();
+			for (; z + 4 < sizeZ; z += 4)
+			{
+				__m128 dy_x = _mm_sub_ps(_mm_loadu_ps(pRowNext + z), _mm_loadu_ps(pRowPrev + z));
+				__m128 dy_z = _mm_sub_ps(_mm_loadu_ps(pRow + z + 1), _mm_loadu_ps(pRow + z - 1));
+				__m128 m = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dy_x, dy_x), vFour), _mm_mul_ps(dy_z, dy_z)));
+				__m128 nx = _mm_div_ps(_mm_sub_ps(vZero, dy_x), m);
+				__m128 ny = _mm_div_ps(vTwo, m);
+				__m128 nz = _mm_div_ps(_mm_sub_ps(vZero, dy_z), m);
+
+				// interleave (x0 x1 x2 x3), (y0 ..), (z0 ..) into x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+				__m128 xy01 = _mm_unpacklo_ps(nx, ny);
+				__m128 xy23 = _mm_unpackhi_ps(nx, ny);
+				__m128 z0x1 = _mm_shuffle_ps(nz, nx, _MM_SHUFFLE(1, 1, 0, 0));
+				__m128 y1z1 = _mm_shuffle_ps(ny, nz, _MM_SHUFFLE(1, 1, 1, 1));
+				__m128 z2z3x3y3 = _mm_shuffle_ps(nz, xy23, _MM_SHUFFLE(3, 2, 3, 2));
+				_mm_storeu_ps(pOut + z * 3, _mm_shuffle_ps(xy01, z0x1, _MM_SHUFFLE(2, 0, 1, 0)));
+				_mm_storeu_ps(pOut + z * 3 + 4, _mm_shuffle_ps(y1z1, xy23, _MM_SHUFFLE(1, 0, 2, 0)));
+				_mm_storeu_ps(pOut + z * 3 + 8, _mm_shuffle_ps(z2z3x3y3, z2z3x3y3, _MM_SHUFFLE(1, 3, 2, 0)));
+			}
+#endif
+			for (; z < sizeZ; z++)
+				normal(z);
+		}
+	});
 }
 
-	// compute the area of a triangle using Heron's formula
-	float triarea(float a, float b, float c)
+bool C3dglTerrain::loadHeightmap(const std::string filename, float scaleHeight)
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	// strips need primitive restart and base vertex draws
+	if (m_indexMode == INDEX_STRIPS && !GLEW_VERSION_3_2)
 	{
-		float s = (a + b + c)/2.0f;
-		float area=sqrt(fabs(s*(s-a)*(s-b)*(s-c)));
-		return area;     
+		logWarning("index strips require OpenGL 3.2 - using triangle lists");
+		m_indexMode = INDEX_LIST;
 	}
-
-	// compute the distance between two 
-	float dist(float x0, float y0, float x1, float y1)
+	// the height field texture needs instanced arrays and vertex texture fetch
+	if (m_bHeightTexture && !GLEW_VERSION_3_3)
 	{
-		float a = x1 - x0;	  
-		float b = y1 - y0;
-		return sqrt(a*a + b*b);
+		logWarning("height field texture requires OpenGL 3.3 - using vertex buffers");
+		m_bHeightTexture = false;
 	}
 
-	// barycentric interpolation of (x, y) within a triangle (x0, y0), (x1, y1), (x2, y2) with values v0, v1, v2
-	float barycent(float x, float y, float x0, float y0, float v0, float x1, float y1, float v1, float x2, float y2, float v2)
+	unsigned long long hash = 0;
+	int nLevelsRequested = m_nLevels;
+	// the baked cache is valid as long as the source image and the build settings are the same
+	if (m_bBakedCache)
 	{
-		// compute the area of the big triangle
-		float a = dist(x0, y0, x1, y1);
-		float b = dist(x1, y1, x2, y2);
-		float c = dist(x2, y2, x0, y0);
-		float totalarea = triarea(a, b, c);
-
-		// compute the distances from the outer vertices to the inner vertex
-		float length0 = dist(x0, y0, x, y);
-		float length1 = dist(x1, y1, x, y);
-		float length2 = dist(x2, y2, x, y);
-
-		float f0 = triarea(b, length1, length2) / totalarea;
-		float f1 = triarea(c, length0, length2) / totalarea;
-		float f2 = triarea(a, length0, length1) / totalarea;
-
-		return v0 * f0 + v1 * f1 + v2 * f2;
+		hash = hashFile(filename);
+		if (hash && loadBaked(filename + ".baked", hash, scaleHeight))
+		{
+			auto t1 = std::chrono::high_resolution_clock::now();
+			logInfo("loaded " + filename + " from the baked cache: " + getBufferInfo()
+				+ " in " + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count()) + " ms");
+			return true;
+		}
 	}
 
-float C3dglTerrain::getInterpolatedHeight(float fx, float fz)
-{
-	int x = (int)floor(fx);
-	int z = (int)floor(fz);
-	fx -= x;
-	fz -= z;
-	if (fx + fz < 1)
-		return barycent(fx, fz, 0, 0, getHeight(x, z), 0, 1, getHeight(x, z + 1), 1, 0, getHeight(x + 1, z));
-	else
-		return barycent(fx, fz, 0, 1, getHeight(x, z + 1), 1, 0, getHeight(x + 1, z), 1, 1, getHeight(x + 1, z + 1));
-
-
-	return m_heights[z * m_nSizeX + x];
-}
-
-bool C3dglTerrain::loadHeightmap(const std::string filename, float scaleHeight)
-{
 	C3dglBitmap bm;
 	bm.load(filename, GL_RGBA);
 
@@ -108,17 +217,9 @@ bool C3dglTerrain::loadHeightmap(const std::string filename, float scaleHeight)
 	m_fScaleHeight = scaleHeight;
 
 	// Collect Height Values
-	m_heights.clear();
-    m_heights.reserve(m_nSizeX * m_nSizeZ); //Reserve some space (faster)
-	for (int i = 0; i < m_nSizeX; i++)
-		for (int j = m_nSizeZ - 1; j >= 0; j--)
-		{
-			int index = (i + j * m_nSizeX) * 4;
-			unsigned char *pBytes = (unsigned char*)(bm.GetBits());
-			unsigned char val = pBytes[index];
-			float f = (float)val / 256.0f;
-			m_heights.push_back(f * m_fScaleHeight);
-		}
+	m_heights.resize(m_nSizeX * m_nSizeZ);
+	computeHeights((const unsigned char*)bm.GetBits(), m_nSizeX, m_nSizeZ, m_fScaleHeight, &m_heights[0]);
+	m_heightField.create(&m_heights[0], m_nSizeX, m_nSizeZ);
 
 //bool C3dglTerrain::loadHeightmap(const std::wstring& rawFile, float scaleHeight)
 //{
@@ -144,95 +245,844 @@ bool C3dglTerrain::loadHeightmap(const std::string filename, float scaleHeight)
 //			m_heights.push_back(f);
 //		}
 
-	// Collect Vertices, Normals and Lines (the latter - for the visualisation of normal vectors)
-    vector<float> vertices;
-    vector<float> normals;
-    vector<float> texCoords;
-	vector<float> lines;
+	// Build the quadtree of chunks
+	m_chunks.clear();
+	m_nodes.clear();
+	if (m_nChunkSize < 1) m_nChunkSize = 1;
+	int nChunksX = (m_nSizeX - 2) / m_nChunkSize + 1;
+	int nChunksZ = (m_nSizeZ - 2) / m_nChunkSize + 1;
+	buildQuadtree(0, 0, nChunksX, nChunksZ);
+
+	// LOD levels: the coarsest level must still fit in a chunk
+	int nLevels = 1;
+	while (nLevels < MAX_LOD && (1 << nLevels) <= m_nChunkSize) nLevels++;
+	m_nLevels = std::max(1, std::min(m_nLevels, nLevels));
+
+	// Normal vectors for the entire height map (the height field texture shader calculates its own)
+	vector<float> normalMap;
+	if (!m_bHeightTexture)
+	{
+		normalMap.resize(m_nSizeX * m_nSizeZ * 3);
+		computeNormals(&m_heights[0], m_nSizeX, m_nSizeZ, &normalMap[0]);
+	}
+
+	// Vertex blocks: each contains the chunk grid followed by the skirts along its four edges
+	// (none with the height field texture - the LOD data is still needed)
+	unsigned nVertices = 0;
+	for (CHUNK &chunk : m_chunks)
+	{
+		int nx = chunk.x1 - chunk.x0, nz = chunk.z1 - chunk.z0;
+		chunk.firstVertex = nVertices;
+		chunk.numVertices = m_bHeightTexture ? 0 : (nx + 1) * (nz + 1) + 2 * (nx + 1) + 2 * (nz + 1);
+		nVertices += chunk.numVertices;
+	}
+	bool bVertices = nVertices > 0;
+
+	// Collect Vertices, Normals, Texture Coordinates and Morph Data - into pre-sized buffers, chunks processed in parallel
 	int minx = -m_nSizeX/2;
 	int minz = -m_nSizeZ/2;
-	for (int x = minx; x < minx + m_nSizeX; x++)
-		for (int z = minz; z < minz + m_nSizeZ; z++)
+	// the float format buffers are kept in a single block, as stored in the baked file
+	vector<float> vertexData(nVertices * (3 + 3 + 2 + 2));
+	float *vertices = vertexData.data();
+	float *normals = vertices + nVertices * 3;
+	float *texCoords = normals + nVertices * 3;
+	float *morphs = texCoords + nVertices * 2;
+	vector<float> chunkErrors(m_chunks.size() * MAX_LOD, 0.f);
+	parallelFor(m_chunks.size(), 0, [&](int iFirst, int iLast)
+	{
+		for (int iChunk = iFirst; iChunk < iLast; iChunk++)
 		{
-			vertices.push_back((float)x);
-			vertices.push_back(getHeight(x, z));
-			vertices.push_back((float)z);
+			const CHUNK &chunk = m_chunks[iChunk];
+			int nx = chunk.x1 - chunk.x0, nz = chunk.z1 - chunk.z0;
+			unsigned i = chunk.firstVertex;
+
+			// the grid
+			for (int lx = 0; lx <= nx; lx++)
+				for (int lz = 0; lz <= nz; lz++, i++)
+				{
+					int x = minx + chunk.x0 + lx, z = minz + chunk.z0 + lz;
+					unsigned iSample = (chunk.x0 + lx) * m_nSizeZ + chunk.z0 + lz;
+					float h = m_heights[iSample];
+
+					// the coarsest level the vertex belongs to
+					int level = getVertexLevel(chunk, lx, lz);
+
+					if (bVertices)
+					{
+						vertices[i * 3] = (float)x;
+						vertices[i * 3 + 1] = h;
+						vertices[i * 3 + 2] = (float)z;
+
+						for (int k = 0; k < 3; k++)
+							normals[i * 3 + k] = normalMap[iSample * 3 + k];
+
+						texCoords[i * 2] = (float)x / 2.f;
+						texCoords[i * 2 + 1] = (float)z / 2.f;
+
+						// height at the next coarser level
+						morphs[i * 2] = level + 1 < m_nLevels ? getLodHeight(chunk, 2 << level, lx, lz) : h;
+						morphs[i * 2 + 1] = (float)level;
+					}
+
+					// geometric error of each LOD level - the largest height difference from the full resolution mesh
+					for (int l = level + 1; l < m_nLevels; l++)
+						chunkErrors[iChunk * MAX_LOD + l] = std::max(chunkErrors[iChunk * MAX_LOD + l], std::abs(h - getLodHeight(chunk, 1 << l, lx, lz)));
+				}
+		}
+	});
 
-			int x0 = (x == minx) ? x : x - 1;
-			int x1 = (x == minx + m_nSizeX-1) ? x : x + 1;
-			int z0 = (z == minz) ? z : z - 1;
-			int z1 = (z == minz + m_nSizeZ-1) ? z : z + 1;
+	// LOD errors, chunk sizes and the skirt depth
+	m_fChunkDiag = 0;
+	for (int i = 0; i < MAX_LOD; i++)
+		m_lodError[i] = 0;
+	for (size_t iChunk = 0; iChunk < m_chunks.size(); iChunk++)
+	{
+		const CHUNK &chunk = m_chunks[iChunk];
+		for (int l = 1; l < m_nLevels; l++)
+			m_lodError[l] = std::max(m_lodError[l], chunkErrors[iChunk * MAX_LOD + l]);
+		float dx = chunk.bb[1][0] - chunk.bb[0][0], dy = chunk.bb[1][1] - chunk.bb[0][1], dz = chunk.bb[1][2] - chunk.bb[0][2];
+		m_fChunkDiag = std::max(m_fChunkDiag, std::sqrt(dx * dx + dy * dy + dz * dz));
+	}
+	for (int l = 1; l < m_nLevels; l++)
+		m_lodError[l] = std::max(m_lodError[l], m_lodError[l - 1]);	// keep it monotonic
+	m_fSkirtDepth = m_lodError[m_nLevels - 1] + 1;
 
-			float dy_x = getHeight(x1, z) - getHeight(x0, z);
-			float dy_z = getHeight(x, z1) - getHeight(x, z0);
-			float m = sqrt(dy_x * dy_x + 4 + dy_z * dy_z);
-			normals.push_back(-dy_x / m);
-			normals.push_back(2 / m);
-			normals.push_back(-dy_z / m);
+	// the skirts: z = 0, z = nz, x = 0 and x = nx edges - copies of the edge vertices, lowered by m_fSkirtDepth
+	parallelFor(bVertices ? m_chunks.size() : 0, 0, [&](int iFirst, int iLast)
+	{
+		for (int iChunk = iFirst; iChunk < iLast; iChunk++)
+		{
+			const CHUNK &chunk = m_chunks[iChunk];
+			int nx = chunk.x1 - chunk.x0, nz = chunk.z1 - chunk.z0;
+			unsigned i = chunk.firstVertex + (nx + 1) * (nz + 1);
+			int edges[4][4] = { { 0, 0, 1, 0 }, { 0, nz, 1, 0 }, { 0, 0, 0, 1 }, { nx, 0, 0, 1 } };
+			for (auto &e : edges)
+				for (int j = 0; j <= (e[2] ? nx : nz); j++, i++)
+				{
+					unsigned iVertex = chunk.firstVertex + (e[0] + e[2] * j) * (nz + 1) + e[1] + e[3] * j;
+					for (int k = 0; k < 3; k++)
+						vertices[i * 3 + k] = vertices[iVertex * 3 + k] - (k == 1 ? m_fSkirtDepth : 0);
+					for (int k = 0; k < 3; k++)
+						normals[i * 3 + k] = normals[iVertex * 3 + k];
+					for (int k = 0; k < 2; k++)
+						texCoords[i * 2 + k] = texCoords[iVertex * 2 + k];
+					morphs[i * 2] = morphs[iVertex * 2] - m_fSkirtDepth;
+					morphs[i * 2 + 1] = morphs[iVertex * 2 + 1];
+				}
+		}
+	});
+
+	// Generate Indices - level by level, and chunk by chunk within each level
+	// strips: relative to the chunk vertex block, 16-bit if all the blocks are small enough (0xFFFF is the restart index)
+	bool bStrips = m_indexMode == INDEX_STRIPS;
+	unsigned maxVertices = 0;
+	for (CHUNK &chunk : m_chunks)
+		maxVertices = std::max(maxVertices, chunk.numVertices);
+	m_nIndexSize = (bStrips && maxVertices < 0xFFFF) ? 2 : 4;
+
+	vector<unsigned int> indices, chunkIndices;
+	for (int l = 0; l < m_nLevels; l++)
+		for (CHUNK &chunk : m_chunks)
+		{
+			chunk.firstIndex[l] = indices.size();
+			chunk.numTriangles[l] = buildChunkIndices(chunk.x1 - chunk.x0, chunk.z1 - chunk.z0, l, m_indexMode, chunkIndices);
+			if (bVertices)
+				for (unsigned i : chunkIndices)
+					indices.push_back(bStrips ? i : i + chunk.firstVertex);
+			chunk.numIndices[l] = indices.size() - chunk.firstIndex[l];
+		}
+	vector<unsigned short> shortIndices;
+	if (m_nIndexSize == 2)
+		shortIndices.assign(indices.begin(), indices.end());
+	const void *pIndices = (m_nIndexSize == 2) ? (const void*)shortIndices.data() : (const void*)indices.data();
+
+	m_nVertices = nVertices;
+	vector<COMPACT_VERTEX> compact;
+	if (m_bCompact && bVertices)
+	{
+		// quantise heights to 16 bits - the range must include the skirts and the morph targets
+		float maxY = 0;
+		for (size_t i = 0; i < m_nVertices; i++)
+			maxY = std::max(maxY, std::max(std::abs(vertices[i * 3 + 1]), std::abs(morphs[i * 2])));
+		m_fHeightQuantum = std::max(maxY, 1.f) / 32767;
+
+		compact.resize(m_nVertices);
+		for (size_t i = 0; i < m_nVertices; i++)
+			compact[i] = compactVertex(vertices + i * 3, normals + i * 3, morphs + i * 2);
+	}
+	else
+		m_fHeightQuantum = 1;
 
-			texCoords.push_back((float)x / 2.f);
-			texCoords.push_back((float)z / 2.f);
+	const void *pVertexData = m_bCompact ? (const void*)compact.data() : (const void*)vertexData.data();
+	createBuffers(pVertexData, pIndices, indices.size());
+
+	auto t1 = std::chrono::high_resolution_clock::now();
+	logInfo("loaded " + filename + ": " + getBufferInfo() + " in " + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count()) + " ms");
+
+	if (m_bBakedCache && hash)
+		storeBaked(filename + ".baked", hash, nLevelsRequested, pVertexData, pIndices, indices.size());
+	return true;
+}
+
+unsigned C3dglTerrain::getChunkIndices(unsigned iChunk, int level, std::vector<unsigned> &indices)
+{
+	indices.clear();
+	if (iChunk >= m_chunks.size() || level < 0 || level >= m_nLevels)
+		return 0;
+
+	// with the height field texture every chunk is drawn with the patch
+	CHUNK &chunk = m_chunks[iChunk];
+	unsigned buffer = m_bHeightTexture ? m_patchIndexBuffer : m_indexBuffer;
+	unsigned indexSize = m_bHeightTexture ? m_nPatchIndexSize : m_nIndexSize;
+	size_t first = m_bHeightTexture ? m_patchFirst[level] : chunk.firstIndex[level];
+	size_t count = m_bHeightTexture ? m_patchCount[level] : chunk.numIndices[level];
+	if (!buffer || !count)
+		return 0;
+
+	// GL_ARRAY_BUFFER is not a part of the vertex array state
+	vector<unsigned char> data(count * indexSize);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glGetBufferSubData(GL_ARRAY_BUFFER, first * indexSize, data.size(), data.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	bool bStrips = m_indexMode == INDEX_STRIPS;
+	indices.resize(count);
+	for (size_t i = 0; i < count; i++)
+		if (indexSize == 2)
+		{
+			unsigned short index = ((const unsigned short*)data.data())[i];
+			indices[i] = (bStrips && index == 0xFFFF) ? 0xFFFFFFFF : index;
+		}
+		else
+			indices[i] = ((const unsigned*)data.data())[i];
+
+	if (!m_bHeightTexture)
+		return chunk.numTriangles[level];
+
+	// the patch is as large as the largest chunk - see createPatch
+	int n = 1;
+	for (CHUNK &c : m_chunks)
+		n = std::max(n, std::max(c.x1 - c.x0, c.z1 - c.z0));
+	vector<unsigned> patch;
+	return buildChunkIndices(n, n, level, m_indexMode, patch);
+}
+
+unsigned C3dglTerrain::buildChunkIndices(int nx, int nz, int level, INDEX_MODE mode, std::vector<unsigned> &indices)
+{
+	/*
+		We loop through building the triangles that
+		make up each grid square in the chunk;
+		at level L the grid lines are every (1 << L) vertices, plus the last one
+
+		(x, z)   *----* (x+1, z)
+		         |   /|
+		         |  / |
+		         | /  |
+		(x, z+1) *----* (x+1, z+1)
+	*/
+	indices.clear();
+	vector<int> gx, gz;
+	for (int i = 0; i < nx; i += 1 << level) gx.push_back(i);
+	gx.push_back(nx);
+	for (int i = 0; i < nz; i += 1 << level) gz.push_back(i);
+	gz.push_back(nz);
+
+	auto grid = [&](int lx, int lz) { return (unsigned)(lx * (nz + 1) + lz); };
+	unsigned skirt[4];
+	skirt[0] = (nx + 1) * (nz + 1);
+	skirt[1] = skirt[0] + nx + 1;
+	skirt[2] = skirt[1] + nx + 1;
+	skirt[3] = skirt[2] + nz + 1;
+
+	unsigned nTriangles = 0;
+	if (mode == INDEX_LIST)
+	{
+		for (size_t i = 0; i + 1 < gx.size(); ++i)
+			for (size_t j = 0; j + 1 < gz.size(); ++j)
+			{
+				indices.push_back(grid(gx[i], gz[j])); // current point
+				indices.push_back(grid(gx[i], gz[j + 1])); // next row
+				indices.push_back(grid(gx[i + 1], gz[j])); // same row, next col
+
+				indices.push_back(grid(gx[i], gz[j + 1])); // next row
+				indices.push_back(grid(gx[i + 1], gz[j + 1])); //next row, next col
+				indices.push_back(grid(gx[i + 1], gz[j])); // same row, next col
+			}
+
+		// skirts - wound to face outwards
+		auto quad = [&](unsigned a, unsigned b, unsigned sa, unsigned sb)
+		{
+			indices.push_back(a); indices.push_back(b); indices.push_back(sa);
+			indices.push_back(b); indices.push_back(sb); indices.push_back(sa);
+		};
+		for (size_t i = 0; i + 1 < gx.size(); ++i)
+		{
+			quad(grid(gx[i], 0), grid(gx[i + 1], 0), skirt[0] + gx[i], skirt[0] + gx[i + 1]);
+			quad(grid(gx[i + 1], nz), grid(gx[i], nz), skirt[1] + gx[i + 1], skirt[1] + gx[i]);
+		}
+		for (size_t j = 0; j + 1 < gz.size(); ++j)
+		{
+			quad(grid(0, gz[j + 1]), grid(0, gz[j]), skirt[2] + gz[j + 1], skirt[2] + gz[j]);
+			quad(grid(nx, gz[j]), grid(nx, gz[j + 1]), skirt[3] + gz[j], skirt[3] + gz[j + 1]);
+		}
+		return indices.size() / 3;
+	}
 
+	// strips of vertex pairs (t, b): triangles (t[i], b[i], t[i+1]) and (t[i+1], b[i], b[i+1]) - as in the lists
+	auto pair = [&](unsigned t, unsigned b)
+	{
+		indices.push_back(t);
+		indices.push_back(b);
+	};
+	auto restart = [&](size_t nPairs)
+	{
+		indices.push_back(0xFFFFFFFF);
+		nTriangles += 2 * (nPairs - 1);
+	};
+
+	// the grid in bands of STRIP_BAND quads, so that a row of vertices is still in the cache when the next row uses it
+	int nBands = (int)(gx.size() - 2) / STRIP_BAND + 1;
+	for (int band = 0; band < nBands; band++)
+	{
+		size_t i0 = band * STRIP_BAND, i1 = std::min(i0 + STRIP_BAND, gx.size() - 1);
+		for (size_t j = 0; j + 1 < gz.size(); ++j)
+		{
+			for (size_t i = i0; i <= i1; i++)
+				pair(grid(gx[i], gz[j]), grid(gx[i], gz[j + 1]));
+			restart(i1 - i0 + 1);
+		}
+	}
+
+	// skirts - one strip along each edge, wound to face outwards
+	for (size_t i = 0; i < gx.size(); ++i)
+		pair(skirt[0] + gx[i], grid(gx[i], 0));
+	restart(gx.size());
+	for (size_t i = gx.size(); i-- > 0; )
+		pair(skirt[1] + gx[i], grid(gx[i], nz));
+	restart(gx.size());
+	for (size_t j = gz.size(); j-- > 0; )
+		pair(skirt[2] + gz[j], grid(0, gz[j]));
+	restart(gz.size());
+	for (size_t j = 0; j < gz.size(); ++j)
+		pair(skirt[3] + gz[j], grid(nx, gz[j]));
+	restart(gz.size());
+	indices.pop_back();		// no restart after the last strip
+	return nTriangles;
+}
+
+// creates the vertex and index buffers; pVertexData: compact vertices or the float format buffers back to back
+// with the height field texture: creates the texture and the patch instead (there are no vertices nor indices)
+void C3dglTerrain::createBuffers(const void *pVertexData, const void *pIndices, size_t nIndices)
+{
+	// the buffers of the previous height map, if any; the Vertex Buffer for Visualisation
+	// of Normal Vectors is created again by renderNormals
+	destroy();
+	C3dglResourceLedger::OWNER owner(getName());
+
+	if (m_bHeightTexture)
+	{
+		m_nBytesPerVertex = 0;
+		createHeightTexture();
+		createPatch();
+		return;
+	}
+
+	if (m_bCompact)
+	{
+		// Prepare Interleaved Vertex Buffer
+		glGenBuffers(1, &m_vertexBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(COMPACT_VERTEX) * m_nVertices, pVertexData, GL_STATIC_DRAW);
+		m_nBytesPerVertex = sizeof(COMPACT_VERTEX);
+	}
+	else
+	{
+		const GLfloat *vertices = (const GLfloat*)pVertexData;
+		const GLfloat *normals = vertices + m_nVertices * 3;
+		const GLfloat *texCoords = normals + m_nVertices * 3;
+		const GLfloat *morphs = texCoords + m_nVertices * 2;
+
+		// Prepare Vertex Buffer
+		glGenBuffers(1, &m_vertexBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * m_nVertices * 3, vertices, GL_STATIC_DRAW);
+
+		// Prepare Normal Buffer
+		glGenBuffers(1, &m_normalBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, m_normalBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * m_nVertices * 3, normals, GL_STATIC_DRAW);
+
+		// Prepare TexCoords Buffer
+		glGenBuffers(1, &m_texCoordBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * m_nVertices * 2, texCoords, GL_STATIC_DRAW);
+
+		// Prepare Morph Buffer (LOD)
+		glGenBuffers(1, &m_morphBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, m_morphBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * m_nVertices * 2, morphs, GL_STATIC_DRAW);
+		m_nBytesPerVertex = sizeof(GLfloat) * (3 + 3 + 2 + 2);
+	}
+
+	// Prepare Index Buffer
+    glGenBuffers(1, &m_indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_nIndexSize * nIndices, pIndices, GL_STATIC_DRAW);
+	m_nVideoMemory = (size_t)m_nVertices * m_nBytesPerVertex + m_nIndexSize * nIndices;
+}
+
+void C3dglTerrain::createHeightTexture()
+{
+	// 16-bit heights over three times the original range, leaving room for the terrain to be edited below and above it
+	m_fHeightBase = -m_fScaleHeight;
+	m_fHeightQuantum = 3 * m_fScaleHeight / 65535;
+
+	GLint activeTexture;
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &activeTexture);
+	glActiveTexture(GL_TEXTURE0 + m_nHeightTextureUnit);
+	C3dglResourceLedger::genTextures(1, &m_heightTexture);
+	C3dglCallStats::bindTexture(GL_TEXTURE_2D, m_heightTexture);
+	C3dglCallStats::texImage2D(GL_TEXTURE_2D, 0, GL_R16, m_nSizeZ, m_nSizeX, 0, GL_RED, GL_UNSIGNED_SHORT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glActiveTexture(activeTexture);
+
+	uploadHeightTexture(0, 0, m_nSizeX - 1, m_nSizeZ - 1);
+}
+
+// quantises and uploads the heights of the rectangle [x0, x1] x [z0, z1] (height map coordinates) to the height field texture
+void C3dglTerrain::uploadHeightTexture(int x0, int z0, int x1, int z1)
+{
+	vector<unsigned short> texels((size_t)(x1 - x0 + 1) * (z1 - z0 + 1));
+	unsigned short *p = texels.data();
+	for (int x = x0; x <= x1; x++)
+		for (int z = z0; z <= z1; z++)
+			*p++ = (unsigned short)std::min(std::max(std::floor((m_heights[(size_t)x * m_nSizeZ + z] - m_fHeightBase) / m_fHeightQuantum + 0.5f), 0.f), 65535.f);
+
+	GLint activeTexture, alignment;
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &activeTexture);
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+	glActiveTexture(GL_TEXTURE0 + m_nHeightTextureUnit);
+	C3dglCallStats::bindTexture(GL_TEXTURE_2D, m_heightTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+	C3dglCallStats::texSubImage2D(GL_TEXTURE_2D, 0, z0, x0, z1 - z0 + 1, x1 - x0 + 1, GL_RED, GL_UNSIGNED_SHORT, texels.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+	glActiveTexture(activeTexture);
+}
+
+void C3dglTerrain::createPatch()
+{
+	// the patch is as large as the largest chunk; smaller chunks (at the edges of the height map) are clamped by the shader
+	int n = 1;
+	for (CHUNK &chunk : m_chunks)
+		n = std::max(n, std::max(chunk.x1 - chunk.x0, chunk.z1 - chunk.z0));
+
+	// vertices: (x, skirt, z) - the grid, then the skirts along the z = 0, z = n, x = 0 and x = n edges
+	vector<GLshort> vertices;
+	for (int lx = 0; lx <= n; lx++)
+		for (int lz = 0; lz <= n; lz++)
+			vertices.insert(vertices.end(), { (GLshort)lx, 0, (GLshort)lz });
+	int edges[4][4] = { { 0, 0, 1, 0 }, { 0, n, 1, 0 }, { 0, 0, 0, 1 }, { n, 0, 0, 1 } };
+	for (auto &e : edges)
+		for (int j = 0; j <= n; j++)
+			vertices.insert(vertices.end(), { (GLshort)(e[0] + e[2] * j), 1, (GLshort)(e[1] + e[3] * j) });
+	m_nPatchVertices = vertices.size() / 3;
+
+	// indices: level by level
+	vector<unsigned> indices, levelIndices;
+	for (int l = 0; l < m_nLevels; l++)
+	{
+		buildChunkIndices(n, n, l, m_indexMode, levelIndices);
+		m_patchFirst[l] = indices.size();
+		m_patchCount[l] = levelIndices.size();
+		indices.insert(indices.end(), levelIndices.begin(), levelIndices.end());
+	}
+	m_nPatchIndexSize = (m_nPatchVertices < 0xFFFF) ? 2 : 4;
+	vector<GLushort> shortIndices;
+	if (m_nPatchIndexSize == 2)
+		shortIndices.assign(indices.begin(), indices.end());
+
+	glGenBuffers(1, &m_patchBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, m_patchBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLshort) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &m_patchIndexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_patchIndexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_nPatchIndexSize * indices.size(),
+		(m_nPatchIndexSize == 2) ? (const void*)shortIndices.data() : (const void*)indices.data(), GL_STATIC_DRAW);
+
+	// per-instance chunk data - filled every frame
+	glGenBuffers(1, &m_instanceBuffer);
+
+	m_nVideoMemory = sizeof(GLushort) * m_nSizeX * m_nSizeZ + sizeof(GLshort) * vertices.size() + m_nPatchIndexSize * indices.size();
+}
+
+void C3dglTerrain::destroy()
+{
+	for (unsigned *pBuffer : { &m_vertexBuffer, &m_normalBuffer, &m_texCoordBuffer, &m_morphBuffer, &m_indexBuffer, &m_linesBuffer,
+		&m_patchBuffer, &m_patchIndexBuffer, &m_instanceBuffer })
+	{
+		if (*pBuffer) glDeleteBuffers(1, pBuffer);
+		*pBuffer = 0;
+	}
+	if (m_heightTexture) C3dglResourceLedger::deleteTextures(1, &m_heightTexture);
+	m_heightTexture = 0;
+	m_nVideoMemory = 0;
+}
+
+// buffer sizes, for the log
+std::string C3dglTerrain::getBufferInfo()
+{
+	std::string info;
+	if (m_bHeightTexture)
+		info = "height field texture " + std::to_string(m_nSizeX) + " x " + std::to_string(m_nSizeZ) + ", patch of " + std::to_string(m_nPatchVertices) + " vertices";
+	else
+	{
+		info = std::to_string(m_nVertices) + " vertices, " + std::to_string(m_nBytesPerVertex) + " bytes per vertex";
+		if (m_bCompact)
+			info += " (compact format; " + std::to_string(sizeof(GLfloat) * (3 + 3 + 2 + 2)) + " in float format)";
+	}
+	return info + ", " + std::to_string(m_nVideoMemory / 1024) + " KB of video memory";
+}
+
+void C3dglTerrain::createLinesBuffer()
+{
+	// Collect Lines - for the visualisation of normal vectors
+	int minx = -m_nSizeX / 2;
+	int minz = -m_nSizeZ / 2;
+	vector<float> lines;
+	lines.reserve(m_nSizeX * m_nSizeZ * 6);
+	for (int x = minx; x < minx + m_nSizeX; x++)
+		for (int z = minz; z < minz + m_nSizeZ; z++)
+		{
+			float nx, ny, nz;
+			getNormal(x, z, nx, ny, nz);
 			lines.push_back((float)x);
 			lines.push_back(getHeight(x, z));
 			lines.push_back((float)z);
-			lines.push_back(x - dy_x / m);
-			lines.push_back(getHeight(x, z) + 2 / m);
-			lines.push_back(z - dy_z / m);
+			lines.push_back(x + nx);
+			lines.push_back(getHeight(x, z) + ny);
+			lines.push_back(z + nz);
 		}
 
-	// Prepare Vertex Buffer
-    glGenBuffers(1, &m_vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
+	// Prepare Vertex Buffer for Visualisation of Normal Vectors
+	C3dglResourceLedger::OWNER owner(getName());
+	glGenBuffers(1, &m_linesBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, m_linesBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * lines.size(), &lines[0], GL_STATIC_DRAW);
+}
 
-	// Prepare Normal Buffer
-    glGenBuffers(1, &m_normalBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, m_normalBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * normals.size(), &normals[0], GL_STATIC_DRAW);
+void C3dglTerrain::getNormal(int x, int z, float &nx, float &ny, float &nz)
+{
+	int minx = -m_nSizeX / 2;
+	int minz = -m_nSizeZ / 2;
+	int x0 = (x == minx) ? x : x - 1;
+	int x1 = (x == minx + m_nSizeX - 1) ? x : x + 1;
+	int z0 = (z == minz) ? z : z - 1;
+	int z1 = (z == minz + m_nSizeZ - 1) ? z : z + 1;
+
+	float n[3];
+	computeNormal(getHeight(x1, z) - getHeight(x0, z), getHeight(x, z1) - getHeight(x, z0), n);
+	nx = n[0];
+	ny = n[1];
+	nz = n[2];
+}
 
-	// Prepare TexCoords Buffer
-	glGenBuffers(1, &m_texCoordBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * texCoords.size(), &texCoords[0], GL_STATIC_DRAW);
+int C3dglTerrain::buildQuadtree(int cx0, int cz0, int cx1, int cz1)
+{
+	int iNode = m_nodes.size();
+	m_nodes.push_back(NODE());
 
-	// Prepare Vertex Buffer for Visualisation of Normal Vectors
-    glGenBuffers(1, &m_linesBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, m_linesBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * lines.size(), &lines[0], GL_STATIC_DRAW);
-
-	// Generate Indices
-	
-    /*
-        We loop through building the triangles that
-        make up each grid square in the heightmap
-
-        (z*w+x) *----* (z*w+x+1)
-                |   /|
-                |  / |
-                | /  |
-     ((z+1)*w+x)*----* ((z+1)*w+x+1)
-    */
-    //Generate the triangle indices
-	vector<unsigned int> indices;
-	for (int z = 0; z < m_nSizeZ - 1; ++z)
-		for (int x = 0; x < m_nSizeX - 1; ++x)
+	NODE node;
+	node.firstChunk = m_chunks.size();
+	node.children[0] = node.children[1] = node.children[2] = node.children[3] = -1;
+
+	if (cx1 - cx0 == 1 && cz1 - cz0 == 1)
+	{
+		// a leaf: single chunk
+		CHUNK chunk;
+		chunk.x0 = cx0 * m_nChunkSize;
+		chunk.z0 = cz0 * m_nChunkSize;
+		chunk.x1 = std::min(chunk.x0 + m_nChunkSize, m_nSizeX - 1);
+		chunk.z1 = std::min(chunk.z0 + m_nChunkSize, m_nSizeZ - 1);
+
+		// find the height range
+		float minY = m_heights[chunk.x0 * m_nSizeZ + chunk.z0], maxY = minY;
+		for (int x = chunk.x0; x <= chunk.x1; x++)
+			for (int z = chunk.z0; z <= chunk.z1; z++)
+			{
+				minY = std::min(minY, m_heights[x * m_nSizeZ + z]);
+				maxY = std::max(maxY, m_heights[x * m_nSizeZ + z]);
+			}
+
+		chunk.bb[0][0] = (float)(chunk.x0 - m_nSizeX / 2); chunk.bb[0][1] = minY; chunk.bb[0][2] = (float)(chunk.z0 - m_nSizeZ / 2);
+		chunk.bb[1][0] = (float)(chunk.x1 - m_nSizeX / 2); chunk.bb[1][1] = maxY; chunk.bb[1][2] = (float)(chunk.z1 - m_nSizeZ / 2);
+		chunk.firstVertex = chunk.numVertices = 0;
+		for (int l = 0; l < MAX_LOD; l++)
+			chunk.firstIndex[l] = chunk.numIndices[l] = chunk.numTriangles[l] = 0;
+		memcpy(node.bb, chunk.bb, sizeof(node.bb));
+		m_chunks.push_back(chunk);
+	}
+	else
+	{
+		// split into (up to) four quadrants
+		int xs[] = { cx0, (cx0 + cx1 + 1) / 2, cx1 };
+		int zs[] = { cz0, (cz0 + cz1 + 1) / 2, cz1 };
+		int n = 0;
+		for (int i = 0; i < 2; i++)
+			for (int j = 0; j < 2; j++)
+				if (xs[i] < xs[i + 1] && zs[j] < zs[j + 1])
+					node.children[n++] = buildQuadtree(xs[i], zs[j], xs[i + 1], zs[j + 1]);
+
+		// the bounding box encloses all the children
+		memcpy(node.bb, m_nodes[node.children[0]].bb, sizeof(node.bb));
+		for (int i = 1; i < n; i++)
+			for (int k = 0; k < 3; k++)
+			{
+				node.bb[0][k] = std::min(node.bb[0][k], m_nodes[node.children[i]].bb[0][k]);
+				node.bb[1][k] = std::max(node.bb[1][k], m_nodes[node.children[i]].bb[1][k]);
+			}
+	}
+
+	node.numChunks = m_chunks.size() - node.firstChunk;
+	m_nodes[iNode] = node;
+	return iNode;
+}
+
+// height of the chunk surface at the chunk-local grid point (lx, lz), when rendered with the given grid stride
+float C3dglTerrain::getLodHeight(const CHUNK &chunk, int stride, int lx, int lz)
+{
+	int nx = chunk.x1 - chunk.x0, nz = chunk.z1 - chunk.z0;
+
+	// the grid cell containing the point
+	int ax = std::min(lx / stride * stride, nx), bx = std::min(ax + stride, nx);
+	int az = std::min(lz / stride * stride, nz), bz = std::min(az + stride, nz);
+	float u = (bx > ax) ? (float)(lx - ax) / (bx - ax) : 0;
+	float v = (bz > az) ? (float)(lz - az) / (bz - az) : 0;
+
+	auto h = [&](int x, int z) { return m_heights[(chunk.x0 + x) * m_nSizeZ + chunk.z0 + z]; };
+
+	// the cell is split along the (ax, bz) - (bx, az) diagonal, like the index buffer
+	if (u + v <= 1)
+		return h(ax, az) + u * (h(bx, az) - h(ax, az)) + v * (h(ax, bz) - h(ax, az));
+	else
+		return h(bx, bz) + (1 - u) * (h(ax, bz) - h(bx, bz)) + (1 - v) * (h(bx, az) - h(bx, bz));
+}
+
+// the coarsest LOD level the chunk-local grid point (lx, lz) belongs to
+int C3dglTerrain::getVertexLevel(const CHUNK &chunk, int lx, int lz)
+{
+	int nx = chunk.x1 - chunk.x0, nz = chunk.z1 - chunk.z0;
+	int level = 0;
+	while (level + 1 < m_nLevels && (lx % (2 << level) == 0 || lx == nx) && (lz % (2 << level) == 0 || lz == nz))
+		level++;
+	return level;
+}
+
+// converts a float format vertex to the compact format; heights beyond the quantisation range are clamped
+C3dglTerrain::COMPACT_VERTEX C3dglTerrain::compactVertex(const float *pVertex, const float *pNormal, const float *pMorph)
+{
+	auto quantise = [this](float y) { return (short)std::min(std::max(std::floor(y / m_fHeightQuantum + 0.5f), -32767.f), 32767.f); };
+
+	COMPACT_VERTEX v;
+	v.x = (short)pVertex[0];
+	v.y = quantise(pVertex[1]);
+	v.z = (short)pVertex[2];
+	v.morph = quantise(pMorph[0]);
+	v.level = (short)pMorph[1];
+
+	// octahedral encoding of the normal (y axis up)
+	float nx = pNormal[0], ny = pNormal[1], nz = pNormal[2];
+	float l1 = std::abs(nx) + std::abs(ny) + std::abs(nz);
+	float px = nx / l1, pz = nz / l1;
+	if (ny < 0)
+	{
+		float qx = (1 - std::abs(pz)) * (px >= 0 ? 1 : -1);
+		float qz = (1 - std::abs(px)) * (pz >= 0 ? 1 : -1);
+		px = qx; pz = qz;
+	}
+	v.normal[0] = (signed char)floor(px * 127 + 0.5f);
+	v.normal[1] = (signed char)floor(pz * 127 + 0.5f);
+	return v;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Terrain Editing
+// Only the vertices whose data depend on the modified heights are rebuilt and uploaded: the normals depend
+// on the neighbouring samples, the morph targets on the corners of the LOD cells around.
+// The LOD errors and the skirt depth are not recalculated.
+
+void C3dglTerrain::addHeight(float x, float z, float radius, float delta)
+{
+	applyBrush(x, z, radius, [delta](float h, float w) { return h + w * delta; });
+}
+
+void C3dglTerrain::setHeight(float x, float z, float radius, float height)
+{
+	applyBrush(x, z, radius, [height](float h, float w) { return h + w * (height - h); });
+}
+
+// brush(h, w) returns the new height for the height h and the brush weight w (1 in the centre, 0 at the radius)
+void C3dglTerrain::applyBrush(float x, float z, float radius, const std::function<float(float, float)> &brush)
+{
+	int x0 = (int)std::floor(x - radius), x1 = (int)std::ceil(x + radius);
+	int z0 = (int)std::floor(z - radius), z1 = (int)std::ceil(z + radius);
+	for (int ix = std::max(x0, -m_nSizeX / 2); ix <= std::min(x1, m_nSizeX - 1 - m_nSizeX / 2); ix++)
+		for (int iz = std::max(z0, -m_nSizeZ / 2); iz <= std::min(z1, m_nSizeZ - 1 - m_nSizeZ / 2); iz++)
 		{
-			indices.push_back(x * m_nSizeZ + z); // current point
-			indices.push_back(x * m_nSizeZ + z + 1); // next row
-			indices.push_back((x + 1) * m_nSizeZ + z); // same row, next col
+			float d = std::sqrt((ix - x) * (ix - x) + (iz - z) * (iz - z));
+			if (d >= radius)
+				continue;
+			float &h = m_heights[(size_t)(ix + m_nSizeX / 2) * m_nSizeZ + iz + m_nSizeZ / 2];
+			h = brush(h, 0.5f + 0.5f * std::cos(3.14159265f * d / radius));
+		}
+	updateHeights(x0, z0, x1, z1);
+}
 
-			indices.push_back(x * m_nSizeZ + z + 1); // next row
-			indices.push_back((x + 1) * m_nSizeZ + z + 1); //next row, next col
-			indices.push_back((x + 1) * m_nSizeZ + z); // same row, next col
+void C3dglTerrain::updateHeights(int x0, int z0, int x1, int z1)
+{
+	// local to height map coordinates
+	x0 = std::max(x0 + m_nSizeX / 2, 0); x1 = std::min(x1 + m_nSizeX / 2, m_nSizeX - 1);
+	z0 = std::max(z0 + m_nSizeZ / 2, 0); z1 = std::min(z1 + m_nSizeZ / 2, m_nSizeZ - 1);
+	if (x0 > x1 || z0 > z1 || m_nodes.empty())
+		return;
+
+	m_heightField.update(x0, z0, x1, z1);
+	if (m_bHeightTexture)
+		uploadHeightTexture(x0, z0, x1, z1);
+	updateNode(0, x0, z0, x1, z1);
+
+	// the normal vectors visualisation is rebuilt when next rendered
+	if (m_linesBuffer) glDeleteBuffers(1, &m_linesBuffer);
+	m_linesBuffer = 0;
+}
+
+// updates the chunks around the modified rectangle (height map coordinates, inclusive), then refits the bounding boxes
+void C3dglTerrain::updateNode(int iNode, int x0, int z0, int x1, int z1)
+{
+	// vertices up to a cell of the coarsest level away may depend on the modified heights
+	int border = std::max(1, (1 << (m_nLevels - 1)) - 1);
+	NODE &node = m_nodes[iNode];
+	if (node.bb[1][0] + m_nSizeX / 2 < x0 - border || node.bb[0][0] + m_nSizeX / 2 > x1 + border
+		|| node.bb[1][2] + m_nSizeZ / 2 < z0 - border || node.bb[0][2] + m_nSizeZ / 2 > z1 + border)
+		return;
+
+	if (node.children[0] < 0)
+	{
+		updateChunk(m_chunks[node.firstChunk], x0, z0, x1, z1, border);
+		memcpy(node.bb, m_chunks[node.firstChunk].bb, sizeof(node.bb));
+		return;
+	}
+
+	for (int i = 0; i < 4 && node.children[i] >= 0; i++)
+		updateNode(node.children[i], x0, z0, x1, z1);
+	memcpy(node.bb, m_nodes[node.children[0]].bb, sizeof(node.bb));
+	for (int i = 1; i < 4 && node.children[i] >= 0; i++)
+		for (int k = 0; k < 3; k++)
+		{
+			node.bb[0][k] = std::min(node.bb[0][k], m_nodes[node.children[i]].bb[0][k]);
+			node.bb[1][k] = std::max(node.bb[1][k], m_nodes[node.children[i]].bb[1][k]);
 		}
+}
 
-	// Prepare Index Buffer
-    glGenBuffers(1, &m_indexBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), &indices[0], GL_STATIC_DRAW);
+void C3dglTerrain::updateChunk(CHUNK &chunk, int x0, int z0, int x1, int z1, int border)
+{
+	int nx = chunk.x1 - chunk.x0, nz = chunk.z1 - chunk.z0;
+
+	// the height range
+	if (x0 <= chunk.x1 && x1 >= chunk.x0 && z0 <= chunk.z1 && z1 >= chunk.z0)
+	{
+		float minY = m_heights[chunk.x0 * m_nSizeZ + chunk.z0], maxY = minY;
+		for (int x = chunk.x0; x <= chunk.x1; x++)
+			for (int z = chunk.z0; z <= chunk.z1; z++)
+			{
+				minY = std::min(minY, m_heights[x * m_nSizeZ + z]);
+				maxY = std::max(maxY, m_heights[x * m_nSizeZ + z]);
+			}
+		chunk.bb[0][1] = minY;
+		chunk.bb[1][1] = maxY;
+	}
+	if (m_bHeightTexture)
+		return;
+
+	// the vertices to rebuild (chunk-local)
+	int lx0 = std::max(x0 - border - chunk.x0, 0), lx1 = std::min(x1 + border - chunk.x0, nx);
+	int lz0 = std::max(z0 - border - chunk.z0, 0), lz1 = std::min(z1 + border - chunk.z0, nz);
+	if (lx0 > lx1 || lz0 > lz1)
+		return;
+	// entire columns if that takes less than twice the data - a single upload
+	if (2 * (lz1 - lz0 + 1) > nz + 1)
+	{
+		lz0 = 0;
+		lz1 = nz;
+	}
+
+	// vertex data - as loadHeightmap, column by column (x), each column being contiguous in the vertex block
+	int minx = -m_nSizeX / 2, minz = -m_nSizeZ / 2;
+	int nColumn = lz1 - lz0 + 1, nColumns = lx1 - lx0 + 1;
+	vector<float> vertices(nColumns * nColumn * 3), normals(nColumns * nColumn * 3), morphs(nColumns * nColumn * 2);
+	for (int lx = lx0, i = 0; lx <= lx1; lx++)
+		for (int lz = lz0; lz <= lz1; lz++, i++)
+		{
+			int x = minx + chunk.x0 + lx, z = minz + chunk.z0 + lz;
+			float h = m_heights[(chunk.x0 + lx) * m_nSizeZ + chunk.z0 + lz];
+			vertices[i * 3] = (float)x;
+			vertices[i * 3 + 1] = h;
+			vertices[i * 3 + 2] = (float)z;
+			getNormal(x, z, normals[i * 3], normals[i * 3 + 1], normals[i * 3 + 2]);
+			int level = getVertexLevel(chunk, lx, lz);
+			morphs[i * 2] = level + 1 < m_nLevels ? getLodHeight(chunk, 2 << level, lx, lz) : h;
+			morphs[i * 2 + 1] = (float)level;
+		}
+	if (lz0 == 0 && lz1 == nz)
+		uploadVertices(chunk.firstVertex + lx0 * (nz + 1), nColumns * nColumn, &vertices[0], &normals[0], &morphs[0]);
+	else
+		for (int c = 0; c < nColumns; c++)
+			uploadVertices(chunk.firstVertex + (lx0 + c) * (nz + 1) + lz0, nColumn, &vertices[c * nColumn * 3], &normals[c * nColumn * 3], &morphs[c * nColumn * 2]);
 
-    return true;
+	// the skirts along the edges within the rectangle: copies of the edge vertices, lowered by m_fSkirtDepth
+	unsigned skirt = chunk.firstVertex + (nx + 1) * (nz + 1);
+	auto uploadSkirt = [&](unsigned first, int lx, int lz, int dx, int dz, int n)
+	{
+		vector<float> skirtVertices, skirtNormals, skirtMorphs;
+		for (int j = 0; j < n; j++)
+		{
+			int i = (lx + dx * j - lx0) * nColumn + lz + dz * j - lz0;
+			skirtVertices.insert(skirtVertices.end(), { vertices[i * 3], vertices[i * 3 + 1] - m_fSkirtDepth, vertices[i * 3 + 2] });
+			skirtNormals.insert(skirtNormals.end(), &normals[i * 3], &normals[i * 3 + 3]);
+			skirtMorphs.insert(skirtMorphs.end(), { morphs[i * 2] - m_fSkirtDepth, morphs[i * 2 + 1] });
+		}
+		uploadVertices(first, n, &skirtVertices[0], &skirtNormals[0], &skirtMorphs[0]);
+	};
+	if (lz0 == 0)  uploadSkirt(skirt + lx0, lx0, 0, 1, 0, nColumns);
+	if (lz1 == nz) uploadSkirt(skirt + nx + 1 + lx0, lx0, nz, 1, 0, nColumns);
+	if (lx0 == 0)  uploadSkirt(skirt + 2 * (nx + 1) + lz0, 0, lz0, 0, 1, nColumn);
+	if (lx1 == nx) uploadSkirt(skirt + 2 * (nx + 1) + nz + 1 + lz0, nx, lz0, 0, 1, nColumn);
+}
+
+// uploads count float format vertices (positions, normals, morph data) to the vertex buffer(s), starting at the first vertex
+void C3dglTerrain::uploadVertices(unsigned first, unsigned count, const float *pVertices, const float *pNormals, const float *pMorphs)
+{
+	if (m_bCompact)
+	{
+		vector<COMPACT_VERTEX> compact(count);
+		for (unsigned i = 0; i < count; i++)
+			compact[i] = compactVertex(pVertices + i * 3, pNormals + i * 3, pMorphs + i * 2);
+		glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(COMPACT_VERTEX) * first, sizeof(COMPACT_VERTEX) * count, &compact[0]);
+	}
+	else
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 3 * first, sizeof(GLfloat) * 3 * count, pVertices);
+		glBindBuffer(GL_ARRAY_BUFFER, m_normalBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 3 * first, sizeof(GLfloat) * 3 * count, pNormals);
+		glBindBuffer(GL_ARRAY_BUFFER, m_morphBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 2 * first, sizeof(GLfloat) * 2 * count, pMorphs);
+	}
 }
 
 bool C3dglTerrain::storeAsOBJ(const std::string filename)
@@ -256,17 +1106,11 @@ bool C3dglTerrain::storeAsOBJ(const std::string filename)
 			vertices.push_back(getHeight(x, z));
 			vertices.push_back((float)z);
 
-			int x0 = (x == minx) ? x : x - 1;
-			int x1 = (x == minx + m_nSizeX - 1) ? x : x + 1;
-			int z0 = (z == minz) ? z : z - 1;
-			int z1 = (z == minz + m_nSizeZ - 1) ? z : z + 1;
-
-			float dy_x = getHeight(x1, z) - getHeight(x0, z);
-			float dy_z = getHeight(x, z1) - getHeight(x, z0);
-			float m = sqrt(dy_x * dy_x + 4 + dy_z * dy_z);
-			normals.push_back(-dy_x / m);
-			normals.push_back(2 / m);
-			normals.push_back(-dy_z / m);
+			float nx, ny, nz;
+			getNormal(x, z, nx, ny, nz);
+			normals.push_back(nx);
+			normals.push_back(ny);
+			normals.push_back(nz);
 
 			texCoords.push_back((float)x / 2.f);
 			texCoords.push_back((float)z / 2.f);
@@ -323,8 +1167,462 @@ bool C3dglTerrain::storeAsRAW(const std::string filename)
 	return true;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Baked Terrain Cache
+// File layout: BAKED_HEADER, then the heights, chunks, nodes, vertex data (as in the vertex buffers)
+// and indices - each section aligned to 16 bytes, at the offsets given in the header
+
+struct C3dglTerrain::BAKED_HEADER
+{
+	char magic[4];							// "3DTB"
+	unsigned version;
+	unsigned long long hash;				// hash of the source image
+	// build settings
+	float scaleHeight;
+	int chunkSize, levels, compact;			// levels: as requested with setLodLevels
+	int indexMode, heightTexture;
+	unsigned chunkBytes, nodeBytes, vertexBytes;	// sizes of the structures, to detect layout changes
+	// terrain data
+	int sizeX, sizeZ, nLevels;
+	float lodError[MAX_LOD];
+	float chunkDiag, skirtDepth, heightQuantum;
+	unsigned nVertices, nChunks, nNodes, indexSize;
+	unsigned long long nIndices;
+	unsigned long long offsHeights, offsChunks, offsNodes, offsVertices, offsIndices, fileSize;
+};
+
+static const unsigned BAKED_VERSION = 3;
+
+// FNV-1a hash of the file contents (0 if the file cannot be read)
+unsigned long long C3dglTerrain::hashFile(const std::string filename)
+{
+	C3dglMappedFile file;
+	if (!file.open(filename))
+		return 0;
+	const unsigned char *p = (const unsigned char*)file.getData();
+	unsigned long long hash = 14695981039346656037ull;
+	for (size_t i = 0; i < file.getSize(); i++)
+		hash = (hash ^ p[i]) * 1099511628211ull;
+	return hash ? hash : 1;
+}
+
+bool C3dglTerrain::loadBaked(const std::string filename, unsigned long long hash, float scaleHeight)
+{
+	// the cache may be missing - open it quietly
+	std::ifstream test(filename, std::ios::binary);
+	if (!test)
+		return false;
+	test.close();
+
+	C3dglMappedFile file;
+	if (!file.open(filename) || file.getSize() < sizeof(BAKED_HEADER))
+		return false;
+	const char *pData = (const char*)file.getData();
+	BAKED_HEADER header;
+	memcpy(&header, pData, sizeof(header));
+	bool bValid = memcmp(header.magic, "3DTB", 4) == 0 && header.version == BAKED_VERSION && header.fileSize == file.getSize()
+		&& header.chunkBytes == sizeof(CHUNK) && header.nodeBytes == sizeof(NODE) && header.vertexBytes == sizeof(COMPACT_VERTEX)
+		&& header.sizeX > 0 && header.sizeZ > 0 && header.chunkSize > 0 && header.nLevels >= 1 && header.nLevels <= MAX_LOD
+		&& (header.indexSize == 2 || header.indexSize == 4);
+
+	// the sections must lie within the file, aligned, in the order written and not overlapping;
+	// the counts are checked against the room left before they are multiplied, so nothing overflows
+	unsigned bytesPerVertex = header.heightTexture ? 0 : header.compact ? sizeof(COMPACT_VERTEX) : sizeof(GLfloat) * (3 + 3 + 2 + 2);
+	struct { unsigned long long offset, count, size; } sections[] =
+	{
+		{ header.offsHeights, (unsigned long long)header.sizeX * header.sizeZ, sizeof(float) },
+		{ header.offsChunks, header.nChunks, sizeof(CHUNK) },
+		{ header.offsNodes, header.nNodes, sizeof(NODE) },
+		{ header.offsVertices, header.nVertices, bytesPerVertex },
+		{ header.offsIndices, header.nIndices, header.indexSize },
+	};
+	unsigned long long end = sizeof(BAKED_HEADER);
+	for (auto &section : sections)
+	{
+		if (!bValid || section.offset < end || section.offset > header.fileSize || section.offset % 16
+			|| (section.size && section.count > (header.fileSize - section.offset) / section.size))
+			bValid = false;
+		else
+			end = section.offset + section.count * section.size;
+	}
+
+	// the chunks must tile the height map and their ranges lie within the buffers; the nodes
+	// refer to chunks in range and to children after them (depth-first), so the tree has no cycles
+	if (bValid)
+	{
+		unsigned long long nChunksX = (header.sizeX - 2) / header.chunkSize + 1, nChunksZ = (header.sizeZ - 2) / header.chunkSize + 1;
+		bValid = header.nNodes > 0 && header.nChunks == nChunksX * nChunksZ;
+		const CHUNK *pChunks = (const CHUNK*)(pData + header.offsChunks);
+		for (unsigned i = 0; bValid && i < header.nChunks; i++)
+		{
+			const CHUNK &chunk = pChunks[i];
+			bValid = chunk.x0 >= 0 && chunk.x0 <= chunk.x1 && chunk.x1 - chunk.x0 <= header.chunkSize && chunk.x1 < header.sizeX
+				&& chunk.z0 >= 0 && chunk.z0 <= chunk.z1 && chunk.z1 - chunk.z0 <= header.chunkSize && chunk.z1 < header.sizeZ
+				&& (unsigned long long)chunk.firstVertex + chunk.numVertices <= header.nVertices;
+			for (int l = 0; bValid && l < header.nLevels; l++)
+				bValid = (unsigned long long)chunk.firstIndex[l] + chunk.numIndices[l] <= header.nIndices;
+		}
+		const NODE *pNodes = (const NODE*)(pData + header.offsNodes);
+		for (unsigned i = 0; bValid && i < header.nNodes; i++)
+		{
+			const NODE &node = pNodes[i];
+			bValid = (unsigned long long)node.firstChunk + node.numChunks <= header.nChunks && (node.children[0] >= 0 || node.numChunks > 0);
+			for (int j = 0; bValid && j < 4; j++)
+				bValid = node.children[j] == -1 || (node.children[j] > (int)i && (unsigned)node.children[j] < header.nNodes);
+		}
+	}
+
+	if (!bValid)
+	{
+		logWarning(filename + " is not a valid baked terrain - rebuilding");
+		return false;
+	}
+	if (header.hash != hash || header.scaleHeight != scaleHeight || header.chunkSize != m_nChunkSize || header.levels != m_nLevels || header.compact != (int)m_bCompact
+		|| header.indexMode != m_indexMode || header.heightTexture != (int)m_bHeightTexture)
+	{
+		logInfo(filename + " is out of date - rebuilding");
+		return false;
+	}
+
+	m_nSizeX = header.sizeX;
+	m_nSizeZ = header.sizeZ;
+	m_fScaleHeight = header.scaleHeight;
+	m_nLevels = header.nLevels;
+	memcpy(m_lodError, header.lodError, sizeof(m_lodError));
+	m_fChunkDiag = header.chunkDiag;
+	m_fSkirtDepth = header.skirtDepth;
+	m_fHeightQuantum = header.heightQuantum;
+	m_nVertices = header.nVertices;
+	m_nIndexSize = header.indexSize;
+
+	const float *pHeights = (const float*)(pData + header.offsHeights);
+	m_heights.assign(pHeights, pHeights + (size_t)m_nSizeX * m_nSizeZ);
+	m_heightField.create(&m_heights[0], m_nSizeX, m_nSizeZ);
+	const CHUNK *pChunks = (const CHUNK*)(pData + header.offsChunks);
+	m_chunks.assign(pChunks, pChunks + header.nChunks);
+	const NODE *pNodes = (const NODE*)(pData + header.offsNodes);
+	m_nodes.assign(pNodes, pNodes + header.nNodes);
+
+	// straight from the mapped file into the buffers
+	createBuffers(pData + header.offsVertices, pData + header.offsIndices, (size_t)header.nIndices);
+	return true;
+}
+
+bool C3dglTerrain::storeBaked(const std::string filename, unsigned long long hash, int levels, const void *pVertexData, const void *pIndices, size_t nIndices)
+{
+	BAKED_HEADER header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "3DTB", 4);
+	header.version = BAKED_VERSION;
+	header.hash = hash;
+	header.scaleHeight = m_fScaleHeight;
+	header.chunkSize = m_nChunkSize;
+	header.levels = levels;
+	header.compact = m_bCompact;
+	header.indexMode = m_indexMode;
+	header.heightTexture = m_bHeightTexture;
+	header.chunkBytes = sizeof(CHUNK);
+	header.nodeBytes = sizeof(NODE);
+	header.vertexBytes = sizeof(COMPACT_VERTEX);
+	header.sizeX = m_nSizeX;
+	header.sizeZ = m_nSizeZ;
+	header.nLevels = m_nLevels;
+	memcpy(header.lodError, m_lodError, sizeof(m_lodError));
+	header.chunkDiag = m_fChunkDiag;
+	header.skirtDepth = m_fSkirtDepth;
+	header.heightQuantum = m_fHeightQuantum;
+	header.nVertices = m_nVertices;
+	header.nChunks = m_chunks.size();
+	header.nNodes = m_nodes.size();
+	header.nIndices = nIndices;
+	header.indexSize = m_nIndexSize;
+
+	// sections and their offsets
+	struct { const void *p; size_t size; unsigned long long *pOffset; } sections[] =
+	{
+		{ &m_heights[0], m_heights.size() * sizeof(float), &header.offsHeights },
+		{ &m_chunks[0], m_chunks.size() * sizeof(CHUNK), &header.offsChunks },
+		{ &m_nodes[0], m_nodes.size() * sizeof(NODE), &header.offsNodes },
+		{ pVertexData, (size_t)m_nVertices * m_nBytesPerVertex, &header.offsVertices },
+		{ pIndices, nIndices * m_nIndexSize, &header.offsIndices },
+	};
+	unsigned long long offset = sizeof(header);
+	for (auto &section : sections)
+	{
+		offset = (offset + 15) & ~15ull;
+		*section.pOffset = offset;
+		offset += section.size;
+	}
+	header.fileSize = offset;
+
+	std::ofstream file(filename, std::ios::out | std::ios::binary);
+	file.write((const char*)&header, sizeof(header));
+	unsigned long long pos = sizeof(header);
+	for (auto &section : sections)
+	{
+		static const char zeros[16] = { 0 };
+		file.write(zeros, *section.pOffset - pos);
+		file.write((const char*)section.p, section.size);
+		pos = *section.pOffset + section.size;
+	}
+	if (!file.good())
+	{
+		logWarning("cannot write the baked terrain " + filename);
+		return false;
+	}
+	logInfo("baked into " + filename);
+	return true;
+}
+
+void C3dglTerrain::setupLod(glm::mat4 matrix, glm::mat4 matrixProjection, float lodBudget, int nViewportHeight)
+{
+	m_bLod = lodBudget > 0 && nViewportHeight > 0 && m_nLevels > 1;
+	for (int l = 0; l < MAX_LOD; l++)
+		m_lodRange[l] = 0;
+	if (!m_bLod)
+		return;
+
+	// eye position in local coordinates
+	m_lodEye = glm::vec3(glm::inverse(matrix)[3]);
+
+	// screen-space error of a geometric error e at the distance d is e * K / d pixels
+	float K = matrixProjection[1][1] * nViewportHeight / 2;
+
+	// level L is used up to the distance where level L+1 fits in the budget;
+	// consecutive ranges are at least 1.5 chunk apart, so that neighbouring chunks differ by one level at most
+	float prev = 0;
+	for (int l = 0; l < m_nLevels - 1; l++)
+	{
+		float range = m_lodError[l + 1] * K / lodBudget;
+		if (l > 0) range = std::max(range, prev + 1.5f * m_fChunkDiag);
+		m_lodRange[l] = prev = range;
+	}
+	m_lodRange[m_nLevels - 1] = FLT_MAX;
+}
+
+int C3dglTerrain::selectLevel(const CHUNK &chunk)
+{
+	if (!m_bLod)
+		return 0;
+
+	// distance from the eye to the chunk bounding box
+	glm::vec3 p = glm::clamp(m_lodEye, glm::vec3(chunk.bb[0][0], chunk.bb[0][1], chunk.bb[0][2]), glm::vec3(chunk.bb[1][0], chunk.bb[1][1], chunk.bb[1][2]));
+	float d = glm::distance(m_lodEye, p);
+
+	int l = 0;
+	while (l < m_nLevels - 1 && d >= m_lodRange[l])
+		l++;
+	return l;
+}
+
+void C3dglTerrain::cullNode(int iNode, const C3dglFrustum &frustum)
+{
+	const NODE &node = m_nodes[iNode];
+	switch (frustum.testAABB(node.bb[0], node.bb[1]))
+	{
+	case C3dglFrustum::OUTSIDE:
+		m_nChunksCulled += node.numChunks;
+		break;
+	case C3dglFrustum::INSIDE:
+		addChunks(node.firstChunk, node.numChunks);
+		break;
+	case C3dglFrustum::INTERSECT:
+		if (node.children[0] < 0)
+			addChunks(node.firstChunk, node.numChunks);
+		else
+			for (int i = 0; i < 4 && node.children[i] >= 0; i++)
+				cullNode(node.children[i], frustum);
+		break;
+	}
+}
+
+void C3dglTerrain::addChunks(unsigned firstChunk, unsigned numChunks)
+{
+	if (numChunks == 0) return;
+	m_nChunksDrawn += numChunks;
+
+	// each chunk at its own level; chunks are stored in the depth-first order,
+	// so at a single level their index ranges are contiguous (and merged if lists)
+	for (unsigned i = firstChunk; i < firstChunk + numChunks; i++)
+		addRange(m_chunks[i], m_bLod ? selectLevel(m_chunks[i]) : 0);
+}
+
+void C3dglTerrain::addRange(const CHUNK &chunk, int level)
+{
+	unsigned first = chunk.firstIndex[level], count = chunk.numIndices[level];
+	m_nTrianglesDrawn += chunk.numTriangles[level];
+
+	// height field texture: an instance of the patch
+	if (m_bHeightTexture)
+	{
+		m_patches[level].push_back(glm::vec4(chunk.x0, chunk.z0, chunk.x1 - chunk.x0, chunk.z1 - chunk.z0));
+		return;
+	}
+
+	// merge lists with the previous range if adjacent; strips are relative to the chunk vertex block
+	if (m_indexMode == INDEX_LIST && !m_drawFirst.empty() && m_drawFirst.back() + m_drawCount.back() == first)
+		m_drawCount.back() += count;
+	else
+	{
+		m_drawFirst.push_back(first);
+		m_drawCount.push_back(count);
+		m_drawBaseVertex.push_back(m_indexMode == INDEX_LIST ? 0 : chunk.firstVertex);
+	}
+}
+
+void C3dglTerrain::drawRanges()
+{
+	GLenum type = (m_nIndexSize == 2) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	if (m_indexMode == INDEX_STRIPS)
+	{
+		glEnable(GL_PRIMITIVE_RESTART);
+		glPrimitiveRestartIndex(m_nIndexSize == 2 ? 0xFFFF : 0xFFFFFFFF);
+		glMultiDrawElementsBaseVertex(GL_TRIANGLE_STRIP, &m_drawCount[0], type, &m_drawOffset[0], m_drawCount.size(), &m_drawBaseVertex[0]);
+		glDisable(GL_PRIMITIVE_RESTART);
+	}
+	else
+		glMultiDrawElements(GL_TRIANGLES, &m_drawCount[0], type, &m_drawOffset[0], m_drawCount.size());
+}
+
+void C3dglTerrain::render(glm::mat4 matrix, glm::mat4 matrixProjection, float lodBudget, int nViewportHeight)
+{
+	C3dglProfiler::ZONE zone("C3dglTerrain::render");
+	m_drawFirst.clear();
+	m_drawCount.clear();
+	m_drawBaseVertex.clear();
+	for (auto &patches : m_patches)
+		patches.clear();
+	setupLod(matrix, matrixProjection, lodBudget, nViewportHeight);
+	if (!m_nodes.empty())
+		cullNode(0, C3dglFrustum(matrixProjection * matrix));
+	renderChunks(matrix);
+}
+
 void C3dglTerrain::render(glm::mat4 matrix)
 {
+	C3dglProfiler::ZONE zone("C3dglTerrain::render");
+	m_drawFirst.clear();
+	m_drawCount.clear();
+	m_drawBaseVertex.clear();
+	for (auto &patches : m_patches)
+		patches.clear();
+	setupLod(matrix, matrix, 0, 0);
+	if (!m_nodes.empty())
+		addChunks(0, m_chunks.size());
+	renderChunks(matrix);
+}
+
+// sends the LOD and vertex format uniforms; returns false if the shader does not support them
+bool C3dglTerrain::setupShader(C3dglProgram *pProgram, bool bTerrain)
+{
+	if (pProgram->GetAttribLocation("aMorph") == (GLuint)-1)
+		return false;
+
+	// morphing to the next level takes the last 30% of each level's range
+	GLfloat morph[MAX_LOD][2];
+	for (int l = 0; l < MAX_LOD; l++)
+	{
+		float start = (l > 0) ? m_lodRange[l - 1] : 0;
+		bool bMorph = bTerrain && m_bLod && l < m_nLevels - 1 && m_lodRange[l] > start;
+		morph[l][0] = bMorph ? m_lodRange[l] - 0.3f * (m_lodRange[l] - start) : 0;
+		morph[l][1] = bMorph ? m_lodRange[l] : 0;
+	}
+	pProgram->SendUniform("lodEye", m_lodEye.x, m_lodEye.y, m_lodEye.z);
+	pProgram->SendUniform2v("lodMorph", &morph[0][0], MAX_LOD);
+	pProgram->SendUniform("compact", (bTerrain && m_bCompact) ? 1 : 0);
+	pProgram->SendUniform("heightQuantum", m_fHeightQuantum);
+	pProgram->SendUniform("heightField", (bTerrain && m_bHeightTexture) ? 1 : 0);
+	if (bTerrain && m_bHeightTexture)
+	{
+		pProgram->SendUniform("textureHeight", m_nHeightTextureUnit);
+		pProgram->SendUniform("heightRange", m_fHeightBase, m_fHeightQuantum * 65535);
+		pProgram->SendUniform("lodLevels", m_nLevels);
+		pProgram->SendUniform("skirtDepth", m_fSkirtDepth);
+	}
+	return true;
+}
+
+void C3dglTerrain::renderPatches(glm::mat4 matrix)
+{
+	// all the instances in a single buffer, level by level
+	m_patchData.clear();
+	for (auto &patches : m_patches)
+		m_patchData.insert(m_patchData.end(), patches.begin(), patches.end());
+	if (m_patchData.empty())
+		return;
+
+	// the heights are only available to the shader
+	C3dglProgram *pProgram = C3dglProgram::GetCurrentProgram();
+	GLuint attribPatch = pProgram ? pProgram->GetAttribLocation("aPatch") : (GLuint)-1;
+	if (attribPatch == (GLuint)-1 || !setupShader(pProgram, true))
+	{
+		if (!m_bWarned)
+			logWarning("uses the height field texture but the current shader program does not support it. Consider another shader program.");
+		m_bWarned = true;
+		return;
+	}
+	pProgram->SendStandardUniform(C3dglProgram::UNI_MODELVIEW, matrix);
+	GLuint attribVertex = pProgram->GetAttribLocation(C3dglProgram::ATTR_VERTEX);
+
+	GLint activeTexture;
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &activeTexture);
+	glActiveTexture(GL_TEXTURE0 + m_nHeightTextureUnit);
+	C3dglCallStats::bindTexture(GL_TEXTURE_2D, m_heightTexture);
+	glActiveTexture(activeTexture);
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4) * m_patchData.size(), m_patchData.data(), GL_STREAM_DRAW);
+
+	glEnableVertexAttribArray(attribVertex);
+	glEnableVertexAttribArray(attribPatch);
+	glBindBuffer(GL_ARRAY_BUFFER, m_patchBuffer);
+	glVertexAttribPointer(attribVertex, 3, GL_SHORT, GL_FALSE, 0, 0);
+	glVertexAttribDivisor(attribPatch, 1);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_patchIndexBuffer);
+
+	bool bStrips = m_indexMode == INDEX_STRIPS;
+	GLenum type = (m_nPatchIndexSize == 2) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	if (bStrips)
+	{
+		glEnable(GL_PRIMITIVE_RESTART);
+		glPrimitiveRestartIndex(m_nPatchIndexSize == 2 ? 0xFFFF : 0xFFFFFFFF);
+	}
+
+	// one instanced draw per LOD level
+	size_t first = 0;
+	glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+	for (int l = 0; l < m_nLevels; l++)
+	{
+		if (m_patches[l].empty())
+			continue;
+		glVertexAttribPointer(attribPatch, 4, GL_FLOAT, GL_FALSE, 0, (void*)(first * sizeof(glm::vec4)));
+		glDrawElementsInstanced(bStrips ? GL_TRIANGLE_STRIP : GL_TRIANGLES, m_patchCount[l], type,
+			(void*)((size_t)m_patchFirst[l] * m_nPatchIndexSize), m_patches[l].size());
+		first += m_patches[l].size();
+	}
+
+	if (bStrips)
+		glDisable(GL_PRIMITIVE_RESTART);
+	glVertexAttribDivisor(attribPatch, 0);
+	glDisableVertexAttribArray(attribVertex);
+	glDisableVertexAttribArray(attribPatch);
+}
+
+void C3dglTerrain::renderChunks(glm::mat4 matrix)
+{
+	if (m_bHeightTexture)
+	{
+		renderPatches(matrix);
+		return;
+	}
+	if (m_drawFirst.empty())
+		return;
+
+	// byte offsets into the index buffer
+	m_drawOffset.resize(m_drawFirst.size());
+	for (size_t i = 0; i < m_drawFirst.size(); i++)
+		m_drawOffset[i] = (const void*)((size_t)m_drawFirst[i] * m_nIndexSize);
+
 	// check if a shading program is active
 	C3dglProgram *pProgram = C3dglProgram::GetCurrentProgram();
 
@@ -335,31 +1633,76 @@ void C3dglTerrain::render(glm::mat4 matrix)
 		GLuint attribVertex = pProgram->GetAttribLocation(C3dglProgram::ATTR_VERTEX);
 		GLuint attribNormal = pProgram->GetAttribLocation(C3dglProgram::ATTR_NORMAL);
 		GLuint attribTexCoord = pProgram->GetAttribLocation(C3dglProgram::ATTR_TEXCOORD);
+		GLuint attribMorph = pProgram->GetAttribLocation("aMorph");
+		GLuint attribNormalOct = pProgram->GetAttribLocation("aNormalOct");
 
-		// programmable pipeline
-		glEnableVertexAttribArray(attribVertex);
-		glEnableVertexAttribArray(attribNormal);
-		glEnableVertexAttribArray(attribTexCoord);
-
-		//Bind the vertex array and set the vertex pointer to point at it
-		glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
-		glVertexAttribPointer(attribVertex, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-		// Bind the normal array and set the normal pointer to point at it
-		glBindBuffer(GL_ARRAY_BUFFER, m_normalBuffer);
-		glVertexAttribPointer(attribNormal, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		// LOD morphing and the compact format - only if supported by the shader
+		bool bSupported = setupShader(pProgram, true);
+		if (m_bCompact && !bSupported)
+		{
+			if (!m_bWarned)
+				logWarning("uses the compact vertex format but the current shader program does not support it. Consider another shader program.");
+			m_bWarned = true;
+			return;
+		}
 
-		// Bind the tex coord array and set the tex coord pointer to point at it
-		glBindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer);
-		glVertexAttribPointer(attribTexCoord, 2, GL_FLOAT, GL_FALSE, 0, 0);
+		// programmable pipeline
+		if (m_bCompact)
+		{
+			// interleaved compact vertices
+			glEnableVertexAttribArray(attribVertex);
+			glEnableVertexAttribArray(attribMorph);
+			glEnableVertexAttribArray(attribNormalOct);
+			glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+			glVertexAttribPointer(attribVertex, 3, GL_SHORT, GL_FALSE, sizeof(COMPACT_VERTEX), (void*)offsetof(COMPACT_VERTEX, x));
+			glVertexAttribPointer(attribMorph, 2, GL_SHORT, GL_FALSE, sizeof(COMPACT_VERTEX), (void*)offsetof(COMPACT_VERTEX, morph));
+			glVertexAttribPointer(attribNormalOct, 2, GL_BYTE, GL_TRUE, sizeof(COMPACT_VERTEX), (void*)offsetof(COMPACT_VERTEX, normal));
+		}
+		else
+		{
+			glEnableVertexAttribArray(attribVertex);
+			glEnableVertexAttribArray(attribNormal);
+			glEnableVertexAttribArray(attribTexCoord);
+
+			//Bind the vertex array and set the vertex pointer to point at it
+			glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+			glVertexAttribPointer(attribVertex, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+			// Bind the normal array and set the normal pointer to point at it
+			glBindBuffer(GL_ARRAY_BUFFER, m_normalBuffer);
+			glVertexAttribPointer(attribNormal, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+			// Bind the tex coord array and set the tex coord pointer to point at it
+			glBindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer);
+			glVertexAttribPointer(attribTexCoord, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+			// Bind the morph array (LOD)
+			if (bSupported)
+			{
+				glEnableVertexAttribArray(attribMorph);
+				glBindBuffer(GL_ARRAY_BUFFER, m_morphBuffer);
+				glVertexAttribPointer(attribMorph, 2, GL_FLOAT, GL_FALSE, 0, 0);
+			}
+		}
 
-		//Bind the index array and draw triangles
+		//Bind the index array and draw triangles - one range per group of adjacent visible chunks
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
-		glDrawElements(GL_TRIANGLES, (m_nSizeX - 1) * (m_nSizeZ - 1) * 6, GL_UNSIGNED_INT, 0);
+		drawRanges();
 
-		glDisableVertexAttribArray(attribVertex);
-		glDisableVertexAttribArray(attribNormal);
-		glDisableVertexAttribArray(attribTexCoord);
+		if (m_bCompact)
+		{
+			glDisableVertexAttribArray(attribVertex);
+			glDisableVertexAttribArray(attribMorph);
+			glDisableVertexAttribArray(attribNormalOct);
+		}
+		else
+		{
+			glDisableVertexAttribArray(attribVertex);
+			glDisableVertexAttribArray(attribNormal);
+			glDisableVertexAttribArray(attribTexCoord);
+			if (bSupported)
+				glDisableVertexAttribArray(attribMorph);
+		}
 	}
 	else
 	{
@@ -369,23 +1712,34 @@ void C3dglTerrain::render(glm::mat4 matrix)
 
 		// fixed pipeline rendering
 		glEnableClientState(GL_VERTEX_ARRAY);
-		glEnableClientState(GL_NORMAL_ARRAY);
 
-		//Bind the vertex array and set the vertex pointer to point at it
-		glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
-		glVertexPointer(3, GL_FLOAT, 0, 0);
+		if (m_bCompact)
+		{
+			// compact format: de-quantise heights with the model-view matrix; normals are not available
+			glScalef(1, m_fHeightQuantum, 1);
+			glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+			glVertexPointer(3, GL_SHORT, sizeof(COMPACT_VERTEX), (void*)offsetof(COMPACT_VERTEX, x));
+		}
+		else
+		{
+			glEnableClientState(GL_NORMAL_ARRAY);
 
-		// Bind the normal array and set the normal pointer to point at it
-		glBindBuffer(GL_ARRAY_BUFFER, m_normalBuffer);
-		glNormalPointer(GL_FLOAT, 0, 0);
+			//Bind the vertex array and set the vertex pointer to point at it
+			glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+			glVertexPointer(3, GL_FLOAT, 0, 0);
 
-		// Bind the tex coord array and set the tex coord pointer to point at it
-		glBindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer);
-		glTexCoordPointer(2, GL_FLOAT, 0, 0);
+			// Bind the normal array and set the normal pointer to point at it
+			glBindBuffer(GL_ARRAY_BUFFER, m_normalBuffer);
+			glNormalPointer(GL_FLOAT, 0, 0);
+
+			// Bind the tex coord array and set the tex coord pointer to point at it
+			glBindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer);
+			glTexCoordPointer(2, GL_FLOAT, 0, 0);
+		}
 
-		//Bind the index array and draw triangles
+		//Bind the index array and draw triangles - one range per group of adjacent visible chunks
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
-		glDrawElements(GL_TRIANGLES, (m_nSizeX - 1) * (m_nSizeZ - 1) * 6, GL_UNSIGNED_INT, 0);
+		drawRanges();
 
 		glDisableClientState(GL_VERTEX_ARRAY);
 		glDisableClientState(GL_NORMAL_ARRAY);
@@ -401,18 +1755,24 @@ void C3dglTerrain::render()
 
 void C3dglTerrain::renderNormals()
 {
+	if (!m_linesBuffer)
+		createLinesBuffer();
+
 	// check if a shading program is active
 	C3dglProgram *pProgram = C3dglProgram::GetCurrentProgram();
 	if (pProgram)
 	{
 		GLuint attribVertex = pProgram->GetAttribLocation(C3dglProgram::ATTR_VERTEX);
 
+		// the lines are plain float vertices - switch off LOD morphing and the compact format
+		setupShader(pProgram, false);
+
 		// programmable pipeline
 		glDisable(GL_LIGHTING);
 		glEnableVertexAttribArray(attribVertex);
 		glBindBuffer(GL_ARRAY_BUFFER, m_linesBuffer);
 		glVertexAttribPointer(attribVertex, 3, GL_FLOAT, GL_FALSE, 0, 0);
-		glDrawArrays(GL_LINES, 0, m_nSizeX * m_nSizeZ * 2);
+		C3dglCallStats::drawArrays(GL_LINES, 0, m_nSizeX * m_nSizeZ * 2);
 		glDisableVertexAttribArray(attribVertex);
 		glEnable(GL_LIGHTING);
 	}
@@ -423,7 +1783,7 @@ void C3dglTerrain::renderNormals()
 		glEnableClientState(GL_VERTEX_ARRAY);
 		glBindBuffer(GL_ARRAY_BUFFER, m_linesBuffer);
 		glVertexPointer(3, GL_FLOAT, 0, 0);
-		glDrawArrays(GL_LINES, 0, m_nSizeX * m_nSizeZ * 2);
+		C3dglCallStats::drawArrays(GL_LINES, 0, m_nSizeX * m_nSizeZ * 2);
 		glDisableClientState(GL_VERTEX_ARRAY);
 		glEnable(GL_LIGHTING);
 	}
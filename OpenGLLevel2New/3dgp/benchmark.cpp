@@ -0,0 +1,816 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <map>
+#include "GL/glew.h"
+#include "GL/3dgl.h"
+#include "GL/3dglVertexCache.h"
+#include "GL/glut.h"
+#ifdef BENCHMARK_EGL
+#include <EGL/egl.h>
+#endif
+#include "GL/assimp/cimport.h"
+#include "GL/assimp/scene.h"
+#include "GL/assimp/postprocess.h"
+#include "benchmark.h"
+
+using namespace std;
+using namespace _3dgl;
+
+// best (shortest) time of nRuns runs of f, in milliseconds
+template <class F>
+static double measure(F f, int nRuns = 3)
+{
+	double best = 1e30;
+	for (int i = 0; i < nRuns; i++)
+	{
+		auto t0 = chrono::high_resolution_clock::now();
+		f();
+		auto t1 = chrono::high_resolution_clock::now();
+		best = min(best, chrono::duration<double, milli>(t1 - t0).count());
+	}
+	return best;
+}
+
+// thread counts to test: 1, 2, 4... up to the number of hardware threads
+static vector<int> threadCounts()
+{
+	int nMax = max(1u, thread::hardware_concurrency());
+	vector<int> counts;
+	for (int n = 1; n < nMax; n *= 2)
+		counts.push_back(n);
+	counts.push_back(nMax);
+	return counts;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Heightmap ingestion: heights and normal vectors for 1k, 4k and 16k synthetic height maps
+// Compares the original single-threaded loops with C3dglTerrain::computeHeights/computeNormals
+
+static int benchHeightmap(const vector<string> &params)
+{
+	vector<int> sizes;
+	for (const string &param : params)
+		sizes.push_back(atoi(param.c_str()));
+	if (sizes.empty())
+		sizes = { 1024, 4096, 16384 };
+
+	cout << "Heightmap ingestion (" << thread::hardware_concurrency() << " hardware threads)" << endl;
+	cout << setw(7) << "size" << setw(9) << "threads" << setw(13) << "heights ms" << setw(13) << "normals ms"
+		<< setw(11) << "total ms" << setw(12) << "Msample/s" << setw(9) << "speedup" << endl;
+
+	int nErrors = 0;
+	for (int size : sizes)
+	{
+		try
+		{
+			size_t N = (size_t)size * size;
+			int nRuns = size <= 4096 ? 3 : 1;
+
+			// synthetic RGBA height map - a few overlapping waves
+			vector<unsigned char> bits(N * 4);
+			for (int j = 0; j < size; j++)
+				for (int i = 0; i < size; i++)
+				{
+					float f = 0.5f + 0.25f * sin(i * 0.01f) * cos(j * 0.013f) + 0.2f * sin((i + j) * 0.05f) + 0.05f * sin(i * j * 0.0001f);
+					unsigned char val = (unsigned char)(min(max(f, 0.f), 1.f) * 255);
+					for (int k = 0; k < 4; k++)
+						bits[((size_t)j * size + i) * 4 + k] = val;
+				}
+			float scale = 75;
+
+			// the original code: column-major walk, push_back, bounds-checked neighbours
+			vector<float> refHeights, refNormals;
+			auto getHeight = [&](int x, int z) -> float
+			{
+				if (x < 0 || x >= size) return 0;
+				if (z < 0 || z >= size) return 0;
+				return refHeights[(size_t)x * size + z];
+			};
+			double refH = measure([&]
+			{
+				refHeights.clear();
+				refHeights.reserve(N);
+				for (int i = 0; i < size; i++)
+					for (int j = size - 1; j >= 0; j--)
+					{
+						unsigned char val = bits[((size_t)i + (size_t)j * size) * 4];
+						refHeights.push_back((float)val / 256.0f * scale);
+					}
+			}, nRuns);
+			double refN = measure([&]
+			{
+				refNormals.clear();
+				for (int x = 0; x < size; x++)
+					for (int z = 0; z < size; z++)
+					{
+						int x0 = (x == 0) ? x : x - 1;
+						int x1 = (x == size - 1) ? x : x + 1;
+						int z0 = (z == 0) ? z : z - 1;
+						int z1 = (z == size - 1) ? z : z + 1;
+						float dy_x = getHeight(x1, z) - getHeight(x0, z);
+						float dy_z = getHeight(x, z1) - getHeight(x, z0);
+						float m = sqrt(dy_x * dy_x + 4 + dy_z * dy_z);
+						refNormals.push_back(-dy_x / m);
+						refNormals.push_back(2 / m);
+						refNormals.push_back(-dy_z / m);
+					}
+			}, nRuns);
+			double refTotal = refH + refN;
+			cout << setw(7) << size << setw(9) << "ref" << fixed << setprecision(1) << setw(13) << refH << setw(13) << refN
+				<< setw(11) << refTotal << setw(12) << N / refTotal / 1000 << setw(9) << 1.0 << endl;
+
+			// the parallel, vectorised path - into pre-sized buffers
+			vector<float> heights(N), normals(N * 3);
+			for (int nThreads : threadCounts())
+			{
+				double h = measure([&] { C3dglTerrain::computeHeights(&bits[0], size, size, scale, &heights[0], nThreads); }, nRuns);
+				double n = measure([&] { C3dglTerrain::computeNormals(&heights[0], size, size, &normals[0], nThreads); }, nRuns);
+				cout << setw(7) << size << setw(9) << nThreads << setw(13) << h << setw(13) << n
+					<< setw(11) << h + n << setw(12) << N / (h + n) / 1000 << setw(9) << refTotal / (h + n) << endl;
+			}
+
+			// verify against the original
+			float errH = 0, errN = 0;
+			for (size_t i = 0; i < N; i++)
+				errH = max(errH, fabs(heights[i] - refHeights[i]));
+			for (size_t i = 0; i < N * 3; i++)
+				errN = max(errN, fabs(normals[i] - refNormals[i]));
+			if (errH > 0 || errN > 1e-5f)
+			{
+				cerr << "*** ERROR: results differ from the original code: heights " << errH << ", normals " << errN << endl;
+				nErrors++;
+			}
+		}
+		catch (bad_alloc&)
+		{
+			cout << setw(7) << size << "  skipped - not enough memory" << endl;
+		}
+	}
+	return nErrors ? 1 : 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Height queries and ray casting over a synthetic height map
+// Compares the original getInterpolatedHeight (Heron's formula barycentric weights) with
+// C3dglHeightField - single and batched queries - and ray marching with the pyramid ray cast
+
+// the original code
+static float refTriArea(float a, float b, float c)
+{
+	float s = (a + b + c) / 2.0f;
+	return sqrt(fabs(s * (s - a) * (s - b) * (s - c)));
+}
+
+static float refDist(float x0, float y0, float x1, float y1)
+{
+	float a = x1 - x0;
+	float b = y1 - y0;
+	return sqrt(a * a + b * b);
+}
+
+static float refBarycent(float x, float y, float x0, float y0, float v0, float x1, float y1, float v1, float x2, float y2, float v2)
+{
+	float a = refDist(x0, y0, x1, y1);
+	float b = refDist(x1, y1, x2, y2);
+	float c = refDist(x2, y2, x0, y0);
+	float totalarea = refTriArea(a, b, c);
+	float length0 = refDist(x0, y0, x, y);
+	float length1 = refDist(x1, y1, x, y);
+	float length2 = refDist(x2, y2, x, y);
+	float f0 = refTriArea(b, length1, length2) / totalarea;
+	float f1 = refTriArea(c, length0, length2) / totalarea;
+	float f2 = refTriArea(a, length0, length1) / totalarea;
+	return v0 * f0 + v1 * f1 + v2 * f2;
+}
+
+static int benchHeights(const vector<string> &params)
+{
+	int size = params.size() > 0 ? atoi(params[0].c_str()) : 2048;
+	int nQueries = params.size() > 1 ? atoi(params[1].c_str()) : 1000000;
+	int nRays = nQueries / 100;
+
+	// synthetic height map - a few overlapping waves
+	vector<float> heights((size_t)size * size);
+	for (int x = 0; x < size; x++)
+		for (int z = 0; z < size; z++)
+			heights[(size_t)x * size + z] = 40 + 20 * sin(x * 0.01f) * cos(z * 0.013f) + 10 * sin((x + z) * 0.05f) + 2 * sin(x * 0.3f);
+	C3dglHeightField field;
+	double tCreate = measure([&] { field.create(&heights[0], size, size); }, 1);
+
+	// random query points, mostly within the map
+	srand(1);
+	auto random = [](float a, float b) { return a + (b - a) * rand() / RAND_MAX; };
+	vector<glm::vec2> points(nQueries);
+	for (glm::vec2 &p : points)
+		p = glm::vec2(random(-size * 0.55f, size * 0.55f), random(-size * 0.55f, size * 0.55f));
+
+	auto getHeight = [&](int x, int z) -> float
+	{
+		x += size / 2;
+		z += size / 2;
+		if (x < 0 || x >= size) return 0;
+		if (z < 0 || z >= size) return 0;
+		return heights[(size_t)x * size + z];
+	};
+	vector<float> ref(nQueries), single(nQueries), batch(nQueries);
+	double tRef = measure([&]
+	{
+		for (int i = 0; i < nQueries; i++)
+		{
+			float fx = points[i].x, fz = points[i].y;
+			int x = (int)floor(fx), z = (int)floor(fz);
+			fx -= x;
+			fz -= z;
+			if (fx + fz < 1)
+				ref[i] = refBarycent(fx, fz, 0, 0, getHeight(x, z), 0, 1, getHeight(x, z + 1), 1, 0, getHeight(x + 1, z));
+			else
+				ref[i] = refBarycent(fx, fz, 0, 1, getHeight(x, z + 1), 1, 0, getHeight(x + 1, z), 1, 1, getHeight(x + 1, z + 1));
+		}
+	});
+	double tSingle = measure([&]
+	{
+		for (int i = 0; i < nQueries; i++)
+			single[i] = field.getInterpolatedHeight(points[i].x, points[i].y);
+	});
+	double tBatch = measure([&] { field.getInterpolatedHeights(&points[0], &batch[0], nQueries); });
+
+	// Heron's formula loses precision in thin triangles - the original is only accurate to about 0.1%
+	float errRef = 0, errBatch = 0, maxHeight = *max_element(heights.begin(), heights.end());
+	for (int i = 0; i < nQueries; i++)
+	{
+		errRef = max(errRef, fabs(single[i] - ref[i]));
+		errBatch = max(errBatch, fabs(batch[i] - single[i]));
+	}
+
+	cout << "Height queries: " << size << " x " << size << " map, " << nQueries << " points (pyramid built in "
+		<< fixed << setprecision(1) << tCreate << " ms, " << field.getPyramidLevels() << " levels)" << endl;
+	cout << setw(22) << "" << setw(11) << "ms" << setw(12) << "Mquery/s" << setw(9) << "speedup" << endl;
+	cout << setw(22) << "original" << setw(11) << tRef << setw(12) << nQueries / tRef / 1000 << setw(9) << 1.0 << endl;
+	cout << setw(22) << "getInterpolatedHeight" << setw(11) << tSingle << setw(12) << nQueries / tSingle / 1000 << setw(9) << tRef / tSingle << endl;
+	cout << setw(22) << "batch" << setw(11) << tBatch << setw(12) << nQueries / tBatch / 1000 << setw(9) << tRef / tBatch << endl;
+
+	// rays: from above the terrain, looking down at various angles; the reference marches in 0.1 unit steps
+	vector<glm::vec3> origins(nRays), dirs(nRays);
+	for (int i = 0; i < nRays; i++)
+	{
+		origins[i] = glm::vec3(random(-size * 0.4f, size * 0.4f), random(80, 120), random(-size * 0.4f, size * 0.4f));
+		float a = random(0, 6.2832f), d = random(0.05f, 1.f);
+		dirs[i] = glm::normalize(glm::vec3(cos(a), -d, sin(a)));
+	}
+	const float tMax = size * 0.5f, step = 0.1f;
+	vector<float> tRefHit(nRays, -1), tHit(nRays, -1);
+	double tMarch = measure([&]
+	{
+		for (int i = 0; i < nRays; i++)
+		{
+			tRefHit[i] = -1;
+			for (float t = 0; t <= tMax; t += step)
+			{
+				glm::vec3 p = origins[i] + t * dirs[i];
+				if (p.y <= field.getInterpolatedHeight(p.x, p.z))
+				{
+					tRefHit[i] = t;
+					break;
+				}
+			}
+		}
+	}, 1);
+	double tCast = measure([&]
+	{
+		for (int i = 0; i < nRays; i++)
+		{
+			float t;
+			tHit[i] = field.intersectRay(origins[i], dirs[i], t, tMax) ? t : -1;
+		}
+	});
+
+	// the marched hit must lie within a step after the exact one; marching also hits the zero level
+	// outside the map, and may miss tangent grazes
+	int nMismatch = 0, nHits = 0;
+	for (int i = 0; i < nRays; i++)
+	{
+		if (tHit[i] >= 0) nHits++;
+		glm::vec3 p = origins[i] + tRefHit[i] * dirs[i];
+		if (tRefHit[i] < 0 || fabs(p.x) >= size / 2 - 1 || fabs(p.z) >= size / 2 - 1)
+			continue;
+		if (tHit[i] < 0 || tHit[i] > tRefHit[i] + 1e-3f || tHit[i] < tRefHit[i] - step - 1e-3f)
+			nMismatch++;
+	}
+
+	cout << setprecision(3);
+	cout << setw(22) << "ray marching" << setw(11) << tMarch << setw(12) << nRays / tMarch / 1000 << setw(9) << 1.0 << endl;
+	cout << setw(22) << "intersectRay" << setw(11) << tCast << setw(12) << nRays / tCast / 1000 << setw(9) << tMarch / tCast << endl;
+	cout << "  " << nHits << " of " << nRays << " rays hit; max difference from the original: " << setprecision(6) << errRef << endl;
+
+	if (errBatch > 0 || errRef > 1e-3f * maxHeight || nMismatch)
+	{
+		cerr << "*** ERROR: batch differs by " << errBatch << ", original by " << errRef << ", " << nMismatch << " ray mismatches" << endl;
+		return 1;
+	}
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Out-of-core streaming: a camera flying over a synthetic tiled height field (64k x 64k by default)
+// CPU only - C3dglStreamingTerrain::update, tile reads and decoding; the GPU upload is not measured
+
+static int benchStreaming(const vector<string> &params)
+{
+	int size = params.size() > 0 ? atoi(params[0].c_str()) : 65536;
+	string filename = params.size() > 1 ? params[1] : "streaming" + to_string(size) + ".3dth";
+
+	if (!ifstream(filename))
+	{
+		cout << "Creating " << filename << "..." << endl;
+		double t = measure([&] { C3dglStreamingTerrain::createSynthetic(filename, size, size); }, 1);
+		cout << "  created in " << fixed << setprecision(1) << t / 1000 << " s" << endl;
+	}
+
+	C3dglStreamingTerrain terrain;
+	if (!terrain.open(filename))
+		return 1;
+	terrain.setResidentRadius(1024);
+	terrain.setMemoryBudget(128 * 1024 * 1024);
+
+	// straight flight across the map: 2 units per frame, diagonally, about 1 ms per frame
+	int nFrames = 2000;
+	float extent = size / 2.f - 1;
+	vector<double> updateTimes;
+	size_t nOverBudget = 0;
+	auto t0 = chrono::high_resolution_clock::now();
+	for (int i = 0; i < nFrames; i++)
+	{
+		float f = -extent * 0.9f + 2.f * i;
+		glm::vec3 eye(f, 100, f * 0.5f);
+		updateTimes.push_back(measure([&] { terrain.update(eye); }, 1));
+		if (terrain.getResidentBytes() > terrain.getMemoryBudget())
+			nOverBudget++;
+		this_thread::sleep_for(chrono::milliseconds(1));
+	}
+	terrain.flush();
+	double total = chrono::duration<double>(chrono::high_resolution_clock::now() - t0).count();
+
+	sort(updateTimes.begin(), updateTimes.end());
+	double tileMB = (terrain.getTileSize() + 1.0) * (terrain.getTileSize() + 1.0) * sizeof(unsigned short) / 1048576;
+	cout << "Streaming " << size << " x " << size << ", radius " << (int)terrain.getResidentRadius() << ", budget "
+		<< terrain.getMemoryBudget() / 1048576 << " MB, " << nFrames << " frames in " << fixed << setprecision(2) << total << " s" << endl;
+	cout << "  tiles loaded:        " << terrain.getTilesLoaded() << " (" << terrain.getTilesLoaded() / total << " tiles/s, "
+		<< terrain.getTilesLoaded() * tileMB / total << " MB/s read)" << endl;
+	cout << "  tiles evicted:       " << terrain.getTilesEvicted() << endl;
+	cout << "  resident at the end: " << terrain.getResidentTiles() << " tiles, " << terrain.getResidentBytes() / 1048576.0 << " MB" << endl;
+	cout << "  peak resident:       " << terrain.getPeakBytes() / 1048576.0 << " MB" << endl;
+	cout << "  update ms:           median " << setprecision(3) << updateTimes[nFrames / 2] << ", 99% " << updateTimes[nFrames * 99 / 100]
+		<< ", max " << updateTimes.back() << endl;
+
+	if (nOverBudget || terrain.getPeakBytes() > terrain.getMemoryBudget())
+	{
+		cerr << "*** ERROR: memory budget exceeded in " << nOverBudget << " frames" << endl;
+		return 1;
+	}
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Vertex cache: ACMR (transforms per triangle) and ATVR (transforms per vertex) in a simulated FIFO cache
+// The index buffers as uploaded by the loaders: the terrain of the scene with each chunk index layout
+// (INDEX_LIST vs INDEX_STRIPS, vertex buffers and the height field texture patch) at each LOD level, then the
+// model files as imported by assimp without optimisation and as loaded by C3dglModel::load
+// (aiProcess_ImproveCacheLocality). Needs a GL context (hidden window) - the indices are read back
+
+static void printCacheStats(const string &name, size_t nIndices, size_t nIndexBytes, const C3dglVertexCache::STATS stats[2])
+{
+	cout << setw(26) << name << setw(10) << stats[0].triangles << setw(10) << nIndices << setw(9) << nIndexBytes / 1024
+		<< setw(10) << stats[0].getACMR() << setw(9) << stats[0].getATVR()
+		<< setw(10) << stats[1].getACMR() << setw(9) << stats[1].getATVR() << endl;
+}
+
+static int benchVertexCache(const vector<string> &params)
+{
+	int chunkSize = params.size() > 0 ? atoi(params[0].c_str()) : 64;
+	vector<string> files(params.size() > 1 ? params.begin() + 1 : params.end(), params.end());
+	if (files.empty())
+		files = { "models\\scout.obj", "models\\sword\\sword.obj", "models\\character\\sitIdle.dae" };
+	const int cacheSizes[2] = { 16, 32 };
+
+	int window = createBenchmarkWindow("Vertex cache benchmark", 320, 240);
+	if (!window)
+		return 1;
+
+	cout << "Vertex cache (FIFO " << cacheSizes[0] << " and " << cacheSizes[1] << " entries)" << endl;
+	cout << setw(26) << "mesh" << setw(10) << "tris" << setw(10) << "indices" << setw(9) << "KB"
+		<< setw(10) << "ACMR 16" << setw(9) << "ATVR 16" << setw(10) << "ACMR 32" << setw(9) << "ATVR 32" << endl;
+	cout << fixed << setprecision(3);
+
+	// terrain chunks, with the settings of the scene but the chunk size and the index layout;
+	// each chunk is a separate draw - the cache is not shared between the chunks
+	int nErrors = 0;
+	C3dglObject::setQuietMode(true);
+	for (bool bHeightTexture : { false, true })
+		for (C3dglTerrain::INDEX_MODE mode : { C3dglTerrain::INDEX_LIST, C3dglTerrain::INDEX_STRIPS })
+		{
+			C3dglTerrain terrain;
+			terrain.setChunkSize(chunkSize);
+			terrain.setCompact(true);
+			terrain.setHeightTexture(bHeightTexture);
+			terrain.setIndexMode(mode);
+			if (!terrain.loadHeightmap("models\\sand.bmp", 75))
+			{
+				cerr << "models\\sand.bmp: cannot load the terrain" << endl;
+				nErrors++;
+				continue;
+			}
+			// either may have fallen back
+			bool bStrips = terrain.getIndexMode() == C3dglTerrain::INDEX_STRIPS;
+			bool bPatch = terrain.isHeightTexture();
+			for (int level = 0; level < terrain.getLodLevels(); level++)
+			{
+				C3dglVertexCache::STATS stats[2];
+				vector<unsigned> indices;
+				size_t nIndices = 0;
+				unsigned nTriangles = 0;
+				for (unsigned c = 0; c < terrain.getChunkCount(); c++)
+				{
+					nTriangles += terrain.getChunkIndices(c, level, indices);
+					for (int i = 0; i < 2; i++)
+						stats[i] += C3dglVertexCache::analyse(indices.data(), indices.size(), cacheSizes[i], bStrips, 0xFFFFFFFFu);
+					nIndices += indices.size();
+				}
+				// the patch index buffer is shared by all the chunks - 16-bit as long as the patch vertices fit
+				int nPatchVertices = (chunkSize + 1) * (chunkSize + 5);
+				size_t nIndexBytes = bPatch ? indices.size() * (nPatchVertices < 0xFFFF ? 2 : 4) : nIndices * terrain.getIndexSize();
+				printCacheStats(string(bPatch ? "patch" : "terrain") + " L" + to_string(level) + (bStrips ? " strips" : " list"),
+					nIndices, nIndexBytes, stats);
+				if (stats[0].triangles != nTriangles)
+					nErrors++;
+			}
+			terrain.destroy();
+		}
+
+	// model files: each mesh is drawn with its own index buffer - the cache is not shared between the meshes
+	for (const string &file : files)
+	{
+		string name = file.substr(file.find_last_of("/\\") + 1);
+
+		// as imported, for comparison
+		const aiScene *pScene = aiImportFile(file.c_str(), aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType);
+		if (!pScene)
+		{
+			cerr << file << ": " << aiGetErrorString() << endl;
+			nErrors++;
+			continue;
+		}
+		C3dglVertexCache::STATS stats[2];
+		size_t nIndices = 0;
+		for (unsigned m = 0; m < pScene->mNumMeshes; m++)
+		{
+			const aiMesh *pMesh = pScene->mMeshes[m];
+			vector<unsigned> indices;
+			for (unsigned f = 0; f < pMesh->mNumFaces; f++)
+				if (pMesh->mFaces[f].mNumIndices == 3)
+					indices.insert(indices.end(), pMesh->mFaces[f].mIndices, pMesh->mFaces[f].mIndices + 3);
+			for (int i = 0; i < 2; i++)
+				stats[i] += C3dglVertexCache::analyse(indices.data(), indices.size(), cacheSizes[i]);
+			nIndices += indices.size();
+		}
+		aiReleaseImport(pScene);
+		printCacheStats(name + " imported", nIndices, nIndices * sizeof(unsigned), stats);
+
+		// the index buffers uploaded by C3dglModel
+		C3dglModel model;
+		model.enableBufData(BUF_INDEX, true);
+		if (!model.load(file.c_str()))
+		{
+			nErrors++;
+			continue;
+		}
+		C3dglVertexCache::STATS loaded[2];
+		nIndices = 0;
+		for (unsigned m = 0; m < model.getMeshCount(); m++)
+		{
+			void *p;
+			unsigned size, num;
+			model.getMesh(m)->getBufferData(BUF_INDEX, &p, size, num);
+			if (!p || size != sizeof(unsigned))
+				continue;
+			for (int i = 0; i < 2; i++)
+				loaded[i] += C3dglVertexCache::analyse((const unsigned*)p, num, cacheSizes[i]);
+			nIndices += num;
+		}
+		model.destroy();
+		printCacheStats(name + " loaded", nIndices, nIndices * sizeof(unsigned), loaded);
+	}
+	C3dglObject::setQuietMode(false);
+	destroyBenchmarkWindow(window);
+
+	if (nErrors)
+	{
+		cerr << "*** ERROR: " << nErrors << " meshes failed" << endl;
+		return 1;
+	}
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// GL context for the benchmarks that need one
+// Built with BENCHMARK_EGL (and linked with libEGL) the context is headless - an EGL pbuffer, or no surface
+// at all (EGL_KHR_surfaceless_context) where pbuffers are not supported - so the benchmarks run on machines
+// without a window system, e.g. build servers; GLEW must be built with EGL support (GLEW_EGL).
+// Otherwise it is a hidden GLUT window
+
+#ifdef BENCHMARK_EGL
+
+static EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+static EGLSurface eglSurface = EGL_NO_SURFACE;
+static EGLContext eglContext = EGL_NO_CONTEXT;
+
+int createBenchmarkWindow(const char *title, int width, int height)
+{
+	eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	EGLint major, minor;
+	if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, &major, &minor) || !eglBindAPI(EGL_OPENGL_API))
+	{
+		cerr << "*** ERROR: no EGL display for " << title << endl;
+		return 0;
+	}
+
+	const EGLint pbufferConfig[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8, EGL_DEPTH_SIZE, 24, EGL_NONE };
+	const EGLint anyConfig[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	const EGLint pbufferSize[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+	EGLConfig config;
+	EGLint nConfigs = 0;
+	if (eglChooseConfig(eglDisplay, pbufferConfig, &config, 1, &nConfigs) && nConfigs == 1)
+		eglSurface = eglCreatePbufferSurface(eglDisplay, config, pbufferSize);
+	else if (!eglChooseConfig(eglDisplay, anyConfig, &config, 1, &nConfigs) || nConfigs != 1)
+		config = NULL;
+
+	// without a surface the default framebuffer is incomplete: the passes into the frame graph targets
+	// still render, the final post process draws nothing
+	if (config)
+		eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, NULL);
+	if (eglContext == EGL_NO_CONTEXT || !eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext))
+	{
+		cerr << "*** ERROR: cannot create an EGL context for " << title << endl;
+		destroyBenchmarkWindow(1);
+		return 0;
+	}
+	if (glewInit() != GLEW_OK)
+	{
+		cerr << "*** ERROR: GLEW initialisation failed" << endl;
+		destroyBenchmarkWindow(1);
+		return 0;
+	}
+	return 1;
+}
+
+void destroyBenchmarkWindow(int)
+{
+	if (eglDisplay == EGL_NO_DISPLAY)
+		return;
+	eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (eglContext != EGL_NO_CONTEXT) eglDestroyContext(eglDisplay, eglContext);
+	if (eglSurface != EGL_NO_SURFACE) eglDestroySurface(eglDisplay, eglSurface);
+	eglTerminate(eglDisplay);
+	eglDisplay = EGL_NO_DISPLAY;
+	eglSurface = EGL_NO_SURFACE;
+	eglContext = EGL_NO_CONTEXT;
+}
+
+#else
+
+int createBenchmarkWindow(const char *title, int width, int height)
+{
+	// GLUT can only be initialised once per process
+	static bool bGlutInit = false;
+	if (!bGlutInit)
+	{
+		int argc = 1;
+		char *argv[] = { (char*)"bench", NULL };
+		glutInit(&argc, argv);
+		bGlutInit = true;
+	}
+	glutInitDisplayMode(GLUT_DEPTH | GLUT_DOUBLE | GLUT_RGBA);
+	glutInitWindowSize(width, height);
+	int window = glutCreateWindow(title);
+	glutHideWindow();
+	if (glewInit() != GLEW_OK)
+	{
+		cerr << "*** ERROR: GLEW initialisation failed" << endl;
+		glutDestroyWindow(window);
+		return 0;
+	}
+	return window;
+}
+
+void destroyBenchmarkWindow(int window)
+{
+	glutDestroyWindow(window);
+}
+
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Uniforms: cost of a SendUniform call, for the uniforms of a material of the basic shader
+// SendUniform(std::string) as C3dglProgram did it before the hashed names, std::string names hashed
+// at run time, constexpr names hashed at compile time, and typed uniform handles.
+// With the uniform cache on the values are elided after the first frame, so only the CPU side is
+// measured; with the cache off each call also goes to the GL driver. Needs a GL context (hidden window)
+
+static int benchUniforms(const vector<string> &params)
+{
+	int nFrames = params.size() > 0 ? atoi(params[0].c_str()) : 100000;
+	const int N = 8;		// uniforms per frame
+
+	int window = createBenchmarkWindow("Uniforms benchmark", 320, 240);
+	if (!window)
+		return 1;
+
+	C3dglObject::setQuietMode(true);
+	C3dglShader vertexShader, fragmentShader;
+	C3dglProgram program;
+	bool bOK = vertexShader.Create(GL_VERTEX_SHADER) && vertexShader.LoadFromFile("shaders/basic.vert") && vertexShader.Compile()
+		&& fragmentShader.Create(GL_FRAGMENT_SHADER) && fragmentShader.LoadFromFile("shaders/basic.frag") && fragmentShader.Compile()
+		&& program.Create() && program.Attach(vertexShader) && program.Attach(fragmentShader) && program.Link();
+	C3dglObject::setQuietMode(false);
+	if (!bOK)
+	{
+		cerr << "*** ERROR: cannot build the basic shader: " << program.getInfo() << vertexShader.getInfo() << fragmentShader.getInfo() << endl;
+		return 1;
+	}
+	program.Use();
+
+	// the path SendUniform(std::string) used to take: the name passed by value to the location look-up,
+	// found in a std::map of the active uniforms, its type checked, then the value sent by location
+	map<string, pair<GLuint, GLenum>> uniforms;
+	GLint nUniforms = 0;
+	glGetProgramiv(program.GetId(), GL_ACTIVE_UNIFORMS, &nUniforms);
+	for (GLint i = 0; i < nUniforms; i++)
+	{
+		GLchar name[256];
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(program.GetId(), i, sizeof(name), NULL, &size, &type, name);
+		uniforms[name] = make_pair((GLuint)glGetUniformLocation(program.GetId(), name), type);
+	}
+	auto getUniformLocation = [&](string name, GLuint &location, GLenum &type)
+	{
+		auto i = uniforms.find(name);
+		location = i->second.first;
+		type = i->second.second;
+	};
+	auto sendUniform = [&](string name, GLenum expected, auto... v)
+	{
+		GLuint location; GLenum type; getUniformLocation(name, location, type);
+		if (type == expected) program.SendUniform(location, v...);
+	};
+
+	// hashed at compile time
+	constexpr UniformName nameAmbient = "materialAmbient", nameDiffuse = "materialDiffuse", nameShininess = "shininess", nameFogDensity = "fogDensity";
+	constexpr UniformName nameScaleX = "scaleX", nameOpacity = "opacity", nameUseLights = "useLights", nameUseNormalMap = "useNormalMap";
+
+	UniformHandle<glm::vec3> materialAmbient = program.GetUniform<glm::vec3>("materialAmbient");
+	UniformHandle<glm::vec3> materialDiffuse = program.GetUniform<glm::vec3>("materialDiffuse");
+	UniformHandle<float> shininess = program.GetUniform<float>("shininess");
+	UniformHandle<float> fogDensity = program.GetUniform<float>("fogDensity");
+	UniformHandle<float> scaleX = program.GetUniform<float>("scaleX");
+	UniformHandle<float> opacity = program.GetUniform<float>("opacity");
+	UniformHandle<int> useLights = program.GetUniform<int>("useLights");
+	UniformHandle<int> useNormalMap = program.GetUniform<int>("useNormalMap");
+	if (!materialAmbient.IsValid() || !materialDiffuse.IsValid() || !shininess.IsValid() || !fogDensity.IsValid()
+		|| !scaleX.IsValid() || !opacity.IsValid() || !useLights.IsValid() || !useNormalMap.IsValid())
+	{
+		cerr << "*** ERROR: uniforms of the basic shader not found" << endl;
+		return 1;
+	}
+
+	glm::vec3 ambient(0.1f), diffuse(0.2f);
+	const char *METHODS[] = { "std::string (old)", "run-time hash", "constexpr hash", "typed handle" };
+	auto frames = [&](int method)
+	{
+		for (int i = 0; i < nFrames; i++)
+			switch (method)
+			{
+			case 0:
+				sendUniform("materialAmbient", GL_FLOAT_VEC3, ambient.x, ambient.y, ambient.z);
+				sendUniform("materialDiffuse", GL_FLOAT_VEC3, diffuse.x, diffuse.y, diffuse.z);
+				sendUniform("shininess", GL_FLOAT, 3.0f);
+				sendUniform("fogDensity", GL_FLOAT, 0.05f);
+				sendUniform("scaleX", GL_FLOAT, 1.0f);
+				sendUniform("opacity", GL_FLOAT, 1.0f);
+				sendUniform("useLights", GL_INT, 1);
+				sendUniform("useNormalMap", GL_INT, 0);
+				break;
+			case 1:
+				program.SendUniform(string("materialAmbient"), ambient.x, ambient.y, ambient.z);
+				program.SendUniform(string("materialDiffuse"), diffuse.x, diffuse.y, diffuse.z);
+				program.SendUniform(string("shininess"), 3.0f);
+				program.SendUniform(string("fogDensity"), 0.05f);
+				program.SendUniform(string("scaleX"), 1.0f);
+				program.SendUniform(string("opacity"), 1.0f);
+				program.SendUniform(string("useLights"), 1);
+				program.SendUniform(string("useNormalMap"), 0);
+				break;
+			case 2:
+				program.SendUniform(nameAmbient, ambient.x, ambient.y, ambient.z);
+				program.SendUniform(nameDiffuse, diffuse.x, diffuse.y, diffuse.z);
+				program.SendUniform(nameShininess, 3.0f);
+				program.SendUniform(nameFogDensity, 0.05f);
+				program.SendUniform(nameScaleX, 1.0f);
+				program.SendUniform(nameOpacity, 1.0f);
+				program.SendUniform(nameUseLights, 1);
+				program.SendUniform(nameUseNormalMap, 0);
+				break;
+			case 3:
+				materialAmbient.Send(ambient);
+				materialDiffuse.Send(diffuse);
+				shininess.Send(3.0f);
+				fogDensity.Send(0.05f);
+				scaleX.Send(1.0f);
+				opacity.Send(1.0f);
+				useLights.Send(1);
+				useNormalMap.Send(0);
+				break;
+			}
+	};
+
+	cout << "Uniforms: " << nFrames << " x " << N << " calls" << endl;
+	cout << setw(20) << "method" << setw(16) << "cached ns/call" << setw(9) << "speedup" << setw(16) << "sent ns/call" << setw(9) << "speedup" << endl;
+	cout << fixed << setprecision(1);
+	double ref[2] = { 0, 0 };
+	for (int method = 0; method < 4; method++)
+	{
+		cout << setw(20) << METHODS[method];
+		for (bool bCache : { true, false })
+		{
+			C3dglProgram::EnableUniformCache(bCache);
+			program.InvalidateUniformCache();
+			double t = measure([&] { frames(method); }) * 1e6 / nFrames / N;
+			if (method == 0) ref[bCache ? 0 : 1] = t;
+			cout << setw(16) << t << setw(9) << ref[bCache ? 0 : 1] / t;
+		}
+		cout << endl;
+	}
+	C3dglProgram::EnableUniformCache(true);
+
+	destroyBenchmarkWindow(window);
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Benchmark Registry
+
+struct BENCHMARK
+{
+	const char *name;
+	const char *params;
+	int(*run)(const vector<string> &params);
+};
+
+static BENCHMARK benchmarks[] =
+{
+	{ "heightmap", "[sizes...]", benchHeightmap },
+	{ "heights", "[size] [queries]", benchHeights },
+	{ "streaming", "[size] [file]", benchStreaming },
+	{ "vcache", "[chunk size] [model files...]", benchVertexCache },
+	{ "uniforms", "[frames]", benchUniforms },
+	{ "scene", "[frames] [width] [height] [json file]", benchScene },
+};
+
+int runBenchmarks(int argc, char **argv)
+{
+	// find the arguments following --bench
+	int i = 1;
+	while (i < argc && string(argv[i]) != "--bench") i++;
+	string name = (i + 1 < argc) ? argv[i + 1] : "";
+	vector<string> params;
+	for (int j = i + 2; j < argc; j++)
+		params.push_back(argv[j]);
+
+	int result = 0;
+	bool bFound = false;
+	for (BENCHMARK &bench : benchmarks)
+		if (name.empty() || name == bench.name)
+		{
+			bFound = true;
+			result |= bench.run(params);
+			cout << endl;
+		}
+
+	if (!bFound)
+	{
+		cerr << "Unknown benchmark: " << name << endl << "Available benchmarks:" << endl;
+		for (BENCHMARK &bench : benchmarks)
+			cerr << "  --bench " << bench.name << " " << bench.params << endl;
+		return 1;
+	}
+	return result;
+}
@@ -0,0 +1,24 @@
+#ifndef __benchmark_h_
+#define __benchmark_h_
+
+/*********************************************************************************
+Command line benchmarks
+Run the application with: --bench [name] [parameters]
+Without a name all the benchmarks are run with their default parameters
+*********************************************************************************/
+
+#include <vector>
+#include <string>
+
+// runs the benchmarks requested in the command line, returns the process exit code
+int runBenchmarks(int argc, char **argv);
+
+// GL context for the benchmarks that render: a hidden GLUT window, or headless (EGL) if built with
+// BENCHMARK_EGL; returns 0 on failure
+int createBenchmarkWindow(const char *title, int width, int height);
+void destroyBenchmarkWindow(int window);
+
+// the demo scene rendered with a simulated clock and a scripted camera (main.cpp)
+int benchScene(const std::vector<std::string> &params);
+
+#endif // __benchmark_h_
@@ -1,6 +1,7 @@
 /*********************************************************************************
 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
 Version 2.2 23/03/15
+Altered version - modified since 3DGL 2.2, this is not the original software
 
 Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
 
@@ -31,6 +32,15 @@ freely, subject to the following restrictions:
 #include "3dglModel.h"
 #include "3dglShader.h"
 #include "3dglTerrain.h"
+#include "3dglStreamingTerrain.h"
+#include "3dglFrameGraph.h"
+#include "3dglCubeProbe.h"
+#include "3dglShadowCascades.h"
+#include "3dglRenderQueue.h"
+#include "3dglProfiler.h"
+#include "3dglCallStats.h"
+#include "3dglStartupReport.h"
+#include "3dglResourceLedger.h"
 #include "3dglSkyBox.h"
 #include "3dglBitmap.h"
 
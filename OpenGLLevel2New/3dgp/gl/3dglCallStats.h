@@ -0,0 +1,136 @@
+/*********************************************************************************
+Addition to the 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Not part of the original 3DGL 2.2 - new code, distributed under the same license
+
+GL call accounting: draw calls, triangles, program switches, texture binds, uniform
+calls, buffer uploads and framebuffer switches, per frame and per render pass.
+Usage:
+install (after glewInit) to start counting, uninstall to stop - opt-in, no cost
+when not installed; beginFrame at the start of each frame, beginPass and endPass
+around the passes, e.g. from the frame graph hooks
+getFrame and getPass return the counts of the last complete frame; withinBudget
+checks them against the limits given (e.g. at most 50 draws in the shadow pass),
+dump writes them as a line of JSON
+
+The GL entry points loaded by GLEW are counted by swapping their GLEW function
+pointers for counting ones, so GL calls made anywhere, the application included,
+are counted. The OpenGL 1.1 functions (glDrawArrays, glDrawElements, glBindTexture)
+are linked directly and cannot be redirected: the rendering code calls them through
+drawArrays, drawElements and bindTexture, and the textures are allocated through
+texImage2D (which also records them in C3dglResourceLedger) and texSubImage2D.
+Binds made while creating textures are not counted.
+Triangles are the triangles submitted (strips and fans counted as such), times the
+number of instances; a multi-draw is one draw call.
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+*********************************************************************************/
+#ifndef __3dglCallStats_h_
+#define __3dglCallStats_h_
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "3dglObject.h"
+
+namespace _3dgl
+{
+
+class C3dglCallStats : public C3dglObject
+{
+public:
+	struct COUNTERS
+	{
+		unsigned long long nDraws, nTriangles;
+		unsigned long long nPrograms, nBinds, nUniforms;
+		unsigned long long nUploads, uploadBytes;	// buffer and texture data
+		unsigned long long nFramebuffers;
+
+		// all zero, or a budget: draws, triangles and programs (0: no limit)
+		COUNTERS(unsigned long long draws = 0, unsigned long long triangles = 0, unsigned long long programs = 0)
+			: nDraws(draws), nTriangles(triangles), nPrograms(programs), nBinds(0), nUniforms(0), nUploads(0), uploadBytes(0), nFramebuffers(0)	{ }
+
+		COUNTERS &operator+=(const COUNTERS &c);
+		COUNTERS &operator-=(const COUNTERS &c);
+	};
+
+	struct PASS
+	{
+		std::string name;
+		COUNTERS counters;					// summed if the pass runs more than once
+	};
+
+private:
+	static C3dglCallStats *c_pCurrent;		// installed
+	struct HOOK { void **pFn; void *original, *hook; };
+	std::vector<HOOK> m_hooks;				// GLEW function pointers replaced, with their original values
+
+	COUNTERS m_counters;					// since the frame began
+	COUNTERS m_passStart;					// m_counters when the current pass began
+	int m_pass;								// current pass, -1 if none
+	std::vector<PASS> m_passes;
+
+	// the last complete frame
+	COUNTERS m_frame;
+	std::vector<PASS> m_lastPasses;
+
+	struct HOOKS;							// the counting versions of the GL functions
+	void countDraw(unsigned mode, long long count, long long instances = 1);
+
+public:
+	C3dglCallStats();
+	~C3dglCallStats()						{ uninstall(); }
+
+	bool install();
+	void uninstall();
+	bool isInstalled()						{ return c_pCurrent == this; }
+	static C3dglCallStats *getCurrent()		{ return c_pCurrent; }
+
+	void beginFrame();
+	void beginPass(const std::string &name);
+	void endPass();
+
+	// since the frame began (or since installed, before the first frame)
+	const COUNTERS &getCounters()			{ return m_counters; }
+
+	// the last complete frame; an empty (all zero) result for a pass that did not run
+	const COUNTERS &getFrame()				{ return m_frame; }
+	COUNTERS getPass(const std::string &name);
+	const std::vector<PASS> &getPasses()	{ return m_lastPasses; }
+
+	// true if the counts do not exceed the budget; 0 in the budget stands for no limit.
+	// An empty pass name checks the whole frame
+	bool withinBudget(const std::string &pass, const COUNTERS &budget);
+
+	// the last complete frame, with its passes, as a line of JSON
+	void dump(std::ostream &out);
+
+	// OpenGL 1.1 functions, counted if installed
+	static void drawArrays(unsigned mode, int first, int count);
+	static void drawElements(unsigned mode, int count, unsigned type, const void *indices);
+	static void bindTexture(unsigned target, unsigned texture);
+	static void texImage2D(unsigned target, int level, int internalFormat, int width, int height, int border, unsigned format, unsigned type, const void *pixels);
+	static void texSubImage2D(unsigned target, int level, int x, int y, int width, int height, unsigned format, unsigned type, const void *pixels);
+
+	std::string getName()					{ return "GL Call Stats"; }
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglCallStats_h_
@@ -0,0 +1,104 @@
+/*********************************************************************************
+Addition to the 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Not part of the original 3DGL 2.2 - new code, distributed under the same license
+
+Dynamic cube map probe: decides which faces of a reflection cube map to refresh.
+Usage:
+setPosition and setRadius - the probe reflects the scene around its position,
+changes within the radius are local to the probe
+setPolicy to choose how the refreshes are spread over the frames:
+  EVERY_FRAME - all faces, each frame the scene changes
+  ROUND_ROBIN - n faces per frame, in turn, while any face is out of date
+  INTERVAL - all faces every n frames
+  ON_CHANGE - all faces, but only when the probe moves or something changes within its radius
+notifyChange every frame something changes: with no arguments for changes anywhere
+(ignored by ON_CHANGE), with a bounding sphere for local changes; invalidate forces
+a full refresh
+update once per frame, then render the faces in getFaces with the getFaceView matrices;
+faces never rendered are always due, whatever the policy
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+*********************************************************************************/
+#ifndef __3dglCubeProbe_h_
+#define __3dglCubeProbe_h_
+
+#include <cfloat>
+#include "../glm/mat4x4.hpp"
+
+#include "3dglObject.h"
+
+namespace _3dgl
+{
+
+class C3dglCubeProbe : public C3dglObject
+{
+public:
+	enum POLICY { EVERY_FRAME, ROUND_ROBIN, INTERVAL, ON_CHANGE };
+
+private:
+	glm::vec3 m_pos;
+	float m_fRadius;
+	POLICY m_policy;
+	int m_n;								// faces per frame (ROUND_ROBIN) or frames (INTERVAL)
+
+	unsigned m_stale;						// faces out of date (bit mask)
+	unsigned m_rendered;					// faces rendered at least once (bit mask)
+	unsigned m_faces;						// faces to refresh this frame (bit mask)
+	int m_nNext;							// next face in turn (ROUND_ROBIN)
+	unsigned m_nFrame;
+
+	// statistics
+	unsigned m_nFacesUpdated, m_nTotalFaces;
+
+public:
+	C3dglCubeProbe();
+
+	void setPosition(glm::vec3 pos);
+	glm::vec3 getPosition()					{ return m_pos; }
+	void setRadius(float fRadius)			{ m_fRadius = fRadius; }
+	float getRadius()						{ return m_fRadius; }
+
+	void setPolicy(POLICY policy, int n = 1);
+	POLICY getPolicy()						{ return m_policy; }
+	int getPolicyParam()					{ return m_n; }
+	static std::string getPolicyName(POLICY policy);
+
+	// scene changes
+	void invalidate()						{ m_stale = 0x3f; }
+	void notifyChange()						{ if (m_policy != ON_CHANGE) invalidate(); }
+	void notifyChange(glm::vec3 center, float radius);
+
+	// call once per frame; returns the faces to refresh (bit 0: positive x ... bit 5: negative z)
+	unsigned update();
+	unsigned getFaces()						{ return m_faces; }
+
+	// view matrix for a face (GL_TEXTURE_CUBE_MAP_POSITIVE_X + face)
+	glm::mat4 getFaceView(int face);
+
+	// statistics
+	unsigned getFacesUpdated()				{ return m_nFacesUpdated; }		// in the last frame
+	unsigned getTotalFacesUpdated()			{ return m_nTotalFaces; }
+	unsigned getFrames()					{ return m_nFrame; }
+
+	std::string getName()					{ return "Cube Probe"; }
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglCubeProbe_h_
@@ -0,0 +1,214 @@
+/*********************************************************************************
+Addition to the 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Not part of the original 3DGL 2.2 - new code, distributed under the same license
+
+Render pass graph: a frame described as passes that read and write named targets.
+Usage:
+addTarget to declare the render targets (fixed size, screen relative, cube maps or
+texture arrays), importTexture for textures created elsewhere; setTarget changes
+the description of a target, e.g. its size, at run time
+addPass with the rendering function and an optional key - a hash of everything
+(other than the inputs) the pass result depends on; read/write to declare the
+inputs (optionally bound to a texture unit) and the outputs of the pass
+setScreenSize from the reshape callback, execute every frame
+
+A pass is skipped when its key and the versions of its inputs are the same as when
+it last run - its outputs are left as they were. Passes without a key always run.
+Passes that do not contribute to the back buffer are culled. Targets written only
+by passes that always run are transient: targets of the same format and size with
+disjoint lifetimes share the same texture. All the other targets are persistent;
+they keep their textures and contents when the graph is rebuilt (e.g. on resize)
+as long as their format and size do not change. Targets added as TRANSIENT are
+scratch buffers (e.g. depth) and are never kept, whoever writes them.
+Each pass renders into an FBO with its outputs attached (or into the back buffer),
+with the viewport set to the size of its first output; the back buffer and the
+screen viewport are restored after the last pass. Cube map and texture array outputs
+are attached with their first face or layer; call setLayer (or setCubeFace) from the
+pass to render into another one.
+copy, also called from the pass, fills the pass outputs with a 2D target it reads -
+e.g. to draw dynamic objects over a cached static layer.
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+*********************************************************************************/
+#ifndef __3dglFrameGraph_h_
+#define __3dglFrameGraph_h_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+
+#include "3dglObject.h"
+
+namespace _3dgl
+{
+
+class C3dglFrameGraph : public C3dglObject
+{
+public:
+	enum TYPE { TEXTURE_2D, TEXTURE_CUBE, TEXTURE_ARRAY, BACKBUFFER };
+	enum LIFETIME { AUTO, PERSISTENT, TRANSIENT };
+
+	// render target description; for screen relative targets width == 0 and the size is scale * screen size
+	struct TARGET
+	{
+		TYPE type;
+		unsigned format;					// internal format, e.g. GL_RGBA8 or GL_DEPTH_COMPONENT24
+		int width, height;
+		float scale;
+		int layers;							// 6 for cube maps
+	};
+	static TARGET texture2D(unsigned format, int width, int height)	{ TARGET t = { TEXTURE_2D, format, width, height, 0, 1 }; return t; }
+	static TARGET screen(unsigned format, float scale = 1)			{ TARGET t = { TEXTURE_2D, format, 0, 0, scale, 1 }; return t; }
+	static TARGET cube(unsigned format, int size)					{ TARGET t = { TEXTURE_CUBE, format, size, size, 0, 6 }; return t; }
+	static TARGET array(unsigned format, int width, int height, int layers)	{ TARGET t = { TEXTURE_ARRAY, format, width, height, 0, layers }; return t; }
+	static TARGET backBuffer()										{ TARGET t = { BACKBUFFER, 0, 0, 0, 1, 1 }; return t; }
+
+	// the pass function is called with the FBO bound and the viewport set
+	typedef std::function<void(int width, int height)> EXECUTE;
+	typedef std::function<size_t()> KEY;
+	typedef std::function<void(const std::string &name)> HOOK;
+
+	struct PASS_STATS
+	{
+		std::string name;
+		bool executed, skipped, culled;		// in the last frame
+		double cpuTime, gpuTime;			// milliseconds; gpuTime lags a couple of frames behind
+		unsigned nExecuted, nSkipped;		// totals
+	};
+
+private:
+	struct RESOURCE
+	{
+		std::string name;
+		TARGET desc;
+		bool bImported;
+		LIFETIME lifetime;
+		int physical;						// index to m_textures, -1 if none
+		int width, height;					// actual size
+		unsigned version;					// bumped each time the resource is written
+		int first, last;					// lifetime (pass indices) of transient targets
+		bool bKept;							// persistent, keeps its texture when recompiled
+	};
+	struct TEXTURE
+	{
+		unsigned id;
+		unsigned target;					// GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP or GL_TEXTURE_2D_ARRAY
+		unsigned format;
+		int width, height, layers;
+		bool bImported;
+	};
+	struct INPUT
+	{
+		int resource;
+		int unit;							// texture unit to bind to, -1 for none
+		unsigned version;					// version read when the pass last run
+	};
+	struct PASS
+	{
+		EXECUTE execute;
+		KEY key;
+		std::vector<INPUT> inputs;
+		std::vector<int> outputs;
+		std::vector<int> colours;			// outputs attached as colour buffers, in attachment order
+		int depth;							// output attached as the depth buffer, -1 if none
+		unsigned fbo;
+		bool bValid;						// outputs hold the result of the last run
+		size_t lastKey;
+		unsigned queries[3];				// GPU timer queries (ring)
+		bool pending[3];
+		PASS_STATS stats;
+	};
+
+	std::vector<RESOURCE> m_resources;
+	std::map<std::string, int> m_names;
+	std::vector<TEXTURE> m_textures;
+	std::vector<PASS> m_passes;
+	bool m_bDirty;							// needs compiling
+	int m_nScreenWidth, m_nScreenHeight;
+	unsigned m_nFrame;
+	bool m_bTimer;							// GPU timer queries available
+	PASS *m_pCurrent;						// the pass being executed
+	unsigned m_fboCopy;						// read framebuffer used by copy
+
+	HOOK m_hookBegin, m_hookEnd;
+
+	int findResource(const std::string &name);
+	void compile();
+	void release();
+	void allocate(TEXTURE &texture);
+	void createFBO(PASS &pass);
+	void attach(unsigned fbo, unsigned attachment, TEXTURE &texture, int layer);
+
+public:
+	C3dglFrameGraph();
+	~C3dglFrameGraph()						{ destroy(); }
+
+	// targets
+	void addTarget(const std::string &name, TARGET desc, LIFETIME lifetime = AUTO);
+	void importTexture(const std::string &name, unsigned target, unsigned id, int width = 0, int height = 0);
+	void setTarget(const std::string &name, TARGET desc);
+
+	// passes: returns the pass index, used to declare the inputs and outputs
+	int addPass(const std::string &name, EXECUTE execute, KEY key = nullptr);
+	void read(int pass, const std::string &name, int unit = -1);
+	void write(int pass, const std::string &name);
+
+	// forces all passes to run in the next frame
+	void invalidate();
+
+	void setScreenSize(int width, int height);
+	int getScreenWidth()					{ return m_nScreenWidth; }
+	int getScreenHeight()					{ return m_nScreenHeight; }
+	void execute();
+	void destroy();
+
+	// attaches the given layer of the texture array outputs, or face (GL_TEXTURE_CUBE_MAP_POSITIVE_X + face)
+	// of the cube map outputs; call from the pass function
+	void setLayer(int layer);
+	void setCubeFace(int face)				{ setLayer(face); }
+	// copies a 2D or array target (colour or depth) into the matching buffer of the current pass; call from the pass function
+	void copy(const std::string &name);
+
+	// texture name of a target (valid after the first execute)
+	unsigned getTexture(const std::string &name);
+
+	// timing hooks, called around each pass that runs
+	void setHooks(HOOK begin, HOOK end)		{ m_hookBegin = begin; m_hookEnd = end; }
+
+	// statistics
+	unsigned getPassCount()					{ return m_passes.size(); }
+	const PASS_STATS &getPassStats(unsigned i)	{ return m_passes[i].stats; }
+	unsigned getTextureCount();				// textures allocated by the graph
+	size_t getTargetMemory();				// bytes taken by the textures allocated by the graph
+
+	// hash helper for pass keys
+	template <class T> static void hash(size_t &seed, const T &value)
+	{
+		const unsigned char *p = (const unsigned char*)&value;
+		for (size_t i = 0; i < sizeof(T); i++)
+			seed = (seed ^ p[i]) * 1099511628211ull;
+	}
+
+	std::string getName()					{ return "Frame Graph"; }
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglFrameGraph_h_
@@ -0,0 +1,92 @@
+/*********************************************************************************
+Addition to the 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Not part of the original 3DGL 2.2 - new code, distributed under the same license
+
+A very simple view frustum class.
+Usage:
+set the frustum from a combined projection * model-view matrix, then
+use testAABB / testSphere to check bounding volumes given in model coordinates
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+*********************************************************************************/
+#ifndef __3dglFrustum_h_
+#define __3dglFrustum_h_
+
+#include "../glm/mat4x4.hpp"
+#include "../glm/geometric.hpp"
+
+namespace _3dgl
+{
+
+class C3dglFrustum
+{
+	// six clipping planes (left, right, bottom, top, near, far) - xyz is the normal pointing inwards
+	glm::vec4 m_planes[6];
+
+public:
+	enum { OUTSIDE, INTERSECT, INSIDE };
+
+	C3dglFrustum()								{ }
+	C3dglFrustum(const glm::mat4 &matrix)		{ set(matrix); }
+
+	// extracts the planes from a combined (projection * model-view) matrix - planes are in model coordinates
+	void set(const glm::mat4 &m)
+	{
+		glm::vec4 row[4];
+		for (int i = 0; i < 4; i++)
+			row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+		for (int i = 0; i < 3; i++)
+		{
+			m_planes[i * 2] = row[3] + row[i];
+			m_planes[i * 2 + 1] = row[3] - row[i];
+		}
+		for (glm::vec4 &plane : m_planes)
+			plane /= glm::length(glm::vec3(plane));
+	}
+
+	// axis-aligned bounding box test: returns OUTSIDE, INTERSECT or INSIDE
+	int testAABB(const float pMin[3], const float pMax[3]) const
+	{
+		int result = INSIDE;
+		for (const glm::vec4 &plane : m_planes)
+		{
+			// the corner furthest along the plane normal (p-vertex) and the opposite one (n-vertex)
+			glm::vec3 p(plane.x >= 0 ? pMax[0] : pMin[0], plane.y >= 0 ? pMax[1] : pMin[1], plane.z >= 0 ? pMax[2] : pMin[2]);
+			glm::vec3 n(plane.x >= 0 ? pMin[0] : pMax[0], plane.y >= 0 ? pMin[1] : pMax[1], plane.z >= 0 ? pMin[2] : pMax[2]);
+			if (glm::dot(glm::vec3(plane), p) + plane.w < 0)
+				return OUTSIDE;
+			if (glm::dot(glm::vec3(plane), n) + plane.w < 0)
+				result = INTERSECT;
+		}
+		return result;
+	}
+
+	// bounding sphere test: true if the sphere is at least partially inside
+	bool testSphere(const glm::vec3 &centre, float radius) const
+	{
+		for (const glm::vec4 &plane : m_planes)
+			if (glm::dot(glm::vec3(plane), centre) + plane.w < -radius)
+				return false;
+		return true;
+	}
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglFrustum_h_
@@ -0,0 +1,83 @@
+/*********************************************************************************
+Addition to the 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Not part of the original 3DGL 2.2 - new code, distributed under the same license
+
+Height field queries: heights and ray intersections.
+Usage:
+create with a height map (x-major, pHeights[x * sizeZ + z]) - the data is not copied
+getInterpolatedHeight(s) for heights at arbitrary points, one or many at a time
+intersectRay / lineOfSight for picking and visibility; rays are accelerated
+by a min/max pyramid - call update after modifying the heights
+All coordinates are local: the height map is centred at the origin
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+*********************************************************************************/
+#ifndef __3dglHeightField_h_
+#define __3dglHeightField_h_
+
+#include <vector>
+#include <cfloat>
+#include "../glm/vec2.hpp"
+#include "../glm/vec3.hpp"
+
+namespace _3dgl
+{
+
+class C3dglHeightField
+{
+	const float *m_pHeights;
+	int m_nSizeX, m_nSizeZ;
+
+	// min/max pyramid: level 0 cells are the quads of the height map, each level halves the resolution
+	struct LEVEL
+	{
+		int sizeX, sizeZ;					// number of cells
+		std::vector<float> minmax;			// min and max height of each cell (x-major)
+	};
+	std::vector<LEVEL> m_pyramid;
+
+	float height(int x, int z) const		{ return m_pHeights[x * m_nSizeZ + z]; }
+	bool intersectCell(int level, int cx, int cz, const glm::vec3 &origin, const glm::vec3 &dir, float tMax, float &t) const;
+
+public:
+	C3dglHeightField()						{ m_pHeights = NULL; m_nSizeX = m_nSizeZ = 0; }
+
+	void create(const float *pHeights, int sizeX, int sizeZ);
+	// rebuilds the pyramid after the heights in the region (height map coordinates, inclusive) have changed
+	void update(int x0, int z0, int x1, int z1);
+
+	int getSizeX() const					{ return m_nSizeX; }
+	int getSizeZ() const					{ return m_nSizeZ; }
+	int getPyramidLevels() const			{ return m_pyramid.size(); }
+
+	// heights: 0 outside the height map; interpolated within the triangles of the terrain mesh
+	float getHeight(int x, int z) const;
+	float getInterpolatedHeight(float x, float z) const;
+	// batch query: pHeights[i] = getInterpolatedHeight(pPoints[i].x, pPoints[i].y) - vectorised
+	void getInterpolatedHeights(const glm::vec2 *pPoints, float *pHeights, int n) const;
+
+	// the first intersection of the ray origin + t * dir with the terrain, for 0 <= t <= tMax
+	bool intersectRay(const glm::vec3 &origin, const glm::vec3 &dir, float &t, float tMax = FLT_MAX) const;
+	// true if the segment from a to b does not intersect the terrain
+	bool lineOfSight(const glm::vec3 &a, const glm::vec3 &b) const;
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglHeightField_h_
@@ -0,0 +1,64 @@
+/*********************************************************************************
+Addition to the 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Not part of the original 3DGL 2.2 - new code, distributed under the same license
+
+A very simple read-only memory-mapped file.
+Usage:
+open to map the entire file into the address space; the operating system
+pages the data in on demand, so files larger than the RAM may be used
+getData, getSize to access the contents
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+*********************************************************************************/
+#ifndef __3dglMappedFile_h_
+#define __3dglMappedFile_h_
+
+#include <string>
+#include "3dglObject.h"
+
+namespace _3dgl
+{
+
+class C3dglMappedFile : public C3dglObject
+{
+	std::string m_name;
+	const void *m_pData;
+	size_t m_size;
+
+	// platform-specific handles
+	void *m_hFile, *m_hMapping;
+	int m_fd;
+
+public:
+	C3dglMappedFile();
+	~C3dglMappedFile()						{ close(); }
+
+	bool open(const std::string filename);
+	void close();
+
+	bool isOpen()							{ return m_pData != NULL; }
+	const void *getData()					{ return m_pData; }
+	size_t getSize()						{ return m_size; }
+
+	std::string getName()					{ return "Mapped File (" + m_name + ")"; }
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglMappedFile_h_
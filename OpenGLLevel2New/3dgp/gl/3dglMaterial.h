@@ -2,6 +2,7 @@
 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
 Partially based on http://ogldev.atspace.co.uk/www/tutorial38/tutorial38.html
 Version 2.2 23/03/15
+Altered version - modified since 3DGL 2.2, this is not the original software
 
 Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
 
@@ -95,6 +96,9 @@ namespace _3dgl
 		void loadTexture(std::string strPath) { loadTexture(GL_TEXTURE0, strPath); }
 		void loadTexture(std::string strTexRootPath, std::string strPath) { loadTexture(GL_TEXTURE0, strTexRootPath, strPath); }
 		void loadBlankTexture() { loadBlankTexture(GL_TEXTURE0); }
+
+		// the blank texture is shared by all the materials - release it when they are all destroyed
+		static void destroyBlankTexture();
 	};
 
 }
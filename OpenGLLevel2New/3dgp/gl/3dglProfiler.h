@@ -0,0 +1,165 @@
+/*********************************************************************************
+Addition to the 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Not part of the original 3DGL 2.2 - new code, distributed under the same license
+
+Frame profiler: CPU and GPU time of named zones, exported as CSV or Chrome trace.
+Usage:
+setCurrent to make a profiler the one the zones report to (and the library code
+uses); beginFrame and endFrame around each frame
+a ZONE object times the scope it is declared in: C3dglProfiler::ZONE zone("name");
+begin and end do the same for code that does not fit a scope, e.g. the frame graph
+hooks: frameGraph.setHooks(profiler.beginHook(), profiler.endHook())
+exportCSV and exportTrace write the events in the buffer; the trace opens in
+chrome://tracing (or Perfetto), with the CPU and the GPU zones as two threads
+
+GPU times are measured with GL_TIMESTAMP queries at the start and the end of each
+zone, so that the zones can nest. The results are collected up to LATENCY frames
+later, and only when they are available - the profiler never waits for the GPU;
+a frame still pending after LATENCY frames loses its GPU times. The GPU time line
+is aligned with the CPU one at the start of each frame. Zones outside beginFrame
+and endFrame are ignored; beginFrame also ends the previous frame.
+Finished zones go into a ring buffer of events, written by the rendering thread
+only; the readers take a copy up to the last complete event, without locking, and
+drop the events the writer overwrote while they were copying.
+Zone names are expected to be string literals; the std::string versions keep their
+own copy of the name.
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+*********************************************************************************/
+#ifndef __3dglProfiler_h_
+#define __3dglProfiler_h_
+
+#include <string>
+#include <vector>
+#include <set>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+#include "3dglObject.h"
+
+namespace _3dgl
+{
+
+class C3dglProfiler : public C3dglObject
+{
+public:
+	enum { LATENCY = 4, DEFAULT_CAPACITY = 65536 };
+
+	struct EVENT
+	{
+		const char *name;
+		unsigned frame;
+		unsigned depth;						// nesting level, 0 for the outermost zones
+		double cpuBegin, cpuEnd;			// milliseconds since the profiler was created
+		double gpuBegin, gpuEnd;			// on the same time line; negative if not measured
+	};
+
+	// averages per frame, by zone name
+	struct SUMMARY
+	{
+		const char *name;
+		double nCalls;
+		double cpuTime, gpuTime;			// milliseconds
+	};
+
+	// times the scope it is declared in, using the current profiler
+	class ZONE
+	{
+		C3dglProfiler *m_pProfiler;
+	public:
+		ZONE(const char *name) : m_pProfiler(c_pCurrent && c_pCurrent->begin(name) ? c_pCurrent : NULL)	{ }
+		~ZONE()												{ if (m_pProfiler) m_pProfiler->end(); }
+	};
+
+private:
+	struct FRAME
+	{
+		unsigned frame;
+		std::vector<EVENT> events;
+		std::vector<unsigned> queries;		// timestamp queries, reused from frame to frame
+		unsigned nQueries;					// used in this frame
+		std::vector<unsigned> slots;		// two per event: its start and end query
+		double cpuBase;						// CPU and GPU time taken together at the start of the frame
+		long long gpuBase;
+		bool bPending;						// closed, waiting for the GPU results
+	};
+
+	static C3dglProfiler *c_pCurrent;
+
+	std::chrono::high_resolution_clock::time_point m_start;
+	bool m_bEnabled;
+	bool m_bTimer;							// GL timer queries available
+	bool m_bInFrame;
+	unsigned m_nFrame;
+	FRAME m_frames[LATENCY];
+	std::vector<unsigned> m_stack;			// open zones, indices to the events of the current frame
+	std::set<std::string> m_names;			// copies of the std::string names
+	unsigned m_nDropped;					// frames that lost their GPU times
+
+	// ring buffer of the finished events
+	std::vector<EVENT> m_ring;
+	std::atomic<unsigned long long> m_head;	// events written so far
+	std::atomic<unsigned long long> m_started;	// events being written or written so far
+
+	double now();
+	unsigned query(FRAME &frame);
+	bool resolve(FRAME &frame, bool bForce);
+	void push(const EVENT &event);
+
+public:
+	C3dglProfiler(unsigned capacity = DEFAULT_CAPACITY);
+	~C3dglProfiler()						{ destroy(); }
+
+	static void setCurrent(C3dglProfiler *pProfiler)	{ c_pCurrent = pProfiler; }
+	static C3dglProfiler *getCurrent()		{ return c_pCurrent; }
+
+	void setEnabled(bool bEnabled)			{ m_bEnabled = bEnabled; }
+	bool isEnabled()						{ return m_bEnabled; }
+
+	void beginFrame();
+	void endFrame();
+
+	// false if the zone is ignored (outside of a frame)
+	bool begin(const char *name);
+	bool begin(const std::string &name);
+	void end();
+
+	// for C3dglFrameGraph::setHooks
+	std::function<void(const std::string&)> beginHook()	{ return [this](const std::string &name) { begin(name); }; }
+	std::function<void(const std::string&)> endHook()	{ return [this](const std::string&) { end(); }; }
+
+	// copy of the events in the buffer, oldest first
+	void getEvents(std::vector<EVENT> &events);
+	// average times per frame over the frames in the buffer
+	void getSummary(std::vector<SUMMARY> &summary);
+	unsigned getDroppedFrames()				{ return m_nDropped; }
+
+	bool exportCSV(const std::string &filename);
+	bool exportTrace(const std::string &filename);
+
+	void clear();
+	void destroy();
+
+	std::string getName()					{ return "Profiler"; }
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglProfiler_h_
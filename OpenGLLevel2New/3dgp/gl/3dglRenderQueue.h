@@ -0,0 +1,134 @@
+/*********************************************************************************
+Addition to the 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Not part of the original 3DGL 2.2 - new code, distributed under the same license
+
+Render queue: draw packets sorted by their render state.
+Usage:
+addMaterial with a function that sends the uniforms of a material to its program,
+addTextureSet with the textures (unit, target, name) it needs - both return an id;
+setTextureSet updates a set, e.g. with a render target re-created by the frame graph
+submit a packet for each object: layer, program, material, texture set, distance
+from the camera and the drawing function; flush at the end of the pass
+setBackToFront for the layers of transparent objects
+
+Each packet gets a 64-bit key: layer (4 bits), program (8), material (12), texture
+set (12) and depth (28), so that flush, after a radix sort of the keys, issues the
+objects of the same program, material and texture set in a row. The program, the
+material and each texture are only set when they change from the previous packet;
+a packet with its own state (e.g. a model that binds the textures of its materials)
+leaves the material and the textures unknown to the next one. Nothing is assumed
+about the GL state when the flush starts.
+The statistics count the state changes issued and, for comparison, the changes the
+packets would need in the order they were submitted.
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+*********************************************************************************/
+#ifndef __3dglRenderQueue_h_
+#define __3dglRenderQueue_h_
+
+#include <vector>
+#include <functional>
+#include <initializer_list>
+
+#include "3dglObject.h"
+
+namespace _3dgl
+{
+
+class C3dglProgram;
+
+class C3dglRenderQueue : public C3dglObject
+{
+public:
+	enum { LAYER_BITS = 4, PROGRAM_BITS = 8, MATERIAL_BITS = 12, TEXTURE_BITS = 12, DEPTH_BITS = 28 };
+	enum { MAX_UNITS = 32 };
+
+	typedef std::function<void()> APPLY;
+	typedef std::function<void()> DRAW;
+
+	struct BINDING
+	{
+		unsigned unit;						// GL_TEXTURE0 + n
+		unsigned target;					// GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP...
+		unsigned id;
+	};
+
+	struct STATS
+	{
+		unsigned nPackets, nFlushes;
+		unsigned nPrograms, nMaterials, nBinds;						// state changes issued
+		unsigned nProgramsUnsorted, nMaterialsUnsorted, nBindsUnsorted;	// needed in the submission order
+	};
+
+private:
+	struct PACKET
+	{
+		unsigned long long key;
+		C3dglProgram *pProgram;
+		int material;						// -1 for none
+		int textures;						// -1 for none
+		bool bOwnState;
+		DRAW draw;
+	};
+	struct COUNTS
+	{
+		unsigned nPrograms, nMaterials, nBinds;
+	};
+
+	std::vector<PACKET> m_packets;
+	std::vector<unsigned long long> m_keys, m_keysTemp;	// radix sort buffers
+	std::vector<unsigned> m_order, m_orderTemp;
+	std::vector<APPLY> m_materials;
+	std::vector<std::vector<BINDING>> m_textureSets;
+	std::vector<C3dglProgram*> m_programs;	// program ids
+	unsigned m_backToFront;					// layers sorted back to front (bit mask)
+	bool m_bSorting;
+	STATS m_stats;
+
+	int getProgramId(C3dglProgram *pProgram);
+	void sort();
+	void run(bool bExecute, COUNTS &counts);
+
+public:
+	C3dglRenderQueue();
+
+	// state: return the ids used to submit the packets
+	int addMaterial(APPLY apply);
+	int addTextureSet(std::initializer_list<BINDING> bindings);
+	void setTextureSet(int textures, std::initializer_list<BINDING> bindings);
+
+	void setBackToFront(int layer, bool bBackToFront = true);
+	void setSorting(bool bSorting)			{ m_bSorting = bSorting; }
+	bool isSorting()						{ return m_bSorting; }
+
+	// depth: distance from the camera; bOwnState if draw sets material uniforms or binds textures by itself
+	void submit(int layer, C3dglProgram *pProgram, int material, int textures, float depth, DRAW draw, bool bOwnState = false);
+	void flush();
+	void clear()							{ m_packets.clear(); }
+
+	// statistics, accumulated until reset - e.g. once per frame
+	const STATS &getStats()					{ return m_stats; }
+	void resetStats();
+
+	std::string getName()					{ return "Render Queue"; }
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglRenderQueue_h_
@@ -0,0 +1,150 @@
+/*********************************************************************************
+Addition to the 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Not part of the original 3DGL 2.2 - new code, distributed under the same license
+
+GPU resource ledger: every buffer, texture, renderbuffer, framebuffer and vertex
+array alive, with its owner, size and format; the GPU memory taken by each owner;
+the handles leaked.
+Usage:
+install (after glewInit, before anything is created) to start recording, uninstall
+to stop - opt-in, no cost when not installed
+an OWNER object tags the resources created in the scope it is declared in:
+C3dglResourceLedger::OWNER owner("name"); the tags nest, e.g. "Model (x)/materials".
+The library tags its own resources: the models, the terrain, the sky box, the
+frame graph render targets and the uniform buffers
+print writes the live resources and the memory by owner; reportLeaks lists the
+handles still alive - at shutdown, after everything has been released, or those
+created since a checkpoint, e.g. around a window resize that should reuse or
+release its render targets
+
+The GL entry points loaded by GLEW are recorded by swapping their GLEW function
+pointers, like C3dglCallStats does - install the ledger first and uninstall it
+last if both are used. Textures are created with the OpenGL 1.1 functions, which
+cannot be redirected: the library creates and deletes them through genTextures
+and deleteTextures, and allocates them through C3dglCallStats::texImage2D.
+Sizes are estimated from the internal format and the dimensions, all mipmap levels
+and samples included; the driver may pad or compress them.
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+*********************************************************************************/
+#ifndef __3dglResourceLedger_h_
+#define __3dglResourceLedger_h_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+
+#include "3dglObject.h"
+
+namespace _3dgl
+{
+
+class C3dglResourceLedger : public C3dglObject
+{
+public:
+	enum KIND { BUFFER, TEXTURE, RENDERBUFFER, FRAMEBUFFER, VERTEX_ARRAY, KIND_COUNT };
+
+	struct RESOURCE
+	{
+		KIND kind;
+		unsigned id;
+		std::string owner;
+		unsigned long long size;			// bytes
+		unsigned format;					// internal format of the textures and renderbuffers
+		int width, height, depth;			// of the level 0; depth: layers, 6 for cube maps
+		unsigned long long serial;			// creation order, see checkpoint
+	};
+
+	// live resources of an owner
+	struct USAGE
+	{
+		std::string owner;
+		unsigned count[KIND_COUNT];
+		unsigned long long size;
+	};
+
+	// tags the resources created in the scope it is declared in
+	class OWNER
+	{
+	public:
+		OWNER(const std::string &name, bool bRoot = false)	{ pushOwner(name, bRoot); }
+		~OWNER()											{ popOwner(); }
+	};
+
+private:
+	static C3dglResourceLedger *c_pCurrent;	// installed
+	static std::vector<std::string> c_owners;	// open tags, each with the ones it is nested in
+	struct HOOK { void **pFn; void *original, *hook; };
+	std::vector<HOOK> m_hooks;				// GLEW function pointers replaced, with their original values
+
+	std::map<std::pair<int, unsigned>, RESOURCE> m_resources;	// by kind and id
+	std::map<std::pair<unsigned, int>, unsigned long long> m_images;	// texture images: bytes by texture and face * 32 + level
+	unsigned long long m_serial;			// resources created so far
+	unsigned m_nUnknown;					// deletions of handles not in the ledger
+
+	struct HOOKS;							// the recording versions of the GL functions
+	void created(KIND kind, int n, const unsigned *ids);
+	void deleted(KIND kind, int n, const unsigned *ids);
+	RESOURCE *bound(KIND kind, unsigned target);
+	void image(unsigned target, int level, unsigned internalFormat, int width, int height, int depth);
+
+public:
+	C3dglResourceLedger();
+	~C3dglResourceLedger()					{ uninstall(); }
+
+	bool install();
+	void uninstall();
+	bool isInstalled()						{ return c_pCurrent == this; }
+	static C3dglResourceLedger *getCurrent()	{ return c_pCurrent; }
+
+	// owner tags; bRoot starts a new tag rather than nesting it in the open one
+	static void pushOwner(const std::string &name, bool bRoot = false);
+	static void popOwner();
+	static std::string getOwner()			{ return c_owners.empty() ? "untagged" : c_owners.back(); }
+
+	// live resources created since the checkpoint given (all if 0), oldest first
+	void getResources(std::vector<RESOURCE> &resources, unsigned long long since = 0);
+	// live resources by owner, the largest first
+	void getUsage(std::vector<USAGE> &usage);
+	unsigned long long getMemory();			// all the live resources
+	unsigned getUnknownDeletions()			{ return m_nUnknown; }
+
+	// resources created from now on are those after the checkpoint
+	unsigned long long checkpoint()			{ return m_serial; }
+
+	// lists the live resources created since the checkpoint given (all if 0); returns how many
+	unsigned reportLeaks(std::ostream &out, unsigned long long since = 0);
+	// memory and the number of resources by owner
+	void print(std::ostream &out);
+
+	static const char *getKindName(KIND kind);
+
+	// OpenGL 1.1 functions, recorded if installed
+	static void genTextures(int n, unsigned *textures);
+	static void deleteTextures(int n, const unsigned *textures);
+	// records a texture image allocated with the texture bound to the target - see C3dglCallStats::texImage2D
+	static void texImage(unsigned target, int level, int internalFormat, int width, int height, int depth = 1);
+
+	std::string getName()					{ return "Resource Ledger"; }
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglResourceLedger_h_
@@ -2,6 +2,7 @@
 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
 Partially based on Luke Benstead GLSLProgram class.
 Version 2.2 23/03/15
+Altered version - modified since 3DGL 2.2, this is not the original software
 
 Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
 
@@ -43,7 +44,12 @@ freely, subject to the following restrictions:
 #include <string>
 #include <map>
 #include <set>
+#include <vector>
+#include <unordered_map>
 
+#include "../glm/vec2.hpp"
+#include "../glm/vec3.hpp"
+#include "../glm/vec4.hpp"
 #include "../glm/mat4x4.hpp"
 
 //////////////////////////////////////////////////////////
@@ -56,6 +62,23 @@ namespace _3dgl
 {
 
 class C3dglProgram;
+template <class T> class UniformHandle;
+
+// FNV-1a hash of a uniform name
+constexpr unsigned long long UniformHash(const char *name, unsigned long long hash = 14695981039346656037ull)
+{
+	return *name ? UniformHash(name + 1, (hash ^ (unsigned char)*name) * 1099511628211ull) : hash;
+}
+
+// Uniform name and its hash. The hash is computed at run time for strings; for string literals
+// the compiler may compute it, and must if the name is a constant: constexpr UniformName name = "t";
+struct UniformName
+{
+	const char *name;
+	unsigned long long hash;
+	constexpr UniformName(const char *_name) : name(_name), hash(UniformHash(_name)) { }
+	UniformName(const std::string &_name) : name(_name.c_str()), hash(UniformHash(_name.c_str())) { }
+};
 
 class C3dglShader : public C3dglObject
 {
@@ -88,6 +111,17 @@ public:
 
 private:
 	static C3dglProgram *c_pCurrentProgram;
+	static std::map<std::string, GLuint> c_blockBindings;	// uniform block binding points, see SetUniformBlockBinding
+
+	// the last value sent to a location, see _send
+	struct UNIFORM_CACHE
+	{
+		char kind;							// 'i', 'u', 'f' or 'm' (matrix) - the glUniform function used
+		GLsizei size;						// in bytes, 0 if not known
+		GLuint data[16];
+	};
+	static bool c_bUniformCache, c_bUniformVerify;
+	static unsigned c_nUniformsSent, c_nUniformsElided;
 
 	struct UNIFORM
 	{
@@ -99,12 +133,15 @@ private:
 	GLuint m_id;
 	std::map<std::string, GLuint> m_attribs;
 	std::map<std::string, UNIFORM> m_uniforms;
+	std::unordered_map<unsigned long long, UNIFORM> m_hashed;	// m_uniforms by the hashes of their names
 
 	GLuint m_stdAttr[ATTR_LAST];
 	UNIFORM m_stdUni[UNI_LAST];
 
 	std::map<GLenum, unsigned> m_types;
 
+	std::vector<UNIFORM_CACHE> m_cache;		// by location, for the active uniforms registered by Link
+
 public:
 	C3dglProgram();
 
@@ -118,6 +155,23 @@ public:
 
 	static C3dglProgram *GetCurrentProgram()		{ return c_pCurrentProgram; }
 
+	// uniform blocks: programs linked after SetUniformBlockBinding bind the named block to the binding point;
+	// BindUniformBlock binds a block of a program already linked
+	static void SetUniformBlockBinding(std::string name, GLuint binding)	{ c_blockBindings[name] = binding; }
+	bool BindUniformBlock(std::string name, GLuint binding);
+
+	// redundant uniform elimination: a value equal to the one last sent to the location is not passed to GL.
+	// The counters add up the uniforms sent and elided by all programs until reset, e.g. once per frame.
+	// In the verify mode each elided value is compared with glGetUniform - slow, for debugging only.
+	// InvalidateUniformCache if the uniforms are set bypassing the program
+	static void EnableUniformCache(bool bEnable)			{ c_bUniformCache = bEnable; }
+	static bool IsUniformCacheEnabled()						{ return c_bUniformCache; }
+	static void SetUniformCacheVerify(bool bVerify)			{ c_bUniformVerify = bVerify; }
+	static unsigned GetUniformsSent()						{ return c_nUniformsSent; }
+	static unsigned GetUniformsElided()						{ return c_nUniformsElided; }
+	static void ResetUniformStats()							{ c_nUniformsSent = c_nUniformsElided = 0; }
+	void InvalidateUniformCache();
+
 	// numerical locations for attributes
 	void GetAttribLocation(std::string idUniform, GLuint &location);
 	GLuint GetAttribLocation(std::string idUniform)							{ GLuint location; GetAttribLocation(idUniform, location); return location; }
@@ -125,78 +179,101 @@ public:
 	GLuint GetAttribLocation(ATTRIB_STD attr)								{ return m_stdAttr[attr]; }
 
 	// numerical locations and types for attribute and uniform names
-	void GetUniformLocation(std::string idUniform, GLuint &location, GLenum &type, GLenum &targetType);
-	GLuint GetUniformLocation(std::string idUniform)						{ GLuint location; GLenum type, targetType; GetUniformLocation(idUniform, location, type, targetType); return location; }
+	void GetUniformLocation(UniformName idUniform, GLuint &location, GLenum &type, GLenum &targetType);
+	GLuint GetUniformLocation(UniformName idUniform)						{ GLuint location; GLenum type, targetType; GetUniformLocation(idUniform, location, type, targetType); return location; }
 	void GetUniformLocation(UNI_STD uniId, GLuint &location, GLenum &type, GLenum &targetType);
 	GLuint GetUniformLocation(UNI_STD uniId)								{ GLuint location; GLenum type, targetType; GetUniformLocation(uniId, location, type, targetType); return location; }
 
-	// send uniform using numerical location
-	void SendUniform(GLuint location, GLint v0)													{ if (!IsUsed()) Use(); glUniform1i(location, v0); }
-	void SendUniform(GLuint location, GLint v0, GLint v1)										{ if (!IsUsed()) Use(); glUniform2i(location, v0, v1); }
-	void SendUniform(GLuint location, GLint v0, GLint v1, GLint v2)								{ if (!IsUsed()) Use(); glUniform3i(location, v0, v1, v2); }
-	void SendUniform(GLuint location, GLint v0, GLint v1, GLint v2, GLint v3)					{ if (!IsUsed()) Use(); glUniform4i(location, v0, v1, v2, v3); }
-	void SendUniform(GLuint location, GLuint v0)												{ if (!IsUsed()) Use(); glUniform1ui(location, v0); }
-	void SendUniform(GLuint location, GLuint v0, GLuint v1)										{ if (!IsUsed()) Use(); glUniform2ui(location, v0, v1); }
-	void SendUniform(GLuint location, GLuint v0, GLuint v1, GLuint v2)							{ if (!IsUsed()) Use(); glUniform3ui(location, v0, v1, v2); }
-	void SendUniform(GLuint location, GLuint v0, GLuint v1, GLuint v2, GLuint v3)				{ if (!IsUsed()) Use(); glUniform4ui(location, v0, v1, v2, v3); }
-	void SendUniform(GLuint location, GLfloat v0)												{ if (!IsUsed()) Use(); glUniform1f(location, v0); }
-	void SendUniform(GLuint location, GLfloat v0, GLfloat v1)									{ if (!IsUsed()) Use(); glUniform2f(location, v0, v1); }
-	void SendUniform(GLuint location, GLfloat v0, GLfloat v1, GLfloat v2)						{ if (!IsUsed()) Use(); glUniform3f(location, v0, v1, v2); }
-	void SendUniform(GLuint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3)			{ if (!IsUsed()) Use(); glUniform4f(location, v0, v1, v2, v3); }
-	void SendUniform(GLuint location, double v0)												{ if (!IsUsed()) Use(); glUniform1f(location, (float)v0); }
-	void SendUniform(GLuint location, double v0, double v1)										{ if (!IsUsed()) Use(); glUniform2f(location, (float)v0, (float)v1); }
-	void SendUniform(GLuint location, double v0, double v1, double v2)							{ if (!IsUsed()) Use(); glUniform3f(location, (float)v0, (float)v1, (float)v2); }
-	void SendUniform(GLuint location, double v0, double v1, double v2, double v3)				{ if (!IsUsed()) Use(); glUniform4f(location, (float)v0, (float)v1, (float)v2, (float)v3); }
-	void SendUniform(GLuint location, GLfloat pMatrix[16])										{ if (!IsUsed()) Use(); glUniformMatrix4fv(location, 1, GL_FALSE, pMatrix); }
-	void SendUniform(GLuint location, glm::mat4 matrix)											{ if (!IsUsed()) Use(); glUniformMatrix4fv(location, 1, GL_FALSE, &matrix[0][0]); }
-
-	void SendUniform1v(GLuint location, GLint *p, GLuint count = 1)								{ if (!IsUsed()) Use(); glUniform1iv(location, count, p); }
-	void SendUniform2v(GLuint location, GLint *p, GLuint count = 1)								{ if (!IsUsed()) Use(); glUniform2iv(location, count, p); }
-	void SendUniform3v(GLuint location, GLint *p, GLuint count = 1)								{ if (!IsUsed()) Use(); glUniform3iv(location, count, p); }
-	void SendUniform4v(GLuint location, GLint *p, GLuint count = 1)								{ if (!IsUsed()) Use(); glUniform4iv(location, count, p); }
-	void SendUniform1v(GLuint location, GLuint *p, GLuint count = 1)							{ if (!IsUsed()) Use(); glUniform1uiv(location, count, p); }
-	void SendUniform2v(GLuint location, GLuint *p, GLuint count = 1)							{ if (!IsUsed()) Use(); glUniform2uiv(location, count, p); }
-	void SendUniform3v(GLuint location, GLuint *p, GLuint count = 1)							{ if (!IsUsed()) Use(); glUniform3uiv(location, count, p); }
-	void SendUniform4v(GLuint location, GLuint *p, GLuint count = 1)							{ if (!IsUsed()) Use(); glUniform4uiv(location, count, p); }
-	void SendUniform1v(GLuint location, GLfloat *p, GLuint count = 1)							{ if (!IsUsed()) Use(); glUniform1fv(location, count, p); }
-	void SendUniform2v(GLuint location, GLfloat *p, GLuint count = 1)							{ if (!IsUsed()) Use(); glUniform2fv(location, count, p); }
-	void SendUniform3v(GLuint location, GLfloat *p, GLuint count = 1)							{ if (!IsUsed()) Use(); glUniform3fv(location, count, p); }
-	void SendUniform4v(GLuint location, GLfloat *p, GLuint count = 1)							{ if (!IsUsed()) Use(); glUniform4fv(location, count, p); }
-	void SendUniformMatrixv(GLuint location, GLfloat *pMatrix, GLuint count = 1)				{ if (!IsUsed()) Use(); glUniformMatrix4fv(location, count, GL_FALSE, pMatrix); }
-
-	// send uniform using a name. Internally uses a look-up list to speed up and provide additional control
-	bool SendUniform(std::string name, GLint v0);
-	bool SendUniform(std::string name, GLint v0, GLint v1);
-	bool SendUniform(std::string name, GLint v0, GLint v1, GLint v2);
-	bool SendUniform(std::string name, GLint v0, GLint v1, GLint v2, GLint v3);
-	bool SendUniform(std::string name, GLuint v0);
-	bool SendUniform(std::string name, GLuint v0, GLuint v1);
-	bool SendUniform(std::string name, GLuint v0, GLuint v1, GLuint v2);
-	bool SendUniform(std::string name, GLuint v0, GLuint v1, GLuint v2, GLuint v3);
-	bool SendUniform(std::string name, GLfloat v0);
-	bool SendUniform(std::string name, GLfloat v0, GLfloat v1);
-	bool SendUniform(std::string name, GLfloat v0, GLfloat v1, GLfloat v2);
-	bool SendUniform(std::string name, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3);
-	bool SendUniform(std::string name, double v0);
-	bool SendUniform(std::string name, double v0, double v1);
-	bool SendUniform(std::string name, double v0, double v1, double v2);
-	bool SendUniform(std::string name, double v0, double v1, double v2, double v3);
-	bool SendUniform(std::string name, GLfloat pMatrix[16]);
-	bool SendUniform(std::string name, glm::mat4 matrix);
-
-	bool SendUniform1v(std::string name, GLint *p, GLuint count = 1);
-	bool SendUniform2v(std::string name, GLint *p, GLuint count = 1);
-	bool SendUniform3v(std::string name, GLint *p, GLuint count = 1);
-	bool SendUniform4v(std::string name, GLint *p, GLuint count = 1);
-	bool SendUniform1v(std::string name, GLuint *p, GLuint count = 1);
-	bool SendUniform2v(std::string name, GLuint *p, GLuint count = 1);
-	bool SendUniform3v(std::string name, GLuint *p, GLuint count = 1);
-	bool SendUniform4v(std::string name, GLuint *p, GLuint count = 1);
-	bool SendUniform1v(std::string name, GLfloat *p, GLuint count = 1);
-	bool SendUniform2v(std::string name, GLfloat *p, GLuint count = 1);
-	bool SendUniform3v(std::string name, GLfloat *p, GLuint count = 1);
-	bool SendUniform4v(std::string name, GLfloat *p, GLuint count = 1);
-	bool SendUniformMatrixv(std::string name, GLfloat *pMatrix, GLuint count = 1);
+	// typed uniform handles, e.g. GetUniform<glm::vec3>("materialAmbient") or GetUniform<glm::mat4[]>("bones");
+	// resolve them once, after Link - sending through a handle involves no look-up at all
+	template <class T> UniformHandle<T> GetUniform(UniformName name);
+
+	// send uniform using numerical location; values equal to the last ones sent to the location are not passed to GL
+	void SendUniform(GLuint location, GLint v0)													{ GLint v[] = { v0 }; if (_send(location, 'i', v, sizeof(v))) glUniform1i(location, v0); }
+	void SendUniform(GLuint location, GLint v0, GLint v1)										{ GLint v[] = { v0, v1 }; if (_send(location, 'i', v, sizeof(v))) glUniform2i(location, v0, v1); }
+	void SendUniform(GLuint location, GLint v0, GLint v1, GLint v2)								{ GLint v[] = { v0, v1, v2 }; if (_send(location, 'i', v, sizeof(v))) glUniform3i(location, v0, v1, v2); }
+	void SendUniform(GLuint location, GLint v0, GLint v1, GLint v2, GLint v3)					{ GLint v[] = { v0, v1, v2, v3 }; if (_send(location, 'i', v, sizeof(v))) glUniform4i(location, v0, v1, v2, v3); }
+	void SendUniform(GLuint location, GLuint v0)												{ GLuint v[] = { v0 }; if (_send(location, 'u', v, sizeof(v))) glUniform1ui(location, v0); }
+	void SendUniform(GLuint location, GLuint v0, GLuint v1)										{ GLuint v[] = { v0, v1 }; if (_send(location, 'u', v, sizeof(v))) glUniform2ui(location, v0, v1); }
+	void SendUniform(GLuint location, GLuint v0, GLuint v1, GLuint v2)							{ GLuint v[] = { v0, v1, v2 }; if (_send(location, 'u', v, sizeof(v))) glUniform3ui(location, v0, v1, v2); }
+	void SendUniform(GLuint location, GLuint v0, GLuint v1, GLuint v2, GLuint v3)				{ GLuint v[] = { v0, v1, v2, v3 }; if (_send(location, 'u', v, sizeof(v))) glUniform4ui(location, v0, v1, v2, v3); }
+	void SendUniform(GLuint location, GLfloat v0)												{ GLfloat v[] = { v0 }; if (_send(location, 'f', v, sizeof(v))) glUniform1f(location, v0); }
+	void SendUniform(GLuint location, GLfloat v0, GLfloat v1)									{ GLfloat v[] = { v0, v1 }; if (_send(location, 'f', v, sizeof(v))) glUniform2f(location, v0, v1); }
+	void SendUniform(GLuint location, GLfloat v0, GLfloat v1, GLfloat v2)						{ GLfloat v[] = { v0, v1, v2 }; if (_send(location, 'f', v, sizeof(v))) glUniform3f(location, v0, v1, v2); }
+	void SendUniform(GLuint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3)			{ GLfloat v[] = { v0, v1, v2, v3 }; if (_send(location, 'f', v, sizeof(v))) glUniform4f(location, v0, v1, v2, v3); }
+	void SendUniform(GLuint location, double v0)												{ SendUniform(location, (GLfloat)v0); }
+	void SendUniform(GLuint location, double v0, double v1)										{ SendUniform(location, (GLfloat)v0, (GLfloat)v1); }
+	void SendUniform(GLuint location, double v0, double v1, double v2)							{ SendUniform(location, (GLfloat)v0, (GLfloat)v1, (GLfloat)v2); }
+	void SendUniform(GLuint location, double v0, double v1, double v2, double v3)				{ SendUniform(location, (GLfloat)v0, (GLfloat)v1, (GLfloat)v2, (GLfloat)v3); }
+	void SendUniform(GLuint location, GLfloat pMatrix[16])										{ if (_send(location, 'm', pMatrix, 16 * sizeof(GLfloat))) glUniformMatrix4fv(location, 1, GL_FALSE, pMatrix); }
+	void SendUniform(GLuint location, glm::mat4 matrix)											{ if (_send(location, 'm', &matrix[0][0], 16 * sizeof(GLfloat))) glUniformMatrix4fv(location, 1, GL_FALSE, &matrix[0][0]); }
+
+	void SendUniform1v(GLuint location, GLint *p, GLuint count = 1)								{ if (_send(location, 'i', p, 1 * sizeof(GLint), count)) glUniform1iv(location, count, p); }
+	void SendUniform2v(GLuint location, GLint *p, GLuint count = 1)								{ if (_send(location, 'i', p, 2 * sizeof(GLint), count)) glUniform2iv(location, count, p); }
+	void SendUniform3v(GLuint location, GLint *p, GLuint count = 1)								{ if (_send(location, 'i', p, 3 * sizeof(GLint), count)) glUniform3iv(location, count, p); }
+	void SendUniform4v(GLuint location, GLint *p, GLuint count = 1)								{ if (_send(location, 'i', p, 4 * sizeof(GLint), count)) glUniform4iv(location, count, p); }
+	void SendUniform1v(GLuint location, GLuint *p, GLuint count = 1)							{ if (_send(location, 'u', p, 1 * sizeof(GLuint), count)) glUniform1uiv(location, count, p); }
+	void SendUniform2v(GLuint location, GLuint *p, GLuint count = 1)							{ if (_send(location, 'u', p, 2 * sizeof(GLuint), count)) glUniform2uiv(location, count, p); }
+	void SendUniform3v(GLuint location, GLuint *p, GLuint count = 1)							{ if (_send(location, 'u', p, 3 * sizeof(GLuint), count)) glUniform3uiv(location, count, p); }
+	void SendUniform4v(GLuint location, GLuint *p, GLuint count = 1)							{ if (_send(location, 'u', p, 4 * sizeof(GLuint), count)) glUniform4uiv(location, count, p); }
+	void SendUniform1v(GLuint location, GLfloat *p, GLuint count = 1)							{ if (_send(location, 'f', p, 1 * sizeof(GLfloat), count)) glUniform1fv(location, count, p); }
+	void SendUniform2v(GLuint location, GLfloat *p, GLuint count = 1)							{ if (_send(location, 'f', p, 2 * sizeof(GLfloat), count)) glUniform2fv(location, count, p); }
+	void SendUniform3v(GLuint location, GLfloat *p, GLuint count = 1)							{ if (_send(location, 'f', p, 3 * sizeof(GLfloat), count)) glUniform3fv(location, count, p); }
+	void SendUniform4v(GLuint location, GLfloat *p, GLuint count = 1)							{ if (_send(location, 'f', p, 4 * sizeof(GLfloat), count)) glUniform4fv(location, count, p); }
+	void SendUniformMatrixv(GLuint location, GLfloat *pMatrix, GLuint count = 1)				{ if (_send(location, 'm', pMatrix, 16 * sizeof(GLfloat), count)) glUniformMatrix4fv(location, count, GL_FALSE, pMatrix); }
+
+	// glm vectors and arrays of values, used by the uniform handles
+	void SendUniform(GLuint location, glm::vec2 v)												{ SendUniform(location, v.x, v.y); }
+	void SendUniform(GLuint location, glm::vec3 v)												{ SendUniform(location, v.x, v.y, v.z); }
+	void SendUniform(GLuint location, glm::vec4 v)												{ SendUniform(location, v.x, v.y, v.z, v.w); }
+	void SendUniform(GLuint location, glm::ivec2 v)												{ SendUniform(location, v.x, v.y); }
+	void SendUniform(GLuint location, glm::ivec3 v)												{ SendUniform(location, v.x, v.y, v.z); }
+	void SendUniform(GLuint location, glm::ivec4 v)												{ SendUniform(location, v.x, v.y, v.z, v.w); }
+	void SendUniformv(GLuint location, const GLint *p, GLuint count)							{ SendUniform1v(location, (GLint*)p, count); }
+	void SendUniformv(GLuint location, const GLuint *p, GLuint count)							{ SendUniform1v(location, (GLuint*)p, count); }
+	void SendUniformv(GLuint location, const GLfloat *p, GLuint count)							{ SendUniform1v(location, (GLfloat*)p, count); }
+	void SendUniformv(GLuint location, const glm::vec2 *p, GLuint count)						{ SendUniform2v(location, (GLfloat*)p, count); }
+	void SendUniformv(GLuint location, const glm::vec3 *p, GLuint count)						{ SendUniform3v(location, (GLfloat*)p, count); }
+	void SendUniformv(GLuint location, const glm::vec4 *p, GLuint count)						{ SendUniform4v(location, (GLfloat*)p, count); }
+	void SendUniformv(GLuint location, const glm::ivec2 *p, GLuint count)						{ SendUniform2v(location, (GLint*)p, count); }
+	void SendUniformv(GLuint location, const glm::ivec3 *p, GLuint count)						{ SendUniform3v(location, (GLint*)p, count); }
+	void SendUniformv(GLuint location, const glm::ivec4 *p, GLuint count)						{ SendUniform4v(location, (GLint*)p, count); }
+	void SendUniformv(GLuint location, const glm::mat4 *p, GLuint count)						{ SendUniformMatrixv(location, (GLfloat*)p, count); }
+
+	// send uniform using a name - constexpr names are hashed at compile time, see UniformName;
+	// internally uses a look-up list to speed up and provide additional control
+	bool SendUniform(UniformName name, GLint v0);
+	bool SendUniform(UniformName name, GLint v0, GLint v1);
+	bool SendUniform(UniformName name, GLint v0, GLint v1, GLint v2);
+	bool SendUniform(UniformName name, GLint v0, GLint v1, GLint v2, GLint v3);
+	bool SendUniform(UniformName name, GLuint v0);
+	bool SendUniform(UniformName name, GLuint v0, GLuint v1);
+	bool SendUniform(UniformName name, GLuint v0, GLuint v1, GLuint v2);
+	bool SendUniform(UniformName name, GLuint v0, GLuint v1, GLuint v2, GLuint v3);
+	bool SendUniform(UniformName name, GLfloat v0);
+	bool SendUniform(UniformName name, GLfloat v0, GLfloat v1);
+	bool SendUniform(UniformName name, GLfloat v0, GLfloat v1, GLfloat v2);
+	bool SendUniform(UniformName name, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3);
+	bool SendUniform(UniformName name, double v0);
+	bool SendUniform(UniformName name, double v0, double v1);
+	bool SendUniform(UniformName name, double v0, double v1, double v2);
+	bool SendUniform(UniformName name, double v0, double v1, double v2, double v3);
+	bool SendUniform(UniformName name, GLfloat pMatrix[16]);
+	bool SendUniform(UniformName name, glm::mat4 matrix);
+
+	bool SendUniform1v(UniformName name, GLint *p, GLuint count = 1);
+	bool SendUniform2v(UniformName name, GLint *p, GLuint count = 1);
+	bool SendUniform3v(UniformName name, GLint *p, GLuint count = 1);
+	bool SendUniform4v(UniformName name, GLint *p, GLuint count = 1);
+	bool SendUniform1v(UniformName name, GLuint *p, GLuint count = 1);
+	bool SendUniform2v(UniformName name, GLuint *p, GLuint count = 1);
+	bool SendUniform3v(UniformName name, GLuint *p, GLuint count = 1);
+	bool SendUniform4v(UniformName name, GLuint *p, GLuint count = 1);
+	bool SendUniform1v(UniformName name, GLfloat *p, GLuint count = 1);
+	bool SendUniform2v(UniformName name, GLfloat *p, GLuint count = 1);
+	bool SendUniform3v(UniformName name, GLfloat *p, GLuint count = 1);
+	bool SendUniform4v(UniformName name, GLfloat *p, GLuint count = 1);
+	bool SendUniformMatrixv(UniformName name, GLfloat *pMatrix, GLuint count = 1);
 
 	// send uniform using an indexed name
 	bool SendIndUniform(std::string name, GLuint i, GLint v0)									{ SendUniform(name + "[" + std::to_string(i) + "]", v0); }
@@ -230,6 +307,95 @@ public:
 private:
 	std::set<std::string> m_errlookup;
 	bool _error(std::string name, GLenum actual, GLenum expected);
+	void _findUniform(std::string idUniform, UNIFORM &uni);
+
+	// uses the program; true if the value (size bytes for each of count elements) is to be sent to GL
+	bool _send(GLuint location, char kind, const void *p, GLsizei size, GLsizei count = 1);
+	void _verify(GLuint location, const UNIFORM_CACHE &cache);
+};
+
+// GL types of the uniform handle values
+template <class T> struct UniformType;
+template <> struct UniformType<GLint>		{ enum : GLenum { type = GL_INT }; };
+template <> struct UniformType<GLuint>		{ enum : GLenum { type = GL_UNSIGNED_INT }; };
+template <> struct UniformType<GLfloat>		{ enum : GLenum { type = GL_FLOAT }; };
+template <> struct UniformType<glm::vec2>	{ enum : GLenum { type = GL_FLOAT_VEC2 }; };
+template <> struct UniformType<glm::vec3>	{ enum : GLenum { type = GL_FLOAT_VEC3 }; };
+template <> struct UniformType<glm::vec4>	{ enum : GLenum { type = GL_FLOAT_VEC4 }; };
+template <> struct UniformType<glm::ivec2>	{ enum : GLenum { type = GL_INT_VEC2 }; };
+template <> struct UniformType<glm::ivec3>	{ enum : GLenum { type = GL_INT_VEC3 }; };
+template <> struct UniformType<glm::ivec4>	{ enum : GLenum { type = GL_INT_VEC4 }; };
+template <> struct UniformType<glm::mat4>	{ enum : GLenum { type = GL_FLOAT_MAT4 }; };
+template <class T> struct UniformType<T[]>	{ enum : GLenum { type = UniformType<T>::type }; };
+
+// Typed uniform handle: the program and the location of a uniform, see C3dglProgram::GetUniform.
+// Int handles also set bool uniforms and samplers; a handle to a uniform not found sends nothing
+template <class T> class UniformHandle
+{
+	C3dglProgram *m_pProgram;
+	GLuint m_location;
+public:
+	UniformHandle()													{ m_pProgram = NULL; m_location = (GLuint)-1; }
+	UniformHandle(C3dglProgram *pProgram, GLuint location)			{ m_pProgram = pProgram; m_location = location; }
+
+	bool IsValid() const											{ return m_location != (GLuint)-1; }
+	GLuint GetLocation() const										{ return m_location; }
+	C3dglProgram *GetProgram() const								{ return m_pProgram; }
+
+	void Send(const T &value) const									{ if (IsValid()) m_pProgram->SendUniform(m_location, value); }
+};
+
+// Array handle, e.g. UniformHandle<glm::mat4[]>
+template <class T> class UniformHandle<T[]>
+{
+	C3dglProgram *m_pProgram;
+	GLuint m_location;
+public:
+	UniformHandle()													{ m_pProgram = NULL; m_location = (GLuint)-1; }
+	UniformHandle(C3dglProgram *pProgram, GLuint location)			{ m_pProgram = pProgram; m_location = location; }
+
+	bool IsValid() const											{ return m_location != (GLuint)-1; }
+	GLuint GetLocation() const										{ return m_location; }
+	C3dglProgram *GetProgram() const								{ return m_pProgram; }
+
+	void Send(const T *p, GLuint count) const						{ if (IsValid()) m_pProgram->SendUniformv(m_location, p, count); }
+};
+
+template <class T> UniformHandle<T> C3dglProgram::GetUniform(UniformName name)
+{
+	GLuint location; GLenum type, targetType;
+	GetUniformLocation(name, location, type, targetType);
+	GLenum expected = UniformType<T>::type;
+	if (targetType != 0 && targetType != expected && !(expected == GL_INT && targetType == GL_BOOL))
+	{
+		_error(name.name, expected, targetType);
+		return UniformHandle<T>();
+	}
+	return UniformHandle<T>(this, location);
+}
+
+// Uniform buffer for a std140 uniform block shared by the programs, bound to a fixed binding point.
+// Create it before the programs are linked; Update uploads the whole block with a single call
+class C3dglUniformBuffer : public C3dglObject
+{
+	GLuint m_id;
+	GLuint m_binding;
+	GLsizeiptr m_size;
+
+public:
+	C3dglUniformBuffer() : C3dglObject()	{ m_id = 0; m_binding = 0; m_size = 0; }
+	~C3dglUniformBuffer()					{ Destroy(); }
+
+	bool Create(std::string blockName, GLuint binding, GLsizeiptr size);
+	void Update(const void *pData, GLsizeiptr size, GLintptr offset = 0);
+	template <class T> void Update(const T &data)	{ Update(&data, sizeof(T)); }
+	void Destroy();
+
+	GLuint GetId()			{ return m_id; }
+	GLuint GetBinding()		{ return m_binding; }
+	GLsizeiptr GetSize()	{ return m_size; }
+
+	std::string getName()	{ return "Uniform Buffer"; }
 };
 
 }; // namespace _3dgl
@@ -0,0 +1,97 @@
+/*********************************************************************************
+Addition to the 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Not part of the original 3DGL 2.2 - new code, distributed under the same license
+
+Cascaded shadow maps for a directional light: fits the cascades to the camera frustum.
+Usage:
+setLightDirection, then the settings: setCascadeCount (up to MAX_CASCADES),
+setResolution (of each cascade - the layers of one depth texture array),
+setShadowDistance (how far from the camera shadows reach), setSplitLambda
+(0 - uniform .. 1 - logarithmic split distances), setCasterDistance (how far
+towards the light casters outside the cascade are still rendered)
+update every frame with the camera view matrix and its projection parameters,
+then render cascade i with getView and getProjection(i) into layer i;
+getShadowMatrix(i) maps world coordinates to the texture coordinates and depth
+of the cascade, getSplit(i) is the view distance where the cascade ends.
+Each cascade covers the bounding sphere of its slice of the camera frustum
+and moves in whole texels, so the shadows do not shimmer when the camera moves.
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+*********************************************************************************/
+#ifndef __3dglShadowCascades_h_
+#define __3dglShadowCascades_h_
+
+#include "../glm/mat4x4.hpp"
+
+#include "3dglObject.h"
+
+namespace _3dgl
+{
+
+class C3dglShadowCascades : public C3dglObject
+{
+public:
+	enum { MAX_CASCADES = 4 };
+
+private:
+	// settings
+	glm::vec3 m_lightDir;
+	int m_nCascades;
+	int m_nResolution;
+	float m_fShadowDistance;
+	float m_fLambda;
+	float m_fCasterDistance;
+
+	// cascades
+	glm::mat4 m_view;						// light view (rotation only)
+	glm::mat4 m_projection[MAX_CASCADES];	// orthographic, snapped to texels
+	float m_splits[MAX_CASCADES];			// view distances where the cascades end
+
+public:
+	C3dglShadowCascades();
+
+	void setLightDirection(glm::vec3 dir);
+	glm::vec3 getLightDirection()			{ return m_lightDir; }
+
+	// settings
+	void setCascadeCount(int n)				{ m_nCascades = n < 1 ? 1 : n > MAX_CASCADES ? MAX_CASCADES : n; }
+	int getCascadeCount()					{ return m_nCascades; }
+	void setResolution(int nResolution)		{ m_nResolution = nResolution; }
+	int getResolution()						{ return m_nResolution; }
+	void setShadowDistance(float f)			{ m_fShadowDistance = f; }
+	float getShadowDistance()				{ return m_fShadowDistance; }
+	void setSplitLambda(float f)			{ m_fLambda = f; }
+	float getSplitLambda()					{ return m_fLambda; }
+	void setCasterDistance(float f)			{ m_fCasterDistance = f; }
+	float getCasterDistance()				{ return m_fCasterDistance; }
+
+	// fits the cascades to the camera frustum; fov - vertical, in radians
+	void update(const glm::mat4 &matrixView, float fov, float aspect, float zNear, float zFar);
+
+	glm::mat4 getView()						{ return m_view; }
+	glm::mat4 getProjection(int i)			{ return m_projection[i]; }
+	glm::mat4 getShadowMatrix(int i);
+	float getSplit(int i)					{ return m_splits[i]; }
+
+	std::string getName()					{ return "Shadow Cascades"; }
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglShadowCascades_h_
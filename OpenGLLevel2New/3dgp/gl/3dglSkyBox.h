@@ -1,6 +1,7 @@
 /*********************************************************************************
 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
 Version 2.2 23/03/15
+Altered version - modified since 3DGL 2.2, this is not the original software
 
 Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
 
@@ -40,6 +41,7 @@ public:
 	bool load(const char* pFd, const char* pRt, const char* pBk, const char* pLt, const char* pUp, const char* pDn);
 	void render(glm::mat4 matrix);
 	void render();
+	void destroy();
 
 private:
     unsigned int  m_idTex[6];
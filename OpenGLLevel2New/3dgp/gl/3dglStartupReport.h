@@ -0,0 +1,100 @@
+/*********************************************************************************
+Addition to the 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Not part of the original 3DGL 2.2 - new code, distributed under the same license
+
+Startup report: wall time, bytes read, bytes uploaded and peak memory of each step
+of the initialisation - e.g. each shader program, model and texture.
+Usage:
+start before the first step; step with the name and the category of each step -
+it ends the previous one; finish after the last one
+print writes the steps sorted by time, the slowest first, with the totals;
+exportJSON writes them in the order they were taken, to compare cold and warm starts
+
+Bytes read are taken from the I/O counters of the process (ReadTransferCount on
+Windows, rchar on Linux): all the reads of the step, whether from the disk or from
+the file cache.
+Bytes uploaded are the buffer and texture data counted by C3dglCallStats: an
+instance is installed for the time of the report unless one already is.
+Peak memory is the peak resident set size (working set) of the process at the end
+of the step.
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+*********************************************************************************/
+#ifndef __3dglStartupReport_h_
+#define __3dglStartupReport_h_
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <chrono>
+
+#include "3dglObject.h"
+#include "3dglCallStats.h"
+
+namespace _3dgl
+{
+
+class C3dglStartupReport : public C3dglObject
+{
+public:
+	struct STEP
+	{
+		std::string name, category;
+		double time;						// milliseconds
+		unsigned long long bytesRead;
+		unsigned long long bytesUploaded;
+		unsigned long long peakMemory;		// bytes
+	};
+
+private:
+	typedef std::chrono::high_resolution_clock CLOCK;
+
+	std::vector<STEP> m_steps;
+	bool m_bStarted, m_bStep;				// started, a step is open
+	CLOCK::time_point m_start, m_stepStart;
+	unsigned long long m_readStart, m_uploadStart;
+	double m_totalTime;
+	C3dglCallStats m_callStats;				// installed if no other instance is
+
+	void endStep();
+	unsigned long long getUploaded();
+
+public:
+	C3dglStartupReport();
+
+	void start();
+	void step(const std::string &name, const std::string &category);
+	void finish();
+
+	const std::vector<STEP> &getSteps()		{ return m_steps; }
+	double getTotalTime()					{ return m_totalTime; }
+
+	void print(std::ostream &out);
+	bool exportJSON(const std::string &filename);
+
+	// process statistics: bytes read so far, peak resident set size
+	static unsigned long long getBytesRead();
+	static unsigned long long getPeakMemory();
+
+	std::string getName()					{ return "Startup Report"; }
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglStartupReport_h_
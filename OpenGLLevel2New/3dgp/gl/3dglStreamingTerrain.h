@@ -0,0 +1,169 @@
+/*********************************************************************************
+Addition to the 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Not part of the original 3DGL 2.2 - new code, distributed under the same license
+
+Out-of-core terrain streamed from a memory-mapped tiled height field.
+Usage:
+createSynthetic or createFromRAW to prepare a tiled height field file
+open to map the file (nothing is loaded yet)
+update every frame with the eye position - requests the tiles within the resident
+radius (nearest first) and evicts the far ones, keeping within the memory budget;
+the tiles are read and decoded on a background thread
+render to upload the decoded tiles (a few per frame) and draw the visible ones
+update works without OpenGL, so the streaming may be tested on the CPU alone
+
+File format: HEADER, followed by the tiles (x-major order), each tile being
+(tileSize + 1) x (tileSize + 1) 16-bit heights (x-major) - the edges are shared
+with the neighbouring tiles
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+*********************************************************************************/
+#ifndef __3dglStreamingTerrain_h_
+#define __3dglStreamingTerrain_h_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "3dglObject.h"
+#include "3dglMappedFile.h"
+#include "3dglFrustum.h"
+
+namespace _3dgl
+{
+
+class C3dglStreamingTerrain : public C3dglObject
+{
+public:
+	// tiled height field file header
+	struct HEADER
+	{
+		char magic[4];						// "3DTH"
+		unsigned version;					// 1
+		unsigned sizeX, sizeZ;				// height map size in samples
+		unsigned tileSize;					// tile size in quads
+		float scaleHeight;					// height of the sample value 65535
+		unsigned reserved[2];
+	};
+
+private:
+	C3dglMappedFile m_file;
+	HEADER m_header;
+	const unsigned short *m_pSamples;
+	int m_nTilesX, m_nTilesZ;
+
+	// tile states: QUEUED - waiting for the loader, READY - decoded (CPU), RESIDENT - uploaded (GPU)
+	enum STATE { QUEUED, READY, RESIDENT };
+	struct TILE
+	{
+		STATE state;
+		float bb[2][3];						// Bounding Box (local coordinates)
+		std::vector<float> vertices;		// decoded vertex data (position, normal, tex coord) until uploaded
+		unsigned vertexBuffer;
+		float distance;						// distance from the eye at the last update
+	};
+	std::map<int, TILE> m_tiles;			// key: tx * m_nTilesZ + tz
+	size_t m_nTileBytes;					// memory taken by a single tile
+
+	// background loader
+	struct RESULT
+	{
+		int key;
+		float bb[2][3];
+		std::vector<float> vertices;
+	};
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_bQuit, m_bBusy;
+	std::deque<int> m_queue;				// tiles to load, nearest first
+	std::vector<RESULT> m_results;			// decoded tiles waiting to be collected by update
+	void loaderThread();
+	void loadTile(int key, RESULT &result);
+	void collect();
+
+	// settings
+	float m_fRadius;						// resident radius
+	size_t m_nBudget;						// memory budget (bytes)
+	int m_nMaxUploads;						// max tile uploads per frame
+
+	// rendering
+	unsigned m_indexBuffer;
+	unsigned m_nIndices;
+
+	// statistics
+	unsigned m_nLoaded, m_nEvicted, m_nUploaded, m_nTilesDrawn;
+	size_t m_nPeakBytes;
+
+	float sample(int x, int z);
+	void evict(std::map<int, TILE>::iterator i);
+
+public:
+	C3dglStreamingTerrain();
+	~C3dglStreamingTerrain()				{ close(); }
+
+	// tiled height field files
+	static bool createSynthetic(const std::string filename, unsigned sizeX, unsigned sizeZ, unsigned tileSize = 128, float scaleHeight = 200);
+	static bool createFromRAW(const std::string rawFilename, unsigned sizeX, unsigned sizeZ, float scaleHeight, const std::string filename, unsigned tileSize = 128);
+
+	bool open(const std::string filename);
+	void close();
+
+	// resident radius, memory budget (bytes), uploads per frame
+	void setResidentRadius(float fRadius)	{ m_fRadius = fRadius; }
+	float getResidentRadius()				{ return m_fRadius; }
+	void setMemoryBudget(size_t nBytes)		{ m_nBudget = nBytes; }
+	size_t getMemoryBudget()				{ return m_nBudget; }
+	void setMaxUploadsPerFrame(int n)		{ m_nMaxUploads = n; }
+
+	int getSizeX()							{ return m_header.sizeX; }
+	int getSizeZ()							{ return m_header.sizeZ; }
+	int getTileSize()						{ return m_header.tileSize; }
+
+	// height map (local coordinates, as C3dglTerrain) - read directly from the file
+	float getHeight(int x, int z);
+	float getInterpolatedHeight(float x, float z);
+
+	// eye: eye position in local coordinates
+	void update(glm::vec3 eye);
+	void render(glm::mat4 matrix, glm::mat4 matrixProjection);
+
+	// wait until all the requested tiles are decoded (for tests)
+	void flush();
+
+	// statistics
+	unsigned getResidentTiles()				{ return m_tiles.size(); }
+	size_t getResidentBytes()				{ return m_tiles.size() * m_nTileBytes; }
+	size_t getPeakBytes()					{ return m_nPeakBytes; }
+	unsigned getQueuedTiles();
+	unsigned getTilesLoaded()				{ return m_nLoaded; }
+	unsigned getTilesEvicted()				{ return m_nEvicted; }
+	unsigned getTilesUploaded()				{ return m_nUploaded; }
+	unsigned getTilesDrawn()				{ return m_nTilesDrawn; }
+
+	std::string getName()					{ return "Streaming Terrain"; }
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglStreamingTerrain_h_
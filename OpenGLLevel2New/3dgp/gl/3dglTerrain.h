@@ -2,6 +2,7 @@
 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
 Partially based on Luke Benstead GLSLProgram class.
 Version 2.2 23/03/15
+Altered version - modified since 3DGL 2.2, this is not the original software
 
 Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
 
@@ -10,6 +11,16 @@ Usage:
 loadHeightmap to load the height map and scale its height
 render to render the terrain
 renderNormals to render terrain normal vectors
+The terrain is split into fixed-size chunks organised in a quadtree;
+render(matrix, matrixProjection) draws only the chunks inside the view frustum
+render(matrix, matrixProjection, lodBudget, viewportHeight) selects the level of detail
+for each chunk so that its screen-space error stays within lodBudget pixels (0 = full
+detail) in a viewport viewportHeight pixels high.
+The shader may morph between the levels using the aMorph attribute and
+lodEye, lodMorph[] uniforms (see terrain.vert)
+setCompact(true) before loadHeightmap selects a compact, interleaved vertex format
+(quantised heights, octahedral normals, texture coordinates computed in the shader)
+- requires a shader supporting the compact, heightQuantum uniforms (see terrain.vert)
 ----------------------------------------------------------------------------------
 This software is provided 'as-is', without any express or implied
 warranty. In no event will the authors be held liable for any damages
@@ -37,11 +48,18 @@ freely, subject to the following restrictions:
 
 #include <string>
 #include <vector>
+#include <functional>
+
+#include "3dglObject.h"
+#include "3dglFrustum.h"
+#include "3dglHeightField.h"
 
 namespace _3dgl
 {
-	
-class C3dglTerrain
+
+class C3dglProgram;
+
+class C3dglTerrain : public C3dglObject
 {
 	// height map size (may be rectangular)
 	int m_nSizeX, m_nSizeZ;
@@ -53,6 +71,129 @@ class C3dglTerrain
 	unsigned m_texCoordBuffer;
     unsigned int m_indexBuffer;
     unsigned int m_linesBuffer;
+	unsigned int m_morphBuffer;
+
+	// compact vertex format - 12 bytes per vertex, interleaved in m_vertexBuffer
+	struct COMPACT_VERTEX
+	{
+		short x, y, z;						// position; y quantised with m_fHeightQuantum
+		short morph, level;					// LOD morph data (as aMorph); morph height quantised with m_fHeightQuantum
+		signed char normal[2];				// octahedral-encoded normal
+	};
+	bool m_bCompact;
+	float m_fHeightQuantum;					// height of a single quantisation step
+	unsigned m_nVertices;					// number of vertices in the vertex buffer(s)
+	unsigned m_nBytesPerVertex;				// total size of all vertex buffers per vertex
+	size_t m_nVideoMemory;					// total size of the buffers and textures
+	bool m_bWarned;							// shader compatibility warning already shown
+
+public:
+	enum { MAX_LOD = 5 };
+
+	// index buffer layout
+	// INDEX_LIST: triangle lists, 32-bit indices
+	// INDEX_STRIPS: vertex cache friendly triangle strips (bands of STRIP_BAND quads) with primitive restart;
+	// indices relative to the chunk vertex block - 16-bit if the chunks are small enough
+	// 7 quads: two rows of a band (16 vertices) fit even in a 16-entry FIFO cache (see --bench vcache)
+	enum INDEX_MODE { INDEX_LIST, INDEX_STRIPS };
+	enum { STRIP_BAND = 7 };
+
+private:
+
+	// terrain chunk - a square block of the height map with its own vertex block and index ranges
+	struct CHUNK
+	{
+		int x0, z0, x1, z1;					// height map coordinates of the chunk vertices (inclusive)
+		float bb[2][3];						// Bounding Box (local coordinates)
+		unsigned firstVertex, numVertices;	// vertex block within the vertex buffers (grid, then skirts)
+		unsigned firstIndex[MAX_LOD];		// ranges within the index buffer - one per LOD level
+		unsigned numIndices[MAX_LOD];
+		unsigned numTriangles[MAX_LOD];
+	};
+
+	// quadtree node - chunks of each subtree are stored contiguously (depth-first order)
+	struct NODE
+	{
+		float bb[2][3];						// Bounding Box (local coordinates)
+		unsigned firstChunk, numChunks;		// range within m_chunks
+		int children[4];					// child nodes (-1 if none)
+	};
+
+	int m_nChunkSize;						// chunk size in quads
+	std::vector<CHUNK> m_chunks;
+	std::vector<NODE> m_nodes;
+
+	// level of detail - level L uses every (1 << L)-th vertex of the chunk
+	int m_nLevels;							// number of LOD levels
+	float m_lodError[MAX_LOD];				// geometric error of each level (max height deviation)
+	float m_fChunkDiag;						// the longest chunk bounding box diagonal
+	float m_fSkirtDepth;					// depth of the skirts hiding cracks between chunks
+	bool m_bLod;							// LOD selection active for the current render call
+	glm::vec3 m_lodEye;						// eye position in local coordinates
+	float m_lodRange[MAX_LOD];				// level L is used for chunks closer than m_lodRange[L]
+
+	// index buffer
+	INDEX_MODE m_indexMode;
+	unsigned m_nIndexSize;					// bytes per index (2 or 4)
+
+	// index ranges collected for drawing (triangle lists: merged when contiguous)
+	std::vector<unsigned> m_drawFirst;
+	std::vector<int> m_drawCount;
+	std::vector<int> m_drawBaseVertex;
+	std::vector<const void*> m_drawOffset;
+
+	// height field texture - no vertex buffers: heights in an R16 texture (texel (z, x), as m_heights),
+	// a single chunk-sized grid patch (grid, then skirts - as the chunk vertex blocks) drawn instanced, one instance per chunk
+	bool m_bHeightTexture;
+	int m_nHeightTextureUnit;
+	unsigned m_heightTexture;
+	float m_fHeightBase;					// height of the texel value 0 (the quantum is m_fHeightQuantum)
+	unsigned m_patchBuffer, m_patchIndexBuffer, m_instanceBuffer;
+	unsigned m_nPatchVertices, m_nPatchIndexSize;
+	unsigned m_patchFirst[MAX_LOD], m_patchCount[MAX_LOD];	// index ranges of the LOD levels within the patch index buffer
+	std::vector<glm::vec4> m_patches[MAX_LOD];	// visible chunks collected for drawing: (x0, z0, nx, nz), per level
+	std::vector<glm::vec4> m_patchData;
+
+	// height queries and ray casting over m_heights
+	C3dglHeightField m_heightField;
+
+	// statistics
+	unsigned m_nChunksDrawn, m_nChunksCulled, m_nTrianglesDrawn;
+
+	// chunk building, culling and drawing
+	void getNormal(int x, int z, float &nx, float &ny, float &nz);
+	void createLinesBuffer();
+	int buildQuadtree(int cx0, int cz0, int cx1, int cz1);
+	float getLodHeight(const CHUNK &chunk, int stride, int lx, int lz);
+	void setupLod(glm::mat4 matrix, glm::mat4 matrixProjection, float lodBudget, int nViewportHeight);
+	int selectLevel(const CHUNK &chunk);
+	void cullNode(int iNode, const C3dglFrustum &frustum);
+	void addChunks(unsigned firstChunk, unsigned numChunks);
+	void addRange(const CHUNK &chunk, int level);
+	void drawRanges();
+	bool setupShader(C3dglProgram *pProgram, bool bTerrain);
+	void renderChunks(glm::mat4 matrix);
+	void createBuffers(const void *pVertexData, const void *pIndices, size_t nIndices);
+	void createHeightTexture();
+	void uploadHeightTexture(int x0, int z0, int x1, int z1);
+	void createPatch();
+	void renderPatches(glm::mat4 matrix);
+	std::string getBufferInfo();
+	int getVertexLevel(const CHUNK &chunk, int lx, int lz);
+	COMPACT_VERTEX compactVertex(const float *pVertex, const float *pNormal, const float *pMorph);
+
+	// terrain editing
+	void applyBrush(float x, float z, float radius, const std::function<float(float, float)> &brush);
+	void updateNode(int iNode, int x0, int z0, int x1, int z1);
+	void updateChunk(CHUNK &chunk, int x0, int z0, int x1, int z1, int border);
+	void uploadVertices(unsigned first, unsigned count, const float *pVertices, const float *pNormals, const float *pMorphs);
+
+	// baked terrain cache - a binary file with everything loadHeightmap builds, ready to be mapped and uploaded
+	struct BAKED_HEADER;
+	bool m_bBakedCache;
+	static unsigned long long hashFile(const std::string filename);
+	bool loadBaked(const std::string filename, unsigned long long hash, float scaleHeight);
+	bool storeBaked(const std::string filename, unsigned long long hash, int levels, const void *pVertexData, const void *pIndices, size_t nIndices);
 
 public:
     C3dglTerrain();
@@ -61,15 +202,89 @@ public:
 	std::vector<float> m_heights;
 
 	float getHeight(int x, int z);
-	float getInterpolatedHeight(float x, float z);
+	float getInterpolatedHeight(float x, float z)		{ return m_heightField.getInterpolatedHeight(x, z); }
+	// batch height queries and ray casting - see C3dglHeightField
+	void getInterpolatedHeights(const glm::vec2 *pPoints, float *pHeights, int n)	{ m_heightField.getInterpolatedHeights(pPoints, pHeights, n); }
+	bool intersectRay(const glm::vec3 &origin, const glm::vec3 &dir, float &t, float tMax = FLT_MAX)	{ return m_heightField.intersectRay(origin, dir, t, tMax); }
+	bool lineOfSight(const glm::vec3 &a, const glm::vec3 &b)	{ return m_heightField.lineOfSight(a, b); }
+	const C3dglHeightField &getHeightField()	{ return m_heightField; }
+
+	// chunk size (in quads) - call before loadHeightmap
+	void setChunkSize(int nChunkSize)		{ m_nChunkSize = nChunkSize; }
+	int getChunkSize()						{ return m_nChunkSize; }
+	unsigned getChunkCount()				{ return m_chunks.size(); }
+
+	// number of LOD levels (up to MAX_LOD, limited by the chunk size) - call before loadHeightmap
+	void setLodLevels(int nLevels)			{ m_nLevels = nLevels; }
+	int getLodLevels()						{ return m_nLevels; }
+	float getLodError(int nLevel)			{ return m_lodError[nLevel]; }
+
+	// compact vertex format - call before loadHeightmap
+	void setCompact(bool bCompact)			{ m_bCompact = bCompact; }
+	bool isCompact()						{ return m_bCompact; }
+	unsigned getVertexCount()				{ return m_nVertices; }
+	unsigned getBytesPerVertex()			{ return m_nBytesPerVertex; }
+
+	// index buffer layout - call before loadHeightmap; INDEX_STRIPS requires OpenGL 3.2 (falls back to INDEX_LIST)
+	void setIndexMode(INDEX_MODE mode)		{ m_indexMode = mode; }
+	INDEX_MODE getIndexMode()				{ return m_indexMode; }
+	unsigned getIndexSize()					{ return m_nIndexSize; }
+
+	// indices of a nx by nz quads chunk at the given LOD level, relative to its vertex block (grid, then skirts);
+	// strips are separated by 0xFFFFFFFF; returns the number of triangles
+	static unsigned buildChunkIndices(int nx, int nz, int level, INDEX_MODE mode, std::vector<unsigned> &indices);
+	// indices of a chunk at the given LOD level as drawn - read back from the index buffer (the patch index
+	// buffer with the height field texture); strips are separated by 0xFFFFFFFF; returns the number of triangles
+	unsigned getChunkIndices(unsigned iChunk, int level, std::vector<unsigned> &indices);
+
+	// terrain editing (local coordinates) - a circular brush, smoothly falling off to zero at the radius;
+	// only the vertices around the brush are rebuilt and uploaded
+	void addHeight(float x, float z, float radius, float delta);	// raises the terrain (lowers if delta < 0)
+	void setHeight(float x, float z, float radius, float height);	// levels the terrain towards the height
+	// call after modifying m_heights within the rectangle (local coordinates, inclusive)
+	void updateHeights(int x0, int z0, int x1, int z1);
+
+	// height field texture mode - call before loadHeightmap; requires OpenGL 3.3 (falls back to vertex buffers)
+	// and a shader sampling the heights (see terrain.vert); getHeight and the other queries still use m_heights
+	void setHeightTexture(bool bEnable)		{ m_bHeightTexture = bEnable; }
+	bool isHeightTexture()					{ return m_bHeightTexture; }
+	void setHeightTextureUnit(int nUnit)	{ m_nHeightTextureUnit = nUnit; }
+	int getHeightTextureUnit()				{ return m_nHeightTextureUnit; }
+
+	// total size of the buffers and textures (bytes)
+	size_t getVideoMemory()					{ return m_nVideoMemory; }
+
+	// baked terrain cache: loadHeightmap loads <filename>.baked if it matches the image and the settings,
+	// otherwise builds the terrain and stores it - call before loadHeightmap
+	void setBakedCache(bool bEnable)		{ m_bBakedCache = bEnable; }
+	bool isBakedCache()						{ return m_bBakedCache; }
 
 	bool loadHeightmap(const std::string filename, float scaleHeight);
-	void render(glm::mat4 matrix);
+	void destroy();													// releases the buffers and the height field texture
+	void render(glm::mat4 matrix, glm::mat4 matrixProjection, float lodBudget = 0, int nViewportHeight = 0);	// render chunks visible in the frustum
+	void render(glm::mat4 matrix);									// render the entire terrain
 	void render();
 	void renderNormals();
 
+	// culling statistics - accumulated over render calls since the last resetStats
+	unsigned getChunksDrawn()				{ return m_nChunksDrawn; }
+	unsigned getChunksCulled()				{ return m_nChunksCulled; }
+	unsigned getTrianglesDrawn()			{ return m_nTrianglesDrawn; }
+	void resetStats()						{ m_nChunksDrawn = m_nChunksCulled = m_nTrianglesDrawn = 0; }
+
 	bool storeAsOBJ(const std::string filename);
 	bool storeAsRAW(const std::string filename);
+
+	// parallel, vectorised building blocks of loadHeightmap (nThreads = 0: all hardware threads)
+	// heights from the red channel of an RGBA image: pHeights[x * sizeZ + z], z running bottom-up
+	static void computeHeights(const unsigned char *pBits, int sizeX, int sizeZ, float scaleHeight, float *pHeights, int nThreads = 0);
+	// normal vectors (3 floats per sample, same layout as heights)
+	static void computeNormals(const float *pHeights, int sizeX, int sizeZ, float *pNormals, int nThreads = 0);
+	// normal vector from the height differences between the neighbours along x and z,
+	// one sample apart on each side (one-sided, not scaled, at the edges of the map)
+	static void computeNormal(float dy_x, float dy_z, float *pNormal);
+
+	std::string getName()					{ return "Terrain"; }
 };
 
 }; // namespace _3dgl
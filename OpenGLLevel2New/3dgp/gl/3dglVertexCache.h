@@ -0,0 +1,99 @@
+/*********************************************************************************
+Addition to the 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Not part of the original 3DGL 2.2 - new code, distributed under the same license
+
+Post-transform vertex cache analysis.
+Usage:
+analyse an index buffer (triangle list or triangle strips with primitive restart)
+with a simulated FIFO cache of the given size; the results are:
+ACMR - average cache miss ratio: vertex shader runs per triangle (0.5 is ideal for grids)
+ATVR - average transform to vertex ratio: vertex shader runs per vertex (1.0 is ideal)
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+*********************************************************************************/
+#ifndef __3dglVertexCache_h_
+#define __3dglVertexCache_h_
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+namespace _3dgl
+{
+
+class C3dglVertexCache
+{
+public:
+	struct STATS
+	{
+		unsigned long long triangles;		// non-degenerate triangles
+		unsigned long long vertices;		// distinct vertices referenced
+		unsigned long long transforms;		// cache misses (vertex shader runs)
+
+		STATS()								{ triangles = vertices = transforms = 0; }
+		float getACMR() const				{ return triangles ? (float)transforms / triangles : 0; }
+		float getATVR() const				{ return vertices ? (float)transforms / vertices : 0; }
+		STATS &operator +=(const STATS &s)	{ triangles += s.triangles; vertices += s.vertices; transforms += s.transforms; return *this; }
+	};
+
+	// pIndices: n indices; bStrips: triangle strips separated by restartIndex, otherwise a triangle list
+	template <class T>
+	static STATS analyse(const T *pIndices, size_t n, int cacheSize, bool bStrips = false, T restartIndex = (T)-1)
+	{
+		STATS stats;
+		std::deque<T> fifo;
+		std::vector<T> seen;
+		size_t stripLength = 0;
+		for (size_t i = 0; i < n; i++)
+		{
+			T index = pIndices[i];
+			if (bStrips && index == restartIndex)
+			{
+				stripLength = 0;
+				continue;
+			}
+
+			// FIFO cache: a miss pushes the vertex in, hits do not change the order
+			if (std::find(fifo.begin(), fifo.end(), index) == fifo.end())
+			{
+				stats.transforms++;
+				fifo.push_back(index);
+				if ((int)fifo.size() > cacheSize)
+					fifo.pop_front();
+			}
+			seen.push_back(index);
+
+			// count the triangles, skipping the degenerate ones
+			stripLength++;
+			if (bStrips ? stripLength >= 3 : i % 3 == 2)
+			{
+				T a = pIndices[i - 2], b = pIndices[i - 1];
+				if (a != b && b != index && a != index)
+					stats.triangles++;
+			}
+		}
+		std::sort(seen.begin(), seen.end());
+		stats.vertices = std::unique(seen.begin(), seen.end()) - seen.begin();
+		return stats;
+	}
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglVertexCache_h_
@@ -2,6 +2,7 @@
 3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
 Partially based on http://ogldev.atspace.co.uk/www/tutorial38/tutorial38.html
 Version 2.2 23/03/15
+Altered version - modified since 3DGL 2.2, this is not the original software
 
 Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
 
@@ -96,7 +97,7 @@ public:
 				memcpy(m_pData, pData, m_size * m_num);
 			}
 			void getData(void **p, unsigned &size, unsigned &num)	{ if (p) *p = m_pData; size = m_size; num = m_num; }
-			void release()		{ glDeleteBuffers(1, &m_id); if (m_pData) delete[] m_pData; m_size = m_num = 0; }
+			void release()		{ if (m_id != (unsigned)-1) glDeleteBuffers(1, &m_id); if (m_pData) delete[] m_pData; m_id = (unsigned)-1; m_pData = NULL; m_size = m_num = 0; }
 		};
 
 		// Buffers
@@ -116,7 +117,7 @@ public:
 		aiVector3D centre;
 
 	public:
-		MESH(C3dglModel *pOwner) : m_pOwner(pOwner) { }
+		MESH(C3dglModel *pOwner) : m_pOwner(pOwner), m_idVAO(0) { }
 
 		void create(const aiMesh *pMesh, unsigned maskEnabledBufData = 0);
 		void destroy();
@@ -128,6 +129,8 @@ public:
 		// get buffer binary data - call C3dglModel::enableBufferData before loading!
 		void getBufferData(ATTRIB_STD bufId, void **p, unsigned &size, unsigned &num)	{ m_buf[bufId].getData(p, size, num); }
 		
+		unsigned getTriangleCount()	{ return m_indexSize / 3; }
+
 		aiVector3D *getBB()			{ return bb; }
 		aiVector3D getCentre()		{ return centre; } 
 	
@@ -158,6 +161,7 @@ private:
 	std::vector<std::string> m_vecBoneNames;		// vector of bone names
 	std::vector<aiMatrix4x4> m_vecBoneOffsets;		// vector of bone offsets
 	aiMatrix4x4 m_globInvT;
+	aiVector3D m_bb[2];								// bounding box of the entire model
 
 public:
 	C3dglModel() : C3dglObject()			{ m_pScene = NULL; m_maskEnabledBufData = NULL;  }
@@ -185,6 +189,7 @@ public:
 	unsigned getMeshCount()					{ return m_meshes.size(); }
 	MESH *getMesh(unsigned i)				{ return (i < m_meshes.size()) ? &m_meshes[i] : NULL; }
 	unsigned getMaterialCount()				{ return m_materials.size(); }
+	unsigned getTriangleCount();			// in all meshes
 	CMaterial *getMaterial(unsigned i)		{ return (i < m_materials.size()) ? &m_materials[i] : NULL; }
 
 	// Rendering
@@ -222,6 +227,9 @@ public:
 	void getBB(aiVector3D BB[2]);
 	void getBB(unsigned iNode, aiVector3D BB[2]);
 
+	// view frustum culling: false if the model rendered with the given (model-view) matrix would be entirely off the screen
+	bool isVisible(glm::mat4 matrixProjection, glm::mat4 matrix);
+
 	std::string getName();
 
 private:
@@ -1,10 +1,16 @@
 #define _USE_MATH_DEFINES
 #include <cmath>
 #include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <chrono>
 #include "GL/glew.h"
 #include "GL/3dgl.h"
 #include "GL/glut.h"
 #include "GL/freeglut_ext.h"
+#include "benchmark.h"
 
 // Include GLM core features
 #include "glm/glm.hpp"
@@ -24,10 +30,27 @@ C3dglProgram ProgramTerrain;
 C3dglProgram ProgramParticle;
 
 // Post Process
-GLuint WImage = 800, HImage = 600;
-GLuint TempWImage = 0, TempHImage = 0;
 GLuint bufQuad;
 
+// Render passes: shadow map, dynamic cube maps, main pass and post process
+C3dglFrameGraph frameGraph;
+
+// CPU and GPU times of the frame, the render passes, the scene and the models
+C3dglProfiler profiler;
+
+// GL calls per frame and per pass - counted only when installed
+C3dglCallStats callStats;
+
+// time, I/O and memory taken by each step of init
+C3dglStartupReport startup;
+
+// GPU resources by owner - anything still alive after done() is reported as leaked
+C3dglResourceLedger ledger;
+
+// Reflection probes: the SFCube and the DeLorean cube maps
+C3dglCubeProbe probe1, probe2;
+C3dglShadowCascades shadowCascades;
+
 // Skybox
 C3dglSkyBox skybox;
 
@@ -37,16 +60,20 @@ float waterLevel = 11.0f;
 // Terrain
 C3dglTerrain terrain, water;
 
+// current projection - used for frustum culling of the terrain chunks
+mat4 matrixProjection;
+
+// terrain LOD error budget (in pixels) - coarser for the shadow and cube map passes
+const float LOD_BUDGET_MAIN = 1.0f;
+const float LOD_BUDGET_AUX = 4.0f;
+float lodBudget = LOD_BUDGET_MAIN;
+int lodViewportHeight = 600;	// of the current pass, set with the budget
+
 // quad size
 float quadSize = 4;
 
 // Cube map
 GLuint idTexCube;
-GLuint idTexCube2;
-GLuint idTexCube3;
-
-// Shadow Map
-GLuint idTexShadowMap;
 
 // Particle System Params
 const float PERIOD = 0.01f;
@@ -80,86 +107,139 @@ GLuint idCharacter;
 GLuint idCharacterN;
 GLuint idSword;
 
-GLuint idTexScreen;
-
 float rotateSpeed = 60;
 float transition;
 vec3 finalFogColor;
+float sunAngle;		// of the skybox, by the time of day
 int postProcessMode = 0;
 int animationMode = 0;
 bool isNormalOn = false;
 
+// animation time and the day cycle clock - frozen while paused
+bool isPaused = false;
+float animTime = 0;
+unsigned dayTicks = 0;
+float fixedTime = -1;		// simulated clock (seconds) of the scene benchmark; the real one if negative
+unsigned sceneEdits = 0;	// counts the terrain edits
+
+// models submitted and culled in the current frame
+unsigned nModelsDrawn = 0, nModelsCulled = 0;
+unsigned nTrianglesDrawn = 0;		// by the models
+unsigned nShadowTriangles = 0;		// by the shadow passes, terrain included
+
+// Scene objects and the passes they are submitted to - see setPassMask
+enum { PASS_MAIN = 1, PASS_SHADOW = 2, PASS_PROBE = 4 };
+enum OBJECT { SKYBOX, DELOREAN_WHEEL, SWORD, SCOUT, RADIO, CHARACTER, RING, TERRAIN, WATER, PARTICLES, CUBE, DELOREAN, OBJECT_COUNT };
+struct SCENE_OBJECT
+{
+	const char *name;
+	unsigned passMask;		// PASS_xxx bits
+	bool bMoving;			// moving shadow casters are not cached
+} sceneObjects[OBJECT_COUNT] =
+{
+	{ "skybox", PASS_MAIN | PASS_PROBE, false },
+	{ "DeLorean wheel", PASS_MAIN, false },
+	{ "sword", PASS_MAIN | PASS_SHADOW, false },
+	{ "scout", PASS_MAIN | PASS_SHADOW | PASS_PROBE, true },
+	{ "radio", PASS_MAIN, false },
+	{ "character", PASS_MAIN | PASS_SHADOW | PASS_PROBE, true },
+	{ "ring", PASS_MAIN | PASS_SHADOW | PASS_PROBE, false },
+	{ "terrain", PASS_MAIN | PASS_SHADOW | PASS_PROBE, false },
+	{ "water", PASS_MAIN | PASS_PROBE, false },
+	{ "particles", PASS_MAIN, false },
+	{ "reflective cube", PASS_MAIN | PASS_PROBE, true },
+	{ "DeLorean", PASS_MAIN, false },
+};
+
+// the pass being rendered; shadow passes render either the static or the moving casters
+enum { SCENE_STATIC = 1, SCENE_DYNAMIC = 2, SCENE_ALL = 3 };
+unsigned currentPass = PASS_MAIN, currentParts = SCENE_ALL;
+
+// Render queue: the objects of a pass are submitted as draw packets, sorted by their state when flushed.
+// Layers: the sky first, then the opaque objects, the water and the particles (no depth writes)
+C3dglRenderQueue renderQueue;
+enum { LAYER_SKY, LAYER_OPAQUE, LAYER_WATER, LAYER_PARTICLES };
+int matSky, matWheel, matSword, matScout, matRadio, matCharacter, matRing, matCube, matDelorean, matTerrain, matWater, matParticles;
+int texNone, texSword, texCharacter, texSand, texTerrain, texWater, texParticles, texCube1, texCube2;
+bool bWheelGlow = false;		// the DeLorean headlight and wheels glow, set with the lights
+
+// Shading parameters of the basic shader, see sendMaterial
+struct BASIC_MATERIAL
+{
+	vec3 ambient = vec3(0.1f), diffuse = vec3(0.2f);
+	vec3 lightAmbient = vec3(1.0f);
+	float lightDiffuse = 5;		// of the directional light
+	float shininess = 0;
+	float fogDensity = 0.05f;
+	float scale = 1;			// texture coordinates
+	float opacity = 1;
+	float reflection = 0;		// cube map reflection power, none if 0
+	bool bLit = true;			// the lights (but the ambient) are on
+	bool bNormalMap = false;
+};
+
+// Uniforms sent for each material and object - typed handles, resolved once the programs are linked
+struct BASIC_UNIFORMS
+{
+	UniformHandle<vec3> materialAmbient, materialDiffuse, materialSpecular;
+	UniformHandle<float> shininess, lightDirScale, fogDensity, scaleX, scaleY, opacity, reflectionPower;
+	UniformHandle<int> useLights, useNormalMap, useCubeMap;
+	UniformHandle<mat4[]> bones;
+} uniBasic;
+UniformHandle<mat4> uniTerrainModelView, uniWaterModelView, uniParticleModelView;
+
+// Uniforms still sent by name in every frame - constants, so that the compiler hashes their names
+namespace uniformName
+{
+	constexpr UniformName t = "t", time = "time", mode = "mode", opacity = "opacity";
+	constexpr UniformName useNormalMap = "useNormalMap", useShadowMap = "useShadowMap", reflectionPower = "reflectionPower";
+	constexpr UniformName materialAmbient = "materialAmbient", materialDiffuse = "materialDiffuse", scaleX = "scaleX", scaleY = "scaleY";
+	constexpr UniformName waterColor = "waterColor", skyColor = "skyColor";
+	constexpr UniformName matrixProjection = "matrixProjection", matrixModelView = "matrixModelView";
+	constexpr UniformName matrixShadow = "matrixShadow", shadowSplits = "shadowSplits", shadowCascades = "shadowCascades";
+};
+
+// Uniform blocks shared by the programs, std140 layouts of the blocks declared in the shaders.
+// The camera is set for each pass (cascade, cube face), the lights and the fog once per frame
+enum { BINDING_CAMERA, BINDING_LIGHTS, BINDING_FOG };
+C3dglUniformBuffer uboCamera, uboLights, uboFog;
+
+struct CAMERA_BLOCK
+{
+	mat4 matrixView;
+	mat4 matrixProjection;
+};
+
+struct LIGHT_BLOCK
+{
+	struct AMBIENT { vec3 color; int on; } lightAmbient;
+	struct DIRECTIONAL { vec3 direction; int on; vec3 diffuse; float pad; mat4 matrix; } lightDir;
+	struct POINT { vec3 position; int on; vec3 diffuse; float att_quadratic; vec3 specular; float pad; mat4 matrix; } lightPoint[2];
+	struct SPOT { vec3 position; int on; vec3 diffuse; float att_quadratic; vec3 specular; float cutoff; vec3 direction; float attenuation; mat4 matrix; } lightSpot[2];
+} lights;
+static_assert(sizeof(LIGHT_BLOCK) == 592, "LIGHT_BLOCK does not match the std140 layout of LightBlock");
+
+struct FOG_BLOCK
+{
+	vec3 fogColour;
+	float skyFogDensity;
+	vec3 waterFogColour;
+	float waterFogDensity;
+} fog;
+static_assert(sizeof(FOG_BLOCK) == 32, "FOG_BLOCK does not match the std140 layout of FogBlock");
+
 // buffers names
 unsigned vertexBuffer = 0;
 unsigned normalBuffer = 0;
 unsigned indexBuffer = 0;
-unsigned idFBO;
-unsigned idFBO2;
 
 // camera position (for first person type camera navigation)
 mat4 matrixView;			// The View Matrix
+mat4 matrixCamera;			// matrixView moved up following the terrain, set each frame - the main pass and the shadow cascades view
 float angleTilt = 15;		// Tilt Angle
 float angleRot = 0.1f;		// Camera orbiting angle
 vec3 cam(0);				// Camera movement values
 
-void RefreshPostProcessing ()
-{
-	GLint viewport[4];
-	glGetIntegerv(GL_VIEWPORT, viewport);
-	WImage = viewport[2];
-	HImage = viewport[3];
-
-	if (TempWImage == WImage && TempHImage == HImage) return;
-	ProgramEffect.SendUniform("resolution", WImage, HImage);
-
-	// Create screen space texture
-	glGenTextures(1, &idTexScreen);
-	glBindTexture(GL_TEXTURE_2D, idTexScreen);
-
-	// Texture parameters - to get nice filtering 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-	// This will allocate an uninitilised texture
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, WImage, HImage, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
-
-	// Create a framebuffer object (FBO)
-	glGenFramebuffers(1, &idFBO);
-	glBindFramebuffer(GL_FRAMEBUFFER, idFBO);
-
-	// Attach a depth buffer
-	GLuint depth_rb;
-	glGenRenderbuffers(1, &depth_rb);
-	glBindRenderbuffer(GL_RENDERBUFFER, depth_rb);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, WImage, HImage);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_rb);
-
-	// attach the texture to FBO colour attachment point
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, idTexScreen, 0);
-
-	// switch back to window-system-provided framebuffer
-	glBindFramebufferEXT(GL_FRAMEBUFFER, 0);
-
-	// Create Quad
-	float vertices[] = {
-		0.0f, 0.0f, 0.0f,	0.0f, 0.0f,
-		1.0f, 0.0f, 0.0f,	1.0f, 0.0f,
-		1.0f, 1.0f, 0.0f,	1.0f, 1.0f,
-		0.0f, 1.0f, 0.0f,	0.0f, 1.0f
-	};
-
-	// Generate the buffer name
-	glGenBuffers(1, &bufQuad);
-	// Bind the vertex buffer and send data
-	glBindBuffer(GL_ARRAY_BUFFER, bufQuad);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-	TempWImage = WImage;
-	TempHImage = HImage;
-}
-
 bool init()
 {
 	// rendering states
@@ -170,10 +250,19 @@ bool init()
 
 #pragma region // Initialise Shaders
 
+	startup.start();
+	startup.step("uniform buffers", "setup");
+
+	// Uniform buffers - before the programs are linked, so that they bind the blocks
+	if (!uboCamera.Create("CameraBlock", BINDING_CAMERA, sizeof(CAMERA_BLOCK))) return false;
+	if (!uboLights.Create("LightBlock", BINDING_LIGHTS, sizeof(LIGHT_BLOCK))) return false;
+	if (!uboFog.Create("FogBlock", BINDING_FOG, sizeof(FOG_BLOCK))) return false;
+
 	// Initialise Shaders
 	C3dglShader VertexShader;
 	C3dglShader FragmentShader;
 
+	startup.step("basic", "shader");
 	if (!VertexShader.Create(GL_VERTEX_SHADER)) return false;
 	if (!VertexShader.LoadFromFile("shaders/basic.vert")) return false;
 	if (!VertexShader.Compile()) return false;
@@ -188,6 +277,7 @@ bool init()
 	if (!Program.Link()) return false;
 	if (!Program.Use(true)) return false;
 
+	startup.step("effect", "shader");
 	if (!VertexShader.Create(GL_VERTEX_SHADER)) return false;
 	if (!VertexShader.LoadFromFile("shaders/effect.vert")) return false;
 	if (!VertexShader.Compile()) return false;
@@ -202,6 +292,7 @@ bool init()
 	if (!ProgramEffect.Link()) return false;
 	if (!ProgramEffect.Use(true)) return false;
 
+	startup.step("water", "shader");
 	if (!VertexShader.Create(GL_VERTEX_SHADER)) return false;
 	if (!VertexShader.LoadFromFile("shaders/water.vert")) return false;
 	if (!VertexShader.Compile()) return false;
@@ -216,6 +307,7 @@ bool init()
 	if (!ProgramWater.Link()) return false;
 	if (!ProgramWater.Use(true)) return false;
 
+	startup.step("terrain", "shader");
 	if (!VertexShader.Create(GL_VERTEX_SHADER)) return false;
 	if (!VertexShader.LoadFromFile("shaders/terrain.vert")) return false;
 	if (!VertexShader.Compile()) return false;
@@ -230,6 +322,7 @@ bool init()
 	if (!ProgramTerrain.Link()) return false;
 	if (!ProgramTerrain.Use(true)) return false;
 
+	startup.step("particle", "shader");
 	if (!VertexShader.Create(GL_VERTEX_SHADER)) return false;
 	if (!VertexShader.LoadFromFile("shaders/particle.vert")) return false;
 	if (!VertexShader.Compile()) return false;
@@ -246,146 +339,216 @@ bool init()
 
 	Program.Use();
 
+	// uniform handles
+	startup.step("uniform handles", "setup");
+	uniBasic.materialAmbient = Program.GetUniform<vec3>("materialAmbient");
+	uniBasic.materialDiffuse = Program.GetUniform<vec3>("materialDiffuse");
+	uniBasic.materialSpecular = Program.GetUniform<vec3>("materialSpecular");
+	uniBasic.shininess = Program.GetUniform<float>("shininess");
+	uniBasic.lightDirScale = Program.GetUniform<float>("lightDirScale");
+	uniBasic.fogDensity = Program.GetUniform<float>("fogDensity");
+	uniBasic.scaleX = Program.GetUniform<float>("scaleX");
+	uniBasic.scaleY = Program.GetUniform<float>("scaleY");
+	uniBasic.opacity = Program.GetUniform<float>("opacity");
+	uniBasic.reflectionPower = Program.GetUniform<float>("reflectionPower");
+	uniBasic.useLights = Program.GetUniform<int>("useLights");
+	uniBasic.useNormalMap = Program.GetUniform<int>("useNormalMap");
+	uniBasic.useCubeMap = Program.GetUniform<int>("useCubeMap");
+	uniBasic.bones = Program.GetUniform<mat4[]>("bones");
+	uniTerrainModelView = ProgramTerrain.GetUniform<mat4>("matrixModelView");
+	uniWaterModelView = ProgramWater.GetUniform<mat4>("matrixModelView");
+	uniParticleModelView = ProgramParticle.GetUniform<mat4>("matrixModelView");
+
 #pragma endregion
 
 	glutSetVertexAttribCoord3(Program.GetAttribLocation("aVertex"));
 	glutSetVertexAttribNormal(Program.GetAttribLocation("aNormal"));
 
 	// load your 3D models here!
+	startup.step("models\\ship\\delorean.obj", "model");
 	if (!delorean.load("models\\ship\\delorean.obj")) return false;
 	delorean.loadMaterials("models\\ship\\delorean.mtl");
 	delorean.getMaterial(7)->loadTexture(GL_TEXTURE0, "models/ship", "delorean.jpg");
+	startup.step("models\\ship\\deloranWheel.obj", "model");
 	if (!deloreanWheel.load("models\\ship\\deloranWheel.obj")) return false;
 
+	startup.step("models\\SFCube\\cube.obj", "model");
 	if (!SFCube.load("models\\SFCube\\cube.obj")) return false;
+	startup.step("models\\bg\\ring.obj", "model");
 	if (!ring.load("models\\bg\\ring.obj")) return false;
+	startup.step("models\\character\\sitIdle.dae", "model");
 	if (!character.load("models\\character\\sitIdle.dae")) return false;
+	startup.step("models\\character\\sitIdle2.dae", "model");
 	if (!character2.load("models\\character\\sitIdle2.dae")) return false;
+	startup.step("models\\character\\punchingBag.dae", "model");
 	if (!character3.load("models\\character\\punchingBag.dae")) return false;
+	startup.step("models\\sword\\sword.obj", "model");
 	if (!sword.load("models\\sword\\sword.obj")) return false;
+	startup.step("models\\scout.obj", "model");
 	if (!scout.load("models\\scout.obj")) return false;
+	startup.step("models\\radio\\Radio.obj", "model");
 	if (!radio.load("models\\radio\\Radio.obj")) return false;
 	radio.loadMaterials("models\\radio\\Radio.mtl");
 	radio.getMaterial(0)->loadTexture(GL_TEXTURE0, "models/radio", "TextureRadio.png");
 
+	startup.step("character animations", "model");
 	character.loadAnimations();
 	character2.loadAnimations();
 	character3.loadAnimations();
 
 	// load Sky Box     
+	startup.step("skybox", "texture");
 	if (!skybox.load("models\\skybox\\right.png", "models\\skybox\\left.png", "models\\skybox\\middle.png",
 		"models\\skybox\\middle2.png", "models\\skybox\\top.png", "models\\skybox\\bottom.png")) return false;
 
-	// Terrain map load
+	// Terrain map load - the terrain shader supports the compact vertex format, the water shader does not
+	terrain.setCompact(true);
+	terrain.setHeightTexture(true);
+	terrain.setIndexMode(C3dglTerrain::INDEX_STRIPS);
+	terrain.setBakedCache(true);
+	water.setIndexMode(C3dglTerrain::INDEX_STRIPS);
+	water.setBakedCache(true);
+	startup.step("models\\sand.bmp", "terrain");
 	if (!terrain.loadHeightmap("models\\sand.bmp", 75)) return false;
+	startup.step("models\\watermap.png", "terrain");
+	C3dglResourceLedger::pushOwner("water");
 	if (!water.loadHeightmap("models\\watermap.png", 10)) return false;
+	C3dglResourceLedger::popOwner();
 
 #pragma region // Load Textures
 
 	// Textures
 	C3dglBitmap bm;
+	C3dglResourceLedger::pushOwner("textures");
 
 	// none (simple-white) texture
-	glGenTextures(1, &idTexNone);
+	startup.step("blank texture", "texture");
+	C3dglResourceLedger::genTextures(1, &idTexNone);
 	glBindTexture(GL_TEXTURE_2D, idTexNone);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	BYTE bytes[] = { 255, 255, 255 };
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_BGR, GL_UNSIGNED_BYTE, &bytes);
+	C3dglCallStats::texImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_BGR, GL_UNSIGNED_BYTE, &bytes);
 
 	// Stone Texture
+	startup.step("models/sandC.jpg", "texture");
 	bm.Load("models/sandC.jpg", GL_RGBA);
 	if (!bm.GetBits()) return false;
 
 	glActiveTexture(GL_TEXTURE0);
-	glGenTextures(1, &idTexSandC);
+	C3dglResourceLedger::genTextures(1, &idTexSandC);
 	glBindTexture(GL_TEXTURE_2D, idTexSandC);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), bm.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
+	C3dglCallStats::texImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), bm.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
 
 	//Stone Normal Texture
+	startup.step("models/sandN.jpg", "texture");
 	bm.Load("models/sandN.jpg", GL_RGBA);
 	if (!bm.GetBits()) return false;
 
 	glActiveTexture(GL_TEXTURE1);
-	glGenTextures(1, &idTexSandN);
+	C3dglResourceLedger::genTextures(1, &idTexSandN);
 	glBindTexture(GL_TEXTURE_2D, idTexSandN);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), bm.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
+	C3dglCallStats::texImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), bm.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
 
 	// Water Shore and ShoreBed
 	// Stone Texture - Shore
+	startup.step("models/rockTexture.jpg", "texture");
 	bm.Load("models/rockTexture.jpg", GL_RGBA);
 	if (!bm.GetBits()) return false;
 
 	glActiveTexture(GL_TEXTURE0);
-	glGenTextures(1, &idTexStoneB);
+	C3dglResourceLedger::genTextures(1, &idTexStoneB);
 	glBindTexture(GL_TEXTURE_2D, idTexStoneB);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), bm.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
+	C3dglCallStats::texImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), bm.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
 
 	// Stone Texture - ShoreBed
+	startup.step("models/rockTextureR.jpg", "texture");
 	bm.Load("models/rockTextureR.jpg", GL_RGBA);
 	if (!bm.GetBits()) return false;
 
 	glActiveTexture(GL_TEXTURE1);
-	glGenTextures(1, &idTexStoneS);
+	C3dglResourceLedger::genTextures(1, &idTexStoneS);
 	glBindTexture(GL_TEXTURE_2D, idTexStoneS);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), bm.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
+	C3dglCallStats::texImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), bm.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
 
 	// Smoke Particle
+	startup.step("models/smoke.png", "texture");
 	bm.Load("models/smoke.png", GL_RGBA);
 	if (!bm.GetBits()) return false;
 
 	glActiveTexture(GL_TEXTURE0);
-	glGenTextures(1, &idTexParticle);
+	C3dglResourceLedger::genTextures(1, &idTexParticle);
 	glBindTexture(GL_TEXTURE_2D, idTexParticle);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), bm.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
+	C3dglCallStats::texImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), bm.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
 
 	// Character
+	startup.step("models/character/characterColor.png", "texture");
 	bm.Load("models/character/characterColor.png", GL_RGBA);
 	if (!bm.GetBits()) return false;
 
 	glActiveTexture(GL_TEXTURE0);
-	glGenTextures(1, &idCharacter);
+	C3dglResourceLedger::genTextures(1, &idCharacter);
 	glBindTexture(GL_TEXTURE_2D, idCharacter);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), bm.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
+	C3dglCallStats::texImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), bm.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
 
 	// Character Normal Texture
+	startup.step("models/character/characterNormal.png", "texture");
 	bm.Load("models/character/characterNormal.png", GL_RGBA);
 	if (!bm.GetBits()) return false;
 
 	glActiveTexture(GL_TEXTURE1);
-	glGenTextures(1, &idCharacterN);
+	C3dglResourceLedger::genTextures(1, &idCharacterN);
 	glBindTexture(GL_TEXTURE_2D, idCharacterN);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), bm.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
+	C3dglCallStats::texImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), bm.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
 
 	// Sword
+	startup.step("models/sword/sword.png", "texture");
 	bm.Load("models/sword/sword.png", GL_RGBA);
 	if (!bm.GetBits()) return false;
 
 	glActiveTexture(GL_TEXTURE0);
-	glGenTextures(1, &idSword);
+	C3dglResourceLedger::genTextures(1, &idSword);
 	glBindTexture(GL_TEXTURE_2D, idSword);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), bm.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
+	C3dglCallStats::texImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.GetWidth(), bm.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
+	C3dglResourceLedger::popOwner();
 
 #pragma endregion
 
 #pragma region // Post Process
 
-	RefreshPostProcessing();
+	// Create Quad
+	startup.step("post process quad", "setup");
+	float vertices[] = {
+		0.0f, 0.0f, 0.0f,	0.0f, 0.0f,
+		1.0f, 0.0f, 0.0f,	1.0f, 0.0f,
+		1.0f, 1.0f, 0.0f,	1.0f, 1.0f,
+		0.0f, 1.0f, 0.0f,	0.0f, 1.0f
+	};
+
+	// Generate the buffer name
+	C3dglResourceLedger::pushOwner("post process");
+	glGenBuffers(1, &bufQuad);
+	// Bind the vertex buffer and send data
+	glBindBuffer(GL_ARRAY_BUFFER, bufQuad);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	C3dglResourceLedger::popOwner();
 
 #pragma endregion
 
 #pragma region // Static Cube map;
 
 	// load Static Cube Map
+	startup.step("models\\cube", "texture");
 	glActiveTexture(GL_TEXTURE2);
-	glGenTextures(1, &idTexCube);
+	C3dglResourceLedger::pushOwner("cube map");
+	C3dglResourceLedger::genTextures(1, &idTexCube);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, idTexCube);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -393,83 +556,42 @@ bool init()
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-	bm.Load("models\\cube\\middle2.png", GL_RGBA); glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0,
+	bm.Load("models\\cube\\middle2.png", GL_RGBA); C3dglCallStats::texImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0,
 		GL_RGBA, bm.GetWidth(), abs(bm.GetHeight()), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
-	bm.Load("models\\cube\\left.png", GL_RGBA); glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, 0,
+	bm.Load("models\\cube\\left.png", GL_RGBA); C3dglCallStats::texImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, 0,
 		GL_RGBA, bm.GetWidth(), abs(bm.GetHeight()), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
-	bm.Load("models\\cube\\middle.png", GL_RGBA); glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, 0,
+	bm.Load("models\\cube\\middle.png", GL_RGBA); C3dglCallStats::texImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, 0,
 		GL_RGBA, bm.GetWidth(), abs(bm.GetHeight()), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
-	bm.Load("models\\cube\\right.png", GL_RGBA); glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, 0,
+	bm.Load("models\\cube\\right.png", GL_RGBA); C3dglCallStats::texImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, 0,
 		GL_RGBA, bm.GetWidth(), abs(bm.GetHeight()), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
-	bm.Load("models\\cube\\top.png", GL_RGBA); glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, 0,
+	bm.Load("models\\cube\\top.png", GL_RGBA); C3dglCallStats::texImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, 0,
 		GL_RGBA, bm.GetWidth(), abs(bm.GetHeight()), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
-	bm.Load("models\\cube\\bottom.png", GL_RGBA); glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0,
+	bm.Load("models\\cube\\bottom.png", GL_RGBA); C3dglCallStats::texImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0,
 		GL_RGBA, bm.GetWidth(), abs(bm.GetHeight()), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.GetBits());
+	C3dglResourceLedger::popOwner();
 
 #pragma endregion
 
-#pragma region // Dynamic Cube map;
-	
-	// load Static Cube Map
-	glGenTextures(1, &idTexCube2);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, idTexCube2);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-	glGenTextures(1, &idTexCube3);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, idTexCube3);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	
-#pragma endregion
-
-#pragma region // Shadow map;
-
-	// Create shadow map texture
-	glActiveTexture(GL_TEXTURE7);
-	glGenTextures(1, &idTexShadowMap);
-	glBindTexture(GL_TEXTURE_2D, idTexShadowMap);
-
-	// Create a framebuffer object (FBO)
-	glGenFramebuffers(1, &idFBO2);
-	glBindFramebuffer(GL_FRAMEBUFFER_EXT, idFBO2);
-
-	// Instruct openGL that we won't bind a color texture with the currently binded FBO
-	glDrawBuffer(GL_NONE);
-	glReadBuffer(GL_NONE);
-
-	// attach the texture to FBO depth attachment point
-	glFramebufferTexture2D(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_TEXTURE_2D, idTexShadowMap, 0);
-
-	// switch back to window-system-provided framebuffer
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+#pragma region // Render Passes
 
-	// Texture parameters - to get nice filtering & avoid artefact on the edges of the shadowmap
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LESS);
-
-	// This will associate the texture with the depth component in the Z-buffer
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-		WImage * 2, HImage * 2, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	// the dynamic cube maps, the shadow map and the screen texture are created by the frame graph
+	startup.step("render passes", "setup");
+	void setupRenderPasses();
+	setupRenderPasses();
+	C3dglProfiler::setCurrent(&profiler);
+	void setPassHooks(bool bEnable);
+	setPassHooks(true);
 
-	// revert to texture unit 0
-	glActiveTexture(GL_TEXTURE0);
+	// materials and texture sets of the scene objects
+	void setupRenderQueue();
+	setupRenderQueue();
 
 #pragma endregion
 
 #pragma region // Particle System
 
 	// Setup the particle system
+	startup.step("particles", "setup");
 	ProgramParticle.SendUniform("gravity", 0.0, -10.0, 0.0);
 	ProgramParticle.SendUniform("particleLifetime", LIFETIME);
 
@@ -500,6 +622,7 @@ bool init()
 		bufferInitialPos.push_back(randomPos2);
 		time += PERIOD;
 	}
+	C3dglResourceLedger::pushOwner("particles");
 	glGenBuffers(1, &idBufferVelocity);
 	glBindBuffer(GL_ARRAY_BUFFER, idBufferVelocity);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * bufferVelocity.size(), &bufferVelocity[0],
@@ -512,6 +635,7 @@ bool init()
 	glBindBuffer(GL_ARRAY_BUFFER, idBufferInitialPos);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * bufferInitialPos.size(), &bufferInitialPos[0],
 		GL_STATIC_DRAW);
+	C3dglResourceLedger::popOwner();
 
 	// setup the point size for particle
 	glEnable(0x8642);  
@@ -553,13 +677,13 @@ bool init()
 	ProgramEffect.SendUniform("contrast", 1.2);
 	ProgramEffect.SendUniform("brightness", 0.8);
 
-	// Fog settings
-	ProgramTerrain.SendUniform("fogDensity2", 0.02);
-	ProgramTerrain.SendUniform("fogColour", 0.2f, 0.22f, 0.02f);
-	ProgramTerrain.SendUniform("fogColour2", 0.0f, 0.14f, 0.31f);
+	// Fog settings - the colour of the sky is set by updateLights
+	fog.fogColour = vec3(0.0f, 0.14f, 0.31f);
+	fog.skyFogDensity = 0.02f;
+	fog.waterFogColour = vec3(0.2f, 0.22f, 0.02f);
+	fog.waterFogDensity = 0.3f;
 
 	Program.SendUniform("fogDensity", 0.05);
-	Program.SendUniform("fogColour", 0.0f, 0.14f, 0.31f);
 
 	// Opacity Settings
 	Program.SendUniform("opacity", 1.0f);
@@ -570,115 +694,299 @@ bool init()
 
 	ProgramTerrain.SendUniform("waterLevel", waterLevel);
 
-	// Ambient Light
-	Program.SendUniform("lightAmbient.on", 1);
-	Program.SendUniform("lightAmbient.color", 0.5, 0.5, 0.5);
-	Program.SendUniform("materialAmbient", 0.2, 0.2, 0.2);
-	ProgramTerrain.SendUniform("lightAmbient.on", 1);
-	ProgramTerrain.SendUniform("lightAmbient.color", 0.5, 0.5, 0.5);
-	ProgramTerrain.SendUniform("materialAmbient", 0.2, 0.2, 0.2);
-
-	// Direction Light
-	Program.SendUniform("lightDir.on", 1);
-	Program.SendUniform("lightDir.direction", 0.0, 1.0, 0.0);
-	Program.SendUniform("lightDir.diffuse", 1.5, 1.5, 1.5);	
-	ProgramTerrain.SendUniform("lightDir.on", 1);
-	ProgramTerrain.SendUniform("lightDir.direction", 0.0, 1.0, 0.0);
-	ProgramTerrain.SendUniform("lightDir.diffuse", 1.5, 1.5, 1.5);	  
+	// Lights - the matrices (world coordinates) and the headlight are set by updateLights;
+	// the objects scale the ambient and the directional light with their materials
+	lights.lightAmbient.on = 1;
+	lights.lightAmbient.color = vec3(1.0f);
 
-#pragma region // Point Light
+	lights.lightDir.on = 1;
+	lights.lightDir.direction = vec3(0.0f, 1.0f, 0.0f);
+	lights.lightDir.diffuse = vec3(1.0f);
 
-	Program.SendUniform("lightPoint[0].on", 1);
-	Program.SendUniform("lightPoint[0].att_quadratic", 0.05);
-	Program.SendUniform("lightPoint[0].position", 0.0f, 0.0f, 0.0f);
-	Program.SendUniform("lightPoint[0].diffuse", 1.0, 1.0, 1.0);
-	Program.SendUniform("lightPoint[0].specular", 0.01, 0.01, 0.01);
-
-	ProgramTerrain.SendUniform("lightPoint[0].on", 1);
-	ProgramTerrain.SendUniform("lightPoint[0].att_quadratic", 0.05);
-	ProgramTerrain.SendUniform("lightPoint[0].position", 0.0f, 0.0f, 0.0f);
-	ProgramTerrain.SendUniform("lightPoint[0].diffuse", 1.0, 1.0, 1.0);
-	ProgramTerrain.SendUniform("lightPoint[0].specular", 0.01, 0.01, 0.01);
+#pragma region // Point Light
 
-	Program.SendUniform("lightPoint[1].on", 1);
-	Program.SendUniform("lightPoint[1].att_quadratic", 0.5);
-	Program.SendUniform("lightPoint[1].position", 0.0f, 0.0f, 0.0f);
-	Program.SendUniform("lightPoint[1].diffuse", 1.0, 0.2, 0.1);
-	Program.SendUniform("lightPoint[1].specular", 0.01, 0.01, 0.01);
+	// the first one follows the camera (its matrix is zero)
+	lights.lightPoint[0].on = 1;
+	lights.lightPoint[0].att_quadratic = 0.05f;
+	lights.lightPoint[0].position = vec3(0.0f);
+	lights.lightPoint[0].diffuse = vec3(1.0f);
+	lights.lightPoint[0].specular = vec3(0.01f);
+	lights.lightPoint[0].matrix = mat4(0);
+
+	// the radio
+	lights.lightPoint[1].on = 1;
+	lights.lightPoint[1].att_quadratic = 0.5f;
+	lights.lightPoint[1].position = vec3(0.0f);
+	lights.lightPoint[1].diffuse = vec3(1.0f, 0.2f, 0.1f);
+	lights.lightPoint[1].specular = vec3(0.01f);
 
 #pragma endregion
 
 #pragma region // Spot lights
 
-	// Spot light Blue 
-	Program.SendUniform("lightSpot[0].on", 1);
-	Program.SendUniform("lightSpot[0].position", 0.0f, 0.0f, 0.0f);
-	Program.SendUniform("lightSpot[0].diffuse", 0.0, 3.0, 10.0);
-	Program.SendUniform("lightSpot[0].specular", 2.0, 2.0, 2.0);
-	Program.SendUniform("lightSpot[0].direction", -1.0, -1.0, 0.0);
-	Program.SendUniform("lightSpot[0].cutoff", 60);
-	Program.SendUniform("lightSpot[0].attenuation", 10.0);
-	Program.SendUniform("lightSpot[0].att_quadratic", 0.01);
-
-	ProgramTerrain.SendUniform("lightSpot[0].on", 1);
-	ProgramTerrain.SendUniform("lightSpot[0].position", 0.0f, 0.0f, 0.0f);
-	ProgramTerrain.SendUniform("lightSpot[0].diffuse", 0.0, 1.5, 10.0);
-	ProgramTerrain.SendUniform("lightSpot[0].specular", 2.0, 2.0, 2.0);
-	ProgramTerrain.SendUniform("lightSpot[0].direction", -1.0, -1.0, 0.0);
-	ProgramTerrain.SendUniform("lightSpot[0].cutoff", 60);
-	ProgramTerrain.SendUniform("lightSpot[0].attenuation", 10.0);
-	ProgramTerrain.SendUniform("lightSpot[0].att_quadratic", 0.01);
+	// Spot light Blue - the DeLorean headlight
+	lights.lightSpot[0].on = 0;
+	lights.lightSpot[0].position = vec3(0.0f);
+	lights.lightSpot[0].diffuse = vec3(0.0f, 3.0f, 10.0f);
+	lights.lightSpot[0].specular = vec3(2.0f);
+	lights.lightSpot[0].direction = vec3(-1.0f, -1.0f, 0.0f);
+	lights.lightSpot[0].cutoff = 60;
+	lights.lightSpot[0].attenuation = 10.0f;
+	lights.lightSpot[0].att_quadratic = 0.01f;
 
 	// Spot light Scout
-	Program.SendUniform("lightSpot[1].on", 1);
-	Program.SendUniform("lightSpot[1].diffuse", 5.0, 5.0, 5.0);
-	Program.SendUniform("lightSpot[1].specular", 2.0, 2.0, 2.0);
-	Program.SendUniform("lightSpot[1].direction", 0.0, -1.0, 0.0);
-	Program.SendUniform("lightSpot[1].cutoff", 60);
-	Program.SendUniform("lightSpot[1].attenuation", 10.0);
-	Program.SendUniform("lightSpot[1].att_quadratic", 0.00005);
-
-	ProgramTerrain.SendUniform("lightSpot[1].on", 1);
-	ProgramTerrain.SendUniform("lightSpot[1].diffuse", 5.0, 5.0, 5.0);
-	ProgramTerrain.SendUniform("lightSpot[1].specular", 2.0, 2.0, 2.0);
-	ProgramTerrain.SendUniform("lightSpot[1].direction", 0.0, -1.0, 0.0);
-	ProgramTerrain.SendUniform("lightSpot[1].cutoff", 60);
-	ProgramTerrain.SendUniform("lightSpot[1].attenuation", 10.0);
-	ProgramTerrain.SendUniform("lightSpot[1].att_quadratic", 0.00005);
-
-	
+	lights.lightSpot[1].on = 1;
+	lights.lightSpot[1].position = vec3(0.0f);
+	lights.lightSpot[1].diffuse = vec3(5.0f);
+	lights.lightSpot[1].specular = vec3(2.0f);
+	lights.lightSpot[1].direction = vec3(0.0f, -1.0f, 0.0f);
+	lights.lightSpot[1].cutoff = 60;
+	lights.lightSpot[1].attenuation = 10.0f;
+	lights.lightSpot[1].att_quadratic = 0.00005f;
+
 #pragma endregion
 
+	startup.finish();
+	startup.print(cout);
+	startup.exportJSON("startup.json");
+
 	cout << endl;
 	cout << "Use:" << endl;
 	cout << "  WASD or arrow key to navigate" << endl;
 	cout << "  QE or PgUp/Dn to move the camera up and down" << endl;
 	cout << "  Shift+AD or arrow key to auto-orbit" << endl;
 	cout << "  Drag the mouse to look around" << endl;
+	cout << "  6 to dig a crater where the camera looks" << endl;
+	cout << "  7 for the render pass statistics" << endl;
+	cout << "  8 to change the cube map update policy" << endl;
+	cout << "  9 and 0 to change the number and resolution of the shadow cascades" << endl;
+	cout << "  M to switch between all and the usual objects in the reflections" << endl;
+	cout << "  U to switch the uniform cache on, to the verify mode and off" << endl;
+	cout << "  C to count the GL calls (shown with 7)" << endl;
+	cout << "  F for the profiler summary, saved to profile.csv and profile.json (chrome://tracing)" << endl;
+	cout << "  L for the GPU memory by owner, and the resources created since the last L still alive" << endl;
+	cout << "  P to pause the animation - the shadow and cube map passes are skipped while paused" << endl;
 	cout << endl;
 
 	return true;
 }
 
+// releases all the GPU resources; those still in the ledger have leaked
 void done()
 {
+	for (C3dglModel *pModel : { &delorean, &deloreanWheel, &SFCube, &ring, &character, &character2, &character3, &sword, &radio, &scout })
+		pModel->destroy();
+	CMaterial::destroyBlankTexture();
+	terrain.destroy();
+	water.destroy();
+	skybox.destroy();
+	frameGraph.destroy();
+	profiler.destroy();
+	uboCamera.Destroy();
+	uboLights.Destroy();
+	uboFog.Destroy();
+	for (GLuint *pTexture : { &idTexNone, &idTexSandC, &idTexSandN, &idTexStoneB, &idTexStoneS, &idTexParticle, &idCharacter, &idCharacterN, &idSword, &idTexCube })
+	{
+		if (*pTexture) C3dglResourceLedger::deleteTextures(1, pTexture);
+		*pTexture = 0;
+	}
+	for (GLuint *pBuffer : { &bufQuad, &idBufferVelocity, &idBufferStartTime, &idBufferInitialPos })
+	{
+		if (*pBuffer) glDeleteBuffers(1, pBuffer);
+		*pBuffer = 0;
+	}
+
+	callStats.uninstall();		// before the ledger - its hooks call the ledger's
+	if (ledger.isInstalled())
+	{
+		if (ledger.reportLeaks(cout))
+			ledger.print(cout);
+		ledger.uninstall();
+	}
 }
 
-void renderScene(mat4 &matrixView, float time, bool isLightOn)
+void setPassMask(OBJECT obj, unsigned mask)	{ sceneObjects[obj].passMask = mask; }
+unsigned getPassMask(OBJECT obj)				{ return sceneObjects[obj].passMask; }
+
+void beginPass(unsigned pass, unsigned parts = SCENE_ALL)
 {
-	// Camera position  (Inverse Matrix Extraction)
-	// https://community.khronos.org/t/extracting-camera-position-from-a-modelview-matrix/68031
+	currentPass = pass;
+	currentParts = parts;
+}
 
-	// mat4 viewModel = inverse(matrixView);
-	// vec3 camPos(viewModel[3]);
+// changes whenever any mask changes
+size_t passMaskKey()
+{
+	size_t key = 0;
+	for (SCENE_OBJECT &object : sceneObjects)
+		C3dglFrameGraph::hash(key, object.passMask);
+	return key;
+}
 
-	ProgramEffect.SendUniform("mode", postProcessMode);
+// true if the object is rendered in the current pass
+bool isSubmitted(OBJECT obj)
+{
+	SCENE_OBJECT &object = sceneObjects[obj];
+	return (object.passMask & currentPass) && (currentParts & (object.bMoving ? SCENE_DYNAMIC : SCENE_STATIC));
+}
 
-	mat4 m;
-	mat4 tempM;
+// Submits the model to the render queue unless it is entirely outside the current view frustum;
+// prepare, if given, is called just before the model is rendered (e.g. to send the bones)
+void submitModel(int layer, int material, int textures, C3dglModel &model, mat4 m, bool bOwnState = false, function<void()> prepare = nullptr)
+{
+	if (model.isVisible(matrixProjection, m))
+	{
+		renderQueue.submit(layer, &Program, material, textures, -m[3].z, [&model, m, prepare]
+		{
+			if (prepare) prepare();
+			model.render(m);
+		}, bOwnState);
+		nModelsDrawn++;
+		nTrianglesDrawn += model.getTriangleCount();
+	}
+	else
+		nModelsCulled++;
+}
+
+// Sends the shading parameters of the basic shader - all of them, whatever the previous material was.
+// The lights are shared (see updateLights): the material scales the ambient and the directional light
+void sendMaterial(const BASIC_MATERIAL &mat)
+{
+	uniBasic.materialAmbient.Send(mat.ambient * mat.lightAmbient);
+	uniBasic.materialDiffuse.Send(mat.diffuse);
+	uniBasic.materialSpecular.Send(vec3(0));
+	uniBasic.shininess.Send(mat.shininess);
+	uniBasic.useLights.Send(mat.bLit ? 1 : 0);
+	uniBasic.lightDirScale.Send(mat.lightDiffuse);
+	uniBasic.fogDensity.Send(mat.fogDensity);
+	uniBasic.scaleX.Send(mat.scale);
+	uniBasic.scaleY.Send(mat.scale);
+	uniBasic.opacity.Send(mat.opacity);
+	uniBasic.useNormalMap.Send(mat.bNormalMap ? 1 : 0);
+	uniBasic.useCubeMap.Send(mat.reflection > 0 ? 1 : 0);
+	uniBasic.reflectionPower.Send(mat.reflection);
+}
+
+// Materials and texture sets of the scene objects. The materials read the state of the
+// current frame (day time, normal maps switch) when the queue applies them
+void setupRenderQueue()
+{
+	renderQueue.setBackToFront(LAYER_PARTICLES);
+
+	matSky = renderQueue.addMaterial([]
+	{
+		BASIC_MATERIAL mat;
+		mat.ambient = vec3(1.5f);
+		mat.diffuse = vec3(0.3f);
+		mat.opacity = 1.05f - transition;
+		mat.bLit = false;
+		sendMaterial(mat);
+	});
+	matWheel = renderQueue.addMaterial([]
+	{
+		BASIC_MATERIAL mat;
+		mat.lightDiffuse = 8;
+		if (bWheelGlow)
+		{
+			mat.ambient = vec3(10);
+			mat.lightAmbient = vec3(0.0f, 0.2f, 0.8f);
+		}
+		sendMaterial(mat);
+	});
+	matSword = renderQueue.addMaterial([]
+	{
+		BASIC_MATERIAL mat;
+		mat.shininess = 3;
+		sendMaterial(mat);
+	});
+	matScout = renderQueue.addMaterial([]
+	{
+		sendMaterial(BASIC_MATERIAL());
+	});
+	matRadio = renderQueue.addMaterial([]
+	{
+		BASIC_MATERIAL mat;
+		mat.lightDiffuse = 2;
+		sendMaterial(mat);
+	});
+	matCharacter = renderQueue.addMaterial([]
+	{
+		BASIC_MATERIAL mat;
+		mat.bNormalMap = isNormalOn;
+		sendMaterial(mat);
+	});
+	matRing = renderQueue.addMaterial([]
+	{
+		BASIC_MATERIAL mat;
+		mat.diffuse = vec3(0.4f, 0.3f, 0.1f);
+		mat.lightDiffuse = 1;
+		mat.fogDensity = 0.3f;
+		mat.scale = 300;
+		mat.bNormalMap = isNormalOn;
+		sendMaterial(mat);
+	});
+	matCube = renderQueue.addMaterial([]
+	{
+		BASIC_MATERIAL mat;
+		mat.ambient = vec3(0.2f);
+		mat.diffuse = vec3(0.3f);
+		mat.lightAmbient = vec3(0.5f);
+		mat.lightDiffuse = 1;
+		mat.fogDensity = 0;
+		mat.reflection = 1;
+		sendMaterial(mat);
+	});
+	matDelorean = renderQueue.addMaterial([]
+	{
+		BASIC_MATERIAL mat;
+		mat.lightDiffuse = 8;
+		mat.reflection = 0.4f - std::max(transition - 0.6f, 0.0f);
+		sendMaterial(mat);
+	});
+	matTerrain = renderQueue.addMaterial([]
+	{
+		ProgramTerrain.SendUniform(uniformName::useNormalMap, 0);
+		ProgramTerrain.SendUniform(uniformName::useShadowMap, 0);
+		ProgramTerrain.SendUniform(uniformName::materialAmbient, 0.05f, 0.05f, 0.05f);
+		ProgramTerrain.SendUniform(uniformName::materialDiffuse, finalFogColor[0], finalFogColor[1], finalFogColor[2]);
+		ProgramTerrain.SendUniform(uniformName::scaleX, 1.0);
+		ProgramTerrain.SendUniform(uniformName::scaleY, 1.0);
+	});
+	matWater = renderQueue.addMaterial([]
+	{
+		vec3 skyColor = finalFogColor * 3.0f;
+		ProgramWater.SendUniform(uniformName::waterColor, finalFogColor[0], finalFogColor[1], finalFogColor[2]);
+		ProgramWater.SendUniform(uniformName::skyColor, skyColor[0], skyColor[1], skyColor[2]);
+	});
+	matParticles = renderQueue.addMaterial([]
+	{
+		ProgramParticle.SendUniform(uniformName::opacity, transition);
+	});
+
+	// the terrain samples the sand on the unit 0; the cube maps are set each frame (see renderCube)
+	texNone = renderQueue.addTextureSet({ { GL_TEXTURE0, GL_TEXTURE_2D, idTexNone } });
+	texSword = renderQueue.addTextureSet({ { GL_TEXTURE0, GL_TEXTURE_2D, idSword } });
+	texCharacter = renderQueue.addTextureSet({ { GL_TEXTURE0, GL_TEXTURE_2D, idCharacter }, { GL_TEXTURE1, GL_TEXTURE_2D, idCharacterN } });
+	texSand = renderQueue.addTextureSet({ { GL_TEXTURE0, GL_TEXTURE_2D, idTexSandC }, { GL_TEXTURE1, GL_TEXTURE_2D, idTexSandN } });
+	texTerrain = renderQueue.addTextureSet({ { GL_TEXTURE0, GL_TEXTURE_2D, idTexSandC }, { GL_TEXTURE1, GL_TEXTURE_2D, idTexNone } });
+	texWater = renderQueue.addTextureSet({ { GL_TEXTURE0, GL_TEXTURE_2D, idTexNone }, { GL_TEXTURE1, GL_TEXTURE_2D, idTexNone } });
+	texParticles = renderQueue.addTextureSet({ { GL_TEXTURE0, GL_TEXTURE_2D, idTexParticle } });
+	texCube1 = renderQueue.addTextureSet({ });
+	texCube2 = renderQueue.addTextureSet({ });
+}
 
+// Sets the camera of all programs (but the particles and the post process)
+void setCamera(mat4 matrixView, mat4 matrixProjection)
+{
+	CAMERA_BLOCK camera = { matrixView, matrixProjection };
+	uboCamera.Update(camera);
+}
+
+// The time of day, the fog colour and the lights, in world coordinates - once per frame
+void updateLights()
+{
 	float speed = 20;
-	float counter = (float)(GetTickCount() % 86400 / speed);
+	float counter = (float)(dayTicks % 86400 / speed);
 	float hour = counter / 3600 * speed;
 
 	float step = hour * 15;
@@ -695,619 +1003,428 @@ void renderScene(mat4 &matrixView, float time, bool isLightOn)
 	vec3 fogColorB = vec3(0.4f, 0.3f, 0.1f);
 
 	finalFogColor = fogColorA * (1 - transition) + fogColorB * transition;
+	fog.fogColour = finalFogColor;
 
-#pragma region // Skybox
-	Program.SendUniform("scaleX", 1);
-	Program.SendUniform("scaleY", 1);
-	Program.SendUniform("materialSpecular", 0.0, 0.0, 0.0);
-	Program.SendUniform("lightSpot[0].on", 0);
-	Program.SendUniform("lightSpot[1].on", 0);
-	Program.SendUniform("lightSpot[2].on", 0);
-	Program.SendUniform("lightSpot[3].on", 0);
-	Program.SendUniform("lightPoint[1].on", 0);
-	Program.SendUniform("lightSpot[1].on", 0);
-	Program.SendUniform("lightDir.on", 0);
-	Program.SendUniform("useShadowMap", 0);
-	Program.SendUniform("useNormalMap", 0);
-	Program.SendUniform("lightAmbient.color", 1.0, 1.0, 1.0);
-	Program.SendUniform("materialAmbient", 1.5, 1.5, 1.5);
-	Program.SendUniform("materialDiffuse", 0.3, 0.3, 0.3);
-	Program.SendUniform("opacity", 1.05f - transition);
+	// the sun (and the moon) follows the skybox
+	sunAngle = step;
+	mat4 m = rotate(mat4(1.f), radians(180.f), vec3(0.0f, 1.0f, 0.0f));
+	m = rotate(m, radians(step), vec3(1.0f, 0.0f, 0.0f));
+	lights.lightDir.matrix = rotate(m, radians(230.f), vec3(1.0f, 0.0f, 0.0f));
+
+	// the DeLorean headlight
+	bWheelGlow = (int)step % 10 == 0 || (int)step % 12 == 0;
+	m = translate(mat4(1.f), vec3(55.0f, 18.0f, -5.0f));
+	m = rotate(m, radians(110.0f), vec3(-0.1f, 1.0f, 0.0f));
+	m = scale(m, vec3(5.0f, 5.0f, 5.0f));
+	m = scale(m, vec3(1.001f, 1.001f, 1.001f));
+	lights.lightSpot[0].matrix = translate(m, vec3(-1.0f, 1.0, -0.4f));
+	lights.lightSpot[0].on = bWheelGlow ? 1 : 0;
+
+	// the scout searchlight
+	float calc = sinf(animTime / 1.5f) * 15.0f;
+	m = rotate(mat4(1.f), radians(-animTime * 30), vec3(0.0f, 1.0f, 0.0f));
+	m = rotate(m, radians(40.0f), vec3(0.0f, 0.0f, 1.0f));
+	m = translate(m, vec3(350.0f, -100.0f, 0.0f));
+	m = rotate(m, radians(280.0f + calc), vec3(0.0f, 0.0f, 1.0f));
+	lights.lightSpot[1].matrix = translate(m, vec3(1.0f, -10.5f, 1.0f));
+
+	// the radio
+	m = translate(mat4(1.f), vec3(55.0f, 19.7f, -6.5f));
+	lights.lightPoint[1].matrix = translate(m, vec3(0.0f, 0.5f, -1.2f));
+
+	uboLights.Update(lights);
+	uboFog.Update(fog);
+}
+
+// Submits the scene objects to the render queue; the caller flushes it
+void renderScene(mat4 &matrixView, float time, bool isLightOn)
+{
+	C3dglProfiler::ZONE zone("submitScene");	// the draws are timed by the queue flush
+
+	// Camera position  (Inverse Matrix Extraction)
+	// https://community.khronos.org/t/extracting-camera-position-from-a-modelview-matrix/68031
+
+	// mat4 viewModel = inverse(matrixView);
+	// vec3 camPos(viewModel[3]);
+
+	mat4 m;
+
+	Program.SendUniform(uniformName::useShadowMap, 0);
 
+	// the sun (and the moon) follows the skybox
 	m = matrixView;
 	m = rotate(m, radians(180.f), vec3(0.0f, 1.0f, 0.0f));
-	m = rotate(m, radians(step), vec3(1.0f, 0.0f, 0.0f));
-	tempM = m;
-	skybox.render(m);
-
-	tempM = rotate(tempM, radians(230.f), vec3(1.0f, 0.0f, 0.0f));
-	Program.SendUniform("lightDir.matrix", tempM);
-	ProgramTerrain.SendUniform("lightDir.matrix", tempM);
-
-	//Program.SendUniform("useShadowMap", 1);
-	//ProgramTerrain.SendUniform("useShadowMap", 1);
-	Program.SendUniform("lightDir.on", 1);
-	Program.SendUniform("opacity", 1);
-	Program.SendUniform("lightPoint[1].on", 1);
-#pragma endregion
+	m = rotate(m, radians(sunAngle), vec3(1.0f, 0.0f, 0.0f));
+	mat4 matrixSky = m;
 
-#pragma region // Deloran
+#pragma region // Skybox
 
-	Program.SendUniform("fogColour", finalFogColor[0], finalFogColor[1], finalFogColor[2]);
+	// the skybox binds its own textures
+	if (isSubmitted(SKYBOX))
+		renderQueue.submit(LAYER_SKY, &Program, matSky, -1, 0, [matrixSky] { skybox.render(matrixSky); }, true);
 
-	Program.SendUniform("fogDensity", 0.05);
-	Program.SendUniform("materialAmbient", 0.1, 0.1, 0.1);
-	Program.SendUniform("lightDir.diffuse",8.0, 8.0, 8.0);
-	Program.SendUniform("materialDiffuse", 0.2f, 0.2f, 0.2f);
+#pragma endregion
+
+#pragma region // Deloran
 
 	m = matrixView;
 	m = translate(m, vec3(55.0f, 18.0f, -5.0f));
 	m = rotate(m, radians(110.0f), vec3(-0.1f, 1.0f, 0.0f));
-	tempM = m;
 	m = scale(m, vec3(5.0f, 5.0f, 5.0f));
-
-	if ((int)step % 10 == 0 || (int)step % 12 == 0)
-	{
-		Program.SendUniform("reflectionPower", 0);
-		Program.SendUniform("materialAmbient", 10.0, 10.0, 10.0);
-		Program.SendUniform("lightAmbient.color", 0.0, 0.2, 0.8);
-	}
-
 	m = scale(m, vec3(1.001f, 1.001f, 1.001f));
-	if (isLightOn) deloreanWheel.render(m);
-
-	if (isLightOn)
-	{
-		tempM = translate(m, vec3(-1.0f, 1.0, -0.4f));
-		Program.SendUniform("lightSpot[0].matrix", tempM);
-		ProgramTerrain.SendUniform("lightSpot[0].matrix", tempM);
-		if ((int)step % 10 == 0 || (int)step % 12 == 0)
-		{
-			Program.SendUniform("lightSpot[0].on", 1);
-			ProgramTerrain.SendUniform("lightSpot[0].on", 1);
-		}
-		else
-		{
-			Program.SendUniform("lightSpot[0].on", 0);
-			ProgramTerrain.SendUniform("lightSpot[0].on", 0);
-		}
-	}
-
-	Program.SendUniform("useCubeMap", 0);
-	glActiveTexture(GL_TEXTURE0);
-	Program.SendUniform("reflectionPower", 0.0);
-
+	if (isLightOn && isSubmitted(DELOREAN_WHEEL)) submitModel(LAYER_OPAQUE, matWheel, texNone, deloreanWheel, m);
 
 #pragma endregion
 
 #pragma region // Sword
 
-	Program.SendUniform("lightAmbient.color", 1.0, 1.0, 1.0);
-	Program.SendUniform("materialAmbient", 0.1, 0.1, 0.1);
-	Program.SendUniform("lightDir.diffuse", 5.0, 5.0, 5.0);
-	Program.SendUniform("materialDiffuse", 0.2f, 0.2f, 0.2f);
-	Program.SendUniform("shininess", 3.0f);
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, idSword);
-
 	m = matrixView;
 	m = translate(m, vec3(56.0f, 19.0f, -11.0f));
 	m = rotate(m, radians(160.0f), vec3(1.0f, 0.0f, 0.5f));
 	m = scale(m, vec3(0.03f, 0.03f, 0.03f));
-	sword.render(m);
-
-	Program.SendUniform("shininess", 0.0f);
-	glBindTexture(GL_TEXTURE_2D, idTexNone);
+	if (isSubmitted(SWORD)) submitModel(LAYER_OPAQUE, matSword, texSword, sword, m);
 
 #pragma endregion
 
 #pragma region // Scout
 
-	Program.SendUniform("lightAmbient.color", 1.0, 1.0, 1.0);
-	Program.SendUniform("materialAmbient", 0.1, 0.1, 0.1);
-	Program.SendUniform("lightDir.diffuse", 5.0, 5.0, 5.0);
-	Program.SendUniform("materialDiffuse", 0.2f, 0.2f, 0.2f);
-	Program.SendUniform("lightSpot[1].on", 1);
-
 	m = matrixView;
 	m = translate(m, vec3(0.0f, 0.0f, 0.0f));
 	m = rotate(m, radians(-time * 30), vec3(0.0f, 1.0f, 0.0f));
 	m = rotate(m, radians(40.0f), vec3(0.0f, 0.0f, 1.0f));
 	m = translate(m, vec3(350.0f, -100.0f, 0.0f));
-	tempM = m;
 	m = scale(m, vec3(2.0f, 2.0f, 2.0f));
-	scout.render(m);
-
-	float calc = sinf(time / 1.5f) * 15.0f;
-
-	tempM = rotate(tempM, radians(280.0f + calc), vec3(0.0f, 0.0f, 1.0f));
-	tempM = translate(tempM, vec3(1.0f, -10.5f, 1.0f));
-	if (isLightOn)
-	{
-		Program.SendUniform("lightSpot[1].matrix", tempM);
-		ProgramTerrain.SendUniform("lightSpot[1].matrix", tempM);
-	}
+	if (isSubmitted(SCOUT)) submitModel(LAYER_OPAQUE, matScout, texNone, scout, m);
 
 #pragma endregion
 
 #pragma region // Radio
 
-	Program.SendUniform("lightAmbient.color", 1.0, 1.0, 1.0);
-	Program.SendUniform("materialAmbient", 0.1, 0.1, 0.1);
-	Program.SendUniform("lightDir.diffuse", 2.0, 2.0, 2.0);
-	Program.SendUniform("materialDiffuse", 0.2f, 0.2f, 0.2f);
-
+	// the radio binds the textures of its materials
 	m = matrixView;
 	m = translate(m, vec3(55.0f, 19.7f, -6.5f));
-	tempM = m;
 	m = rotate(m, radians(180.f), vec3(-0.1f, 1.0f, -0.1f));
 	m = scale(m, vec3(0.07f, 0.07f, 0.07f));
-	if (isLightOn) radio.render(m);
-
-	if (isLightOn)
-	{
-		tempM = translate(tempM, vec3(0.0f, 0.5f, -1.2f));
-		Program.SendUniform("lightPoint[1].matrix", tempM);
-	}
-
+	if (isLightOn && isSubmitted(RADIO)) submitModel(LAYER_OPAQUE, matRadio, -1, radio, m, true);
 
 #pragma endregion
 
 #pragma region // Animated Character
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, idCharacter);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, idCharacterN);
+	C3dglModel *pCharacters[] = { &character, &character2, &character3 };
+	C3dglModel *pCharacter = pCharacters[animationMode];
 
-	Program.SendUniform("useNormalMap", isNormalOn);
-	Program.SendUniform("materialAmbient", 0.1, 0.1, 0.1);
-	Program.SendUniform("lightDir.diffuse", 5.0, 5.0, 5.0);
-	Program.SendUniform("materialDiffuse", 0.2f, 0.2f, 0.2f);
-
-	std::vector<float> transforms;
-	character.getAnimData(0, time, transforms);
-	Program.SendUniformMatrixv("bones", (float*)&transforms[0], transforms.size() / 16);
 	m = matrixView;
-	m = translate(m, vec3(54.0f, 16.0f, -8.3f));
-	m = rotate(m, radians(180.0f), vec3(0.0f, 1.0f, 0.0f));
-	m = scale(m, vec3(3.0f, 3.0f, 3.0f));
-	if (animationMode == 0)character.render(m);
-
-	character2.getAnimData(0, time, transforms);
-	Program.SendUniformMatrixv("bones", (float*)&transforms[0], transforms.size() / 16);
-	m = matrixView;
-	m = translate(m, vec3(64.2f, 16.9f, -5.8f));
-	m = rotate(m, radians(40.0f), vec3(0.0f, 1.0f, 0.0f));
-	m = scale(m, vec3(3.0f, 3.0f, 3.0f));
-	if (animationMode == 1) character2.render(m);
-
-	character3.getAnimData(0, time, transforms);
-	Program.SendUniformMatrixv("bones", (float*)&transforms[0], transforms.size() / 16);
-	m = matrixView;
-	m = translate(m, vec3(45.0f, 14.6f, 0.0f));
-	m = rotate(m, radians(270.0f), vec3(0.0f, 1.0f, 0.0f));
+	if (animationMode == 0)
+	{
+		m = translate(m, vec3(54.0f, 16.0f, -8.3f));
+		m = rotate(m, radians(180.0f), vec3(0.0f, 1.0f, 0.0f));
+	}
+	else if (animationMode == 1)
+	{
+		m = translate(m, vec3(64.2f, 16.9f, -5.8f));
+		m = rotate(m, radians(40.0f), vec3(0.0f, 1.0f, 0.0f));
+	}
+	else
+	{
+		m = translate(m, vec3(45.0f, 14.6f, 0.0f));
+		m = rotate(m, radians(270.0f), vec3(0.0f, 1.0f, 0.0f));
+	}
 	m = scale(m, vec3(3.0f, 3.0f, 3.0f));
-	if (animationMode == 2) character3.render(m);
-
-	Program.SendUniform("useNormalMap", 0);
-	glBindTexture(GL_TEXTURE_2D, idTexNone);
+	if (isSubmitted(CHARACTER)) submitModel(LAYER_OPAQUE, matCharacter, texCharacter, *pCharacter, m, false, [pCharacter, time]
+	{
+		std::vector<float> transforms;
+		pCharacter->getAnimData(0, time, transforms);
+		uniBasic.bones.Send((mat4*)&transforms[0], transforms.size() / 16);
+	});
 
 #pragma endregion
 
 #pragma region // Ring
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, idTexSandC);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, idTexSandN);
-
-	Program.SendUniform("useNormalMap", isNormalOn);
-
-	Program.SendUniform("fogDensity", 0.3);
-	Program.SendUniform("materialAmbient", 0.1f, 0.1f, 0.1f);
-	Program.SendUniform("materialDiffuse", 0.4f, 0.3f, 0.1f);
-	Program.SendUniform("lightDir.diffuse", 1.0, 1.0, 1.0);
-	Program.SendUniform("scaleX", 300.0);
-	Program.SendUniform("scaleY", 300.0);
 
 	m = matrixView;
 	m = translate(m, vec3(0.0f, 20.0f, 0.0f));
 	m = rotate(m, radians(0.f), vec3(0.0f, 1.0f, 0.0f));
 	m = scale(m, vec3(550.0f, 300.0f, 550.0f));
-	ring.render(m);
+	if (isSubmitted(RING)) submitModel(LAYER_OPAQUE, matRing, texSand, ring, m);
 
 #pragma endregion
 
 #pragma region // Map 
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, idTexNone);
-
-	ProgramTerrain.SendUniform("fogColour2", finalFogColor[0], finalFogColor[1], finalFogColor[2]);
-	ProgramTerrain.SendUniform("useNormalMap", 0);
-	ProgramTerrain.SendUniform("useShadowMap", 0);
-	ProgramTerrain.SendUniform("fogDensity", 0.3);
-	ProgramTerrain.SendUniform("materialAmbient", 0.1f, 0.1f, 0.1f);
-	ProgramTerrain.SendUniform("materialDiffuse", finalFogColor[0], finalFogColor[1], finalFogColor[2]);
-	ProgramTerrain.SendUniform("lightDir.diffuse", 1.0, 1.0, 1.0);
-	ProgramTerrain.SendUniform("scaleX", 1.0);
-	ProgramTerrain.SendUniform("scaleY", 1.0);
-
-	ProgramTerrain.Use();
 
 	m = matrixView;
 	m = translate(matrixView, vec3(0, -5.0f, 0));
-	ProgramTerrain.SendUniform("matrixModelView", m);
-	terrain.render(m);
+	if (isSubmitted(TERRAIN)) renderQueue.submit(LAYER_OPAQUE, &ProgramTerrain, matTerrain, texTerrain, -m[3].z, [m]
+	{
+		uniTerrainModelView.Send(m);
+		terrain.render(m, matrixProjection, lodBudget, lodViewportHeight);
+	});
 
 #pragma endregion
 
 #pragma region // Water
 
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, idTexNone);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, idTexNone);
-
-	ProgramWater.SendUniform("waterColor", finalFogColor[0], finalFogColor[1], finalFogColor[2]);
-	finalFogColor = finalFogColor * 3.0f;
-	ProgramWater.SendUniform("skyColor", finalFogColor[0], finalFogColor[1], finalFogColor[2]);
-
-	ProgramWater.Use();
-
 	// render the water
 	m = matrixView;
 	m = translate(m, vec3(0, waterLevel - 5, -75));
 	m = rotate(m, radians(45.f), vec3(0.0f, 1.0f, 0.0f));
 	m = scale(m, vec3(1.4f, 1.0f, 1.3f));
-	ProgramWater.SendUniform("matrixModelView", m);
-	water.render(m);
+	if (isSubmitted(WATER)) renderQueue.submit(LAYER_WATER, &ProgramWater, matWater, texWater, -m[3].z, [m]
+	{
+		uniWaterModelView.Send(m);
+		water.render(m, matrixProjection);
+	});
 
 #pragma endregion
 
 #pragma region // Particle System
 
-	glDepthMask(GL_FALSE);				// disable depth buffer updates
-	glActiveTexture(GL_TEXTURE0);			// choose the active texture
-	glBindTexture(GL_TEXTURE_2D, idTexParticle);	// bind the texture
-
-	// RENDER THE PARTICLE SYSTEM
-	ProgramParticle.Use();
-
-	 mat4 viewModel = inverse(matrixView);
-	 vec3 camPos(viewModel[3]);
-
+	// the last part of the scene
 	m = matrixView;
 	m = translate(m, vec3(0, 70, 0));
-	ProgramParticle.SendUniform("matrixModelView", m);
-	ProgramParticle.SendUniform("opacity", transition);
-
-	// render the buffer
-	glEnableVertexAttribArray(0);	// velocity
-	glEnableVertexAttribArray(1);	// start time
-	glEnableVertexAttribArray(2);	// initial position
-	glBindBuffer(GL_ARRAY_BUFFER, idBufferVelocity);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, idBufferStartTime);
-	glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 0, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, idBufferInitialPos);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
-	glDrawArrays(GL_POINTS, 0, NPARTICLES);
-	glDisableVertexAttribArray(0);
-	glDisableVertexAttribArray(1);
-	glDisableVertexAttribArray(2);
-
-	glDepthMask(GL_TRUE);		// don't forget to switch the depth test updates back on
+	if (isSubmitted(PARTICLES)) renderQueue.submit(LAYER_PARTICLES, &ProgramParticle, matParticles, texParticles, -m[3].z, [m]
+	{
+		glDepthMask(GL_FALSE);				// disable depth buffer updates
+
+		// RENDER THE PARTICLE SYSTEM
+		uniParticleModelView.Send(m);
+
+		// render the buffer
+		glEnableVertexAttribArray(0);	// velocity
+		glEnableVertexAttribArray(1);	// start time
+		glEnableVertexAttribArray(2);	// initial position
+		glBindBuffer(GL_ARRAY_BUFFER, idBufferVelocity);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, idBufferStartTime);
+		glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 0, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, idBufferInitialPos);
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		C3dglCallStats::drawArrays(GL_POINTS, 0, NPARTICLES);
+		glDisableVertexAttribArray(0);
+		glDisableVertexAttribArray(1);
+		glDisableVertexAttribArray(2);
+
+		glDepthMask(GL_TRUE);		// don't forget to switch the depth test updates back on
+	});
 
 #pragma endregion
 
 }
 
-// Creates a shadow map and stores in idFBO
-// theta: current animation control variable
-// lightTransform - usually lookAt transform corresponding to the light position and its direction
-void createShadowMap(float time, mat4 lightTransform)
+// Creates the shadow cascades - the frame graph binds its FBO with the depth texture array
+// time: current animation control variable
+// parts - the casters to render, over the current depth buffer contents unless bClear
+void createShadowMap(float time, unsigned parts, bool bClear)
 {
+	C3dglProfiler::ZONE zone("createShadowMap");
+	beginPass(PASS_SHADOW, parts);
 	glEnable(GL_CULL_FACE);
 	glCullFace(GL_FRONT);
+	lodBudget = LOD_BUDGET_AUX;
+	lodViewportHeight = shadowCascades.getResolution();
 
-	// Store the current viewport in a safe place
-	GLint viewport[4];
-	glGetIntegerv(GL_VIEWPORT, viewport);
-	int w = viewport[2];
-	int h = viewport[3];
-
-	// setup the viewport to 2x2 the original and wide (120 degrees) FoV (Field of View)
-	glViewport(0, 0, w * 2, h * 2);
-	mat4 matrixProjection = perspective(radians(120.f), (float)w / (float)h, 0.5f, 50.0f);
-	Program.SendUniform("matrixProjection", matrixProjection);
-	ProgramTerrain.SendUniform("matrixProjection", matrixProjection);
-
-	// prepare the camera
-	mat4 matrixView = lightTransform;
-
-	// send the View Matrix
-	Program.SendUniform("matrixView", matrixView);
-	ProgramTerrain.SendUniform("matrixView", matrixView);
-
-	// Bind the Framebuffer
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, idFBO2);
-	// OFF-SCREEN RENDERING FROM NOW!
-
-	// Clear previous frame values - depth buffer only!
-	glClear(GL_DEPTH_BUFFER_BIT);
+	// prepare the camera - the light view is common for all cascades
+	mat4 matrixView = shadowCascades.getView();
 
 	// Disable color rendering, we only want to write to the Z-Buffer (this is to speed-up)
 	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 
-	// Prepare and send the Shadow Matrix - this is matrix transform every coordinate x,y,z
-	// x = x* 0.5 + 0.5 
-	// y = y* 0.5 + 0.5 
-	// z = z* 0.5 + 0.5 
-	// Moving from unit cube [-1,1] to [0,1]  
-	
-	const mat4 bias = {
-		{ 0.5, 0.0, 0.0, 0.0 },
-		{ 0.0, 0.5, 0.0, 0.0 },
-		{ 0.0, 0.0, 0.5, 0.0 },
-		{ 0.5, 0.5, 0.5, 1.0 }
-	};
-
-	Program.SendUniform("matrixShadow", bias * matrixProjection * matrixView);
-	ProgramTerrain.SendUniform("matrixShadow", bias * matrixProjection * matrixView);
-	
-	// Render all objects in the scene
-	renderScene(matrixView, time, false);
-
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-	glDisable(GL_CULL_FACE);
-	void onReshape(int w, int h);
-	onReshape(w, h);
-}
-
-void prepareCubeMap(float x, float y, float z, float time)
-{
-	// Store the current viewport in a safe place
-	GLint viewport[4];
-	glGetIntegerv(GL_VIEWPORT, viewport);
-	int w = viewport[2];
-	int h = viewport[3];
-
-	// setup the viewport to 256x256, 90 degrees FoV (Field of View)
-	glViewport(0, 0, 512, 512);
-	Program.SendUniform("matrixProjection", perspective(radians(90.f), 1.0f, 0.02f, 1000.0f));
-
-	// render environment 6 times
-	Program.SendUniform("reflectionPower", 0.0);
-	for (int i = 0; i < 6; ++i)
+	// Render the shadow casters into each cascade (a layer of the texture array)
+	unsigned nTriangles = nTrianglesDrawn + terrain.getTrianglesDrawn();
+	for (int i = 0; i < shadowCascades.getCascadeCount(); i++)
 	{
-		// clear background
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		frameGraph.setLayer(i);
+		if (bClear) glClear(GL_DEPTH_BUFFER_BIT);
 
-		// setup the camera
-		const GLfloat ROTATION[6][6] =
-		{	// at              up
-			{ 1.0, 0.0, 0.0,   0.0, -1.0, 0.0 },  // pos x
-			{ -1.0, 0.0, 0.0,  0.0, -1.0, 0.0 },  // neg x
-			{ 0.0, 1.0, 0.0,   0.0, 0.0, 1.0 },   // pos y
-			{ 0.0, -1.0, 0.0,  0.0, 0.0, -1.0 },  // neg y
-			{ 0.0, 0.0, 1.0,   0.0, -1.0, 0.0 },  // poz z
-			{ 0.0, 0.0, -1.0,  0.0, -1.0, 0.0 }   // neg z
-		};
-		mat4 matrixView2 = lookAt(
-			vec3(x, y, z),
-			vec3(x + ROTATION[i][0], y + ROTATION[i][1], z + ROTATION[i][2]),
-			vec3(ROTATION[i][3], ROTATION[i][4], ROTATION[i][5]));
-
-		// send the View Matrix
-		Program.SendUniform("matrixView", matrixView2);
-
-		// render scene objects - all but the reflective one
-		renderScene(matrixView2, time, false);
+		matrixProjection = shadowCascades.getProjection(i);
+		setCamera(matrixView, matrixProjection);
 
-		// send the image to the cube texture
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, idTexCube2);
-		glCopyTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB8, 0, 0, 512, 512, 0);
+		renderScene(matrixView, time, false);
+		renderQueue.flush();
 	}
+	nShadowTriangles += nTrianglesDrawn + terrain.getTrianglesDrawn() - nTriangles;
 
-	// restore the matrixView, viewport and projection
-	void onReshape(int w, int h);
-	onReshape(w, h);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDisable(GL_CULL_FACE);
 }
 
 void renderCube(mat4 matrixView, float time)
 {
+	if (!isSubmitted(CUBE))
+		return;
+
 	float calc = sinf(time / 1.5f);
 
+	// the frame graph may re-create the cube map
+	renderQueue.setTextureSet(texCube1, { { GL_TEXTURE0, GL_TEXTURE_2D, idTexNone }, { GL_TEXTURE2, GL_TEXTURE_CUBE_MAP, frameGraph.getTexture("cube1") } });
 
 	mat4 m = matrixView;
-	Program.SendUniform("scaleX", 1);
-	Program.SendUniform("scaleY", 1);
-	Program.SendUniform("fogDensity", 0.0);
-	Program.SendUniform("lightAmbient.color", 0.5, 0.5, 0.5);
-	Program.SendUniform("materialDiffuse", 0.3f, 0.3f, 0.3f);
-	Program.SendUniform("materialAmbient", 0.2f, 0.2f, 0.2f);
-
-	Program.SendUniform("useCubeMap", 1);
-	Program.SendUniform("reflectionPower", 1.0);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, idTexCube2);
-
-	m = matrixView;
 	m = translate(m, vec3(0.0f, 50.0f, 0.0f));
 	m = rotate(m, radians(time * 25), vec3(0.0f, 1.0f, 0.0f));
 	m = scale(m, vec3(0.2f, 0.2f, 0.2f));
-	SFCube.render(m);
+	submitModel(LAYER_OPAQUE, matCube, texCube1, SFCube, m);
 
 	m = matrixView;
 	m = translate(m, vec3(0.0f, 50.0f, 0.0f));
 	m = scale(m, vec3(18.0f, 18.0f, 18.0f));
 	m = rotate(m, radians(20 * 5 * calc), vec3(1.0f, 0.0f, 0.0f));
-	ring.render(m);
+	submitModel(LAYER_OPAQUE, matCube, texCube1, ring, m);
 
 	m = matrixView;
 	m = translate(m, vec3(0.0f, 50.0f, 0.0f));
 	m = scale(m, vec3(22.0f, 22.0f, 22.0f));
 	m = rotate(m, radians(-25 * 7 * calc), vec3(1.0f, 0.0f, 1.0f));
-	ring.render(m);
+	submitModel(LAYER_OPAQUE, matCube, texCube1, ring, m);
 
 	m = matrixView;
 	m = translate(m, vec3(0.0f, 50.0f, 0.0f));
 	m = scale(m, vec3(26.0f, 26.0f, 26.0f));
 	m = rotate(m, radians(30 * 9 * calc), vec3(0.0f, 0.0f, 1.0f));
-	ring.render(m);
-
-	glActiveTexture(GL_TEXTURE0);
-	Program.SendUniform("useCubeMap", 0);
-	Program.SendUniform("reflectionPower", 0.0);
+	submitModel(LAYER_OPAQUE, matCube, texCube1, ring, m);
 }
 
-void prepareCubeMap2(float x, float y, float z, float time)
+// Renders the faces of the probe due in this frame straight into its cube map,
+// attached by the frame graph; each face culls the models against its own frustum.
+// The reflective cube is only rendered for the probe that sees it
+void prepareCubeMap(C3dglCubeProbe &probe, float time, bool bRenderCube)
 {
-	// Store the current viewport in a safe place
-	GLint viewport[4];
-	glGetIntegerv(GL_VIEWPORT, viewport);
-	int w = viewport[2];
-	int h = viewport[3];
-
-	// setup the viewport to 256x256, 90 degrees FoV (Field of View)
-	glViewport(0, 0, 512, 512);
-	Program.SendUniform("matrixProjection", perspective(radians(90.f), 1.0f, 0.02f, 1000.0f));
-
-	// render environment 6 times
-	Program.SendUniform("reflectionPower", 0.0);
+	C3dglProfiler::ZONE zone(bRenderCube ? "prepareCubeMap2" : "prepareCubeMap");
+	beginPass(PASS_PROBE);
+	// the frame graph sets the viewport to 512x512; 90 degrees FoV (Field of View)
+	matrixProjection = perspective(radians(90.f), 1.0f, 0.02f, 1000.0f);
+	lodBudget = LOD_BUDGET_AUX;
+	lodViewportHeight = 512;
+
+	// the cube map being rendered must not be bound for sampling
+	glActiveTexture(GL_TEXTURE2);
+	C3dglCallStats::bindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	glActiveTexture(GL_TEXTURE0);
+
+	// render environment up to 6 times
+	Program.SendUniform(uniformName::reflectionPower, 0.0);
 	for (int i = 0; i < 6; ++i)
 	{
-		// clear background
+		if ((probe.getFaces() & (1 << i)) == 0)
+			continue;
+
+		// render into the face, clear background
+		frameGraph.setCubeFace(i);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		// setup the camera
-		const GLfloat ROTATION[6][6] =
-		{	// at              up
-			{ 1.0, 0.0, 0.0,   0.0, -1.0, 0.0 },  // pos x
-			{ -1.0, 0.0, 0.0,  0.0, -1.0, 0.0 },  // neg x
-			{ 0.0, 1.0, 0.0,   0.0, 0.0, 1.0 },   // pos y
-			{ 0.0, -1.0, 0.0,  0.0, 0.0, -1.0 },  // neg y
-			{ 0.0, 0.0, 1.0,   0.0, -1.0, 0.0 },  // poz z
-			{ 0.0, 0.0, -1.0,  0.0, -1.0, 0.0 }   // neg z
-		};
-		mat4 matrixView2 = lookAt(
-			vec3(x, y, z),
-			vec3(x + ROTATION[i][0], y + ROTATION[i][1], z + ROTATION[i][2]),
-			vec3(ROTATION[i][3], ROTATION[i][4], ROTATION[i][5]));
+		mat4 matrixView2 = probe.getFaceView(i);
 
 		// send the View Matrix
-		Program.SendUniform("matrixView", matrixView2);
+		setCamera(matrixView2, matrixProjection);
 
 		// render scene objects - all but the reflective one
 		renderScene(matrixView2, time, false);
-		renderCube(matrixView2, time);
-
-		// send the image to the cube texture
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, idTexCube3);
-		glCopyTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB8, 0, 0, 512, 512, 0);
+		if (bRenderCube) renderCube(matrixView2, time);
+		renderQueue.flush();
 	}
-
-	// restore the matrixView, viewport and projection
-	void onReshape(int w, int h);
-	onReshape(w, h);
 }
 
 void renderDeloran(mat4 matrixView, float time)
 {
-	mat4 m = matrixView;
-
-	Program.SendUniform("fogDensity", 0.05);
-	Program.SendUniform("materialAmbient", 0.1, 0.1, 0.1);
-	Program.SendUniform("lightDir.diffuse", 8.0, 8.0, 8.0);
-	Program.SendUniform("materialDiffuse", 0.2f, 0.2f, 0.2f);
-
-	Program.SendUniform("useCubeMap", 1);
-	float reflectionValue = transition - 0.6f;
-	if (reflectionValue <= 0) reflectionValue = 0;
-	Program.SendUniform("reflectionPower", 0.4f - reflectionValue);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, idTexCube3);
+	// the DeLorean binds the textures of its materials, the reflection goes to the unit 2
+	renderQueue.setTextureSet(texCube2, { { GL_TEXTURE2, GL_TEXTURE_CUBE_MAP, frameGraph.getTexture("cube2") } });
 
-	m = matrixView;
+	mat4 m = matrixView;
 	m = translate(m, vec3(55.0f, 18.0f, -5.0f));
 	m = rotate(m, radians(110.0f), vec3(-0.1f, 1.0f, 0.0f));
 	m = scale(m, vec3(5.0f, 5.0f, 5.0f));
-	delorean.render(m);
-
-	glActiveTexture(GL_TEXTURE0);
-	Program.SendUniform("useCubeMap", 0);
-	Program.SendUniform("reflectionPower", 0.0);
+	if (isSubmitted(DELOREAN)) submitModel(LAYER_OPAQUE, matDelorean, texCube2, delorean, m, true);
 }
 
-void onRender()
+// everything the scene depends on, other than the camera
+size_t sceneKey()
 {
-	RefreshPostProcessing();
-
-	// this global variable controls the animation
-	float time = glutGet(GLUT_ELAPSED_TIME) * 0.001f;
-
-	// send the animation time to shaders
-	ProgramWater.SendUniform("t", time);
-
-	ProgramParticle.SendUniform("time", time);
-
-	
-	// Shadow map
-	createShadowMap(time, lookAt(
-		vec3(-2.55f, 50.0f, -1.0f), 	// These are the coordinates of the source of the light
-		vec3(0.0f, 3.0f, 0.0f), 		// These are the coordinates of a point behind the scene
-		vec3(0.0f, 1.0f, 0.0f)));		// This is just a reasonable "Up" vector);
+	size_t key = 0;
+	C3dglFrameGraph::hash(key, animTime);
+	C3dglFrameGraph::hash(key, dayTicks);
+	C3dglFrameGraph::hash(key, animationMode);
+	C3dglFrameGraph::hash(key, isNormalOn);
+	C3dglFrameGraph::hash(key, sceneEdits);
+	C3dglFrameGraph::hash(key, passMaskKey());
+	return key;
+}
 
-	
+// Tells the probes what has changed since the last frame and schedules their faces
+void updateProbes()
+{
+	static size_t lastKey = 0;
+	static int lastMode = -1;
+	static bool lastNormal = false;
+	static size_t lastMasks = passMaskKey();
+	C3dglCubeProbe *probes[] = { &probe1, &probe2 };
+
+	// render settings affect the whole scene
+	if (animationMode != lastMode || isNormalOn != lastNormal || passMaskKey() != lastMasks)
+		for (C3dglCubeProbe *probe : probes)
+			probe->invalidate();
+	lastMode = animationMode;
+	lastNormal = isNormalOn;
+	lastMasks = passMaskKey();
+
+	// animation: the sky and the particles are everywhere, the characters and the scout are local
+	size_t key = sceneKey();
+	if (key != lastKey)
+	{
+		mat4 m = rotate(mat4(1.f), radians(-animTime * 30), vec3(0.0f, 1.0f, 0.0f));
+		m = rotate(m, radians(40.0f), vec3(0.0f, 0.0f, 1.0f));
+		m = translate(m, vec3(350.0f, -100.0f, 0.0f));
+		for (C3dglCubeProbe *probe : probes)
+		{
+			probe->notifyChange();
+			probe->notifyChange(vec3(54.0f, 16.0f, -8.3f), 5);
+			probe->notifyChange(vec3(64.2f, 16.9f, -5.8f), 5);
+			probe->notifyChange(vec3(45.0f, 14.6f, 0.0f), 5);
+			probe->notifyChange(vec3(m[3]), 20);
+		}
+	}
+	lastKey = key;
 
-	prepareCubeMap(0.0f, 50.0f, 0.0f, time);
-	prepareCubeMap2(55.0f, 18.0f, -5.0f, time);
+	probe1.update();
+	probe2.update();
+}
 
-	// Pass 1: off-screen rendering
-	glBindFramebufferEXT(GL_FRAMEBUFFER, idFBO);
+// Pass 1: off-screen rendering
+void renderMainPass(int w, int h)
+{
+	beginPass(PASS_MAIN);
+	matrixProjection = perspective(radians(60.f), (float)w / (float)h, 0.02f, 1000.f);
+	lodBudget = LOD_BUDGET_MAIN;
+	lodViewportHeight = h;
+	ProgramParticle.SendUniform(uniformName::matrixProjection, matrixProjection);
 
 	// clear screen and buffers
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	mat4 m = rotate(mat4(1.f), radians(angleTilt), vec3(1.f, 0.f, 0.f));// switch tilt off
-	m = translate(m, cam);												// animate camera motion (controlled by WASD keys)
-	m = rotate(m, radians(-angleTilt), vec3(1.f, 0.f, 0.f));			// switch tilt on
-	matrixView = m * matrixView;
-
-	// move the camera up following the profile of terrain (Y coordinate of the terrain)
-	float terrainY = -terrain.getInterpolatedHeight(inverse(matrixView)[3][0], inverse(matrixView)[3][2]);
-	matrixView = translate(matrixView, vec3(0, terrainY, 0));;
-
-	Program.SendUniform("matrixView", matrixView);
-	ProgramWater.SendUniform("matrixView", matrixView);
-	ProgramTerrain.SendUniform("matrixView", matrixView);
+	// the camera follows the terrain - see onRender; matrixView itself is the pass key
+	mat4 m = matrixCamera;
+	setCamera(m, matrixProjection);
 
 	// render the scene objects
-	renderScene(matrixView, time, true);
+	renderScene(m, animTime, true);
 
 	// render reflected objects
-	renderCube(matrixView, time);
-	renderDeloran(matrixView, time);
-
-	// the camera must be moved down by terrainY to avoid unwanted effects
-	matrixView = translate(matrixView, vec3(0, -terrainY, 0));
-
-	// Pass 2: on-screen rendering
-	glBindFramebufferEXT(GL_FRAMEBUFFER, 0);
+	renderCube(m, animTime);
+	renderDeloran(m, animTime);
+	renderQueue.flush();
+}
 
+// Pass 2: on-screen rendering
+void renderPostProcess()
+{
 	// setup ortographic projection
-	ProgramEffect.SendUniform("matrixProjection", ortho(0, 1, 0, 1, -1, 1));
+	ProgramEffect.SendUniform(uniformName::matrixProjection, ortho(0, 1, 0, 1, -1, 1));
+	ProgramEffect.SendUniform(uniformName::mode, postProcessMode);
 
 	// clear screen and buffers
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glBindTexture(GL_TEXTURE_2D, idTexScreen);
 
 	// setup identity matrix as the model-view
-	ProgramEffect.SendUniform("matrixModelView", mat4(1));
+	ProgramEffect.SendUniform(uniformName::matrixModelView, mat4(1));
 
 	GLuint attribVertex = ProgramEffect.GetAttribLocation("aVertex");
 	GLuint attribTextCoord = ProgramEffect.GetAttribLocation("aTexCoord");
@@ -1316,9 +1433,190 @@ void onRender()
 	glBindBuffer(GL_ARRAY_BUFFER, bufQuad);
 	glVertexAttribPointer(attribVertex, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), 0);
 	glVertexAttribPointer(attribTextCoord, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-	glDrawArrays(GL_QUADS, 0, 4);
+	C3dglCallStats::drawArrays(GL_QUADS, 0, 4);
 	glDisableVertexAttribArray(attribVertex);
 	glDisableVertexAttribArray(attribTextCoord);
+}
+
+// depth texture array with a layer for each shadow cascade
+C3dglFrameGraph::TARGET shadowTarget()
+{
+	int size = shadowCascades.getResolution();
+	return C3dglFrameGraph::array(GL_DEPTH_COMPONENT24, size, size, shadowCascades.getCascadeCount());
+}
+
+// the cascades and the casters, as rendered in this frame
+size_t shadowKey()
+{
+	size_t key = passMaskKey();
+	for (int i = 0; i < shadowCascades.getCascadeCount(); i++)
+		C3dglFrameGraph::hash(key, shadowCascades.getProjection(i));
+	return key;
+}
+
+// fits the shadow cascades to the camera and sends them to the shaders
+void updateShadows()
+{
+	int w = frameGraph.getScreenWidth(), h = frameGraph.getScreenHeight();
+	shadowCascades.update(matrixCamera, radians(60.f), (float)w / (float)std::max(h, 1), 0.02f, 1000.f);
+
+	int n = shadowCascades.getCascadeCount();
+	mat4 matrices[C3dglShadowCascades::MAX_CASCADES];
+	float splits[C3dglShadowCascades::MAX_CASCADES];
+	for (int i = 0; i < n; i++)
+	{
+		matrices[i] = shadowCascades.getShadowMatrix(i);
+		splits[i] = shadowCascades.getSplit(i);
+	}
+	for (C3dglProgram *pProgram : { &Program, &ProgramTerrain })
+	{
+		pProgram->SendUniformMatrixv(uniformName::matrixShadow, &matrices[0][0][0], n);
+		pProgram->SendUniform1v(uniformName::shadowSplits, splits, n);
+		pProgram->SendUniform(uniformName::shadowCascades, n);
+	}
+}
+
+// The shadow map and the dynamic cube maps are only re-rendered when the scene changes,
+// the main pass also when the camera moves; the post process runs every frame
+void setupRenderPasses()
+{
+	// the light used to come from (-2.55, 50, -1) towards (0, 3, 0)
+	shadowCascades.setLightDirection(vec3(2.55f, -47.0f, 1.0f));
+	frameGraph.addTarget("staticShadowMap", shadowTarget());
+	frameGraph.addTarget("shadowMap", shadowTarget());
+	frameGraph.addTarget("cube1", C3dglFrameGraph::cube(GL_RGB8, 512));
+	frameGraph.addTarget("cube2", C3dglFrameGraph::cube(GL_RGB8, 512));
+	frameGraph.addTarget("cubeDepth", C3dglFrameGraph::texture2D(GL_DEPTH_COMPONENT24, 512, 512), C3dglFrameGraph::TRANSIENT);
+	frameGraph.addTarget("screen", C3dglFrameGraph::screen(GL_RGBA8));
+	frameGraph.addTarget("depth", C3dglFrameGraph::screen(GL_DEPTH_COMPONENT24));
+	frameGraph.addTarget("backBuffer", C3dglFrameGraph::backBuffer());
+
+	// Shadow cascades - the static casters are cached and only re-rendered after terrain edits or
+	// when the cascades move; each frame the moving casters are drawn over a copy of them
+	int pass = frameGraph.addPass("staticShadow", [](int, int) { createShadowMap(animTime, SCENE_STATIC, true); }, []()
+	{
+		size_t key = shadowKey();
+		C3dglFrameGraph::hash(key, sceneEdits);
+		return key;
+	});
+	frameGraph.write(pass, "staticShadowMap");
+
+	pass = frameGraph.addPass("shadow", [](int, int)
+	{
+		frameGraph.copy("staticShadowMap");
+		createShadowMap(animTime, SCENE_DYNAMIC, false);
+	}, []()
+	{
+		size_t key = shadowKey();
+		C3dglFrameGraph::hash(key, animTime);
+		C3dglFrameGraph::hash(key, animationMode);
+		return key;
+	});
+	frameGraph.read(pass, "staticShadowMap");
+	frameGraph.write(pass, "shadowMap");
+
+	// Dynamic cube maps - the second one reflects the first; they run when their probes have faces due
+	probe1.setPosition(vec3(0.0f, 50.0f, 0.0f));
+	probe1.setRadius(30);
+	probe1.setPolicy(C3dglCubeProbe::ROUND_ROBIN, 2);
+	probe2.setPosition(vec3(55.0f, 18.0f, -5.0f));
+	probe2.setRadius(20);
+	probe2.setPolicy(C3dglCubeProbe::ROUND_ROBIN, 2);
+
+	// both render through an FBO into the cube faces and share the scratch depth buffer
+	pass = frameGraph.addPass("cube1", [](int, int) { prepareCubeMap(probe1, animTime, false); },
+		[]() { return (size_t)probe1.getTotalFacesUpdated(); });
+	frameGraph.write(pass, "cube1");
+	frameGraph.write(pass, "cubeDepth");
+
+	pass = frameGraph.addPass("cube2", [](int, int) { prepareCubeMap(probe2, animTime, true); },
+		[]() { return (size_t)probe2.getTotalFacesUpdated(); });
+	frameGraph.read(pass, "cube1");
+	frameGraph.write(pass, "cube2");
+	frameGraph.write(pass, "cubeDepth");
+
+	pass = frameGraph.addPass("main", renderMainPass, []()
+	{
+		size_t key = sceneKey();
+		C3dglFrameGraph::hash(key, matrixView);
+		return key;
+	});
+	frameGraph.read(pass, "shadowMap", 7);
+	frameGraph.read(pass, "cube1");
+	frameGraph.read(pass, "cube2");
+	frameGraph.write(pass, "screen");
+	frameGraph.write(pass, "depth");
+
+	pass = frameGraph.addPass("post", [](int, int) { renderPostProcess(); });
+	frameGraph.read(pass, "screen", 0);
+	frameGraph.write(pass, "backBuffer");
+}
+
+// the profiler zones and the GL call counts of each pass
+void setPassHooks(bool bEnable)
+{
+	if (bEnable)
+		frameGraph.setHooks([](const string &name) { profiler.begin(name); callStats.beginPass(name); },
+			[](const string &) { callStats.endPass(); profiler.end(); });
+	else
+		frameGraph.setHooks(nullptr, nullptr);
+}
+
+// the frame, without presenting it - see onRender
+void renderFrame()
+{
+	// the previous frame ends here
+	profiler.beginFrame();
+	callStats.beginFrame();
+	C3dglProfiler::ZONE zone("renderFrame");
+
+	// terrain culling statistics are collected per frame
+	terrain.resetStats();
+	water.resetStats();
+	renderQueue.resetStats();
+	C3dglProgram::ResetUniformStats();
+	nModelsDrawn = nModelsCulled = nTrianglesDrawn = nShadowTriangles = 0;
+
+	// this global variable controls the animation
+	if (fixedTime >= 0)
+	{
+		animTime = fixedTime;
+		dayTicks = (unsigned)(fixedTime * 1000);
+	}
+	else if (!isPaused)
+	{
+		animTime = glutGet(GLUT_ELAPSED_TIME) * 0.001f;
+		dayTicks = glutGet(GLUT_ELAPSED_TIME);
+	}
+
+	// send the animation time to shaders
+	ProgramWater.SendUniform(uniformName::t, animTime);
+
+	ProgramParticle.SendUniform(uniformName::time, animTime);
+
+	mat4 m = rotate(mat4(1.f), radians(angleTilt), vec3(1.f, 0.f, 0.f));// switch tilt off
+	m = translate(m, cam);												// animate camera motion (controlled by WASD keys)
+	m = rotate(m, radians(-angleTilt), vec3(1.f, 0.f, 0.f));			// switch tilt on
+	matrixView = m * matrixView;
+
+	// move the camera up following the profile of terrain (Y coordinate of the terrain)
+	vec3 eye = vec3(inverse(matrixView)[3]);
+	matrixCamera = translate(matrixView, vec3(0, -terrain.getInterpolatedHeight(eye.x, eye.z), 0));
+
+	// the lights and the fog shared by the programs
+	updateLights();
+
+	// reflection probe faces due in this frame, shadow cascades
+	updateProbes();
+	updateShadows();
+
+	// shadow map, cube maps, main pass and post process
+	frameGraph.execute();
+}
+
+void onRender()
+{
+	renderFrame();
 
 	// essential for double-buffering technique
 	glutSwapBuffers();
@@ -1327,19 +1625,12 @@ void onRender()
 	glutPostRedisplay();
 }
 
-// called before window opened or resized - to setup the Projection Matrix
+// called before window opened or resized - the render targets follow the window size
 void onReshape(int w, int h)
 {
-	float ratio = w * 1.0f / h;      // we hope that h is not zero
 	glViewport(0, 0, w, h);
-	mat4 matrixProjection = perspective(radians(60.f), ratio, 0.02f, 1000.f);
-
-	// Setup the Projection Matrix
-	Program.SendUniform("matrixProjection", matrixProjection);
-	ProgramWater.SendUniform("matrixProjection", matrixProjection);
-	ProgramTerrain.SendUniform("matrixProjection", matrixProjection);
-	ProgramParticle.SendUniform("matrixProjection", matrixProjection);
-
+	frameGraph.setScreenSize(w, h);
+	ProgramEffect.SendUniform("resolution", (float)w, (float)h);
 }
 
 // Handle WASDQE keys
@@ -1387,6 +1678,152 @@ void onKeyUp(unsigned char key, int x, int y)
 	case '4':
 		isNormalOn = false;
 		break;
+	case '5':
+		cout << "Terrain chunks: " << terrain.getChunksDrawn() << " drawn, " << terrain.getChunksCulled() << " culled (of " << terrain.getChunkCount() << " per pass), " << terrain.getTrianglesDrawn() << " triangles" << endl;
+		cout << "Water chunks: " << water.getChunksDrawn() << " drawn, " << water.getChunksCulled() << " culled (of " << water.getChunkCount() << " per pass)" << endl;
+		break;
+	case '6':
+		{
+			// dig a crater where the camera looks - as rendered in the last frame: from the camera
+			// following the terrain profile, with the terrain 5 units down
+			mat4 m = inverse(matrixCamera);
+			vec3 eye = vec3(m[3]) + vec3(0, 5, 0), dir = -vec3(m[2]);
+			float t;
+			if (terrain.intersectRay(eye, dir, t))
+			{
+				vec3 hit = eye + t * dir;
+				int t0 = glutGet(GLUT_ELAPSED_TIME);
+				terrain.addHeight(hit.x, hit.z, 8, -3);
+				sceneEdits++;
+				probe1.notifyChange(hit - vec3(0, 5, 0), 8);
+				probe2.notifyChange(hit - vec3(0, 5, 0), 8);
+				cout << "Crater at (" << hit.x << ", " << hit.z << "): " << glutGet(GLUT_ELAPSED_TIME) - t0 << " ms" << endl;
+			}
+		}
+		break;
+	case '7':
+		for (unsigned i = 0; i < frameGraph.getPassCount(); i++)
+		{
+			const C3dglFrameGraph::PASS_STATS &stats = frameGraph.getPassStats(i);
+			cout << "Pass " << stats.name << ": " << (stats.culled ? "culled" : stats.skipped ? "skipped" : "executed")
+				<< ", CPU " << stats.cpuTime << " ms, GPU " << stats.gpuTime << " ms (" << stats.nExecuted << " runs, " << stats.nSkipped << " skipped)" << endl;
+		}
+		cout << "Render targets: " << frameGraph.getTextureCount() << " textures, " << frameGraph.getTargetMemory() / 1024 << " kB" << endl;
+		for (C3dglCubeProbe *probe : { &probe1, &probe2 })
+			cout << "Cube probe at (" << probe->getPosition().x << ", " << probe->getPosition().y << ", " << probe->getPosition().z << "), "
+				<< C3dglCubeProbe::getPolicyName(probe->getPolicy()) << ": " << probe->getFacesUpdated() << " faces this frame, "
+				<< probe->getTotalFacesUpdated() << " in " << probe->getFrames() << " frames" << endl;
+		cout << "Models: " << nModelsDrawn << " drawn, " << nModelsCulled << " culled" << endl;
+		cout << "Shadow passes: " << nShadowTriangles << " triangles this frame" << endl;
+		{
+			// state changes in the sorted order and in the order the objects were submitted
+			const C3dglRenderQueue::STATS &stats = renderQueue.getStats();
+			cout << "Render queue: " << stats.nPackets << " packets in " << stats.nFlushes << " flushes, "
+				<< stats.nPrograms << " program switches (" << stats.nProgramsUnsorted << " unsorted), "
+				<< stats.nMaterials << " material changes (" << stats.nMaterialsUnsorted << " unsorted), "
+				<< stats.nBinds << " texture binds (" << stats.nBindsUnsorted << " unsorted)" << endl;
+		}
+		cout << "Uniforms: " << C3dglProgram::GetUniformsSent() << " sent, " << C3dglProgram::GetUniformsElided() << " elided as unchanged" << endl;
+		if (callStats.isInstalled())
+		{
+			// the last complete frame
+			C3dglCallStats::PASS frame = { "frame", callStats.getFrame() };
+			vector<C3dglCallStats::PASS> passes = callStats.getPasses();
+			passes.push_back(frame);
+			for (C3dglCallStats::PASS &pass : passes)
+				cout << "GL calls, " << pass.name << ": " << pass.counters.nDraws << " draws, " << pass.counters.nTriangles << " triangles, "
+					<< pass.counters.nPrograms << " programs, " << pass.counters.nBinds << " binds, " << pass.counters.nUniforms << " uniforms, "
+					<< pass.counters.nUploads << " uploads (" << pass.counters.uploadBytes / 1024 << " kB), " << pass.counters.nFramebuffers << " framebuffers" << endl;
+		}
+		break;
+	case '8':
+		{
+			// cycle the probe update policies
+			static int policy = 1;
+			const C3dglCubeProbe::POLICY POLICIES[] = { C3dglCubeProbe::EVERY_FRAME, C3dglCubeProbe::ROUND_ROBIN, C3dglCubeProbe::INTERVAL, C3dglCubeProbe::ON_CHANGE };
+			const int PARAMS[] = { 1, 2, 4, 1 };
+			policy = (policy + 1) % 4;
+			probe1.setPolicy(POLICIES[policy], PARAMS[policy]);
+			probe2.setPolicy(POLICIES[policy], PARAMS[policy]);
+			cout << "Cube map updates: " << C3dglCubeProbe::getPolicyName(POLICIES[policy]) << " (" << PARAMS[policy] << ")" << endl;
+		}
+		break;
+	case '9':
+	case '0':
+		// shadow cascade count (1 to 4) and resolution (512 to 2048)
+		if (key == '9')
+			shadowCascades.setCascadeCount(shadowCascades.getCascadeCount() % C3dglShadowCascades::MAX_CASCADES + 1);
+		else
+			shadowCascades.setResolution(shadowCascades.getResolution() >= 2048 ? 512 : shadowCascades.getResolution() * 2);
+		frameGraph.setTarget("staticShadowMap", shadowTarget());
+		frameGraph.setTarget("shadowMap", shadowTarget());
+		cout << "Shadows: " << shadowCascades.getCascadeCount() << " cascades, " << shadowCascades.getResolution() << "x" << shadowCascades.getResolution() << endl;
+		break;
+	case 'p':
+		isPaused = !isPaused;
+		break;
+	case 'c':
+		if (callStats.isInstalled())
+			callStats.uninstall();
+		else
+			callStats.install();
+		cout << "GL call counting: " << (callStats.isInstalled() ? "on" : "off") << endl;
+		break;
+	case 'l':
+		{
+			// resize the window between two presses: the old render targets should all be gone
+			static unsigned long long checkpoint = 0;
+			ledger.print(cout);
+			if (checkpoint)
+				ledger.reportLeaks(cout, checkpoint);
+			checkpoint = ledger.checkpoint();
+		}
+		break;
+	case 'f':
+		{
+			// averages over the frames in the profiler buffer
+			vector<C3dglProfiler::SUMMARY> summary;
+			profiler.getSummary(summary);
+			for (C3dglProfiler::SUMMARY &s : summary)
+				cout << "Zone " << s.name << ": " << s.nCalls << " calls, CPU " << s.cpuTime << " ms, GPU " << s.gpuTime << " ms per frame" << endl;
+			if (profiler.exportCSV("profile.csv") && profiler.exportTrace("profile.json"))
+				cout << "Profile saved to profile.csv and profile.json (" << profiler.getDroppedFrames() << " frames without GPU times)" << endl;
+		}
+		break;
+	case 'u':
+		{
+			// uniform cache: on, on and verified against the GL state, off
+			static int mode = 0;
+			mode = (mode + 1) % 3;
+			C3dglProgram::EnableUniformCache(mode != 2);
+			C3dglProgram::SetUniformCacheVerify(mode == 1);
+			for (C3dglProgram *pProgram : { &Program, &ProgramEffect, &ProgramWater, &ProgramTerrain, &ProgramParticle })
+				pProgram->InvalidateUniformCache();
+			const char *MODES[] = { "on", "on, verified", "off" };
+			cout << "Uniform cache: " << MODES[mode] << endl;
+		}
+		break;
+	case 'm':
+		{
+			// all objects in the reflections, or back to the previous masks
+			static unsigned masks[OBJECT_COUNT];
+			static bool bFull = false;
+			bFull = !bFull;
+			for (int i = 0; i < OBJECT_COUNT; i++)
+				if (bFull)
+				{
+					masks[i] = getPassMask((OBJECT)i);
+					setPassMask((OBJECT)i, masks[i] | PASS_PROBE);
+				}
+				else
+					setPassMask((OBJECT)i, masks[i]);
+			cout << "Reflections:";
+			for (SCENE_OBJECT &object : sceneObjects)
+				if (object.passMask & PASS_PROBE)
+					cout << " " << object.name;
+			cout << endl;
+		}
+		break;
 	}
 }
 
@@ -1453,8 +1890,145 @@ void onMotion(int x, int y)
 	}
 }
 
+// JSON string: quoted, with the quotes, backslashes and control characters escaped
+static string jsonString(const char *str)
+{
+	string s = "\"";
+	for (const char *p = str; p && *p; p++)
+		if (*p == '"' || *p == '\\')
+			s += string("\\") + *p;
+		else if ((unsigned char)*p < 0x20)
+			s += ' ';
+		else
+			s += *p;
+	return s + "\"";
+}
+
+// Scene benchmark: the frames rendered off-screen with a fixed time step (60 fps) and the camera
+// on a scripted path, so that the runs are comparable; frame times and the GL calls of each frame as JSON.
+// The frames are rendered twice: timed (renderFrame to glFinish) with no profiler, no call counting
+// and no buffer swap, then again, untimed, with the GL calls counted
+int benchScene(const vector<string> &params)
+{
+	int nFrames = params.size() > 0 ? atoi(params[0].c_str()) : 600;
+	int width = params.size() > 1 ? atoi(params[1].c_str()) : 1280;
+	int height = params.size() > 2 ? atoi(params[2].c_str()) : 720;
+	string filename = params.size() > 3 ? params[3] : "";
+	const int WARMUP = 30;			// frames not measured: shader compilation, first cube map updates
+	const float STEP = 1.0f / 60;
+
+	// GL call budgets, checked in every frame measured: draws, triangles, programs (0: no limit)
+	struct BUDGET { const char *pass; C3dglCallStats::COUNTERS budget; };
+	const BUDGET budgets[] = {
+		{ "shadow", C3dglCallStats::COUNTERS(50) },
+		{ "main", C3dglCallStats::COUNTERS(150) },
+		{ "", C3dglCallStats::COUNTERS(300, 2000000, 40) },	// the whole frame
+	};
+	int overBudget[sizeof(budgets) / sizeof(budgets[0])] = { 0 };
+
+	int window = createBenchmarkWindow("Scene benchmark", width, height);
+	if (!window)
+		return 1;
+	srand(1);						// the particles
+	if (!init())
+	{
+		cerr << "*** ERROR: Application failed to initialise" << endl;
+		return 1;
+	}
+	onReshape(width, height);
+
+	// orbit around the scene, once a minute, rising and falling
+	auto setFrame = [&](int frame)
+	{
+		fixedTime = (frame + WARMUP) * STEP;
+		float angle = fixedTime * 2 * (float)M_PI / 60;
+		vec3 eye(75.0f * cos(angle), 10.0f + 5.0f * sin(fixedTime * 0.5f), -75.0f * sin(angle));
+		matrixView = rotate(mat4(1.f), radians(angleTilt), vec3(1.f, 0.f, 0.f)) * lookAt(eye, vec3(0.0, 5.0, 0.0), vec3(0.0, 1.0, 0.0));
+	};
+
+	// timed
+	profiler.setEnabled(false);
+	setPassHooks(false);
+	vector<double> times;
+	for (int frame = -WARMUP; frame < nFrames; frame++)
+	{
+		setFrame(frame);
+		auto t0 = chrono::high_resolution_clock::now();
+		renderFrame();
+		glFinish();
+		if (frame >= 0)
+			times.push_back(chrono::duration<double, milli>(chrono::high_resolution_clock::now() - t0).count());
+	}
+	profiler.setEnabled(true);
+	setPassHooks(true);
+
+	// counted - the same frames, after the same warm-up
+	frameGraph.invalidate();
+	callStats.install();
+	vector<string> calls;		// GL calls per frame, as JSON
+	for (int frame = -WARMUP; frame < nFrames; frame++)
+	{
+		setFrame(frame);
+		renderFrame();
+
+		// the calls of this frame are complete when the next one begins
+		callStats.beginFrame();
+		if (frame >= 0)
+		{
+			ostringstream str;
+			callStats.dump(str);
+			calls.push_back(str.str());
+			for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++)
+				if (!callStats.withinBudget(budgets[i].pass, budgets[i].budget))
+					overBudget[i]++;
+		}
+	}
+	fixedTime = -1;
+	callStats.uninstall();
+
+	// nearest rank percentiles
+	sort(times.begin(), times.end());
+	auto percentile = [&](double p) { return times.empty() ? 0 : times[std::max(0, (int)ceil(p * times.size()) - 1)]; };
+	double total = 0;
+	for (double t : times) total += t;
+
+	ofstream file;
+	if (!filename.empty())
+		file.open(filename.c_str());
+	ostream &out = filename.empty() ? cout : file;
+	out << "{" << endl;
+	out << "  \"benchmark\": \"scene\"," << endl;
+	out << "  \"renderer\": " << jsonString((const char*)glGetString(GL_RENDERER)) << "," << endl;
+	out << "  \"frames\": " << times.size() << ", \"width\": " << width << ", \"height\": " << height << ", \"step_ms\": " << STEP * 1000 << "," << endl;
+	out << "  \"frame_ms\": { \"min\": " << percentile(0) << ", \"median\": " << percentile(0.5) << ", \"mean\": " << (times.empty() ? 0 : total / times.size())
+		<< ", \"p95\": " << percentile(0.95) << ", \"p99\": " << percentile(0.99) << ", \"max\": " << percentile(1) << " }," << endl;
+	out << "  \"frames_over_budget\": {";
+	for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++)
+		out << (i ? ", " : " ") << "\"" << (*budgets[i].pass ? budgets[i].pass : "frame") << "\": " << overBudget[i];
+	out << " }," << endl;
+	out << "  \"calls\": [" << endl;
+	for (size_t i = 0; i < calls.size(); i++)
+		out << "    " << calls[i] << (i + 1 < calls.size() ? "," : "") << endl;
+	out << "  ]" << endl;
+	out << "}" << endl;
+	if (!filename.empty() && !file)
+	{
+		cerr << "*** ERROR: cannot write " << filename << endl;
+		return 1;
+	}
+
+	done();
+	destroyBenchmarkWindow(window);
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
+	// command line benchmarks - those that render open a hidden window
+	for (int i = 1; i < argc; i++)
+		if (string(argv[i]) == "--bench")
+			return runBenchmarks(argc, argv);
+
 	// init GLUT and create Window
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DEPTH | GLUT_DOUBLE | GLUT_RGBA);
@@ -1470,6 +2044,7 @@ int main(int argc, char **argv)
 		return 0;
 	}
 	cout << "Using GLEW " << glewGetString(GLEW_VERSION) << endl;
+	ledger.install();
 
 	// register callbacks
 	glutDisplayFunc(onRender);
@@ -1480,6 +2055,7 @@ int main(int argc, char **argv)
 	glutSpecialUpFunc(onSpecUp);
 	glutMouseFunc(onMouse);
 	glutMotionFunc(onMotion);
+	glutCloseFunc(done);		// while the GL context still exists - the main loop does not return
 
 	cout << "Vendor: " << glGetString(GL_VENDOR) << endl;
 	cout << "Renderer: " << glGetString(GL_RENDERER) << endl;
@@ -1495,8 +2071,6 @@ int main(int argc, char **argv)
 	// enter GLUT event processing cycle
 	glutMainLoop();
 
-	done();
-
 	return 1;
 }
 
@@ -2,8 +2,6 @@
 #version 330
 
 // Matrices
-uniform mat4 matrixProjection;
-uniform mat4 matrixView;
 uniform mat4 matrixModelView;
 
 // Materials
@@ -33,9 +31,8 @@ out mat3 matrixTangent;
 // Cube Map
 out vec3 texCoordCubeMap;
 
-// Shadow Map
-uniform mat4 matrixShadow;
-out vec4 shadowCoord;
+// Shadow Map - world coordinates, the cascade is chosen per fragment
+out vec4 shadowPosition;
 
 // Bone
 #define MAX_BONES 100
@@ -44,23 +41,62 @@ in ivec4 aBoneId;
 in  vec4 aBoneWeight;
 uniform int isAnimated;
 
+// Camera - shared by all programs, set for each pass
+layout(std140) uniform CameraBlock
+{
+	mat4 matrixView;
+	mat4 matrixProjection;
+};
 
-
+// Lights - shared by all programs, set once per frame; the matrices are in world coordinates
 struct AMBIENT
-{	
-	int on;
+{
 	vec3 color;
+	int on;
 };
-uniform AMBIENT lightAmbient, lightAmbient2;
 
 struct DIRECTIONAL
-{	
-	int on;
+{
 	vec3 direction;
+	int on;
+	vec3 diffuse;
+	mat4 matrix;
+};
+
+struct POINT
+{
+	vec3 position;
+	int on;
 	vec3 diffuse;
+	float att_quadratic;
+	vec3 specular;
 	mat4 matrix;
 };
-uniform DIRECTIONAL lightDir;
+
+struct SPOT
+{
+	vec3 position;
+	int on;
+	vec3 diffuse;
+	float att_quadratic;
+	vec3 specular;
+	float cutoff;
+	vec3 direction;
+	float attenuation;
+	mat4 matrix;
+};
+
+layout(std140) uniform LightBlock
+{
+	AMBIENT lightAmbient;
+	DIRECTIONAL lightDir;
+	POINT lightPoint[2];
+	SPOT lightSpot[2];
+};
+
+// Lights of the object: 0 for the ambient only
+uniform int useLights;
+uniform float lightDirScale;	// brightness of the directional light for the object
 
 vec4 AmbientLight(AMBIENT light)
 {
@@ -72,10 +108,10 @@ vec4 DirectionalLight(DIRECTIONAL light)
 {
 	// Calculate Directional Light
 	vec4 color = vec4(0, 0, 0, 0);
-	vec3 L = normalize(mat3(light.matrix) * light.direction);
+	vec3 L = normalize(mat3(matrixView * light.matrix) * light.direction);
 	float NdotL = dot(normal, L);
 	if (NdotL > 0)
-		color += vec4(materialDiffuse * light.diffuse, 1) * max(NdotL, 0);
+		color += vec4(materialDiffuse * light.diffuse * lightDirScale, 1) * max(NdotL, 0);
 	return color;
 }
 
@@ -109,13 +145,13 @@ void main(void)
 
 	// calculate shadow coordinate  using the Shadow Matrix
 	mat4 matrixModel = inverse(matrixView) * matrixModelView;
-	shadowCoord = matrixShadow * matrixModel * vec4(aVertex + aNormal * 0.1, 1);
+	shadowPosition = matrixModel * vec4(aVertex + aNormal * 0.1, 1);
 
 
 	// calculate light
 	color = vec4(0, 0, 0, 1);
 	if (lightAmbient.on == 1)	color += AmbientLight(lightAmbient);
-	if (lightDir.on == 1)		color += DirectionalLight(lightDir);
+	if (lightDir.on == 1 && useLights == 1)	color += DirectionalLight(lightDir);
 
 	// calculate texture coordinate
 	texCoord0 = aTexCoord;
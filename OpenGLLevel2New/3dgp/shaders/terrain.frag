@@ -5,8 +5,6 @@ in vec4 color;
 out vec4 outColor;
 
 // Matrices
-uniform mat4 matrixProjection;
-uniform mat4 matrixView;
 uniform mat4 matrixModelView;
 
 // Materials
@@ -27,8 +25,6 @@ uniform float scaleX;
 uniform float scaleY;
 
 // Fog
-uniform vec3 fogColour;
-uniform vec3 fogColour2;
 in float fogFactor;
 in float fogFactor2;
 
@@ -39,9 +35,12 @@ in float waterDepth;		// water depth (positive for underwater, negative for the
 uniform sampler2D textureBed;
 uniform sampler2D textureShore;
 
-// Shadow Map
-in vec4 shadowCoord;
-uniform sampler2DShadow shadowMap;
+// Shadow Map - cascades in the layers of a texture array
+in vec4 shadowPosition;
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 matrixShadow[4];
+uniform float shadowSplits[4];		// view distances where the cascades end
+uniform int shadowCascades;
 uniform int useShadowMap;
 
 // Normal Map
@@ -50,35 +49,74 @@ in mat3 matrixTangent;
 uniform int useNormalMap;
 vec3 normalNew;
 
-struct SPOT{
+// Camera - shared by all programs, set for each pass
+layout(std140) uniform CameraBlock
+{
+	mat4 matrixView;
+	mat4 matrixProjection;
+};
+
+// Lights - shared by all programs, set once per frame; the matrices are in world coordinates
+struct AMBIENT
+{
+	vec3 color;
 	int on;
-	float att_quadratic;
-	vec3 position;
-	vec3 diffuse;
-	vec3 specular;
+};
+
+struct DIRECTIONAL
+{
 	vec3 direction;
-	float cutoff;
-	float attenuation;
+	int on;
+	vec3 diffuse;
 	mat4 matrix;
 };
-uniform SPOT lightSpot[10];
 
 struct POINT
 {
+	vec3 position;
 	int on;
+	vec3 diffuse;
 	float att_quadratic;
+	vec3 specular;
+	mat4 matrix;
+};
+
+struct SPOT
+{
 	vec3 position;
+	int on;
 	vec3 diffuse;
+	float att_quadratic;
 	vec3 specular;
+	float cutoff;
+	vec3 direction;
+	float attenuation;
 	mat4 matrix;
 };
-uniform POINT lightPoint[5];
+
+layout(std140) uniform LightBlock
+{
+	AMBIENT lightAmbient;
+	DIRECTIONAL lightDir;
+	POINT lightPoint[2];
+	SPOT lightSpot[2];
+};
+
+// Fog - shared by all programs, set once per frame
+layout(std140) uniform FogBlock
+{
+	vec3 fogColour;			// the sky at the time of day
+	float skyFogDensity;	// distance fog of the terrain
+	vec3 waterFogColour;	// under the water
+	float waterFogDensity;	// scaled by the depth of the water
+};
 
 vec4 SpotLight(SPOT light)
 {
 	// Calculate Point Light
 	vec4 color = vec4(0, 0, 0, 0);
-	vec3 L = normalize(light.matrix * vec4(light.position, 1) - position).xyz;
+	mat4 matrix = matrixView * light.matrix;
+	vec3 L = normalize(matrix * vec4(light.position, 1) - position).xyz;
 	
 	float NdotL = dot(normalNew, L);
 	if (NdotL > 0)
@@ -91,11 +129,11 @@ vec4 SpotLight(SPOT light)
 	if(NdotL > 0&& RdotV > 0)color += vec4(materialSpecular * light.specular * pow(RdotV, shininess), 1);
 
 	// Attenuated
-	float dist = length(light.matrix * vec4(light.position, 1) -position);
+	float dist = length(matrix * vec4(light.position, 1) -position);
 	float att = 1 / (light.att_quadratic * dist * dist);
 
 	// Calculate Spot Light part
-	vec3 direction = normalize(mat3(light.matrix) * light.direction);
+	vec3 direction = normalize(mat3(matrix) * light.direction);
 	float spot = dot(-L, direction);
 	float angleAlpha = acos(spot);
 	float cutAngle = radians(clamp(light.cutoff, 0, 90));
@@ -111,7 +149,8 @@ vec4 PointLight (POINT light)
 {
 	// Calculate Point Light
 	vec4 color = vec4(0, 0, 0, 0);
-	vec3 L = normalize(light.matrix * vec4(light.position, 1) - position).xyz;
+	mat4 matrix = matrixView * light.matrix;
+	vec3 L = normalize(matrix * vec4(light.position, 1) - position).xyz;
 	
 	float NdotL = dot(normalNew, L);
 	if (NdotL > 0)
@@ -124,12 +163,24 @@ vec4 PointLight (POINT light)
 	if(NdotL > 0&& RdotV > 0)color += vec4(materialSpecular * light.specular * pow(RdotV, shininess), 1);
 
 	// Attenuated
-	float dist = length(light.matrix * vec4(light.position, 1) -position);
+	float dist = length(matrix * vec4(light.position, 1) -position);
 	float att = 1 / (light.att_quadratic * dist * dist);
 
 	return color * att;
 }
 
+float ShadowCascades()
+{
+	float depth = -position.z;
+	for (int i = 0; i < shadowCascades; i++)
+		if (depth < shadowSplits[i])
+		{
+			vec4 coord = matrixShadow[i] * shadowPosition;
+			return texture(shadowMap, vec4(coord.xy, i, coord.z));
+		}
+	return 1.0;		// beyond the shadow distance
+}
+
 void main(void) 
 {
 	// Rim Light Effect
@@ -150,24 +201,7 @@ void main(void)
 	outColor = color;
 
 	// Calculation of the shadow
-	vec4 shadowCoordNew = shadowCoord;
-
-	float textureProjectionCalc = 0;
-
-	for (int i = -1; i <= 1; i++)
-	{
-		shadowCoordNew[0] += 0.025 * i;
-		shadowCoordNew[0] -= 0.025 * i;
-		shadowCoordNew[2] += 0.025 * i;
-		shadowCoordNew[2] -= 0.025 * i;
-		textureProjectionCalc += textureProj(shadowMap, shadowCoordNew);
-	}
-
-	textureProjectionCalc /= 3;
-
-	float shadow = 1.0;
-	if (shadowCoord.w > 0)	// if shadowCoord.w < 0 fragment is out of the Light POV
-		shadow = 0.5 + 0.5 * textureProjectionCalc;
+	float shadow = 0.5 + 0.5 * ShadowCascades();
 	
 	for (int i = 0; i < lightPoint.length; i++)
 	{
@@ -187,6 +221,6 @@ void main(void)
 
 	outColor.rgb += vec3(finalColor) * materialDiffuse.rgb; // Rim light
 	if (useShadowMap == 1) outColor *= shadow; // Shadow
-	outColor = mix(vec4(fogColour, 1), outColor, fogFactor); // Fog
-	outColor += mix(vec4(fogColour2 ,1), outColor, fogFactor2); // Fog
+	outColor = mix(vec4(waterFogColour, 1), outColor, fogFactor); // Fog
+	outColor += mix(vec4(fogColour ,1), outColor, fogFactor2); // Fog
 }
@@ -2,8 +2,6 @@
 #version 330
 
 // Matrices
-uniform mat4 matrixProjection;
-uniform mat4 matrixView;
 uniform mat4 matrixModelView;
 
 // Materials
@@ -17,6 +15,24 @@ in vec3 aNormal;
 in vec2 aTexCoord;
 out vec2 texCoord0;
 
+// Level of Detail (geomorphing)
+in vec2 aMorph;				// x: height at the next coarser level, y: the coarsest level the vertex belongs to
+uniform vec3 lodEye;		// eye position in model coordinates
+uniform vec2 lodMorph[5];	// morphing range (start, end distance) for each level; no morphing if empty
+
+// Compact vertex format (C3dglTerrain::setCompact)
+in vec2 aNormalOct;				// octahedral-encoded normal
+uniform int compact;			// 1 if the compact format is used
+uniform float heightQuantum;	// height of a single quantisation step
+
+// Height field texture (C3dglTerrain::setHeightTexture) - aVertex holds the patch grid position (x, z) and the skirt flag (y)
+in vec4 aPatch;					// per instance: the chunk origin (x, z) and size (x, z) in height map samples
+uniform int heightField;		// 1 if the heights are sampled from the texture
+uniform sampler2D textureHeight;	// heights, texel (z, x)
+uniform vec2 heightRange;		// height = heightRange.x + texel value * heightRange.y
+uniform int lodLevels;			// number of LOD levels
+uniform float skirtDepth;		// depth of the skirts
+
 out vec4 color;
 out vec4 position;
 out vec3 normal;
@@ -24,16 +40,13 @@ out vec3 normal;
 // Fog
 out float fogFactor;
 out float fogFactor2;
-uniform float fogDensity;
-uniform float fogDensity2;
 
 // Water
 uniform float waterLevel;	// water level (in absolute units)
 out float waterDepth;	// water depth (positive for underwater, negative for the shore)
 
-// Shadow Map
-uniform mat4 matrixShadow;
-out vec4 shadowCoord;
+// Shadow Map - world coordinates, the cascade is chosen per fragment
+out vec4 shadowPosition;
 
 // Normal Map
 in vec3 aTangent;
@@ -41,21 +54,67 @@ in vec3 aBiTangent;
 out mat3 matrixTangent;
 
 
+// Camera - shared by all programs, set for each pass
+layout(std140) uniform CameraBlock
+{
+	mat4 matrixView;
+	mat4 matrixProjection;
+};
+
+// Lights - shared by all programs, set once per frame; the matrices are in world coordinates
 struct AMBIENT
-{	
-	int on;
+{
 	vec3 color;
+	int on;
 };
-uniform AMBIENT lightAmbient, lightAmbient2;
 
 struct DIRECTIONAL
-{	
-	int on;
+{
 	vec3 direction;
+	int on;
+	vec3 diffuse;
+	mat4 matrix;
+};
+
+struct POINT
+{
+	vec3 position;
+	int on;
+	vec3 diffuse;
+	float att_quadratic;
+	vec3 specular;
+	mat4 matrix;
+};
+
+struct SPOT
+{
+	vec3 position;
+	int on;
 	vec3 diffuse;
+	float att_quadratic;
+	vec3 specular;
+	float cutoff;
+	vec3 direction;
+	float attenuation;
 	mat4 matrix;
 };
-uniform DIRECTIONAL lightDir;
+
+layout(std140) uniform LightBlock
+{
+	AMBIENT lightAmbient;
+	DIRECTIONAL lightDir;
+	POINT lightPoint[2];
+	SPOT lightSpot[2];
+};
+
+// Fog - shared by all programs, set once per frame
+layout(std140) uniform FogBlock
+{
+	vec3 fogColour;			// the sky at the time of day
+	float skyFogDensity;	// distance fog of the terrain
+	vec3 waterFogColour;	// under the water
+	float waterFogDensity;	// scaled by the depth of the water
+};
 
 vec4 AmbientLight(AMBIENT light)
 {
@@ -67,21 +126,92 @@ vec4 DirectionalLight(DIRECTIONAL light)
 {
 	// Calculate Directional Light
 	vec4 color = vec4(0, 0, 0, 0);
-	vec3 L = normalize(mat3(light.matrix) * light.direction);
+	vec3 L = normalize(mat3(matrixView * light.matrix) * light.direction);
 	float NdotL = dot(normal, L);
 	if (NdotL > 0)
 		color += vec4(materialDiffuse * light.diffuse, 1) * max(NdotL, 0);
 	return color;
 }
 
+vec3 OctDecode(vec2 e)
+{
+	// octahedral normal encoding, y axis up
+	vec3 n = vec3(e.x, 1.0 - abs(e.x) - abs(e.y), e.y);
+	if (n.y < 0)
+		n.xz = (1.0 - abs(n.zx)) * vec2(n.x >= 0 ? 1.0 : -1.0, n.z >= 0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
+float HeightAt(ivec2 p)
+{
+	// height map sample (x, z), clamped to the edges
+	p = clamp(p, ivec2(0), textureSize(textureHeight, 0).yx - 1);
+	return heightRange.x + texelFetch(textureHeight, p.yx, 0).r * heightRange.y;
+}
+
+float LodHeight(ivec2 origin, ivec2 size, int stride, ivec2 p)
+{
+	// height of the chunk surface at the grid point p, rendered with the given grid stride (as C3dglTerrain::getLodHeight)
+	ivec2 a = min(p / stride * stride, size), b = min(a + stride, size);
+	vec2 uv = vec2(b.x > a.x ? float(p.x - a.x) / (b.x - a.x) : 0.0, b.y > a.y ? float(p.y - a.y) / (b.y - a.y) : 0.0);
+	float haa = HeightAt(origin + a), hba = HeightAt(origin + ivec2(b.x, a.y)), hab = HeightAt(origin + ivec2(a.x, b.y)), hbb = HeightAt(origin + b);
+	if (uv.x + uv.y <= 1)
+		return haa + uv.x * (hba - haa) + uv.y * (hab - haa);
+	else
+		return hbb + (1 - uv.x) * (hab - hbb) + (1 - uv.y) * (hba - hbb);
+}
+
 void main(void) 
 {
+	// decode the vertex
+	vec3 vertex = aVertex;
+	vec3 vertexNormal = aNormal;
+	vec2 morph = aMorph;
+	texCoord0 = aTexCoord;
+	if (heightField == 1)
+	{
+		// the patch vertex, clamped to the chunk size (smaller chunks at the edges of the height map)
+		ivec2 origin = ivec2(aPatch.xy), size = ivec2(aPatch.zw);
+		ivec2 l = min(ivec2(aVertex.xz), size);
+		ivec2 p = origin + l;
+		ivec2 mapSize = textureSize(textureHeight, 0).yx;
+		vertex = vec3(p.x - mapSize.x / 2, HeightAt(p), p.y - mapSize.y / 2);
+		texCoord0 = vertex.xz / 2;
+
+		// central differences - as C3dglTerrain::computeNormals
+		float dy_x = HeightAt(p + ivec2(1, 0)) - HeightAt(p - ivec2(1, 0));
+		float dy_z = HeightAt(p + ivec2(0, 1)) - HeightAt(p - ivec2(0, 1));
+		vertexNormal = normalize(vec3(-dy_x, 2, -dy_z));
+
+		// the coarsest level the vertex belongs to, and its height at the next coarser level
+		int level = 0;
+		while (level + 1 < lodLevels && (l.x % (2 << level) == 0 || l.x == size.x) && (l.y % (2 << level) == 0 || l.y == size.y))
+			level++;
+		morph = vec2(level + 1 < lodLevels ? LodHeight(origin, size, 2 << level, l) : vertex.y, level);
+
+		// skirts
+		vertex.y -= aVertex.y * skirtDepth;
+		morph.x -= aVertex.y * skirtDepth;
+	}
+	else if (compact == 1)
+	{
+		vertex.y *= heightQuantum;
+		morph.x *= heightQuantum;
+		vertexNormal = OctDecode(aNormalOct);
+		texCoord0 = aVertex.xz / 2;
+	}
+
+	// morph the vertex height towards the next coarser level
+	vec2 range = lodMorph[int(morph.y + 0.5)];
+	if (range.y > range.x)
+		vertex.y = mix(vertex.y, morph.x, clamp((distance(vertex, lodEye) - range.x) / (range.y - range.x), 0, 1));
+
 	// calculate position
-	position = matrixModelView * vec4(aVertex, 1.0);
+	position = matrixModelView * vec4(vertex, 1.0);
 	gl_Position = matrixProjection * position;
 
 	// calculate normal
-	normal = normalize(mat3(matrixModelView) * aNormal);
+	normal = normalize(mat3(matrixModelView) * vertexNormal);
 
 	// calculate tangent local system transformation
 	vec3 tangent = normalize(mat3(matrixModelView) * aTangent);
@@ -95,20 +225,17 @@ void main(void)
 
 	// calculate shadow coordinate  using the Shadow Matrix
 	mat4 matrixModel = inverse(matrixView) * matrixModelView;
-	shadowCoord = matrixShadow * matrixModel * vec4(aVertex + aNormal * 0.1, 1);
-
-	// calculate texture coordinate
-	texCoord0 = aTexCoord;
+	shadowPosition = matrixModel * vec4(vertex + vertexNormal * 0.1, 1);
 
 	// calculate depth of water
-	waterDepth = waterLevel - aVertex.y;
+	waterDepth = waterLevel - vertex.y;
 
 	// calculate the observer's altitude above the observed vertex
 	float eyeAlt = dot(-position.xyz, mat3(matrixModelView) * vec3(0, 1 ,0));
 	float depthFactor = max(waterDepth, 0) / max(eyeAlt, 0.001f); 
 
 	// Fog calculation
-	fogFactor = exp2(-fogDensity * length(position) * depthFactor);
+	fogFactor = exp2(-waterFogDensity * length(position) * depthFactor);
 
-	fogFactor2 = exp2(-fogDensity2 * length(position));
+	fogFactor2 = exp2(-skyFogDensity * length(position));
 }
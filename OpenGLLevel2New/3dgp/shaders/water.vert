@@ -1,8 +1,6 @@
 #version 330
 
 // Uniforms: Transformation Matrices
-uniform mat4 matrixProjection;
-uniform mat4 matrixView;
 uniform mat4 matrixModelView;
 
 // Uniforms: Material Colours
@@ -31,19 +29,58 @@ uniform float t;			// real time
 			pow(sin(2.0 * (x * 0.8 + y * 0.2) + t * 1.1), 2));
 }
 
-// Light declarations
+// Camera - shared by all programs, set for each pass
+layout(std140) uniform CameraBlock
+{
+	mat4 matrixView;
+	mat4 matrixProjection;
+};
+
+// Lights - shared by all programs, set once per frame; the matrices are in world coordinates
 struct AMBIENT
-{	
+{
 	vec3 color;
+	int on;
 };
-uniform AMBIENT lightAmbient;
 
 struct DIRECTIONAL
-{	
+{
 	vec3 direction;
+	int on;
+	vec3 diffuse;
+	mat4 matrix;
+};
+
+struct POINT
+{
+	vec3 position;
+	int on;
 	vec3 diffuse;
+	float att_quadratic;
+	vec3 specular;
+	mat4 matrix;
+};
+
+struct SPOT
+{
+	vec3 position;
+	int on;
+	vec3 diffuse;
+	float att_quadratic;
+	vec3 specular;
+	float cutoff;
+	vec3 direction;
+	float attenuation;
+	mat4 matrix;
+};
+
+layout(std140) uniform LightBlock
+{
+	AMBIENT lightAmbient;
+	DIRECTIONAL lightDir;
+	POINT lightPoint[2];
+	SPOT lightSpot[2];
 };
-uniform DIRECTIONAL lightDir;
 
 vec4 AmbientLight(AMBIENT light)
 {
@@ -26,6 +26,7 @@ if exist 3dgp\Debug\*.* rmdir /S /Q 3dgp\Debug
 if exist 3dgp\Release\*.* rmdir /S /Q 3dgp\Release
 if exist ipch\*.* rmdir /S /Q ipch
 if exist .vs\*.* rmdir /S /Q .vs
+if exist 3dgp\models\*.baked del 3dgp\models\*.baked
 echo.
 echo All non-essential files have been removed.
 echo.